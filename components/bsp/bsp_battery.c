@@ -1,20 +1,72 @@
 #include "bsp_battery.h"
 #include "bsp_board.h"
 
-#include <math.h>
+#include <stdatomic.h>
+#include <string.h>
 
 #include <driver/gpio.h>
 #include <esp_adc/adc_cali.h>
 #include <esp_adc/adc_cali_scheme.h>
-#include <esp_adc/adc_oneshot.h>
+#include <esp_adc/adc_continuous.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "sdkconfig.h"
 
 /* -------------------------------------------------------------------------- */
 
-static adc_oneshot_unit_handle_t _p_adc1;
-static adc_cali_handle_t _p_battery_calibration;
-static adc_cali_handle_t _p_solar_calibration;
-static bool _battery_calibration_ok = false;
-static bool _solar_calibration_ok = false;
+static const char *TAG = "bsp_battery.c";
+
+#define BATTERY_TASK_STACK_SIZE (3072)
+#define BATTERY_TASK_PRIORITY   (2)
+#define BATTERY_CHANNELS        (2)
+#define BATTERY_FRAME_BYTES     (CONFIG_GATEWAY_BATTERY_OVERSAMPLE * BATTERY_CHANNELS * SOC_ADC_DIGI_RESULT_BYTES)
+#define BATTERY_SAMPLE_FREQ_HZ  (SOC_ADC_SAMPLE_FREQ_THRES_LOW)
+#define BATTERY_READ_TIMEOUT_MS (100)
+#define BATTERY_IIR_SHIFT       (CONFIG_GATEWAY_BATTERY_IIR_SHIFT)
+#define BATTERY_FRAC_BITS       (4)
+#define ADC_RAW_MAX             (4095)
+#define ADC_LINEAR_FULL_MV      (3600)
+// The divider reads about 2% low against a multimeter
+#define ADC_CORRECTION_PERMILLE (1020)
+
+// ESP32 delivers continuous mode results in the TYPE1 layout
+#define ADC_RESULT_CHANNEL(d) ((d)->type1.channel)
+#define ADC_RESULT_DATA(d)    ((d)->type1.data)
+
+typedef struct {
+    adc_channel_t channel;
+    uint32_t divider_ratio;
+    adc_cali_handle_t calibration;
+    bool is_calibrated;
+    int32_t filtered_mv_q4;
+    bool is_seeded;
+} _battery_input_t;
+
+// Resting LiPo discharge curve, capacity by voltage, interpolated between the points
+typedef struct {
+    uint16_t mv;
+    uint8_t percent;
+} _lipo_point_t;
+
+static const _lipo_point_t LIPO_CURVE[] = {
+    { 3270, 0 },  { 3610, 5 },  { 3690, 10 }, { 3710, 15 }, { 3730, 20 }, { 3750, 25 }, { 3770, 30 },
+    { 3790, 35 }, { 3800, 40 }, { 3820, 45 }, { 3840, 50 }, { 3850, 55 }, { 3870, 60 }, { 3910, 65 },
+    { 3950, 70 }, { 3980, 75 }, { 4020, 80 }, { 4080, 85 }, { 4110, 90 }, { 4150, 95 }, { 4200, 100 },
+};
+
+static adc_continuous_handle_t _p_adc;
+static _battery_input_t _inputs[BATTERY_CHANNELS] = {
+    { .channel = ADC_CHANNEL_BAT, .divider_ratio = ADC_BAT_DIVIDER_RATIO },
+    { .channel = ADC_CHANNEL_SOLAR, .divider_ratio = ADC_SOLAR_DIVIDER_RATIO },
+};
+static uint8_t _frame[BATTERY_FRAME_BYTES];
+
+// Written into the slot readers are not pointed at, then published by bumping the sequence
+static atomic_uint _snapshot_seq;
+static bsp_battery_snapshot_t _snapshots[2];
 
 /* -------------------------------------------------------------------------- */
 
@@ -33,22 +85,115 @@ static bool _create_calibration(adc_channel_t chan, adc_cali_handle_t *out) {
 #endif  // ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED == 1
 /* -------------------------------------------------------------------------- */
 
-static uint32_t _read_voltage_mv(adc_channel_t chan, adc_cali_handle_t cal, bool is_cal_ok, uint32_t divider_ratio) {
-    int raw = 0;
+static uint32_t _raw_to_mv(const _battery_input_t *input, int raw) {
+    int mv = 0;
+    if ((input->is_calibrated == false) || (adc_cali_raw_to_voltage(input->calibration, raw, &mv) != ESP_OK)) {
+        mv = (raw * ADC_LINEAR_FULL_MV + ADC_RAW_MAX / 2) / ADC_RAW_MAX;
+    }
+    return ((uint32_t)mv * ADC_CORRECTION_PERMILLE * input->divider_ratio + 500) / 1000;
+}
+
+/* -------------------------------------------------------------------------- */
 
-    if (adc_oneshot_read(_p_adc1, chan, &raw) != ESP_OK) {
+static uint32_t _capacity_percent(uint32_t voltage_mv) {
+    const size_t last = sizeof(LIPO_CURVE) / sizeof(LIPO_CURVE[0]) - 1;
+    if (voltage_mv <= LIPO_CURVE[0].mv) {
         return 0;
     }
+    if (voltage_mv >= LIPO_CURVE[last].mv) {
+        return LIPO_CURVE[last].percent;
+    }
 
-    int mv = raw;
-    if ((is_cal_ok == true) && (adc_cali_raw_to_voltage(cal, raw, &mv) != ESP_OK)) {
-        return 0;
-    } else {
-        mv = (int)roundf(((float)raw / 4095.0f) * 3600.0f);
+    size_t i = 1;
+    while (voltage_mv > LIPO_CURVE[i].mv) {
+        i++;
+    }
+    const _lipo_point_t *lo = &LIPO_CURVE[i - 1];
+    const _lipo_point_t *hi = &LIPO_CURVE[i];
+    return lo->percent + ((voltage_mv - lo->mv) * (hi->percent - lo->percent)) / (hi->mv - lo->mv);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _publish(uint32_t samples) {
+    uint32_t battery_mv = (uint32_t)(_inputs[0].filtered_mv_q4 >> BATTERY_FRAC_BITS);
+    uint32_t solar_mv = (uint32_t)(_inputs[1].filtered_mv_q4 >> BATTERY_FRAC_BITS);
+
+    unsigned seq = atomic_load_explicit(&_snapshot_seq, memory_order_relaxed);
+    const bsp_battery_snapshot_t *current = &_snapshots[seq & 1];
+    bsp_battery_snapshot_t *next = &_snapshots[(seq + 1) & 1];
+
+    next->battery_mv = battery_mv;
+    next->solar_mv = solar_mv;
+    next->capacity_percent = _capacity_percent(battery_mv);
+    next->samples = current->samples + samples;
+    next->updated_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    atomic_store_explicit(&_snapshot_seq, seq + 1, memory_order_release);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* One short DMA burst, averaged per channel and folded into the IIR filter */
+static bool _sample_burst(void) {
+    uint32_t sums[BATTERY_CHANNELS] = { 0 };
+    uint32_t counts[BATTERY_CHANNELS] = { 0 };
+    uint32_t length = 0;
+
+    if (adc_continuous_start(_p_adc) != ESP_OK) {
+        return false;
+    }
+    // Whatever the previous burst left unread in the pool is a sampling period old
+    adc_continuous_flush_pool(_p_adc);
+    esp_err_t err = adc_continuous_read(_p_adc, _frame, sizeof(_frame), &length, BATTERY_READ_TIMEOUT_MS);
+    adc_continuous_stop(_p_adc);
+    if (err != ESP_OK) {
+        return false;
+    }
+
+    for (uint32_t offset = 0; offset + SOC_ADC_DIGI_RESULT_BYTES <= length; offset += SOC_ADC_DIGI_RESULT_BYTES) {
+        const adc_digi_output_data_t *result = (const adc_digi_output_data_t *)&_frame[offset];
+        for (int i = 0; i < BATTERY_CHANNELS; i++) {
+            if (ADC_RESULT_CHANNEL(result) == _inputs[i].channel) {
+                sums[i] += ADC_RESULT_DATA(result);
+                counts[i]++;
+            }
+        }
+    }
+
+    uint32_t samples = 0;
+    for (int i = 0; i < BATTERY_CHANNELS; i++) {
+        _battery_input_t *input = &_inputs[i];
+        if (counts[i] == 0) {
+            continue;
+        }
+        int32_t mv_q4 = (int32_t)(_raw_to_mv(input, (int)((sums[i] + counts[i] / 2) / counts[i])) << BATTERY_FRAC_BITS);
+        if (input->is_seeded == false) {
+            input->filtered_mv_q4 = mv_q4;
+            input->is_seeded = true;
+        } else {
+            input->filtered_mv_q4 += (mv_q4 - input->filtered_mv_q4) >> BATTERY_IIR_SHIFT;
+        }
+        samples += counts[i];
+    }
+    if (samples == 0) {
+        return false;
+    }
+
+    _publish(samples);
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _sampling_task(void *arg) {
+    (void)arg;
+    TickType_t last_wake = xTaskGetTickCount();
+    while (1) {
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(CONFIG_GATEWAY_BATTERY_SAMPLE_PERIOD_MS));
+        if (_sample_burst() == false) {
+            ESP_LOGW(TAG, "ADC burst failed");
+        }
     }
-    const float CORRECTION = 1.02f;
-    float millivolts_f = (float)mv * CORRECTION;
-    return (uint32_t)lroundf(millivolts_f * (float)divider_ratio);
 }
 
 /* -------------------------------------------------------------------------- */
@@ -64,62 +209,78 @@ void bsp_battery_init(void) {
     };
     ESP_ERROR_CHECK(gpio_config(&ADC_IN_CFG));
 
-    adc_oneshot_unit_init_cfg_t unit_cfg = {
-        .unit_id = ADC_UNIT_1,
-        .clk_src = ADC_DIGI_CLK_SRC_DEFAULT,
-        .ulp_mode = ADC_ULP_MODE_DISABLE,
+    adc_continuous_handle_cfg_t handle_cfg = {
+        .max_store_buf_size = 2 * BATTERY_FRAME_BYTES,
+        .conv_frame_size = BATTERY_FRAME_BYTES,
     };
-    ESP_ERROR_CHECK(adc_oneshot_new_unit(&unit_cfg, &_p_adc1));
+    ESP_ERROR_CHECK(adc_continuous_new_handle(&handle_cfg, &_p_adc));
 
-    ///
-
-    adc_oneshot_chan_cfg_t ch_cfg = {
-        .bitwidth = ADC_BITWIDTH_12,
-        .atten = ADC_ATTEN_DB_12,
+    adc_digi_pattern_config_t patterns[BATTERY_CHANNELS];
+    for (int i = 0; i < BATTERY_CHANNELS; i++) {
+        patterns[i] = (adc_digi_pattern_config_t){
+            .atten = ADC_ATTEN_DB_12,
+            .channel = _inputs[i].channel,
+            .unit = ADC_UNIT_1,
+            .bit_width = ADC_BITWIDTH_12,
+        };
+    }
+    adc_continuous_config_t adc_cfg = {
+        .pattern_num = BATTERY_CHANNELS,
+        .adc_pattern = patterns,
+        .sample_freq_hz = BATTERY_SAMPLE_FREQ_HZ,
+        .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+        .format = ADC_DIGI_OUTPUT_FORMAT_TYPE1,
     };
-    ESP_ERROR_CHECK(adc_oneshot_config_channel(_p_adc1, ADC_CHANNEL_BAT, &ch_cfg));
-    ESP_ERROR_CHECK(adc_oneshot_config_channel(_p_adc1, ADC_CHANNEL_SOLAR, &ch_cfg));
+    ESP_ERROR_CHECK(adc_continuous_config(_p_adc, &adc_cfg));
 
 #if ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED == 1
-    _battery_calibration_ok = _create_calibration(ADC_CHANNEL_BAT, &_p_battery_calibration);
-    _solar_calibration_ok = _create_calibration(ADC_CHANNEL_SOLAR, &_p_solar_calibration);
+    for (int i = 0; i < BATTERY_CHANNELS; i++) {
+        _inputs[i].is_calibrated = _create_calibration(_inputs[i].channel, &_inputs[i].calibration);
+    }
 #endif  // ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED == 1
+
+    // Seed the filter so the first readers already see a real value
+    if (_sample_burst() == false) {
+        ESP_LOGW(TAG, "Initial ADC burst failed");
+    }
+    xTaskCreate(_sampling_task, "battery", BATTERY_TASK_STACK_SIZE, NULL, BATTERY_TASK_PRIORITY, NULL);
 }
 
 /* -------------------------------------------------------------------------- */
 
-uint32_t bsp_battery_read_voltage_mv(void) {
-    return _read_voltage_mv(ADC_CHANNEL_BAT, _p_battery_calibration, _battery_calibration_ok, ADC_BAT_DIVIDER_RATIO);
+/* Never waits on the sampling task, a copy is retried whenever a publication lands while it is taken. Only a second
+ * one could have touched the slot being copied, but telling the two apart is not worth it at this rate. */
+void bsp_battery_get_snapshot(bsp_battery_snapshot_t *out) {
+    unsigned seq = 0;
+    do {
+        seq = atomic_load_explicit(&_snapshot_seq, memory_order_acquire);
+        memcpy(out, &_snapshots[seq & 1], sizeof(*out));
+        atomic_thread_fence(memory_order_acquire);
+    } while (seq != atomic_load_explicit(&_snapshot_seq, memory_order_relaxed));
 }
 
 /* -------------------------------------------------------------------------- */
 
-size_t bsp_battery_get_capacity(void) {
-
-    static const int MAX_PERCENTAGE = 100;
-    static const int MAX_VOLTAGE_MV = 4200;
-    static const int MIN_VOLTAGE_MV = 3300;
-
-    uint32_t voltage_mv = bsp_battery_read_voltage_mv();
-
-    if (voltage_mv <= MIN_VOLTAGE_MV) {
-        return 0;
-    }
+uint32_t bsp_battery_read_voltage_mv(void) {
+    bsp_battery_snapshot_t snapshot;
+    bsp_battery_get_snapshot(&snapshot);
+    return snapshot.battery_mv;
+}
 
-    if (voltage_mv >= MAX_VOLTAGE_MV) {
-        return MAX_PERCENTAGE;
-    }
+/* -------------------------------------------------------------------------- */
 
-    static const float COEFFICIENT = 100.0f / (MAX_VOLTAGE_MV - MIN_VOLTAGE_MV);
-    float capacity_f = ((float)voltage_mv - (float)MIN_VOLTAGE_MV) * COEFFICIENT;
-    size_t capacity = (size_t)capacity_f;
-    return capacity;
+size_t bsp_battery_get_capacity(void) {
+    bsp_battery_snapshot_t snapshot;
+    bsp_battery_get_snapshot(&snapshot);
+    return snapshot.capacity_percent;
 }
 
 /* -------------------------------------------------------------------------- */
 
 uint32_t bsp_solar_battery_read_voltage_mv(void) {
-    return _read_voltage_mv(ADC_CHANNEL_SOLAR, _p_solar_calibration, _solar_calibration_ok, ADC_SOLAR_DIVIDER_RATIO);
+    bsp_battery_snapshot_t snapshot;
+    bsp_battery_get_snapshot(&snapshot);
+    return snapshot.solar_mv;
 }
 
 /* -------------------------------------------------------------------------- */
@@ -0,0 +1,378 @@
+#include "bsp_binlog.h"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#if CONFIG_GATEWAY_BINLOG
+
+/* -------------------------------------------------------------------------- */
+
+static const char *TAG = "bsp_binlog.c";
+
+#define BINLOG_RECORDS         (CONFIG_GATEWAY_BINLOG_RECORDS)
+#define BINLOG_PARTITION_LABEL "binlog"
+#define BINLOG_PARTITION_TYPE  (0x40)
+#define BINLOG_SECTOR_SIZE     (4096)
+#define BINLOG_SECTOR_MAGIC    (0x474F4C42UL)
+#define BINLOG_RAM_MAGIC       (0x4D41524CUL)
+#define BINLOG_FORMAT_VER      (1)
+#define BINLOG_BATCH           (32)
+#define BINLOG_TASK_STACK_SIZE (3072)
+#define BINLOG_TASK_PRIORITY   (1)
+#define BINLOG_CORE_SHIFT      (4)
+#define BINLOG_COUNT_MASK      (0x0F)
+
+// Layout is shared with tools/binlog_decode.py
+typedef struct {
+    uint32_t magic;
+    // The newest sector has the highest sequence, writing resumes after it
+    uint32_t sequence;
+    uint32_t boot;
+    uint16_t version;
+    uint16_t record_size;
+} _sector_header_t;
+
+typedef struct {
+    uint16_t check;
+    uint8_t level;
+    // Argument count in the low nibble, core in the high one
+    uint8_t info;
+    uint32_t ms;
+    uint32_t tag;
+    uint32_t format;
+    uint32_t args[BSP_BINLOG_ARGS_MAX];
+} _record_t;
+
+typedef struct {
+    _record_t record;
+    // Head position plus one, written last, zero while the slot is being filled
+    atomic_uint_fast32_t sequence;
+} _slot_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t boot;
+    atomic_uint_fast32_t heads[portNUM_PROCESSORS];
+    // Owned by the flush task
+    uint32_t tails[portNUM_PROCESSORS];
+    _slot_t slots[portNUM_PROCESSORS][BINLOG_RECORDS];
+} _ram_log_t;
+
+#define BINLOG_SECTOR_RECORDS ((BINLOG_SECTOR_SIZE - sizeof(_sector_header_t)) / sizeof(_record_t))
+
+// Survives a panic or watchdog reset, records that were not flushed yet are written on the next boot
+static __NOINIT_ATTR _ram_log_t _ram;
+static atomic_bool _is_ready;
+static atomic_uint_fast32_t _lost;
+
+// Flush task only, and init before it starts
+static const esp_partition_t *_p_partition;
+static uint32_t _sector_count;
+static uint32_t _sector;
+static uint32_t _sector_sequence;
+static uint32_t _sector_used;
+static _record_t _batch[BINLOG_BATCH];
+static bsp_binlog_stats_t _stats;
+
+/* -------------------------------------------------------------------------- */
+
+/* Hot path: one atomic add to claim a slot on the own core, plain stores, no formatting and no lock */
+bool bsp_binlog_write(bsp_binlog_level_e level, uint32_t arg_count, const char *tag, const char *format, ...) {
+    if (atomic_load_explicit(&_is_ready, memory_order_relaxed) == false) {
+        return false;
+    }
+
+    // The core only picks the ring, a task migrating in between still gets a slot of its own
+    int core = esp_cpu_get_core_id();
+    uint32_t head = atomic_fetch_add_explicit(&_ram.heads[core], 1, memory_order_relaxed);
+    _slot_t *slot = &_ram.slots[core][head % BINLOG_RECORDS];
+    atomic_store_explicit(&slot->sequence, 0, memory_order_relaxed);
+
+    _record_t *record = &slot->record;
+    record->level = level;
+    record->info = (uint8_t)((core << BINLOG_CORE_SHIFT) | (arg_count & BINLOG_COUNT_MASK));
+    record->ms = (uint32_t)(esp_timer_get_time() / 1000);
+    record->tag = (uint32_t)(uintptr_t)tag;
+    record->format = (uint32_t)(uintptr_t)format;
+    va_list args;
+    va_start(args, format);
+    // Every supported argument is one 32-bit word on this target
+    for (uint32_t i = 0; (i < arg_count) && (i < BSP_BINLOG_ARGS_MAX); i++) {
+        record->args[i] = va_arg(args, uint32_t);
+    }
+    va_end(args);
+
+    atomic_store_explicit(&slot->sequence, head + 1, memory_order_release);
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint16_t _check(const _record_t *record) {
+    // Fletcher-16 over everything but the check itself, torn writes after a brown-out fail it
+    const uint8_t *bytes = (const uint8_t *)record + sizeof(record->check);
+    uint32_t a = 0;
+    uint32_t b = 0;
+    for (size_t i = 0; i < sizeof(*record) - sizeof(record->check); i++) {
+        a = (a + bytes[i]) % 255;
+        b = (b + a) % 255;
+    }
+    return (uint16_t)((b << 8) | a);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Sectors are used strictly in turn, so every one is erased once per lap of the partition */
+static void _open_sector(uint32_t boot) {
+    _sector = (_sector + 1) % _sector_count;
+    _sector_sequence++;
+    _sector_used = 0;
+
+    const _sector_header_t header = {
+        .magic = BINLOG_SECTOR_MAGIC,
+        .sequence = _sector_sequence,
+        .boot = boot,
+        .version = BINLOG_FORMAT_VER,
+        .record_size = sizeof(_record_t),
+    };
+    size_t offset = _sector * BINLOG_SECTOR_SIZE;
+    esp_err_t err = esp_partition_erase_range(_p_partition, offset, BINLOG_SECTOR_SIZE);
+    if (err == ESP_OK) {
+        err = esp_partition_write(_p_partition, offset, &header, sizeof(header));
+    }
+    if (err != ESP_OK) {
+        _stats.write_errors++;
+        // Skip the sector, the next batch moves on to the following one
+        _sector_used = BINLOG_SECTOR_RECORDS;
+        return;
+    }
+    _stats.sectors++;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _write_batch(size_t count, uint32_t boot) {
+    size_t done = 0;
+    while (done < count) {
+        if (_sector_used >= BINLOG_SECTOR_RECORDS) {
+            _open_sector(boot);
+            continue;
+        }
+        size_t run = BINLOG_SECTOR_RECORDS - _sector_used;
+        if (run > count - done) {
+            run = count - done;
+        }
+        size_t offset = _sector * BINLOG_SECTOR_SIZE + sizeof(_sector_header_t) + _sector_used * sizeof(_record_t);
+        if (esp_partition_write(_p_partition, offset, &_batch[done], run * sizeof(_record_t)) != ESP_OK) {
+            _stats.write_errors++;
+        } else {
+            _stats.written += run;
+        }
+        _sector_used += run;
+        done += run;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Moves the committed records of every ring to flash, returns the number of records written */
+static size_t _flush(uint32_t boot) {
+    size_t total = 0;
+    size_t count = 0;
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        uint32_t head = atomic_load_explicit(&_ram.heads[core], memory_order_acquire);
+        uint32_t tail = _ram.tails[core];
+        if (head - tail > BINLOG_RECORDS) {
+            atomic_fetch_add_explicit(&_lost, head - tail - BINLOG_RECORDS, memory_order_relaxed);
+            tail = head - BINLOG_RECORDS;
+        }
+
+        for (; tail != head; tail++) {
+            const _slot_t *slot = &_ram.slots[core][tail % BINLOG_RECORDS];
+            // A writer still filling the slot, the rest of the ring waits for the next flush
+            if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != tail + 1) {
+                break;
+            }
+            _batch[count] = slot->record;
+            if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != tail + 1) {
+                // Overwritten while copying
+                atomic_fetch_add_explicit(&_lost, 1, memory_order_relaxed);
+                continue;
+            }
+            _batch[count].check = _check(&_batch[count]);
+            count++;
+            if (count == BINLOG_BATCH) {
+                _write_batch(count, boot);
+                total += count;
+                count = 0;
+            }
+        }
+        _ram.tails[core] = tail;
+    }
+    _write_batch(count, boot);
+    return total + count;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _flush_task(void *arg) {
+    (void)arg;
+
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_GATEWAY_BINLOG_FLUSH_MS));
+        _flush(_ram.boot);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Finds the newest sector, writing continues after it and the boot counter above the highest one seen */
+static void _scan(uint32_t *out_boot) {
+    uint32_t boot = 0;
+    bool is_found = false;
+    for (uint32_t i = 0; i < _sector_count; i++) {
+        _sector_header_t header;
+        if ((esp_partition_read(_p_partition, i * BINLOG_SECTOR_SIZE, &header, sizeof(header)) != ESP_OK) ||
+            (header.magic != BINLOG_SECTOR_MAGIC)) {
+            continue;
+        }
+        if ((is_found == false) || ((int32_t)(header.sequence - _sector_sequence) > 0)) {
+            _sector = i;
+            _sector_sequence = header.sequence;
+            is_found = true;
+        }
+        if (header.boot > boot) {
+            boot = header.boot;
+        }
+    }
+    if (is_found == false) {
+        _sector = _sector_count - 1;
+    }
+    *out_boot = boot;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool _is_ram_kept(void) {
+    if (_ram.magic != BINLOG_RAM_MAGIC) {
+        return false;
+    }
+    switch (esp_reset_reason()) {
+        case ESP_RST_PANIC:
+        case ESP_RST_INT_WDT:
+        case ESP_RST_TASK_WDT:
+        case ESP_RST_WDT:
+        case ESP_RST_SW:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Before the event handlers that log through it are registered */
+void bsp_binlog_init(BaseType_t core) {
+    _p_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, BINLOG_PARTITION_TYPE, BINLOG_PARTITION_LABEL);
+    if ((_p_partition == NULL) || (_p_partition->size < 2 * BINLOG_SECTOR_SIZE)) {
+        ESP_LOGE(TAG, "No \"%s\" partition, binary log records go to the console instead", BINLOG_PARTITION_LABEL);
+        return;
+    }
+    _sector_count = _p_partition->size / BINLOG_SECTOR_SIZE;
+
+    uint32_t last_boot = 0;
+    _scan(&last_boot);
+
+    // Records of the crashed boot go to a sector of their own, under that boot's number
+    if (_is_ram_kept()) {
+        _sector_used = BINLOG_SECTOR_RECORDS;
+        _stats.recovered = _flush(_ram.boot);
+        if (_ram.boot > last_boot) {
+            last_boot = _ram.boot;
+        }
+    }
+
+    memset(&_ram, 0, sizeof(_ram));
+    _ram.boot = last_boot + 1;
+    _ram.magic = BINLOG_RAM_MAGIC;
+    _stats.boot = _ram.boot;
+    _sector_used = BINLOG_SECTOR_RECORDS;
+    atomic_store_explicit(&_is_ready, true, memory_order_release);
+
+    BSP_BINLOGW(TAG, "Boot %" PRIu32 ", reset reason %d", _ram.boot, (int)esp_reset_reason());
+    ESP_LOGI(TAG,
+             "Binary log: boot %" PRIu32 ", %" PRIu32 " sectors of %u records, %" PRIu32 " records recovered",
+             _ram.boot,
+             _sector_count,
+             (unsigned)BINLOG_SECTOR_RECORDS,
+             _stats.recovered);
+    xTaskCreatePinnedToCore(_flush_task,
+                            "binlog",
+                            BINLOG_TASK_STACK_SIZE,
+                            NULL,
+                            BINLOG_TASK_PRIORITY,
+                            NULL,
+                            core);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void bsp_binlog_get_stats(bsp_binlog_stats_t *out) {
+    // Counters of the flush task, a torn read only skews one status line
+    *out = _stats;
+    out->lost = atomic_load_explicit(&_lost, memory_order_relaxed);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void bsp_binlog_log(void) {
+    bsp_binlog_stats_t stats;
+    bsp_binlog_get_stats(&stats);
+    ESP_LOGI(TAG,
+             "Binary log: boot %" PRIu32 ", %" PRIu32 " records written, %" PRIu32 " lost, %" PRIu32
+             " recovered, %" PRIu32 " sectors opened, %" PRIu32 " write errors",
+             stats.boot,
+             stats.written,
+             stats.lost,
+             stats.recovered,
+             stats.sectors,
+             stats.write_errors);
+}
+
+/* -------------------------------------------------------------------------- */
+
+#else  // CONFIG_GATEWAY_BINLOG
+
+void bsp_binlog_init(BaseType_t core) {
+    (void)core;
+}
+
+bool bsp_binlog_write(bsp_binlog_level_e level, uint32_t arg_count, const char *tag, const char *format, ...) {
+    (void)level;
+    (void)arg_count;
+    (void)tag;
+    (void)format;
+    return false;
+}
+
+void bsp_binlog_get_stats(bsp_binlog_stats_t *out) {
+    memset(out, 0, sizeof(*out));
+}
+
+void bsp_binlog_log(void) {
+}
+
+#endif  // CONFIG_GATEWAY_BINLOG
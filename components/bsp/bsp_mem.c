@@ -0,0 +1,136 @@
+#include "bsp_mem.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_memory_utils.h"
+
+/* -------------------------------------------------------------------------- */
+
+static const char *TAG = "bsp_mem.c";
+
+#define MEM_CAPS_INTERNAL (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT)
+#define MEM_CAPS_PSRAM    (MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)
+#define MEM_LOG_LINE_MAX  (192)
+
+typedef enum {
+    _REGION_INTERNAL = 0,
+    _REGION_PSRAM,
+    _REGION_MAX,
+} _region_e;
+
+static const char *const OWNER_NAMES[BSP_MEM_OWNER_MAX] = { "wifi", "modem", "ppp_rx", "napt", "dns" };
+
+// Buffers handed out by bsp_mem_calloc()
+static atomic_uint_fast32_t _tracked[BSP_MEM_OWNER_MAX][_REGION_MAX];
+// Heap taken by drivers that allocate on their own, measured around their setup
+static atomic_uint_fast32_t _measured[BSP_MEM_OWNER_MAX][_REGION_MAX];
+
+/* -------------------------------------------------------------------------- */
+
+static uint32_t _tracked_total(_region_e region) {
+    uint32_t total = 0;
+    for (int i = 0; i < BSP_MEM_OWNER_MAX; i++) {
+        total += atomic_load_explicit(&_tracked[i][region], memory_order_relaxed);
+    }
+    return total;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint32_t _delta(uint32_t free_before, uint32_t free_after, uint32_t tracked_growth) {
+    uint32_t used = (free_before > free_after) ? free_before - free_after : 0;
+    return (used > tracked_growth) ? used - tracked_growth : 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void *bsp_mem_calloc(bsp_mem_owner_e owner, bsp_mem_placement_e placement, size_t count, size_t size) {
+    void *ptr = NULL;
+    if (placement == BSP_MEM_BULK) {
+        ptr = heap_caps_calloc_prefer(count, size, 2, MEM_CAPS_PSRAM, MEM_CAPS_INTERNAL);
+    } else {
+        ptr = heap_caps_calloc(count, size, MEM_CAPS_INTERNAL);
+    }
+    if ((ptr == NULL) || (owner >= BSP_MEM_OWNER_MAX)) {
+        return ptr;
+    }
+
+    _region_e region = esp_ptr_external_ram(ptr) ? _REGION_PSRAM : _REGION_INTERNAL;
+    atomic_fetch_add_explicit(&_tracked[owner][region], heap_caps_get_allocated_size(ptr), memory_order_relaxed);
+    if ((placement == BSP_MEM_BULK) && (region == _REGION_INTERNAL)) {
+        ESP_LOGW(TAG, "No PSRAM for %u bytes of %s, using internal RAM", (unsigned)(count * size), OWNER_NAMES[owner]);
+    }
+    return ptr;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void bsp_mem_mark(bsp_mem_mark_t *mark) {
+    mark->internal_free = heap_caps_get_free_size(MEM_CAPS_INTERNAL);
+    mark->psram_free = heap_caps_get_free_size(MEM_CAPS_PSRAM);
+    mark->tracked_internal = _tracked_total(_REGION_INTERNAL);
+    mark->tracked_psram = _tracked_total(_REGION_PSRAM);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Heap drop since the mark minus tracked buffers allocated meanwhile, other tasks allocating in between add noise */
+void bsp_mem_charge_since(bsp_mem_owner_e owner, const bsp_mem_mark_t *mark) {
+    if (owner >= BSP_MEM_OWNER_MAX) {
+        return;
+    }
+    bsp_mem_mark_t now;
+    bsp_mem_mark(&now);
+    atomic_store_explicit(&_measured[owner][_REGION_INTERNAL],
+                          _delta(mark->internal_free, now.internal_free, now.tracked_internal - mark->tracked_internal),
+                          memory_order_relaxed);
+    atomic_store_explicit(&_measured[owner][_REGION_PSRAM],
+                          _delta(mark->psram_free, now.psram_free, now.tracked_psram - mark->tracked_psram),
+                          memory_order_relaxed);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void bsp_mem_get_usage(bsp_mem_owner_e owner, bsp_mem_usage_t *out) {
+    if (owner >= BSP_MEM_OWNER_MAX) {
+        out->internal_bytes = 0;
+        out->psram_bytes = 0;
+        return;
+    }
+    out->internal_bytes = atomic_load_explicit(&_tracked[owner][_REGION_INTERNAL], memory_order_relaxed) +
+                          atomic_load_explicit(&_measured[owner][_REGION_INTERNAL], memory_order_relaxed);
+    out->psram_bytes = atomic_load_explicit(&_tracked[owner][_REGION_PSRAM], memory_order_relaxed) +
+                       atomic_load_explicit(&_measured[owner][_REGION_PSRAM], memory_order_relaxed);
+}
+
+/* -------------------------------------------------------------------------- */
+
+const char *bsp_mem_owner_name(bsp_mem_owner_e owner) {
+    return (owner < BSP_MEM_OWNER_MAX) ? OWNER_NAMES[owner] : "unknown";
+}
+
+/* -------------------------------------------------------------------------- */
+
+void bsp_mem_log(void) {
+    char line[MEM_LOG_LINE_MAX];
+    size_t len = 0;
+    for (int i = 0; (i < BSP_MEM_OWNER_MAX) && (len < sizeof(line)); i++) {
+        bsp_mem_usage_t usage;
+        bsp_mem_get_usage(i, &usage);
+        len += snprintf(&line[len],
+                        sizeof(line) - len,
+                        "%s%s %" PRIu32 "/%" PRIu32,
+                        (i == 0) ? "" : ", ",
+                        OWNER_NAMES[i],
+                        usage.internal_bytes / 1024,
+                        usage.psram_bytes / 1024);
+    }
+    ESP_LOGI(TAG, "Memory KiB (internal/PSRAM): %s", line);
+}
+
+/* -------------------------------------------------------------------------- */
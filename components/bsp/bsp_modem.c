@@ -6,10 +6,22 @@
 #include "esp_netif_ppp.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+#if CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#include "esp_sleep.h"
+#endif
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "bsp_binlog.h"
 #include "bsp_board.h"
+#include "bsp_mem.h"
 #include "bsp_modem.h"
+#include "bsp_ppp_rx.h"
 #include "sdkconfig.h"
 
 /* -------------------------------------------------------------------------- */
@@ -19,12 +31,71 @@ static const char *TAG = "gw_modem.c";
 static EventGroupHandle_t _event_group = NULL;
 static const int USB_DISCONNECTED_BIT =
     BIT3;  // Used only with USB DTE but we define it unconditionally, to avoid too many #ifdefs in the code
+// NETIF_PPP_ERRORUSER of a hang-up was handled
+static const int PPP_EXITED_BIT = BIT4;
 
 static esp_modem_dce_t *_dce;
 static esp_netif_t *_esp_modem_netif;
+static SemaphoreHandle_t _p_dce_lock;
+static bool _is_data_mode;
+static atomic_bool _is_sleeping;
+#if CONFIG_PM_ENABLE
+// Light sleep stops the UART clock, so it is only allowed while the modem sleeps as well
+static esp_pm_lock_handle_t _p_uart_lock;
+#endif
+static bsp_modem_ring_cb_t _p_ring_cb;
 
 #define CHECK_USB_DISCONNECTION(_event_group)
 
+#define MODEM_PWR_KEY_ON_PULSE_MS  (500)
+#define MODEM_PWR_KEY_OFF_PULSE_MS (3000)
+#define MODEM_STATUS_POLL_MS       (50)
+#define MODEM_PROBE_INTERVAL_MS    (200)
+#define MODEM_BAUD_SETTLE_MS       (1000)
+#define MODEM_DEFAULT_BAUD         (115200)
+#define MODEM_AT_TIMEOUT_MS        (1000)
+#define MODEM_DTR_WAKE_MS          (50)
+#define MODEM_PPP_EXIT_TIMEOUT_MS  (5000)
+#define MODEM_APN_MAX              (64)
+// 3GPP TS 24.008 eDRX cycle code for LTE, 0010 is 20.48 s
+#define MODEM_EDRX_CYCLE           "0010"
+// AT+CNBP LTE mask of the SIM7600E-H firmware, only used until the modem's own default is known
+#define MODEM_LTE_BANDS_FALLBACK   (0x000007FF3FDF3FFFULL)
+
+#if (BSP_PIN_MODEM_UART_RTS >= 0) && (BSP_PIN_MODEM_UART_CTS >= 0)
+#define MODEM_FLOW_CONTROL ESP_MODEM_FLOW_CONTROL_HW
+#elif CONFIG_GATEWAY_MODEM_SW_FLOW_CONTROL
+#define MODEM_FLOW_CONTROL ESP_MODEM_FLOW_CONTROL_SW
+#else
+#define MODEM_FLOW_CONTROL ESP_MODEM_FLOW_CONTROL_NONE
+#endif
+
+static const uint32_t MODEM_BAUD_CANDIDATES[] = { 3000000, 921600, 460800, 230400, MODEM_DEFAULT_BAUD };
+
+static uint32_t _modem_baud = MODEM_DEFAULT_BAUD;
+static uint32_t _baud_ceiling = CONFIG_GATEWAY_MODEM_MAX_BAUD;
+static uint32_t _task_priority = CONFIG_GATEWAY_MODEM_UART_EVENT_TASK_PRIORITY;
+static portMUX_TYPE _apn_lock = portMUX_INITIALIZER_UNLOCKED;
+static char _apn[MODEM_APN_MAX] = CONFIG_GATEWAY_MODEM_PPP_APN;
+static bool _is_apn_pending;
+static atomic_uint_fast32_t _buffer_overflows;
+static atomic_uint_fast32_t _terminal_errors;
+static atomic_uint_fast32_t _baud_fallbacks;
+// LTE band mask a lock with lte_bands 0 stands for, 0 until the application provides it
+static _Atomic uint64_t _lte_bands_default;
+
+/* -------------------------------------------------------------------------- */
+
+static void _mark_awake(void) {
+    if (atomic_exchange(&_is_sleeping, false) == false) {
+        return;
+    }
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_acquire(_p_uart_lock);
+    gpio_wakeup_disable(BSP_PIN_MODEM_UART_RXD);
+#endif
+}
+
 /* -------------------------------------------------------------------------- */
 
 static void _gpio_init(void) {
@@ -34,6 +105,7 @@ static void _gpio_init(void) {
 
     gpio_set_direction(BSP_PIN_MODEM_DTR, GPIO_MODE_OUTPUT);
     gpio_set_level(BSP_PIN_MODEM_DTR, 0);
+    _mark_awake();
 
     gpio_reset_pin(BSP_PIN_BLUE_LED);
     gpio_set_direction(BSP_PIN_BLUE_LED, GPIO_MODE_OUTPUT);
@@ -49,26 +121,261 @@ static void _gpio_init(void) {
 /* -------------------------------------------------------------------------- */
 
 static void _power_on_button_press(bool is_on) {
-    gpio_set_level(BSP_PIN_MODEM_PWR_KEY, 0);
-    gpio_set_level(BSP_PIN_BLUE_LED, 0);
-    vTaskDelay(pdMS_TO_TICKS(500));
-
     gpio_set_level(BSP_PIN_MODEM_PWR_KEY, 1);
     gpio_set_level(BSP_PIN_BLUE_LED, 1);
-    vTaskDelay(is_on == true ? pdMS_TO_TICKS(500) : pdMS_TO_TICKS(3000));
+    vTaskDelay(is_on == true ? pdMS_TO_TICKS(MODEM_PWR_KEY_ON_PULSE_MS) : pdMS_TO_TICKS(MODEM_PWR_KEY_OFF_PULSE_MS));
 
     gpio_set_level(BSP_PIN_MODEM_PWR_KEY, 0);
     gpio_set_level(BSP_PIN_BLUE_LED, 0);
-    vTaskDelay(pdMS_TO_TICKS(500));
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool _wait_for_status_level(int level, uint32_t timeout_ms) {
+    TickType_t start = xTaskGetTickCount();
+    while (gpio_get_level(BSP_PIN_MODEM_STATUS) != level) {
+        if ((xTaskGetTickCount() - start) > pdMS_TO_TICKS(timeout_ms)) {
+            return false;
+        }
+        vTaskDelay(pdMS_TO_TICKS(MODEM_STATUS_POLL_MS));
+    }
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool _wait_for_at_ready(uint32_t timeout_ms) {
+    TickType_t start = xTaskGetTickCount();
+    while (esp_modem_sync(_dce) != ESP_OK) {
+        if ((xTaskGetTickCount() - start) > pdMS_TO_TICKS(timeout_ms)) {
+            return false;
+        }
+        vTaskDelay(pdMS_TO_TICKS(MODEM_PROBE_INTERVAL_MS));
+    }
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool _wait_for_sim_ready(uint32_t timeout_ms) {
+    TickType_t start = xTaskGetTickCount();
+    while ((xTaskGetTickCount() - start) <= pdMS_TO_TICKS(timeout_ms)) {
+        bool pin_ok = false;
+        // +CME ERROR while the SIM is still initializing, +CPIN: READY once usable
+        if (esp_modem_read_pin(_dce, &pin_ok) == ESP_OK) {
+            if (pin_ok == true) {
+                return true;
+            }
+#if CONFIG_GATEWAY_NEED_SIM_PIN
+            if (esp_modem_set_pin(_dce, CONFIG_GATEWAY_SIM_PIN) != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to unlock SIM");
+                return false;
+            }
+#else
+            ESP_LOGE(TAG, "SIM is locked, enable GATEWAY_NEED_SIM_PIN");
+            return false;
+#endif
+        }
+        vTaskDelay(pdMS_TO_TICKS(MODEM_PROBE_INTERVAL_MS));
+    }
+    return false;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool _wait_for_attach(uint32_t timeout_ms) {
+    TickType_t start = xTaskGetTickCount();
+    while ((xTaskGetTickCount() - start) <= pdMS_TO_TICKS(timeout_ms)) {
+        int state = 0;
+        if ((esp_modem_get_network_attachment_state(_dce, &state) == ESP_OK) && (state == 1)) {
+            return true;
+        }
+        vTaskDelay(pdMS_TO_TICKS(MODEM_PROBE_INTERVAL_MS));
+    }
+    return false;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _on_terminal_error(esp_modem_terminal_error_t err) {
+    // The UART terminal reports both HW FIFO overflow and RX ring buffer full as BUFFER_OVERFLOW
+    if (err == ESP_MODEM_TERMINAL_BUFFER_OVERFLOW) {
+        atomic_fetch_add(&_buffer_overflows, 1);
+    } else {
+        atomic_fetch_add(&_terminal_errors, 1);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static esp_err_t _set_flow_control(void) {
+    if (MODEM_FLOW_CONTROL == ESP_MODEM_FLOW_CONTROL_NONE) {
+        return ESP_OK;
+    }
+
+    // AT+IFC=<dce>,<dte>: 2 is RTS/CTS, 1 is XON/XOFF
+    int mode = (MODEM_FLOW_CONTROL == ESP_MODEM_FLOW_CONTROL_HW) ? 2 : 1;
+    esp_err_t err = esp_modem_set_flow_control(_dce, mode, mode);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_modem_set_flow_control(%d) failed with %d", mode, err);
+    }
+    return err;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Called with the DCE lock held, every path talking to the modem has to run this first */
+static void _dtr_wake(void) {
+    if (atomic_load(&_is_sleeping) == false) {
+        return;
+    }
+    gpio_set_level(BSP_PIN_MODEM_DTR, 0);
+    _mark_awake();
+    // The UART of the modem comes back some milliseconds after DTR falls
+    vTaskDelay(pdMS_TO_TICKS(MODEM_DTR_WAKE_MS));
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _on_ring_isr(void *arg) {
+    (void)arg;
+    if (_p_ring_cb != NULL) {
+        _p_ring_cb();
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool _validate_link(void) {
+    uint_fast32_t overflows = atomic_load(&_buffer_overflows);
+
+    for (int i = 0; i < CONFIG_GATEWAY_MODEM_BAUD_VALIDATE_ROUNDS; i++) {
+        if (esp_modem_sync(_dce) != ESP_OK) {
+            return false;
+        }
+        // Echo of a known string, a corrupted byte either fails the parse or returns garbage
+        char line[CONFIG_ESP_MODEM_C_API_STR_MAX] = { 0 };
+        if (esp_modem_at(_dce, "AT+CGMI", line, MODEM_AT_TIMEOUT_MS) != ESP_OK) {
+            return false;
+        }
+        if (strstr(line, "SIMCOM") == NULL) {
+            return false;
+        }
+    }
+    return atomic_load(&_buffer_overflows) == overflows;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool _resync_baud(void) {
+    for (size_t i = 0; i < sizeof(MODEM_BAUD_CANDIDATES) / sizeof(MODEM_BAUD_CANDIDATES[0]); i++) {
+        ESP_ERROR_CHECK(uart_set_baudrate(CONFIG_GATEWAY_MODEM_UART_NUM, MODEM_BAUD_CANDIDATES[i]));
+        if (_wait_for_at_ready(MODEM_BAUD_SETTLE_MS) == true) {
+            _modem_baud = MODEM_BAUD_CANDIDATES[i];
+            ESP_LOGW(TAG, "Modem found at %" PRIu32 " baud", _modem_baud);
+            return true;
+        }
+    }
+    return false;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static esp_err_t _negotiate_baud(void) {
+    for (size_t i = 0; i < sizeof(MODEM_BAUD_CANDIDATES) / sizeof(MODEM_BAUD_CANDIDATES[0]); i++) {
+        uint32_t baud = MODEM_BAUD_CANDIDATES[i];
+        if (baud > _baud_ceiling) {
+            continue;
+        }
+
+        if (baud != _modem_baud) {
+            if (esp_modem_set_baud(_dce, (int)baud) != ESP_OK) {
+                ESP_LOGW(TAG, "Modem rejected %" PRIu32 " baud", baud);
+                continue;
+            }
+            ESP_ERROR_CHECK(uart_set_baudrate(CONFIG_GATEWAY_MODEM_UART_NUM, baud));
+            _modem_baud = baud;
+        }
+
+        if ((_wait_for_at_ready(MODEM_BAUD_SETTLE_MS) == true) && (_validate_link() == true)) {
+            ESP_LOGI(TAG, "UART link validated at %" PRIu32 " baud", baud);
+            return ESP_OK;
+        }
+
+        ESP_LOGW(TAG, "UART link unreliable at %" PRIu32 " baud, stepping down", baud);
+        atomic_fetch_add(&_baud_fallbacks, 1);
+        _baud_ceiling = baud - 1;
+        if (_resync_baud() == false) {
+            return ESP_ERR_TIMEOUT;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static esp_err_t _enter_data_mode(void) {
+    xEventGroupClearBits(_event_group, MODEM_CONNECT_BIT | MODEM_LOST_BIT);
+
+#if CONFIG_GATEWAY_MODEM_USE_CMUX
+    // PPP runs on the data DLC, AT commands stay available on the command DLC
+    const esp_modem_dce_mode_t mode = ESP_MODEM_MODE_CMUX;
+#else
+    const esp_modem_dce_mode_t mode = ESP_MODEM_MODE_DATA;
+#endif
+
+    esp_err_t err = esp_modem_set_mode(_dce, mode);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_modem_set_mode(%d) failed with %d", (int)mode, err);
+        return err;
+    }
+    _is_data_mode = true;
+    return ESP_OK;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _leave_data_mode(void) {
+    bool was_data_mode = _is_data_mode;
+    _is_data_mode = false;
+    xEventGroupClearBits(_event_group, PPP_EXITED_BIT);
+    esp_err_t err = esp_modem_set_mode(_dce, ESP_MODEM_MODE_COMMAND);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "esp_modem_set_mode(ESP_MODEM_MODE_COMMAND) failed with %d", err);
+        return;
+    }
+
+    // Dialing before the event loop handled the hang-up would count it as a loss of the new session
+    if (was_data_mode) {
+        EventBits_t bits = xEventGroupWaitBits(_event_group,
+                                               PPP_EXITED_BIT,
+                                               pdFALSE,
+                                               pdFALSE,
+                                               pdMS_TO_TICKS(MODEM_PPP_EXIT_TIMEOUT_MS));
+        if ((bits & PPP_EXITED_BIT) == 0) {
+            ESP_LOGW(TAG, "PPP did not report the hang-up within %d ms", MODEM_PPP_EXIT_TIMEOUT_MS);
+        }
+    }
 }
 
 /* -------------------------------------------------------------------------- */
 
 static void _on_ppp_changed(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data) {
-    ESP_LOGI(TAG, "PPP state changed event %d", (int)event_id);
+    BSP_BINLOGI(TAG, "PPP state changed event %d", (int)event_id);
     if (event_id == NETIF_PPP_ERRORUSER) {
         esp_netif_t *netif = event_data;
-        ESP_LOGI(TAG, "User interrupted event from netif:%p", netif);
+        BSP_BINLOGI(TAG, "User interrupted event from netif:%p", netif);
+    }
+
+    /* Any PPP error ends the session, including LCP echo timeouts reported as NETIF_PPP_ERRORPEERDEAD. LCP echo is
+     * enabled in sdkconfig.defaults, without it a dead bearer is never noticed. */
+    if ((event_id > NETIF_PPP_ERRORNONE) && (event_id < NETIF_PPP_PHASE_DEAD)) {
+        xEventGroupClearBits(_event_group, MODEM_CONNECT_BIT);
+        xEventGroupSetBits(_event_group, MODEM_LOST_BIT);
+    }
+    // Only after MODEM_LOST_BIT, the redial clears it once this is set
+    if (event_id == NETIF_PPP_ERRORUSER) {
+        xEventGroupSetBits(_event_group, PPP_EXITED_BIT);
     }
 }
 
@@ -82,26 +389,28 @@ static void _on_ip_event(void *arg, esp_event_base_t event_base, int32_t event_i
         ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
         esp_netif_t *netif = event->esp_netif;
 
-        ESP_LOGI(TAG, "Modem Connect to PPP Server");
-        ESP_LOGI(TAG, "~~~~~~~~~~~~~~");
-        ESP_LOGI(TAG, "IP          : " IPSTR, IP2STR(&event->ip_info.ip));
-        ESP_LOGI(TAG, "Netmask     : " IPSTR, IP2STR(&event->ip_info.netmask));
-        ESP_LOGI(TAG, "Gateway     : " IPSTR, IP2STR(&event->ip_info.gw));
+        BSP_BINLOGI(TAG, "Modem Connect to PPP Server");
+        BSP_BINLOGI(TAG, "~~~~~~~~~~~~~~");
+        BSP_BINLOGI(TAG, "IP          : " IPSTR, IP2STR(&event->ip_info.ip));
+        BSP_BINLOGI(TAG, "Netmask     : " IPSTR, IP2STR(&event->ip_info.netmask));
+        BSP_BINLOGI(TAG, "Gateway     : " IPSTR, IP2STR(&event->ip_info.gw));
         esp_netif_get_dns_info(netif, 0, &dns_info);
-        ESP_LOGI(TAG, "Name Server1: " IPSTR, IP2STR(&dns_info.ip.u_addr.ip4));
+        BSP_BINLOGI(TAG, "Name Server1: " IPSTR, IP2STR(&dns_info.ip.u_addr.ip4));
         esp_netif_get_dns_info(netif, 1, &dns_info);
-        ESP_LOGI(TAG, "Name Server2: " IPSTR, IP2STR(&dns_info.ip.u_addr.ip4));
-        ESP_LOGI(TAG, "~~~~~~~~~~~~~~");
+        BSP_BINLOGI(TAG, "Name Server2: " IPSTR, IP2STR(&dns_info.ip.u_addr.ip4));
+        BSP_BINLOGI(TAG, "~~~~~~~~~~~~~~");
         xEventGroupSetBits(_event_group, MODEM_CONNECT_BIT);
 
-        ESP_LOGI(TAG, "GOT ip event!!!");
+        BSP_BINLOGI(TAG, "GOT ip event!!!");
     } else if (event_id == IP_EVENT_PPP_LOST_IP) {
-        ESP_LOGI(TAG, "Modem Disconnect from PPP Server");
+        BSP_BINLOGI(TAG, "Modem Disconnect from PPP Server");
+        xEventGroupClearBits(_event_group, MODEM_CONNECT_BIT);
+        xEventGroupSetBits(_event_group, MODEM_LOST_BIT);
     } else if (event_id == IP_EVENT_GOT_IP6) {
-        ESP_LOGI(TAG, "GOT IPv6 event!");
+        BSP_BINLOGI(TAG, "GOT IPv6 event!");
 
         ip_event_got_ip6_t *event = (ip_event_got_ip6_t *)event_data;
-        ESP_LOGI(TAG, "Got IPv6 address " IPV6STR, IPV62STR(event->ip6_info.ip));
+        BSP_BINLOGI(TAG, "Got IPv6 address " IPV6STR, IPV62STR(event->ip6_info.ip));
     }
 }
 
@@ -125,16 +434,47 @@ esp_netif_t *air_gateway_get_modem_netif(void) {
 
 /* -------------------------------------------------------------------------- */
 
-void bsp_modem_setup(void) {
-    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, ESP_EVENT_ANY_ID, &_on_ip_event, NULL));
-    ESP_ERROR_CHECK(esp_event_handler_register(NETIF_PPP_STATUS, ESP_EVENT_ANY_ID, &_on_ppp_changed, NULL));
+/* Returns whether the APN changed since it was taken last */
+static bool _take_apn(char *out, size_t size) {
+    portENTER_CRITICAL(&_apn_lock);
+    strlcpy(out, _apn, size);
+    bool is_pending = _is_apn_pending;
+    _is_apn_pending = false;
+    portEXIT_CRITICAL(&_apn_lock);
+    return is_pending;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* The DCE sends its PDP context on the next switch to data mode */
+static void _apply_pending_apn(void) {
+    char apn[MODEM_APN_MAX];
+    if (_take_apn(apn, sizeof(apn)) == false) {
+        return;
+    }
+    esp_err_t err = esp_modem_set_apn(_dce, apn);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_modem_set_apn failed with %d", err);
+        return;
+    }
+    ESP_LOGI(TAG, "Dialing with APN %s", apn);
+}
+
+/* -------------------------------------------------------------------------- */
 
-    esp_modem_dce_config_t dce_config = ESP_MODEM_DCE_DEFAULT_CONFIG(CONFIG_GATEWAY_MODEM_PPP_APN);
+static esp_err_t _setup(void) {
+    char apn[MODEM_APN_MAX];
+    _take_apn(apn, sizeof(apn));
+    esp_modem_dce_config_t dce_config = ESP_MODEM_DCE_DEFAULT_CONFIG(apn);
     esp_netif_config_t netif_ppp_config = ESP_NETIF_DEFAULT_PPP();
+#if CONFIG_GATEWAY_MODEM_PPP_RX_DIRECT
+    netif_ppp_config.stack = bsp_ppp_rx_netstack();
+#endif
     _esp_modem_netif = esp_netif_new(&netif_ppp_config);
     assert(_esp_modem_netif);
-
-    _event_group = xEventGroupCreate();
+#if CONFIG_GATEWAY_MODEM_PPP_RX_DIRECT
+    bsp_ppp_rx_attach(_esp_modem_netif);
+#endif
 
     esp_modem_dte_config_t dte_config = ESP_MODEM_DTE_DEFAULT_CONFIG();
 
@@ -143,107 +483,554 @@ void bsp_modem_setup(void) {
     dte_config.uart_config.rx_io_num = BSP_PIN_MODEM_UART_RXD;
     dte_config.uart_config.rts_io_num = BSP_PIN_MODEM_UART_RTS;
     dte_config.uart_config.cts_io_num = BSP_PIN_MODEM_UART_CTS;
-    dte_config.uart_config.baud_rate = 115200;
+    dte_config.uart_config.baud_rate = MODEM_DEFAULT_BAUD;
 
-    dte_config.uart_config.flow_control = ESP_MODEM_FLOW_CONTROL_NONE;
+    dte_config.uart_config.flow_control = MODEM_FLOW_CONTROL;
     dte_config.uart_config.rx_buffer_size = CONFIG_GATEWAY_MODEM_UART_RX_BUFFER_SIZE;
     dte_config.uart_config.tx_buffer_size = CONFIG_GATEWAY_MODEM_UART_TX_BUFFER_SIZE;
     dte_config.uart_config.event_queue_size = CONFIG_GATEWAY_MODEM_UART_EVENT_QUEUE_SIZE;
     dte_config.task_stack_size = CONFIG_GATEWAY_MODEM_UART_EVENT_TASK_STACK_SIZE;
-    dte_config.task_priority = CONFIG_GATEWAY_MODEM_UART_EVENT_TASK_PRIORITY;
+    dte_config.task_priority = _task_priority;
     dte_config.dte_buffer_size = CONFIG_GATEWAY_MODEM_UART_RX_BUFFER_SIZE / 2;
 
     ESP_LOGI(TAG, "Initializing esp_modem for the SIM7600 module...");
     _dce = esp_modem_new_dev(ESP_MODEM_DCE_SIM7600, &dte_config, &dce_config, _esp_modem_netif);
     assert(_dce);
+    ESP_ERROR_CHECK(esp_modem_set_error_cb(_dce, _on_terminal_error));
 
-    xEventGroupClearBits(_event_group, MODEM_CONNECT_BIT | MODEM_GOT_DATA_BIT | USB_DISCONNECTED_BIT);
-
-    /* Run the modem demo app */
-#if GATEWAY_NEED_SIM_PIN == 1
-    // check if PIN needed
-    bool pin_ok = false;
-    if (esp_modem_read_pin(_dce, &pin_ok) == ESP_OK && pin_ok == false) {
-        if (esp_modem_set_pin(_dce, GATEWAY_SIM_PIN) == ESP_OK) {
-            vTaskDelay(pdMS_TO_TICKS(1000));
-        } else {
-            abort();
-        }
+    xEventGroupClearBits(_event_group,
+                         MODEM_CONNECT_BIT | MODEM_LOST_BIT | MODEM_GOT_DATA_BIT | USB_DISCONNECTED_BIT);
+
+    // The modem keeps its UART rate across a DTE re-creation, only a power cycle resets it
+    if (_modem_baud != MODEM_DEFAULT_BAUD) {
+        ESP_ERROR_CHECK(uart_set_baudrate(dte_config.uart_config.port_num, _modem_baud));
+    }
+
+    if ((_wait_for_at_ready(CONFIG_GATEWAY_MODEM_READY_TIMEOUT_MS) == false) && (_resync_baud() == false)) {
+        ESP_LOGE(TAG, "Modem does not respond to AT");
+        return ESP_ERR_TIMEOUT;
+    }
+
+    if (_wait_for_sim_ready(CONFIG_GATEWAY_MODEM_READY_TIMEOUT_MS) == false) {
+        ESP_LOGE(TAG, "SIM is not ready");
+        return ESP_ERR_INVALID_STATE;
     }
-#endif
 
-    esp_err_t err = esp_modem_set_baud(_dce, 3000000);
+    esp_err_t err = _set_flow_control();
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to set baud rate: %d", err);
-    } else {
-        ESP_ERROR_CHECK(uart_set_baudrate(dte_config.uart_config.port_num, 3000000));
+        return err;
+    }
+
+    err = _negotiate_baud();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "No reliable UART baud rate found: %s", esp_err_to_name(err));
+        return err;
     }
-    vTaskDelay(pdMS_TO_TICKS(1000));
 
     int rssi = 0;
     int ber = 0;
     err = esp_modem_get_signal_quality(_dce, &rssi, &ber);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "esp_modem_get_signal_quality failed with %d %s", err, esp_err_to_name(err));
-        return;
+        return err;
     }
     ESP_LOGI(TAG, "Signal quality: rssi=%d, ber=%d", rssi, ber);
 
-    err = esp_modem_set_mode(_dce, ESP_MODEM_MODE_DATA);
+#if CONFIG_GATEWAY_MODEM_SLEEP
+    // Slow clock only takes effect while DTR is high, so the modem stays awake until bsp_modem_sleep()
+    char line[CONFIG_ESP_MODEM_C_API_STR_MAX] = { 0 };
+    if (esp_modem_at(_dce, "AT+CSCLK=1", line, MODEM_AT_TIMEOUT_MS) != ESP_OK) {
+        ESP_LOGW(TAG, "Modem rejected slow clock mode");
+    }
+#endif
+
+    return _enter_data_mode();
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _deinit(void) {
+    if (_dce != NULL) {
+        _leave_data_mode();
+
+#if 0
+        char imsi[32];
+        esp_err_t err = esp_modem_get_imsi(_dce, imsi);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "esp_modem_get_imsi failed with %d", err);
+            return;
+        }
+        ESP_LOGI(TAG, "IMSI=%s", imsi);
+#endif
+
+        esp_modem_destroy(_dce);
+        _dce = NULL;
+        _is_data_mode = false;
+    }
+
+#if CONFIG_GATEWAY_MODEM_PPP_RX_DIRECT
+    bsp_ppp_rx_attach(NULL);
+#endif
+
+    if (_esp_modem_netif != NULL) {
+        esp_netif_destroy(_esp_modem_netif);
+        _esp_modem_netif = NULL;
+    }
+
+    if (_event_group != NULL) {
+        xEventGroupClearBits(_event_group, MODEM_CONNECT_BIT);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static esp_err_t _redial(void) {
+    if (_dce == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Hanging up and dialing again renegotiates PPP on the existing DTE
+    _leave_data_mode();
+    _apply_pending_apn();
+    return _enter_data_mode();
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* One rung above a redial: the command channel is checked and the attach awaited before dialing, the DTE and DCE are
+ * kept, so neither the UART nor the baud rate is negotiated again */
+static esp_err_t _reenter_data_mode(void) {
+    if (_dce == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    _leave_data_mode();
+    if ((_wait_for_at_ready(CONFIG_GATEWAY_MODEM_READY_TIMEOUT_MS) == false) && (_resync_baud() == false)) {
+        ESP_LOGE(TAG, "Modem does not respond to AT");
+        return ESP_ERR_TIMEOUT;
+    }
+    if (_wait_for_attach(CONFIG_GATEWAY_MODEM_READY_TIMEOUT_MS) == false) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    _apply_pending_apn();
+    return _enter_data_mode();
+}
+
+/* -------------------------------------------------------------------------- */
+
+static esp_err_t _radio_reset(void) {
+    if (_dce == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    _leave_data_mode();
+    if (_wait_for_at_ready(CONFIG_GATEWAY_MODEM_READY_TIMEOUT_MS) == false) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    ESP_LOGW(TAG, "Resetting modem radio (CFUN)...");
+    esp_err_t err = esp_modem_set_radio_state(_dce, 0);
+    if (err == ESP_OK) {
+        err = esp_modem_set_radio_state(_dce, 1);
+    }
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "esp_modem_set_mode(ESP_MODEM_MODE_DATA) failed with %d", err);
+        ESP_LOGE(TAG, "esp_modem_set_radio_state failed with %d", err);
+        return err;
+    }
+
+    if ((_wait_for_sim_ready(CONFIG_GATEWAY_MODEM_READY_TIMEOUT_MS) == false) ||
+        (_wait_for_attach(CONFIG_GATEWAY_MODEM_READY_TIMEOUT_MS) == false)) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    _apply_pending_apn();
+    return _enter_data_mode();
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* The rules for when an AT command may go out: never wait behind a reconnect, the caller simply tries again later,
+ * and only on a running DCE that is awake, on the command DLC under CMUX or in command mode otherwise. On ESP_OK the
+ * caller owns the DCE until _give_command_channel(). */
+static esp_err_t _take_command_channel(void) {
+    if (_p_dce_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (xSemaphoreTake(_p_dce_lock, 0) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+#if CONFIG_GATEWAY_MODEM_USE_CMUX
+    bool is_command_channel_available = true;
+#else
+    bool is_command_channel_available = (_is_data_mode == false);
+#endif
+    if ((_dce == NULL) || (is_command_channel_available == false) || (atomic_load(&_is_sleeping) == true)) {
+        xSemaphoreGive(_p_dce_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    return ESP_OK;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _give_command_channel(void) {
+    xSemaphoreGive(_p_dce_lock);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _ensure_initialized(void) {
+    if (_event_group != NULL) {
         return;
     }
+    _event_group = xEventGroupCreate();
+    assert(_event_group);
+    _p_dce_lock = xSemaphoreCreateMutex();
+    assert(_p_dce_lock);
+#if CONFIG_PM_ENABLE
+    ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "modem_uart", &_p_uart_lock));
+    ESP_ERROR_CHECK(esp_pm_lock_acquire(_p_uart_lock));
+    ESP_ERROR_CHECK(esp_sleep_enable_gpio_wakeup());
+#endif
+    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, ESP_EVENT_ANY_ID, &_on_ip_event, NULL));
+    ESP_ERROR_CHECK(esp_event_handler_register(NETIF_PPP_STATUS, ESP_EVENT_ANY_ID, &_on_ppp_changed, NULL));
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Takes effect when the DTE is created next, its UART task cannot be pinned to a core */
+void bsp_modem_set_task_priority(uint32_t priority) {
+    _task_priority = priority;
+}
+
+/* The running PPP session keeps its context, the APN is used from the next dial */
+void bsp_modem_set_apn(const char *apn) {
+    portENTER_CRITICAL(&_apn_lock);
+    strlcpy(_apn, apn, sizeof(_apn));
+    _is_apn_pending = true;
+    portEXIT_CRITICAL(&_apn_lock);
+}
+
+/* -------------------------------------------------------------------------- */
+
+esp_err_t bsp_modem_setup(void) {
+    _ensure_initialized();
+
+    xSemaphoreTake(_p_dce_lock, portMAX_DELAY);
+    _dtr_wake();
+    // UART driver, DTE and CMUX buffers are allocated inside esp_modem, only their total is visible
+    bsp_mem_mark_t mark;
+    bsp_mem_mark(&mark);
+    esp_err_t err = _setup();
+    bsp_mem_charge_since(BSP_MEM_MODEM, &mark);
+    xSemaphoreGive(_p_dce_lock);
+
+    bsp_mem_usage_t usage;
+    bsp_mem_get_usage(BSP_MEM_MODEM, &usage);
+    ESP_LOGI(TAG,
+             "Modem buffers: %" PRIu32 " bytes internal, %" PRIu32 " bytes PSRAM",
+             usage.internal_bytes,
+             usage.psram_bytes);
+    return err;
 }
 
 /* -------------------------------------------------------------------------- */
 
 void bsp_modem_deinit(void) {
-    esp_err_t err = esp_modem_set_mode(_dce, ESP_MODEM_MODE_COMMAND);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "esp_modem_set_mode(ESP_MODEM_MODE_COMMAND) failed with %d", err);
+    if (_p_dce_lock == NULL) {
         return;
     }
 
-#if 0
-    char imsi[32];
-    err = esp_modem_get_imsi(_dce, imsi);
+    xSemaphoreTake(_p_dce_lock, portMAX_DELAY);
+    _dtr_wake();
+    _deinit();
+    xSemaphoreGive(_p_dce_lock);
+}
+
+/* -------------------------------------------------------------------------- */
+
+esp_err_t bsp_modem_redial(void) {
+    if (_p_dce_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(_p_dce_lock, portMAX_DELAY);
+    _dtr_wake();
+    esp_err_t err = _redial();
+    xSemaphoreGive(_p_dce_lock);
+    return err;
+}
+
+/* -------------------------------------------------------------------------- */
+
+esp_err_t bsp_modem_reenter_data_mode(void) {
+    if (_p_dce_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(_p_dce_lock, portMAX_DELAY);
+    _dtr_wake();
+    esp_err_t err = _reenter_data_mode();
+    xSemaphoreGive(_p_dce_lock);
+    return err;
+}
+
+/* -------------------------------------------------------------------------- */
+
+esp_err_t bsp_modem_radio_reset(void) {
+    if (_p_dce_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(_p_dce_lock, portMAX_DELAY);
+    _dtr_wake();
+    esp_err_t err = _radio_reset();
+    xSemaphoreGive(_p_dce_lock);
+    return err;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void bsp_modem_get_link_stats(bsp_modem_link_stats_t *out) {
+    out->baud = _modem_baud;
+    out->flow_control = MODEM_FLOW_CONTROL;
+    out->buffer_overflows = atomic_load(&_buffer_overflows);
+    out->terminal_errors = atomic_load(&_terminal_errors);
+    out->baud_fallbacks = atomic_load(&_baud_fallbacks);
+}
+
+/* -------------------------------------------------------------------------- */
+
+size_t bsp_modem_get_tx_pending(void) {
+    size_t free_size = 0;
+    if (uart_get_tx_buffer_free_size(CONFIG_GATEWAY_MODEM_UART_NUM, &free_size) != ESP_OK) {
+        return 0;
+    }
+    return (free_size < CONFIG_GATEWAY_MODEM_UART_TX_BUFFER_SIZE) ? CONFIG_GATEWAY_MODEM_UART_TX_BUFFER_SIZE - free_size
+                                                                   : 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+esp_err_t bsp_modem_read_telemetry(bsp_modem_telemetry_t *out) {
+    esp_err_t err = _take_command_channel();
     if (err != ESP_OK) {
-        ESP_LOGE(TAG, "esp_modem_get_imsi failed with %d", err);
-        return;
+        return err;
+    }
+
+    err = esp_modem_get_signal_quality(_dce, &out->rssi, &out->ber);
+
+    char line[CONFIG_ESP_MODEM_C_API_STR_MAX] = { 0 };
+    if ((err == ESP_OK) && (esp_modem_at(_dce, "AT+CPSI?", line, MODEM_AT_TIMEOUT_MS) == ESP_OK)) {
+        bsp_modem_parse_cpsi(line, out);
+    }
+
+    line[0] = '\0';
+    if ((err == ESP_OK) && (esp_modem_at(_dce, "AT+CPMUTEMP", line, MODEM_AT_TIMEOUT_MS) == ESP_OK)) {
+        bsp_modem_parse_cpmutemp(line, &out->temperature_c);
+    }
+
+    _give_command_channel();
+    return err;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* eDRX only stretches paging while RRC is idle, an active PPP session is not affected */
+esp_err_t bsp_modem_set_power_save(bool is_enabled) {
+    esp_err_t err = _take_command_channel();
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    char line[CONFIG_ESP_MODEM_C_API_STR_MAX] = { 0 };
+    const char *command = is_enabled ? "AT+CEDRXS=1,4,\"" MODEM_EDRX_CYCLE "\"" : "AT+CEDRXS=0";
+    err = esp_modem_at(_dce, command, line, MODEM_AT_TIMEOUT_MS);
+
+    _give_command_channel();
+    return err;
+}
+
+/* -------------------------------------------------------------------------- */
+
+esp_err_t bsp_modem_get_rat_lock(bsp_modem_rat_lock_t *out) {
+    esp_err_t err = _take_command_channel();
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    char line[CONFIG_ESP_MODEM_C_API_STR_MAX] = { 0 };
+    uint64_t gw_bands = 0;
+    uint64_t lte_bands = 0;
+    err = esp_modem_at(_dce, "AT+CNMP?", line, MODEM_AT_TIMEOUT_MS);
+    if ((err == ESP_OK) && (bsp_modem_parse_cnmp(line, &out->rat) == false)) {
+        err = ESP_ERR_INVALID_RESPONSE;
+    }
+
+    line[0] = '\0';
+    if (err == ESP_OK) {
+        err = esp_modem_at(_dce, "AT+CNBP?", line, MODEM_AT_TIMEOUT_MS);
+    }
+    if ((err == ESP_OK) && (bsp_modem_parse_cnbp(line, &gw_bands, &lte_bands) == false)) {
+        err = ESP_ERR_INVALID_RESPONSE;
+    }
+    uint64_t default_bands = atomic_load(&_lte_bands_default);
+    out->lte_bands = ((default_bands != 0) && (lte_bands == default_bands)) ? 0 : lte_bands;
+
+    _give_command_channel();
+    return err;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* The modem reselects right away and keeps the lock across power cycles, PPP usually drops and is redialed */
+esp_err_t bsp_modem_set_rat_lock(const bsp_modem_rat_lock_t *lock) {
+    esp_err_t err = _take_command_channel();
+    if (err != ESP_OK) {
+        return err;
     }
-    ESP_LOGI(TAG, "IMSI=%s", imsi);
+
+    char line[CONFIG_ESP_MODEM_C_API_STR_MAX] = { 0 };
+    char command[64] = { 0 };
+    uint64_t gw_bands = 0;
+    uint64_t lte_bands = 0;
+
+    // GSM and WCDMA bands share the command, keep whatever the modem uses
+    err = esp_modem_at(_dce, "AT+CNBP?", line, MODEM_AT_TIMEOUT_MS);
+    if ((err == ESP_OK) && (bsp_modem_parse_cnbp(line, &gw_bands, &lte_bands) == false)) {
+        err = ESP_ERR_INVALID_RESPONSE;
+    }
+
+    uint64_t wanted_bands = lock->lte_bands;
+    if (wanted_bands == 0) {
+        wanted_bands = atomic_load(&_lte_bands_default);
+        wanted_bands = (wanted_bands != 0) ? wanted_bands : MODEM_LTE_BANDS_FALLBACK;
+    }
+    if ((err == ESP_OK) && (lte_bands != wanted_bands)) {
+        snprintf(command, sizeof(command), "AT+CNBP=0x%016" PRIX64 ",0x%016" PRIX64, gw_bands, wanted_bands);
+        line[0] = '\0';
+        err = esp_modem_at(_dce, command, line, MODEM_AT_TIMEOUT_MS);
+    }
+
+    if (err == ESP_OK) {
+        snprintf(command, sizeof(command), "AT+CNMP=%d", (int)lock->rat);
+        line[0] = '\0';
+        err = esp_modem_at(_dce, command, line, MODEM_AT_TIMEOUT_MS);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to lock the radio to mode %d with %s", (int)lock->rat, esp_err_to_name(err));
+    }
+
+    _give_command_channel();
+    return err;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* The band mask the modem used before any lock was applied, the model and firmware decide which bands it has. The
+ * modem keeps a lock across power cycles, so only the application can remember this across reboots. */
+void bsp_modem_set_default_lte_bands(uint64_t lte_bands) {
+    atomic_store(&_lte_bands_default, lte_bands);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* DTR high lets the modem drop to slow clock whenever its UART is idle, the PPP session stays up */
+esp_err_t bsp_modem_sleep(void) {
+    if (_p_dce_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (xSemaphoreTake(_p_dce_lock, 0) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    esp_err_t err = ESP_ERR_INVALID_STATE;
+    if ((_dce != NULL) && (_is_data_mode == true)) {
+        gpio_set_level(BSP_PIN_MODEM_DTR, 1);
+        atomic_store(&_is_sleeping, true);
+#if CONFIG_PM_ENABLE
+        /* The UART itself cannot wake the chip on these pins, a start bit on RX does. The bytes that arrive before the
+         * clock is back are lost, PPP drops the frame on its FCS and the sender retransmits. */
+        gpio_wakeup_enable(BSP_PIN_MODEM_UART_RXD, GPIO_INTR_LOW_LEVEL);
+        esp_pm_lock_release(_p_uart_lock);
 #endif
+        err = ESP_OK;
+    }
+
+    xSemaphoreGive(_p_dce_lock);
+    return err;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void bsp_modem_wake(void) {
+    if ((_p_dce_lock == NULL) || (atomic_load(&_is_sleeping) == false)) {
+        return;
+    }
+
+    xSemaphoreTake(_p_dce_lock, portMAX_DELAY);
+    _dtr_wake();
+    xSemaphoreGive(_p_dce_lock);
+}
 
-    esp_modem_destroy(_dce);
-    esp_netif_destroy(_esp_modem_netif);
+/* -------------------------------------------------------------------------- */
+
+bool bsp_modem_is_sleeping(void) {
+    return atomic_load(&_is_sleeping);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* The callback runs in interrupt context on every falling edge of RING */
+esp_err_t bsp_modem_set_ring_callback(bsp_modem_ring_cb_t cb) {
+    const gpio_config_t RING_CFG = {
+        .pin_bit_mask = 1ULL << BSP_PIN_MODEM_RING,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = GPIO_INTR_NEGEDGE,
+    };
+    esp_err_t err = gpio_config(&RING_CFG);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    err = gpio_install_isr_service(0);
+    if ((err != ESP_OK) && (err != ESP_ERR_INVALID_STATE)) {
+        return err;
+    }
+    _p_ring_cb = cb;
+    return gpio_isr_handler_add(BSP_PIN_MODEM_RING, _on_ring_isr, NULL);
 }
 
 /* -------------------------------------------------------------------------- */
 
 void bsp_modem_power_up_por(void) {
     _gpio_init();
+    _modem_baud = MODEM_DEFAULT_BAUD;
+    _baud_ceiling = CONFIG_GATEWAY_MODEM_MAX_BAUD;
 
     bool is_modem_on = gpio_get_level(BSP_PIN_MODEM_STATUS) == 1;
     if (is_modem_on == true) {
         ESP_LOGW(TAG, "Turning off modem...");
         _power_on_button_press(false);
 
-        while (gpio_get_level(BSP_PIN_MODEM_STATUS) == 1) {
-            vTaskDelay(pdMS_TO_TICKS(100));
+        if (_wait_for_status_level(0, CONFIG_GATEWAY_MODEM_STATUS_TIMEOUT_MS) == false) {
+            ESP_LOGW(TAG, "Modem STATUS is still high after power off");
         }
-        vTaskDelay(pdMS_TO_TICKS(100));
     }
 
     ESP_LOGI(TAG, "Turning on modem...");
     _power_on_button_press(true);
 
-    while (gpio_get_level(BSP_PIN_MODEM_STATUS) == 0) {
-        vTaskDelay(pdMS_TO_TICKS(1000));
+    if (_wait_for_status_level(1, CONFIG_GATEWAY_MODEM_STATUS_TIMEOUT_MS) == false) {
+        ESP_LOGW(TAG, "Modem STATUS is still low after power on");
     }
 
-    vTaskDelay(pdMS_TO_TICKS(17000));
-    ESP_LOGI(TAG, "Modem is powered up and ready");
+    // AT readiness is probed by bsp_modem_setup() instead of waiting for a fixed boot time
+    ESP_LOGI(TAG, "Modem is powered up");
 }
 
 /* -------------------------------------------------------------------------- */
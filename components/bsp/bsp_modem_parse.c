@@ -0,0 +1,153 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_modem_api.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+
+#include "bsp_modem.h"
+
+/* -------------------------------------------------------------------------- */
+
+// Responses of the SIM7600 AT commands, one line each as esp_modem_at() returns it
+
+static void _copy_field(char *dst, size_t dst_size, const char *src, size_t len) {
+    if (len >= dst_size) {
+        len = dst_size - 1;
+    }
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+/* -------------------------------------------------------------------------- */
+
+static const char *_skip_prefix(const char *line, const char *prefix) {
+    const char *p = strstr(line, prefix);
+    if (p == NULL) {
+        return NULL;
+    }
+    p += strlen(prefix);
+    while (*p == ' ') {
+        p++;
+    }
+    return p;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool bsp_modem_parse_cpsi(const char *line, bsp_modem_telemetry_t *out) {
+    // +CPSI: LTE,Online,250-01,0x1A2B,12345678,301,EUTRAN-BAND3,1300,5,5,-95,-1100,-780,12
+    const char *p = _skip_prefix(line, "+CPSI:");
+    if (p == NULL) {
+        return false;
+    }
+
+    out->rsrp_dbm_x10 = 0;
+    out->rsrq_db_x10 = 0;
+    out->operator_code[0] = '\0';
+    out->cell_id[0] = '\0';
+    out->band[0] = '\0';
+
+    int field = 0;
+    while (*p != '\0') {
+        const char *end = strchr(p, ',');
+        size_t len = (end != NULL) ? (size_t)(end - p) : strlen(p);
+
+        switch (field) {
+            case 0:
+                _copy_field(out->rat, sizeof(out->rat), p, len);
+                break;
+            case 2:
+                _copy_field(out->operator_code, sizeof(out->operator_code), p, len);
+                break;
+            case 4:
+                _copy_field(out->cell_id, sizeof(out->cell_id), p, len);
+                break;
+            case 5:
+                if (strncmp(out->rat, "WCDMA", 5) == 0) {
+                    _copy_field(out->band, sizeof(out->band), p, len);
+                }
+                break;
+            case 6:
+                if (strncmp(out->rat, "LTE", 3) == 0) {
+                    _copy_field(out->band, sizeof(out->band), p, len);
+                }
+                break;
+            case 10:
+                if (strncmp(out->rat, "LTE", 3) == 0) {
+                    out->rsrq_db_x10 = (int)strtol(p, NULL, 10);
+                }
+                break;
+            case 11:
+                if (strncmp(out->rat, "LTE", 3) == 0) {
+                    out->rsrp_dbm_x10 = (int)strtol(p, NULL, 10);
+                }
+                break;
+            default:
+                break;
+        }
+
+        if (end == NULL) {
+            break;
+        }
+        p = end + 1;
+        field++;
+    }
+    return field >= 4;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool bsp_modem_parse_cnmp(const char *line, bsp_modem_rat_e *out) {
+    // +CNMP: 38
+    const char *p = _skip_prefix(line, "+CNMP:");
+    if (p == NULL) {
+        return false;
+    }
+    char *end = NULL;
+    long mode = strtol(p, &end, 10);
+    if (end == p) {
+        return false;
+    }
+    *out = (bsp_modem_rat_e)mode;
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool bsp_modem_parse_cnbp(const char *line, uint64_t *gw_bands, uint64_t *lte_bands) {
+    // +CNBP: 0x0002000004400380,0x000007FF3FDF3FFF,0x000000000000003F
+    const char *p = _skip_prefix(line, "+CNBP:");
+    if (p == NULL) {
+        return false;
+    }
+    char *end = NULL;
+    *gw_bands = strtoull(p, &end, 16);
+    if ((end == p) || (*end != ',')) {
+        return false;
+    }
+    p = end + 1;
+    *lte_bands = strtoull(p, &end, 16);
+    return end != p;
+}
+
+/* -------------------------------------------------------------------------- */
+
+bool bsp_modem_parse_cpmutemp(const char *line, int *out) {
+    // +CPMUTEMP: 35
+    const char *p = _skip_prefix(line, "+CPMUTEMP:");
+    if (p == NULL) {
+        return false;
+    }
+    char *end = NULL;
+    long celsius = strtol(p, &end, 10);
+    if (end == p) {
+        return false;
+    }
+    *out = (int)celsius;
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
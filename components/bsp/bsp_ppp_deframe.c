@@ -0,0 +1,208 @@
+#include "bsp_ppp_deframe.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* -------------------------------------------------------------------------- */
+
+// HDLC-like framing of RFC 1662, bytes in and whole frames out. Buffers and the tcpip thread stay in bsp_ppp_rx.c.
+
+#define DEFRAME_FLAG        (0x7E)
+#define DEFRAME_ESCAPE      (0x7D)
+#define DEFRAME_TRANS       (0x20)
+#define DEFRAME_ALLSTATIONS (0xFF)
+#define DEFRAME_UI          (0x03)
+#define DEFRAME_FCS_INIT    (0xFFFF)
+#define DEFRAME_FCS_GOOD    (0xF0B8)
+#define DEFRAME_FCS_POLY    (0x8408)
+
+#define ESCAPE_P(accm, c) ((accm)[(c) >> 3] & (1 << ((c) & 0x07)))
+
+typedef enum {
+    DEFRAME_STATE_IDLE = 0,
+    DEFRAME_STATE_ADDRESS,
+    DEFRAME_STATE_CONTROL,
+    DEFRAME_STATE_PROTOCOL_1,
+    DEFRAME_STATE_PROTOCOL_2,
+    DEFRAME_STATE_DATA,
+} _state_e;
+
+static uint16_t _fcs_table[256];
+
+/* -------------------------------------------------------------------------- */
+
+static void _drop_frame(bsp_ppp_deframer_t *deframer) {
+    if (deframer->buffer != NULL) {
+        deframer->ops->release(deframer->ctx, deframer->buffer);
+        deframer->buffer = NULL;
+    }
+    deframer->state = DEFRAME_STATE_IDLE;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _end_frame(bsp_ppp_deframer_t *deframer) {
+    if (deframer->state == DEFRAME_STATE_DATA) {
+        if (deframer->fcs != DEFRAME_FCS_GOOD) {
+            deframer->stats.fcs_errors++;
+        } else if (deframer->len > BSP_PPP_DEFRAME_PROTOCOL_SIZE + BSP_PPP_DEFRAME_FCS_SIZE) {
+            uint16_t frame_len = deframer->len - BSP_PPP_DEFRAME_FCS_SIZE;
+            uint8_t *frame = deframer->buffer;
+            deframer->buffer = NULL;
+            deframer->stats.frames++;
+            deframer->stats.bytes += frame_len;
+            deframer->ops->deliver(deframer->ctx, frame, frame_len);
+        }
+    }
+
+    // A flag both closes the current frame and opens the next one
+    if (deframer->buffer == NULL) {
+        deframer->buffer = deframer->ops->take(deframer->ctx);
+        if (deframer->buffer == NULL) {
+            deframer->stats.no_buffer_drops++;
+        }
+    }
+    deframer->state = (deframer->buffer != NULL) ? DEFRAME_STATE_ADDRESS : DEFRAME_STATE_IDLE;
+    deframer->is_escaped = false;
+    deframer->len = 0;
+    deframer->fcs = DEFRAME_FCS_INIT;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _put_byte(bsp_ppp_deframer_t *deframer, uint8_t c) {
+    if (deframer->len >= deframer->frame_max) {
+        deframer->stats.oversize_drops++;
+        _drop_frame(deframer);
+        return;
+    }
+    deframer->buffer[deframer->len++] = c;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _deframe_byte(bsp_ppp_deframer_t *deframer, const uint8_t *accm, uint8_t c) {
+    if (c == DEFRAME_FLAG) {
+        _end_frame(deframer);
+        return;
+    }
+
+    if (deframer->state == DEFRAME_STATE_IDLE) {
+        return;
+    }
+
+    if ((c < DEFRAME_TRANS) && ESCAPE_P(accm, c)) {
+        // Control characters the peer must escape are line noise when they arrive raw
+        return;
+    }
+    if (c == DEFRAME_ESCAPE) {
+        deframer->is_escaped = true;
+        return;
+    }
+    if (deframer->is_escaped == true) {
+        deframer->is_escaped = false;
+        c ^= DEFRAME_TRANS;
+    }
+
+    deframer->fcs = (deframer->fcs >> 8) ^ _fcs_table[(deframer->fcs ^ c) & 0xFF];
+
+    // Address and control may be compressed away (ACFC), the protocol may be a single odd byte (PFC)
+    switch (deframer->state) {
+        case DEFRAME_STATE_ADDRESS:
+            if (c == DEFRAME_ALLSTATIONS) {
+                deframer->state = DEFRAME_STATE_CONTROL;
+                return;
+            }
+            /* fall through */
+        case DEFRAME_STATE_CONTROL:
+            if ((deframer->state == DEFRAME_STATE_CONTROL) && (c == DEFRAME_UI)) {
+                deframer->state = DEFRAME_STATE_PROTOCOL_1;
+                return;
+            }
+            /* fall through */
+        case DEFRAME_STATE_PROTOCOL_1:
+            if (c & 1) {
+                _put_byte(deframer, 0);
+                _put_byte(deframer, c);
+                deframer->state = DEFRAME_STATE_DATA;
+            } else {
+                _put_byte(deframer, c);
+                deframer->state = DEFRAME_STATE_PROTOCOL_2;
+            }
+            return;
+        case DEFRAME_STATE_PROTOCOL_2:
+            _put_byte(deframer, c);
+            deframer->state = DEFRAME_STATE_DATA;
+            return;
+        case DEFRAME_STATE_DATA:
+        default:
+            _put_byte(deframer, c);
+            return;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+void bsp_ppp_deframe_init(bsp_ppp_deframer_t *deframer,
+                          const bsp_ppp_deframe_ops_t *ops,
+                          void *ctx,
+                          uint16_t frame_max) {
+    if (_fcs_table[1] == 0) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint16_t fcs = (uint16_t)i;
+            for (int bit = 0; bit < 8; bit++) {
+                fcs = (fcs & 1) ? (uint16_t)((fcs >> 1) ^ DEFRAME_FCS_POLY) : (uint16_t)(fcs >> 1);
+            }
+            _fcs_table[i] = fcs;
+        }
+    }
+
+    *deframer = (bsp_ppp_deframer_t){
+        .ops = ops,
+        .ctx = ctx,
+        .frame_max = frame_max,
+        .state = DEFRAME_STATE_IDLE,
+    };
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Gives back the buffer of a frame in progress, the next flag starts over */
+void bsp_ppp_deframe_reset(bsp_ppp_deframer_t *deframer) {
+    _drop_frame(deframer);
+    deframer->is_escaped = false;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* accm is the 32 byte receive ACCM of the PPP session. Plain payload bytes, nearly all of the line, take a loop that
+ * keeps the frame state in registers, everything else goes through the state machine one byte at a time. */
+void bsp_ppp_deframe(bsp_ppp_deframer_t *deframer, const uint8_t *accm, const uint8_t *data, size_t len) {
+    size_t i = 0;
+    while (i < len) {
+        if ((deframer->state == DEFRAME_STATE_DATA) && (deframer->is_escaped == false)) {
+            uint8_t *buffer = deframer->buffer;
+            uint16_t frame_len = deframer->len;
+            uint16_t fcs = deframer->fcs;
+            const uint16_t frame_max = deframer->frame_max;
+            for (; i < len; i++) {
+                uint8_t c = data[i];
+                if ((c == DEFRAME_FLAG) || (c == DEFRAME_ESCAPE) || ((c < DEFRAME_TRANS) && ESCAPE_P(accm, c)) ||
+                    (frame_len >= frame_max)) {
+                    break;
+                }
+                fcs = (fcs >> 8) ^ _fcs_table[(fcs ^ c) & 0xFF];
+                buffer[frame_len++] = c;
+            }
+            deframer->len = frame_len;
+            deframer->fcs = fcs;
+            if (i == len) {
+                break;
+            }
+        }
+        _deframe_byte(deframer, accm, data[i++]);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
@@ -0,0 +1,212 @@
+#include "bsp_ppp_rx.h"
+#include "bsp_mem.h"
+#include "bsp_ppp_deframe.h"
+#include "bsp_trace.h"
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "lwip/esp_netif_net_stack.h"
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcpip.h"
+#include "netif/ppp/ppp_impl.h"
+#include "netif/ppp/pppos.h"
+#include "sdkconfig.h"
+#include <stdatomic.h>
+#include <stddef.h>
+#include <string.h>
+
+/* -------------------------------------------------------------------------- */
+
+#if !LWIP_SUPPORT_CUSTOM_PBUF
+#error "Direct PPP RX needs custom pbuf support in lwIP"
+#endif
+
+static const char *TAG = "bsp_ppp_rx.c";
+
+// Same headroom pppos_input() reserves so forwarded frames get their Ethernet header without a copy
+#define PPP_RX_HEADROOM  (PBUF_LINK_ENCAPSULATION_HLEN + PBUF_LINK_HLEN)
+#define PPP_RX_FRAME_MAX (BSP_PPP_DEFRAME_PROTOCOL_SIZE + PPP_MRU + BSP_PPP_DEFRAME_FCS_SIZE)
+
+typedef struct ppp_rx_slot {
+    struct pbuf_custom custom;
+    struct ppp_rx_slot *next_free;
+    uint8_t buffer[PPP_RX_HEADROOM + PPP_RX_FRAME_MAX];
+} ppp_rx_slot_t;
+
+static struct netif *_p_netif;
+static esp_netif_netstack_config_t _netstack;
+
+static ppp_rx_slot_t *_p_slots;
+static ppp_rx_slot_t *_p_free_slots;
+static uint32_t _free_slot_count;
+static portMUX_TYPE _pool_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Only touched from the modem DTE receive task
+static bsp_ppp_deframer_t _deframer;
+static atomic_uint_fast32_t _queue_full_drops;
+
+/* -------------------------------------------------------------------------- */
+
+static void _slot_release(ppp_rx_slot_t *slot) {
+    portENTER_CRITICAL(&_pool_lock);
+    slot->next_free = _p_free_slots;
+    _p_free_slots = slot;
+    _free_slot_count++;
+    portEXIT_CRITICAL(&_pool_lock);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static ppp_rx_slot_t *_slot_take(void) {
+    portENTER_CRITICAL(&_pool_lock);
+    ppp_rx_slot_t *slot = _p_free_slots;
+    if (slot != NULL) {
+        _p_free_slots = slot->next_free;
+        _free_slot_count--;
+    }
+    portEXIT_CRITICAL(&_pool_lock);
+    return slot;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _on_pbuf_free(struct pbuf *p) {
+    _slot_release((ppp_rx_slot_t *)p);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _pool_init(void) {
+    // Written byte by byte from the UART task and read by lwIP for every frame
+    _p_slots =
+        bsp_mem_calloc(BSP_MEM_PPP_RX, BSP_MEM_HOT, CONFIG_GATEWAY_MODEM_PPP_RX_POOL_SIZE, sizeof(ppp_rx_slot_t));
+    assert(_p_slots);
+    for (int i = 0; i < CONFIG_GATEWAY_MODEM_PPP_RX_POOL_SIZE; i++) {
+        _p_slots[i].custom.custom_free_function = _on_pbuf_free;
+        _slot_release(&_p_slots[i]);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static err_t _input_frame(struct pbuf *p, struct netif *inp) {
+    ppp_pcb *pcb = (ppp_pcb *)inp->state;
+    pppos_pcb *pppos = (pppos_pcb *)pcb->link_ctx_cb;
+    if (pppos->open == 0) {
+        pbuf_free(p);
+        return ERR_OK;
+    }
+    ppp_input(pcb, p);
+    return ERR_OK;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static ppp_rx_slot_t *_slot_of(uint8_t *frame) {
+    return (ppp_rx_slot_t *)(frame - PPP_RX_HEADROOM - offsetof(ppp_rx_slot_t, buffer));
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint8_t *_take_frame_buffer(void *ctx) {
+    ppp_rx_slot_t *slot = _slot_take();
+    return (slot != NULL) ? &slot->buffer[PPP_RX_HEADROOM] : NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _release_frame_buffer(void *ctx, uint8_t *buffer) {
+    _slot_release(_slot_of(buffer));
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* The slot becomes the pbuf, lwIP gives it back to the pool through _on_pbuf_free() */
+static void _deliver_frame(void *ctx, uint8_t *frame, uint16_t len) {
+    ppp_rx_slot_t *slot = _slot_of(frame);
+    struct pbuf *p = pbuf_alloced_custom(PBUF_RAW,
+                                         PPP_RX_HEADROOM + len,
+                                         PBUF_POOL,
+                                         &slot->custom,
+                                         slot->buffer,
+                                         sizeof(slot->buffer));
+    pbuf_remove_header(p, PPP_RX_HEADROOM);
+#if CONFIG_GATEWAY_PACKET_TRACE
+    if ((frame[0] == (PPP_IP >> 8)) && (frame[1] == (PPP_IP & 0xFF))) {
+        BSP_TRACE(BSP_TRACE_PPP_RX, &frame[BSP_PPP_DEFRAME_PROTOCOL_SIZE], len - BSP_PPP_DEFRAME_PROTOCOL_SIZE);
+    }
+#endif
+    if (tcpip_inpkt(p, _p_netif, _input_frame) != ERR_OK) {
+        atomic_fetch_add(&_queue_full_drops, 1);
+        pbuf_free(p);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static const bsp_ppp_deframe_ops_t _deframe_ops = {
+    .take = _take_frame_buffer,
+    .deliver = _deliver_frame,
+    .release = _release_frame_buffer,
+};
+
+/* -------------------------------------------------------------------------- */
+
+/* Called from the esp_modem DTE task in place of esp_netif_lwip_ppp_input(), the ring buffer bytes are deframed
+ * straight into the pbuf that lwIP will route, no intermediate pbuf and no per-frame allocation */
+static esp_netif_recv_ret_t _on_ppp_rx(void *ppp_ctx, void *buffer, size_t len, void *eb) {
+    (void)ppp_ctx;
+    (void)eb;
+
+    struct netif *netif = _p_netif;
+    if (netif == NULL) {
+        return ESP_NETIF_OPTIONAL_RETURN_CODE(ESP_OK);
+    }
+    const pppos_pcb *pppos = (const pppos_pcb *)((ppp_pcb *)netif->state)->link_ctx_cb;
+    bsp_ppp_deframe(&_deframer, pppos->in_accm, buffer, len);
+    // Same return type as esp_netif_lwip_ppp_input(), void unless CONFIG_ESP_NETIF_RECEIVE_REPORT_ERRORS
+    return ESP_NETIF_OPTIONAL_RETURN_CODE(ESP_OK);
+}
+
+/* -------------------------------------------------------------------------- */
+
+const esp_netif_netstack_config_t *bsp_ppp_rx_netstack(void) {
+    if (_p_slots == NULL) {
+        _pool_init();
+        bsp_ppp_deframe_init(&_deframer, &_deframe_ops, NULL, PPP_RX_FRAME_MAX);
+        _netstack = *ESP_NETIF_NETSTACK_DEFAULT_PPP;
+        _netstack.lwip_ppp.input_fn = _on_ppp_rx;
+        ESP_LOGI(TAG,
+                 "Direct PPP RX: %d slots of %d bytes",
+                 CONFIG_GATEWAY_MODEM_PPP_RX_POOL_SIZE,
+                 (int)sizeof(ppp_rx_slot_t));
+    }
+    return &_netstack;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Only called while the DTE is not running, so the deframer state can be reset without locking */
+void bsp_ppp_rx_attach(esp_netif_t *ppp_netif) {
+    bsp_ppp_deframe_reset(&_deframer);
+    _p_netif = (ppp_netif != NULL) ? esp_netif_get_netif_impl(ppp_netif) : NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void bsp_ppp_rx_get_stats(bsp_ppp_rx_stats_t *out) {
+    // Counters of the DTE task, a torn read only skews one status line
+    out->frames = _deframer.stats.frames;
+    out->bytes = _deframer.stats.bytes;
+    out->fcs_errors = _deframer.stats.fcs_errors;
+    out->pool_empty_drops = _deframer.stats.no_buffer_drops;
+    out->oversize_drops = _deframer.stats.oversize_drops;
+    out->queue_full_drops = atomic_load(&_queue_full_drops);
+
+    portENTER_CRITICAL(&_pool_lock);
+    out->pool_free = _free_slot_count;
+    portEXIT_CRITICAL(&_pool_lock);
+}
+
+/* -------------------------------------------------------------------------- */
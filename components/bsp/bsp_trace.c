@@ -0,0 +1,157 @@
+#include "bsp_trace.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+
+#if !CONFIG_FREERTOS_UNICORE
+#include "esp_ipc.h"
+#endif
+
+#if CONFIG_GATEWAY_PACKET_TRACE
+
+/* -------------------------------------------------------------------------- */
+
+static const char *TAG = "bsp_trace.c";
+
+#define TRACE_RECORDS    (CONFIG_GATEWAY_PACKET_TRACE_RECORDS)
+#define TRACE_FORMAT_VER (1)
+#define TRACE_KEY_BYTES  (6)
+
+typedef struct {
+    uint32_t cycles;
+    uint32_t key;
+    // Written last, zero while the slot is being filled
+    atomic_uint_fast32_t stage;
+} _trace_record_t;
+
+typedef struct {
+    uint32_t cycles;
+    int64_t us;
+} _trace_clock_t;
+
+// One ring per core so the cores never share a cache line or a head index in the hot path
+static _trace_record_t _rings[portNUM_PROCESSORS][TRACE_RECORDS];
+static atomic_uint_fast32_t _heads[portNUM_PROCESSORS];
+// Owned by the dumping task
+static uint32_t _tails[portNUM_PROCESSORS];
+static uint32_t _lost[portNUM_PROCESSORS];
+
+#if CONFIG_PM_ENABLE
+static esp_pm_lock_handle_t _p_clock_lock;
+#endif
+
+/* -------------------------------------------------------------------------- */
+
+/* The ID and total length survive NAPT and MSS clamping, which makes them a key that follows a packet */
+uint32_t bsp_trace_key(const void *ip_header, size_t len) {
+    const uint8_t *ip = ip_header;
+    if (len < TRACE_KEY_BYTES) {
+        return 0;
+    }
+    return ((uint32_t)ip[4] << 24) | ((uint32_t)ip[5] << 16) | ((uint32_t)ip[2] << 8) | ip[3];
+}
+
+/* -------------------------------------------------------------------------- */
+
+void bsp_trace_record(bsp_trace_stage_e stage, uint32_t key) {
+    // Cycle counters are per core, a task migrating between the two reads takes its stamp again
+    int core = 0;
+    uint32_t cycles = 0;
+    do {
+        core = esp_cpu_get_core_id();
+        cycles = esp_cpu_get_cycle_count();
+    } while (core != esp_cpu_get_core_id());
+
+    uint32_t index = atomic_fetch_add_explicit(&_heads[core], 1, memory_order_relaxed) % TRACE_RECORDS;
+    _trace_record_t *record = &_rings[core][index];
+    atomic_store_explicit(&record->stage, 0, memory_order_relaxed);
+    record->cycles = cycles;
+    record->key = key;
+    atomic_store_explicit(&record->stage, stage, memory_order_release);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _sample_clock(void *arg) {
+    _trace_clock_t *clock = arg;
+    clock->us = esp_timer_get_time();
+    clock->cycles = esp_cpu_get_cycle_count();
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Text export, one header, one clock line per core to align their counters, then the new records */
+void bsp_trace_dump(void) {
+    uint32_t mhz = esp_rom_get_cpu_ticks_per_us();
+    printf("#trace,%d,%" PRIu32 ",%d\n", TRACE_FORMAT_VER, mhz, portNUM_PROCESSORS);
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        _trace_clock_t clock = { 0 };
+#if CONFIG_FREERTOS_UNICORE
+        _sample_clock(&clock);
+#else
+        esp_ipc_call_blocking(core, _sample_clock, &clock);
+#endif
+        printf("#clock,%d,%" PRIu32 ",%" PRId64 "\n", core, clock.cycles, clock.us);
+    }
+
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        uint32_t head = atomic_load_explicit(&_heads[core], memory_order_acquire);
+        if (head - _tails[core] > TRACE_RECORDS) {
+            _lost[core] += head - _tails[core] - TRACE_RECORDS;
+            _tails[core] = head - TRACE_RECORDS;
+        }
+        for (; _tails[core] != head; _tails[core]++) {
+            const _trace_record_t *record = &_rings[core][_tails[core] % TRACE_RECORDS];
+            uint32_t stage = atomic_load_explicit(&record->stage, memory_order_acquire);
+            if (stage != 0) {
+                printf("T,%d,%" PRIu32 ",%08" PRIx32 ",%" PRIu32 "\n", core, stage, record->key, record->cycles);
+            }
+        }
+        printf("#lost,%d,%" PRIu32 "\n", core, _lost[core]);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+void bsp_trace_init(void) {
+#if CONFIG_PM_ENABLE
+    // Cycle stamps convert to time only at a fixed clock, DFS stays at the top while tracing
+    if ((esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "trace", &_p_clock_lock) != ESP_OK) ||
+        (esp_pm_lock_acquire(_p_clock_lock) != ESP_OK)) {
+        ESP_LOGE(TAG, "Failed to pin the CPU clock, trace latencies are off whenever DFS scales");
+    }
+#endif
+    ESP_LOGW(TAG, "Packet tracing is on, %d records per core", TRACE_RECORDS);
+}
+
+/* -------------------------------------------------------------------------- */
+
+#else  // CONFIG_GATEWAY_PACKET_TRACE
+
+void bsp_trace_init(void) {
+}
+
+uint32_t bsp_trace_key(const void *ip_header, size_t len) {
+    (void)ip_header;
+    (void)len;
+    return 0;
+}
+
+void bsp_trace_record(bsp_trace_stage_e stage, uint32_t key) {
+    (void)stage;
+    (void)key;
+}
+
+void bsp_trace_dump(void) {
+}
+
+#endif  // CONFIG_GATEWAY_PACKET_TRACE
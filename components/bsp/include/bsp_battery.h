@@ -7,7 +7,16 @@ extern "C" {
 #include <stddef.h>
 #include <stdint.h>
 
+typedef struct {
+    uint32_t battery_mv;
+    uint32_t solar_mv;
+    uint32_t capacity_percent;
+    uint32_t samples;
+    uint32_t updated_ms;
+} bsp_battery_snapshot_t;
+
 void bsp_battery_init(void);
+void bsp_battery_get_snapshot(bsp_battery_snapshot_t *out);
 uint32_t bsp_battery_read_voltage_mv(void);
 uint32_t bsp_solar_battery_read_voltage_mv(void);
 size_t bsp_battery_get_capacity(void);
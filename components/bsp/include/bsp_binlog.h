@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BSP_BINLOG_ARGS_MAX (8)
+
+// Numbering is part of the flash format, tools/binlog_decode.py has the same table
+typedef enum {
+    BSP_BINLOG_ERROR = 1,
+    BSP_BINLOG_WARN,
+    BSP_BINLOG_INFO,
+} bsp_binlog_level_e;
+
+typedef struct {
+    uint32_t boot;
+    uint32_t written;
+    uint32_t lost;
+    uint32_t recovered;
+    uint32_t sectors;
+    uint32_t write_errors;
+} bsp_binlog_stats_t;
+
+void bsp_binlog_init(BaseType_t core);
+// False while the log is not running, without its partition for one, the record is then left to the caller
+bool bsp_binlog_write(bsp_binlog_level_e level, uint32_t arg_count, const char *tag, const char *format, ...)
+    __attribute__((format(printf, 4, 5)));
+void bsp_binlog_get_stats(bsp_binlog_stats_t *out);
+void bsp_binlog_log(void);
+
+// Counts up to BSP_BINLOG_ARGS_MAX arguments, more push the count past the limit and fail the static assert
+#define _BSP_BINLOG_COUNT(...) _BSP_BINLOG_COUNT_(_, ##__VA_ARGS__, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define _BSP_BINLOG_COUNT_(_0, _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, count, ...) count
+
+#if CONFIG_GATEWAY_BINLOG
+/* Only the format and tag addresses and the raw 32-bit arguments are stored, %s must point at a string literal. When
+ * the log is not running the record goes to the console as text instead. */
+#define _BSP_BINLOG(level, text_log, tag, format, ...)                                                            \
+    do {                                                                                                          \
+        _Static_assert(_BSP_BINLOG_COUNT(__VA_ARGS__) <= BSP_BINLOG_ARGS_MAX, "Too many binary log arguments");   \
+        if (bsp_binlog_write((level), _BSP_BINLOG_COUNT(__VA_ARGS__), (tag), (format), ##__VA_ARGS__) == false) { \
+            text_log(tag, format, ##__VA_ARGS__);                                                                 \
+        }                                                                                                         \
+    } while (0)
+#define BSP_BINLOGE(tag, format, ...) _BSP_BINLOG(BSP_BINLOG_ERROR, ESP_LOGE, tag, format, ##__VA_ARGS__)
+#define BSP_BINLOGW(tag, format, ...) _BSP_BINLOG(BSP_BINLOG_WARN, ESP_LOGW, tag, format, ##__VA_ARGS__)
+#define BSP_BINLOGI(tag, format, ...) _BSP_BINLOG(BSP_BINLOG_INFO, ESP_LOGI, tag, format, ##__VA_ARGS__)
+#else
+#define BSP_BINLOGE(tag, format, ...) ESP_LOGE(tag, format, ##__VA_ARGS__)
+#define BSP_BINLOGW(tag, format, ...) ESP_LOGW(tag, format, ##__VA_ARGS__)
+#define BSP_BINLOGI(tag, format, ...) ESP_LOGI(tag, format, ##__VA_ARGS__)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
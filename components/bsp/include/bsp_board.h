@@ -19,6 +19,7 @@
 #define BSP_PIN_ADC_BAT        35
 #define BSP_PIN_ADC_SOLAR      36
 
+// Not routed on the LilyGo board, set both to GPIOs to enable RTS/CTS flow control
 #define BSP_PIN_MODEM_UART_RTS -1
 #define BSP_PIN_MODEM_UART_CTS -1
 
@@ -0,0 +1,47 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    BSP_MEM_WIFI = 0,
+    BSP_MEM_MODEM,
+    BSP_MEM_PPP_RX,
+    BSP_MEM_NAPT,
+    BSP_MEM_DNS,
+    BSP_MEM_OWNER_MAX,
+} bsp_mem_owner_e;
+
+typedef enum {
+    // Internal RAM only: DMA, ISR and per-packet data
+    BSP_MEM_HOT = 0,
+    // PSRAM first, internal RAM as fallback: large and latency tolerant data
+    BSP_MEM_BULK,
+} bsp_mem_placement_e;
+
+typedef struct {
+    uint32_t internal_bytes;
+    uint32_t psram_bytes;
+} bsp_mem_usage_t;
+
+typedef struct {
+    uint32_t internal_free;
+    uint32_t psram_free;
+    uint32_t tracked_internal;
+    uint32_t tracked_psram;
+} bsp_mem_mark_t;
+
+void *bsp_mem_calloc(bsp_mem_owner_e owner, bsp_mem_placement_e placement, size_t count, size_t size);
+void bsp_mem_mark(bsp_mem_mark_t *mark);
+void bsp_mem_charge_since(bsp_mem_owner_e owner, const bsp_mem_mark_t *mark);
+void bsp_mem_get_usage(bsp_mem_owner_e owner, bsp_mem_usage_t *out);
+const char *bsp_mem_owner_name(bsp_mem_owner_e owner);
+void bsp_mem_log(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
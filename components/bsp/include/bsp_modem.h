@@ -4,14 +4,71 @@
 extern "C" {
 #endif
 
+typedef struct {
+    int rssi;
+    int ber;
+    char rat[16];
+    char operator_code[16];
+    char cell_id[16];
+    char band[24];
+    int rsrp_dbm_x10;
+    int rsrq_db_x10;
+    int temperature_c;
+} bsp_modem_telemetry_t;
+
+typedef struct {
+    uint32_t baud;
+    esp_modem_flow_ctrl_t flow_control;
+    uint32_t buffer_overflows;
+    uint32_t terminal_errors;
+    uint32_t baud_fallbacks;
+} bsp_modem_link_stats_t;
+
+// AT+CNMP preferred mode
+typedef enum {
+    BSP_MODEM_RAT_AUTO = 2,
+    BSP_MODEM_RAT_GSM = 13,
+    BSP_MODEM_RAT_WCDMA = 14,
+    BSP_MODEM_RAT_LTE = 38,
+} bsp_modem_rat_e;
+
+typedef struct {
+    bsp_modem_rat_e rat;
+    // Bit n - 1 allows LTE band n, 0 is the modem's own default set, see bsp_modem_set_default_lte_bands()
+    uint64_t lte_bands;
+} bsp_modem_rat_lock_t;
+
+typedef void (*bsp_modem_ring_cb_t)(void);
+
 #define MODEM_CONNECT_BIT  BIT0
+#define MODEM_LOST_BIT     BIT1
 #define MODEM_GOT_DATA_BIT BIT2
 
 EventGroupHandle_t bsp_modem_eventgroup(void);
 esp_modem_dce_t *air_gateway_get_modem_dce(void);
 esp_netif_t *air_gateway_get_modem_netif(void);
-void bsp_modem_setup(void);
+void bsp_modem_set_task_priority(uint32_t priority);
+void bsp_modem_set_apn(const char *apn);
+esp_err_t bsp_modem_setup(void);
 void bsp_modem_deinit(void);
+esp_err_t bsp_modem_redial(void);
+esp_err_t bsp_modem_reenter_data_mode(void);
+esp_err_t bsp_modem_radio_reset(void);
+void bsp_modem_get_link_stats(bsp_modem_link_stats_t *out);
+size_t bsp_modem_get_tx_pending(void);
+esp_err_t bsp_modem_read_telemetry(bsp_modem_telemetry_t *out);
+esp_err_t bsp_modem_set_power_save(bool is_enabled);
+esp_err_t bsp_modem_get_rat_lock(bsp_modem_rat_lock_t *out);
+esp_err_t bsp_modem_set_rat_lock(const bsp_modem_rat_lock_t *lock);
+void bsp_modem_set_default_lte_bands(uint64_t lte_bands);
+esp_err_t bsp_modem_sleep(void);
+void bsp_modem_wake(void);
+bool bsp_modem_is_sleeping(void);
+esp_err_t bsp_modem_set_ring_callback(bsp_modem_ring_cb_t cb);
+bool bsp_modem_parse_cpsi(const char *line, bsp_modem_telemetry_t *out);
+bool bsp_modem_parse_cnmp(const char *line, bsp_modem_rat_e *out);
+bool bsp_modem_parse_cnbp(const char *line, uint64_t *gw_bands, uint64_t *lte_bands);
+bool bsp_modem_parse_cpmutemp(const char *line, int *out);
 void bsp_modem_power_up_por(void);
 void bsp_modem_disable(void);
 
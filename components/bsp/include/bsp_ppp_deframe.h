@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BSP_PPP_DEFRAME_FCS_SIZE      (2)
+#define BSP_PPP_DEFRAME_PROTOCOL_SIZE (2)
+
+// Buffers come from the owner, one per frame and none taken per byte
+typedef struct {
+    // At least frame_max bytes, NULL when none is free and the frame is dropped
+    uint8_t *(*take)(void *ctx);
+    // A frame with a good FCS, protocol field first and the FCS cut off, the buffer now belongs to the owner
+    void (*deliver)(void *ctx, uint8_t *frame, uint16_t len);
+    // A buffer given back unused
+    void (*release)(void *ctx, uint8_t *buffer);
+} bsp_ppp_deframe_ops_t;
+
+typedef struct {
+    uint32_t frames;
+    uint32_t bytes;
+    uint32_t fcs_errors;
+    uint32_t no_buffer_drops;
+    uint32_t oversize_drops;
+} bsp_ppp_deframe_stats_t;
+
+typedef struct {
+    const bsp_ppp_deframe_ops_t *ops;
+    void *ctx;
+    uint16_t frame_max;
+    // Only touched by the task that feeds the bytes, counters included
+    int state;
+    bool is_escaped;
+    uint8_t *buffer;
+    uint16_t len;
+    uint16_t fcs;
+    bsp_ppp_deframe_stats_t stats;
+} bsp_ppp_deframer_t;
+
+void bsp_ppp_deframe_init(bsp_ppp_deframer_t *deframer,
+                          const bsp_ppp_deframe_ops_t *ops,
+                          void *ctx,
+                          uint16_t frame_max);
+void bsp_ppp_deframe_reset(bsp_ppp_deframer_t *deframer);
+void bsp_ppp_deframe(bsp_ppp_deframer_t *deframer, const uint8_t *accm, const uint8_t *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_netif.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint32_t frames;
+    uint32_t bytes;
+    uint32_t fcs_errors;
+    uint32_t pool_empty_drops;
+    uint32_t oversize_drops;
+    uint32_t queue_full_drops;
+    uint32_t pool_free;
+} bsp_ppp_rx_stats_t;
+
+const esp_netif_netstack_config_t *bsp_ppp_rx_netstack(void);
+void bsp_ppp_rx_attach(esp_netif_t *ppp_netif);
+void bsp_ppp_rx_get_stats(bsp_ppp_rx_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
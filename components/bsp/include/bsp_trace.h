@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Numbering is part of the dump format, tools/trace_latency.py has the same table
+typedef enum {
+    BSP_TRACE_AP_RX = 1,
+    BSP_TRACE_AP_ROUTED,
+    BSP_TRACE_UPLINK_QUEUED,
+    BSP_TRACE_UPLINK_SENT,
+    BSP_TRACE_UART_WRITTEN,
+    BSP_TRACE_PPP_RX,
+    BSP_TRACE_PPP_INPUT,
+    BSP_TRACE_PPP_ROUTED,
+    BSP_TRACE_AP_TX,
+} bsp_trace_stage_e;
+
+void bsp_trace_init(void);
+uint32_t bsp_trace_key(const void *ip_header, size_t len);
+void bsp_trace_record(bsp_trace_stage_e stage, uint32_t key);
+void bsp_trace_dump(void);
+
+#if CONFIG_GATEWAY_PACKET_TRACE
+#define BSP_TRACE(stage, ip_header, len) bsp_trace_record((stage), bsp_trace_key((ip_header), (len)))
+#else
+#define BSP_TRACE(stage, ip_header, len) ((void)0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
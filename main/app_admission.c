@@ -0,0 +1,274 @@
+#include "app_admission.h"
+
+#include "app_config.h"
+#include "app_connection.h"
+#include "app_napt.h"
+#if CONFIG_AIR_GATEWAY_RAT_OPTIMIZER
+#include "app_rat.h"
+#endif
+#include "app_stations.h"
+#include "app_stats.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_modem_api.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "sdkconfig.h"
+
+#include "bsp_modem.h"
+
+/* -------------------------------------------------------------------------- */
+
+static const char *TAG = "app_admission.c";
+
+// Same capacity as the station table, departed stations included
+#define ADMISSION_STATIONS_MAX         (APP_CONFIG_STATIONS_MAX + 4)
+// 8N1 framing carries 8 payload bits in every 10 on the modem UART
+#define ADMISSION_UART_PAYLOAD_PERCENT (80)
+// Refused stations remembered for their hold-off, the oldest entry is reused when all are taken
+#define ADMISSION_REFUSED_MAX          (8)
+
+typedef struct {
+    uint8_t mac[6];
+    uint32_t until_ms;
+} _refused_t;
+
+typedef struct {
+    atomic_uint_fast32_t admitted;
+    atomic_uint_fast32_t evicted;
+    atomic_uint_fast32_t refused;
+    atomic_uint_fast32_t held_off;
+    atomic_uint_fast32_t over_budget[APP_ADMISSION_BUDGET_MAX];
+} _admission_stats_t;
+
+static const char *const BUDGET_NAMES[APP_ADMISSION_BUDGET_MAX] = { "stations", "memory", "napt", "link" };
+
+static _admission_stats_t _stats;
+// Supervisor task only
+static app_station_t _stations[ADMISSION_STATIONS_MAX];
+static _refused_t _refused[ADMISSION_REFUSED_MAX];
+
+/* -------------------------------------------------------------------------- */
+
+static uint32_t _now_ms(void) {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* First budget the station set exceeds, APP_ADMISSION_BUDGET_MAX when all of them hold */
+app_admission_budget_e app_admission_check(const app_admission_input_t *input) {
+    if (input->stations > input->max_stations) {
+        return APP_ADMISSION_BUDGET_STATIONS;
+    }
+    if (input->heap_free < CONFIG_AIR_GATEWAY_ADMISSION_HEAP_RESERVE) {
+        return APP_ADMISSION_BUDGET_MEMORY;
+    }
+#if CONFIG_AIR_GATEWAY_NAPT
+    if ((input->napt_capacity != 0) && ((uint64_t)input->napt_entries * 100 >=
+                                        (uint64_t)input->napt_capacity * CONFIG_AIR_GATEWAY_ADMISSION_NAPT_PERCENT)) {
+        return APP_ADMISSION_BUDGET_NAPT;
+    }
+#endif
+    // Every station is promised a minimum share of the uplink, one that is too slow for a single share still serves one
+    if ((input->link_kbps != 0) && (input->stations > 1) &&
+        ((uint64_t)input->stations * CONFIG_AIR_GATEWAY_ADMISSION_MIN_KBPS > input->link_kbps)) {
+        return APP_ADMISSION_BUDGET_LINK;
+    }
+    return APP_ADMISSION_BUDGET_MAX;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _gather_input(size_t count, app_admission_input_t *out) {
+    memset(out, 0, sizeof(*out));
+    for (size_t i = 0; i < count; i++) {
+        out->stations += _stations[i].is_connected ? 1 : 0;
+    }
+
+    app_config_t config;
+    app_config_get(&config);
+    out->max_stations = config.max_stations;
+
+    app_stats_heap_t heap;
+    app_stats_get_heap(&heap);
+    out->heap_free = heap.heap_free_internal;
+
+#if CONFIG_AIR_GATEWAY_NAPT
+    app_napt_stats_t napt;
+    app_napt_get_stats(&napt);
+    out->napt_entries = napt.entries;
+    out->napt_capacity = napt.capacity;
+#endif
+
+    app_connection_stats_t uplink;
+    app_connection_get_stats(&uplink);
+    if (uplink.is_up) {
+        bsp_modem_link_stats_t link;
+        bsp_modem_get_link_stats(&link);
+        out->link_kbps = (link.baud / 1000) * ADMISSION_UART_PAYLOAD_PERCENT / 100;
+#if CONFIG_AIR_GATEWAY_RAT_OPTIMIZER
+        // The radio side is usually the narrower one, the probe measured what it actually delivers
+        app_rat_stats_t rat;
+        app_rat_get_stats(&rat);
+        if ((rat.kbps != 0) && (rat.kbps < out->link_kbps)) {
+            out->link_kbps = rat.kbps;
+        }
+#endif
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* A refused station usually reassociates at once, each attempt would cost a full check and another deauth */
+static bool _is_held_off(const uint8_t mac[6], uint32_t now_ms) {
+    for (size_t i = 0; i < ADMISSION_REFUSED_MAX; i++) {
+        if ((memcmp(_refused[i].mac, mac, sizeof(_refused[i].mac)) == 0) &&
+            ((int32_t)(_refused[i].until_ms - now_ms) > 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _hold_off(const uint8_t mac[6], uint32_t now_ms) {
+    _refused_t *slot = &_refused[0];
+    for (size_t i = 0; i < ADMISSION_REFUSED_MAX; i++) {
+        if (memcmp(_refused[i].mac, mac, sizeof(_refused[i].mac)) == 0) {
+            slot = &_refused[i];
+            break;
+        }
+        if ((int32_t)(_refused[i].until_ms - slot->until_ms) < 0) {
+            slot = &_refused[i];
+        }
+    }
+    memcpy(slot->mac, mac, sizeof(slot->mac));
+    slot->until_ms = now_ms + CONFIG_AIR_GATEWAY_ADMISSION_HOLDOFF_S * 1000U;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Idle the longest and past the idle limit, never the station that just joined */
+static const app_station_t *_pick_idle(size_t count, const uint8_t joined[6]) {
+    uint32_t now_ms = _now_ms();
+    const app_station_t *victim = NULL;
+    uint32_t victim_idle_ms = 0;
+    for (size_t i = 0; i < count; i++) {
+        const app_station_t *station = &_stations[i];
+        if ((station->is_connected == false) || (memcmp(station->mac, joined, sizeof(station->mac)) == 0)) {
+            continue;
+        }
+        uint32_t idle_ms = now_ms - station->last_seen_ms;
+        if ((idle_ms >= CONFIG_AIR_GATEWAY_ADMISSION_IDLE_S * 1000U) &&
+            ((victim == NULL) || (idle_ms > victim_idle_ms))) {
+            victim = station;
+            victim_idle_ms = idle_ms;
+        }
+    }
+    return victim;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool _deauth(const uint8_t mac[6]) {
+    uint16_t aid = 0;
+    if ((esp_wifi_ap_get_sta_aid(mac, &aid) != ESP_OK) || (esp_wifi_deauth_sta(aid) != ESP_OK)) {
+        ESP_LOGW(TAG, "Failed to deauthenticate " MACSTR, MAC2STR(mac));
+        return false;
+    }
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Supervisor context after app_stations_join(). An idle station makes room before a new one is turned away. */
+void app_admission_station_joined(const uint8_t mac[6]) {
+    uint32_t now_ms = _now_ms();
+    if (_is_held_off(mac, now_ms)) {
+        _deauth(mac);
+        atomic_fetch_add_explicit(&_stats.held_off, 1, memory_order_relaxed);
+        return;
+    }
+
+    size_t count = app_stations_snapshot(_stations, ADMISSION_STATIONS_MAX);
+    app_admission_input_t input;
+    _gather_input(count, &input);
+
+    app_admission_budget_e budget = app_admission_check(&input);
+    if (budget == APP_ADMISSION_BUDGET_MAX) {
+        atomic_fetch_add_explicit(&_stats.admitted, 1, memory_order_relaxed);
+        return;
+    }
+    atomic_fetch_add_explicit(&_stats.over_budget[budget], 1, memory_order_relaxed);
+
+    // One eviction per join, the next join checks the budgets again
+    const app_station_t *victim = _pick_idle(count, mac);
+    if ((victim != NULL) && _deauth(victim->mac)) {
+        atomic_fetch_add_explicit(&_stats.evicted, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&_stats.admitted, 1, memory_order_relaxed);
+        ESP_LOGW(TAG,
+                 "Over the %s budget, idle station " MACSTR " evicted for " MACSTR,
+                 BUDGET_NAMES[budget],
+                 MAC2STR(victim->mac),
+                 MAC2STR(mac));
+        return;
+    }
+
+    _deauth(mac);
+    _hold_off(mac, now_ms);
+    atomic_fetch_add_explicit(&_stats.refused, 1, memory_order_relaxed);
+    ESP_LOGW(TAG,
+             "Over the %s budget and no idle station, " MACSTR " refused for %d s",
+             BUDGET_NAMES[budget],
+             MAC2STR(mac),
+             CONFIG_AIR_GATEWAY_ADMISSION_HOLDOFF_S);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_admission_get_stats(app_admission_stats_t *out) {
+    out->admitted = atomic_load_explicit(&_stats.admitted, memory_order_relaxed);
+    out->evicted = atomic_load_explicit(&_stats.evicted, memory_order_relaxed);
+    out->refused = atomic_load_explicit(&_stats.refused, memory_order_relaxed);
+    out->held_off = atomic_load_explicit(&_stats.held_off, memory_order_relaxed);
+    for (int i = 0; i < APP_ADMISSION_BUDGET_MAX; i++) {
+        out->over_budget[i] = atomic_load_explicit(&_stats.over_budget[i], memory_order_relaxed);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+const char *app_admission_budget_name(app_admission_budget_e budget) {
+    return (budget < APP_ADMISSION_BUDGET_MAX) ? BUDGET_NAMES[budget] : "none";
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_admission_log(void) {
+    app_admission_stats_t stats;
+    app_admission_get_stats(&stats);
+    ESP_LOGI(TAG,
+             "Admission: %" PRIu32 " admitted, %" PRIu32 " idle evicted, %" PRIu32 " refused, %" PRIu32
+             " retries held off; over budget: stations %" PRIu32 ", memory %" PRIu32 ", napt %" PRIu32
+             ", link %" PRIu32,
+             stats.admitted,
+             stats.evicted,
+             stats.refused,
+             stats.held_off,
+             stats.over_budget[APP_ADMISSION_BUDGET_STATIONS],
+             stats.over_budget[APP_ADMISSION_BUDGET_MEMORY],
+             stats.over_budget[APP_ADMISSION_BUDGET_NAPT],
+             stats.over_budget[APP_ADMISSION_BUDGET_LINK]);
+}
+
+/* -------------------------------------------------------------------------- */
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef enum {
+    APP_ADMISSION_BUDGET_STATIONS = 0,
+    APP_ADMISSION_BUDGET_MEMORY,
+    APP_ADMISSION_BUDGET_NAPT,
+    APP_ADMISSION_BUDGET_LINK,
+    APP_ADMISSION_BUDGET_MAX,
+} app_admission_budget_e;
+
+typedef struct {
+    // Associated stations, including the one that just joined
+    uint32_t stations;
+    uint32_t max_stations;
+    uint32_t heap_free;
+    uint32_t napt_entries;
+    uint32_t napt_capacity;
+    // Modem UART payload rate, or the measured uplink throughput when lower, 0 while the link is down
+    uint32_t link_kbps;
+} app_admission_input_t;
+
+typedef struct {
+    uint32_t admitted;
+    uint32_t evicted;
+    uint32_t refused;
+    uint32_t held_off;
+    uint32_t over_budget[APP_ADMISSION_BUDGET_MAX];
+} app_admission_stats_t;
+
+app_admission_budget_e app_admission_check(const app_admission_input_t *input);
+void app_admission_station_joined(const uint8_t mac[6]);
+void app_admission_get_stats(app_admission_stats_t *out);
+const char *app_admission_budget_name(app_admission_budget_e budget);
+void app_admission_log(void);
@@ -0,0 +1,224 @@
+#include "app_affinity.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_modem_api.h"
+#include "esp_timer.h"
+#include "freertos/event_groups.h"
+#include "freertos/task.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+
+#include "bsp_modem.h"
+
+/* -------------------------------------------------------------------------- */
+
+static const char *TAG = "app_affinity.c";
+
+#define AFFINITY_NVS_NAMESPACE "gateway"
+#define AFFINITY_NVS_KEY       "affinity"
+#define AFFINITY_NAME_MAX      (16)
+// Just below the tcpip task, so PPP deframing is never starved by background work
+#define AFFINITY_UART_PRIORITY (CONFIG_LWIP_TCPIP_TASK_PRIO - 1)
+#define AFFINITY_TCPIP_TASK    "tiT"
+#define AFFINITY_WIFI_TASK     "wifi"
+#define AFFINITY_LOG_TASKS     (6)
+#define AFFINITY_TASKS_MAX     (32)
+
+#if CONFIG_AIR_GATEWAY_AFFINITY_UNPINNED
+#define AFFINITY_DEFAULT_PROFILE (0)
+#elif CONFIG_AIR_GATEWAY_AFFINITY_SPLIT
+#define AFFINITY_DEFAULT_PROFILE (1)
+#else
+#define AFFINITY_DEFAULT_PROFILE (2)
+#endif
+
+typedef struct {
+    const char *name;
+    BaseType_t role_cores[APP_AFFINITY_ROLE_MAX];
+    // Core the Wi-Fi and tcpip tasks are expected on, both are pinned at build time
+    BaseType_t stack_core;
+    UBaseType_t uart_priority;
+} _profile_t;
+
+// Order follows the Kconfig choice
+static const _profile_t PROFILES[] = {
+    { "unpinned", { tskNO_AFFINITY, tskNO_AFFINITY }, tskNO_AFFINITY, CONFIG_GATEWAY_MODEM_UART_EVENT_TASK_PRIORITY },
+    { "split", { 1, 1 }, 0, AFFINITY_UART_PRIORITY },
+    { "split_low", { 1, 1 }, 0, CONFIG_GATEWAY_MODEM_UART_EVENT_TASK_PRIORITY },
+};
+
+#define AFFINITY_PROFILES (sizeof(PROFILES) / sizeof(PROFILES[0]))
+
+typedef struct {
+    TaskHandle_t handle;
+    uint64_t run_time;
+} _task_sample_t;
+
+typedef struct {
+    const char *name;
+    BaseType_t core;
+    UBaseType_t priority;
+    uint32_t permille;
+} _task_load_t;
+
+static const _profile_t *_p_profile = &PROFILES[AFFINITY_DEFAULT_PROFILE];
+static _task_sample_t _samples[AFFINITY_TASKS_MAX];
+static size_t _sample_count;
+static uint64_t _sampled_at_us;
+
+/* -------------------------------------------------------------------------- */
+
+/* An NVS entry overrides the Kconfig default, unknown names fall back to it */
+static void _load_override(void) {
+    nvs_handle_t nvs;
+    if (nvs_open(AFFINITY_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+    char name[AFFINITY_NAME_MAX] = { 0 };
+    size_t len = sizeof(name);
+    esp_err_t err = nvs_get_str(nvs, AFFINITY_NVS_KEY, name, &len);
+    nvs_close(nvs);
+    if (err != ESP_OK) {
+        return;
+    }
+
+    for (size_t i = 0; i < AFFINITY_PROFILES; i++) {
+        if (strcmp(PROFILES[i].name, name) == 0) {
+            _p_profile = &PROFILES[i];
+            return;
+        }
+    }
+    ESP_LOGW(TAG, "Unknown affinity profile \"%s\" in NVS, keeping %s", name, _p_profile->name);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Before any task is created and before the modem DTE exists */
+void app_affinity_init(void) {
+    _load_override();
+    bsp_modem_set_task_priority(_p_profile->uart_priority);
+    ESP_LOGI(TAG,
+             "Affinity profile %s: modem tasks on %d, background on %d, modem UART priority %u",
+             _p_profile->name,
+             (int)_p_profile->role_cores[APP_AFFINITY_ROLE_MODEM],
+             (int)_p_profile->role_cores[APP_AFFINITY_ROLE_BACKGROUND],
+             (unsigned)_p_profile->uart_priority);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* The tcpip and Wi-Fi tasks are created pinned by IDF, a profile can only verify them */
+void app_affinity_check_stack(void) {
+    if (_p_profile->stack_core == tskNO_AFFINITY) {
+        return;
+    }
+    const char *names[] = { AFFINITY_TCPIP_TASK, AFFINITY_WIFI_TASK };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        TaskHandle_t task = xTaskGetHandle(names[i]);
+        if ((task != NULL) && (xTaskGetCoreID(task) != _p_profile->stack_core)) {
+            ESP_LOGW(TAG,
+                     "Task %s runs on %d, profile %s expects core %d, check the LWIP/ESP_WIFI task affinity options",
+                     names[i],
+                     (int)xTaskGetCoreID(task),
+                     _p_profile->name,
+                     (int)_p_profile->stack_core);
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+BaseType_t app_affinity_core(app_affinity_role_e role) {
+    return (role < APP_AFFINITY_ROLE_MAX) ? _p_profile->role_cores[role] : tskNO_AFFINITY;
+}
+
+/* -------------------------------------------------------------------------- */
+
+const char *app_affinity_profile_name(void) {
+    return _p_profile->name;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint64_t _previous_run_time(TaskHandle_t handle) {
+    for (size_t i = 0; i < _sample_count; i++) {
+        if (_samples[i].handle == handle) {
+            return _samples[i].run_time;
+        }
+    }
+    return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static int _by_load(const void *a, const void *b) {
+    const _task_load_t *left = a;
+    const _task_load_t *right = b;
+    return (left->permille < right->permille) - (left->permille > right->permille);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* CPU share of the busiest tasks since the previous log, 100 % is one core */
+void app_affinity_log(void) {
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    UBaseType_t capacity = uxTaskGetNumberOfTasks() + 4;
+    TaskStatus_t *tasks = malloc(capacity * sizeof(TaskStatus_t));
+    _task_load_t *loads = malloc(capacity * sizeof(_task_load_t));
+    if ((tasks == NULL) || (loads == NULL)) {
+        free(tasks);
+        free(loads);
+        return;
+    }
+
+    UBaseType_t count = uxTaskGetSystemState(tasks, capacity, NULL);
+    uint64_t now_us = esp_timer_get_time();
+    uint64_t elapsed_us = now_us - _sampled_at_us;
+    for (UBaseType_t i = 0; i < count; i++) {
+        uint64_t run_time = tasks[i].ulRunTimeCounter;
+        uint64_t previous = _previous_run_time(tasks[i].xHandle);
+        uint64_t busy_us = (run_time >= previous) ? run_time - previous : run_time;
+        loads[i].name = tasks[i].pcTaskName;
+        loads[i].core = xTaskGetCoreID(tasks[i].xHandle);
+        loads[i].priority = tasks[i].uxCurrentPriority;
+        loads[i].permille = (elapsed_us != 0) ? (uint32_t)((busy_us * 1000) / elapsed_us) : 0;
+    }
+
+    // Handles of deleted tasks may be reused, a stale sample only skews one interval
+    _sample_count = 0;
+    for (UBaseType_t i = 0; (i < count) && (_sample_count < AFFINITY_TASKS_MAX); i++) {
+        _samples[_sample_count].handle = tasks[i].xHandle;
+        _samples[_sample_count].run_time = tasks[i].ulRunTimeCounter;
+        _sample_count++;
+    }
+    _sampled_at_us = now_us;
+
+    qsort(loads, count, sizeof(loads[0]), _by_load);
+    char line[192] = { 0 };
+    size_t len = 0;
+    for (UBaseType_t i = 0; (i < count) && (i < AFFINITY_LOG_TASKS) && (len < sizeof(line)); i++) {
+        len += snprintf(&line[len],
+                        sizeof(line) - len,
+                        "%s%s %" PRIu32 ".%" PRIu32 "%% c%d p%u",
+                        (i == 0) ? "" : ", ",
+                        loads[i].name,
+                        loads[i].permille / 10,
+                        loads[i].permille % 10,
+                        (loads[i].core == tskNO_AFFINITY) ? -1 : (int)loads[i].core,
+                        (unsigned)loads[i].priority);
+    }
+    ESP_LOGI(TAG, "Profile %s, busiest tasks: %s", _p_profile->name, line);
+
+    free(loads);
+    free(tasks);
+#else
+    ESP_LOGI(TAG, "Profile %s, run time stats are disabled", _p_profile->name);
+#endif
+}
+
+/* -------------------------------------------------------------------------- */
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+typedef enum {
+    // Modem control, the uplink and telemetry tasks
+    APP_AFFINITY_ROLE_MODEM = 0,
+    // Supervisor, governor, idle manager and the metrics server
+    APP_AFFINITY_ROLE_BACKGROUND,
+    APP_AFFINITY_ROLE_MAX,
+} app_affinity_role_e;
+
+void app_affinity_init(void);
+void app_affinity_check_stack(void);
+BaseType_t app_affinity_core(app_affinity_role_e role);
+const char *app_affinity_profile_name(void);
+void app_affinity_log(void);
@@ -6,6 +6,7 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
 #include "sdkconfig.h"
+#include <inttypes.h>
 #include <string.h>
 
 #include "dhcpserver/dhcpserver.h"
@@ -15,25 +16,54 @@
 #include "lwip/lwip_napt.h"
 #include "nvs_flash.h"
 
+#include "app_admission.h"
+#include "app_affinity.h"
 #include "app_blinking.h"
+#include "app_channel.h"
+#include "app_config.h"
+#include "app_connection.h"
+#include "app_dns.h"
+#include "app_forward.h"
+#include "app_governor.h"
+#include "app_http.h"
+#include "app_idle.h"
+#include "app_metrics.h"
+#include "app_napt.h"
+#include "app_pmtu.h"
+#include "app_rat.h"
+#include "app_stations.h"
+#include "app_stats.h"
+#include "app_supervisor.h"
+#include "app_telemetry.h"
+#include "app_uplink_queue.h"
 #include "bsp_battery.h"
+#include "bsp_binlog.h"
 #include "bsp_led.h"
+#include "bsp_mem.h"
 #include "bsp_modem.h"
+#include "bsp_trace.h"
 
 static const char *TAG = "air_gateway.c";
 
+static esp_netif_t *_p_ap_netif;
+
 /* -------------------------------------------------------------------------- */
 
-static esp_err_t set_dhcps_dns(esp_netif_t *netif, uint32_t addr) {
-    esp_netif_dns_info_t dns;
-    dns.ip.u_addr.ip4.addr = addr;
-    dns.ip.type = IPADDR_TYPE_V4;
+static void _enable_dhcps_dns_offer(esp_netif_t *netif) {
     dhcps_offer_t dhcps_dns_value = OFFER_DNS;
     ESP_ERROR_CHECK(esp_netif_dhcps_option(netif,
                                            ESP_NETIF_OP_SET,
                                            ESP_NETIF_DOMAIN_NAME_SERVER,
                                            &dhcps_dns_value,
                                            sizeof(dhcps_dns_value)));
+}
+
+/* -------------------------------------------------------------------------- */
+
+static esp_err_t set_dhcps_dns(esp_netif_t *netif, uint32_t addr) {
+    esp_netif_dns_info_t dns;
+    dns.ip.u_addr.ip4.addr = addr;
+    dns.ip.type = IPADDR_TYPE_V4;
     ESP_ERROR_CHECK(esp_netif_set_dns_info(netif, ESP_NETIF_DNS_MAIN, &dns));
     return ESP_OK;
 }
@@ -41,59 +71,256 @@ static esp_err_t set_dhcps_dns(esp_netif_t *netif, uint32_t addr) {
 /* -------------------------------------------------------------------------- */
 
 static void wifi_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data) {
+    app_supervisor_event_t event;
     if (event_id == WIFI_EVENT_AP_STACONNECTED) {
-        wifi_event_ap_staconnected_t *event = (wifi_event_ap_staconnected_t *)event_data;
-        ESP_LOGI(TAG, "station " MACSTR " join, AID=%d", MAC2STR(event->mac), event->aid);
-        app_blinking_station_connected();
+        wifi_event_ap_staconnected_t *connected = (wifi_event_ap_staconnected_t *)event_data;
+        BSP_BINLOGI(TAG, "station " MACSTR " join, AID=%d", MAC2STR(connected->mac), connected->aid);
+        event.type = APP_SUPERVISOR_EVENT_STATION_JOIN;
+        memcpy(event.mac, connected->mac, sizeof(event.mac));
+        app_supervisor_post(&event);
     } else if (event_id == WIFI_EVENT_AP_STADISCONNECTED) {
-        wifi_event_ap_stadisconnected_t *event = (wifi_event_ap_stadisconnected_t *)event_data;
-        ESP_LOGI(TAG, "station " MACSTR " leave, AID=%d", MAC2STR(event->mac), event->aid);
-        app_blinking_station_disconnected();
+        wifi_event_ap_stadisconnected_t *disconnected = (wifi_event_ap_stadisconnected_t *)event_data;
+        BSP_BINLOGI(TAG, "station " MACSTR " leave, AID=%d", MAC2STR(disconnected->mac), disconnected->aid);
+        event.type = APP_SUPERVISOR_EVENT_STATION_LEAVE;
+        memcpy(event.mac, disconnected->mac, sizeof(event.mac));
+        app_supervisor_post(&event);
+#if CONFIG_AIR_GATEWAY_CHANNEL_PLANNER
+    } else if (event_id == WIFI_EVENT_SCAN_DONE) {
+        event.type = APP_SUPERVISOR_EVENT_CHANNEL_SCAN_DONE;
+        app_supervisor_post(&event);
+#endif
     }
 }
 
 /* -------------------------------------------------------------------------- */
 
+/* Only the fields owned by the stored configuration, the rest of out is kept */
+static void _fill_wifi_config(const app_config_t *config, wifi_config_t *out) {
+    memset(out->ap.ssid, 0, sizeof(out->ap.ssid));
+    memset(out->ap.password, 0, sizeof(out->ap.password));
+    size_t ssid_len = strlen(config->ssid);
+    memcpy(out->ap.ssid, config->ssid, ssid_len);
+    out->ap.ssid_len = ssid_len;
+    memcpy(out->ap.password, config->password, strlen(config->password));
+    out->ap.channel = config->channel;
+#if CONFIG_AIR_GATEWAY_ADMISSION
+    // Admission enforces max_stations itself, the driver has to let a join over it through to displace an idle station
+    out->ap.max_connection = ESP_WIFI_MAX_CONN_NUM;
+#else
+    out->ap.max_connection = config->max_stations;
+#endif
+    out->ap.authmode = (config->password[0] == '\0') ? WIFI_AUTH_OPEN : WIFI_AUTH_WPA_WPA2_PSK;
+}
+
+/* -------------------------------------------------------------------------- */
+
 void wifi_init_softap(void) {
+    // Driver buffers are allocated by esp_wifi_init() and esp_wifi_start(), only their total is visible
+    bsp_mem_mark_t mark;
+    bsp_mem_mark(&mark);
+
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
 
     ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler, NULL, NULL));
 
-    wifi_config_t wifi_config = {
-        .ap = {
-            .ssid = CONFIG_AIR_GATEWAY_AP_WIFI_SSID,
-            .ssid_len = strlen(CONFIG_AIR_GATEWAY_AP_WIFI_SSID),
-            .channel = CONFIG_AIR_GATEWAY_AP_WIFI_CHANNEL,
-            .password = CONFIG_AIR_GATEWAY_AP_WIFI_PASS,
-            .max_connection = CONFIG_AIR_GATEWAY_AP_MAX_STA_CONN,
-            .authmode = WIFI_AUTH_WPA_WPA2_PSK,
-        },
-    };
-    if (strlen(CONFIG_AIR_GATEWAY_AP_WIFI_PASS) == 0) {
-        wifi_config.ap.authmode = WIFI_AUTH_OPEN;
-    }
+    app_config_t config;
+    app_config_get(&config);
+    wifi_config_t wifi_config = { 0 };
+    _fill_wifi_config(&config, &wifi_config);
 
+#if CONFIG_AIR_GATEWAY_CHANNEL_PLANNER
+    // Scanning needs the station interface, it is never configured to connect
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_APSTA));
+#else
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_AP));
+#endif
     ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_AP, &wifi_config));
     ESP_ERROR_CHECK(esp_wifi_start());
+    bsp_mem_charge_since(BSP_MEM_WIFI, &mark);
 
     ESP_LOGI(TAG,
              "wifi_init_softap finished. SSID:%s password:%s channel:%d",
-             CONFIG_AIR_GATEWAY_AP_WIFI_SSID,
-             CONFIG_AIR_GATEWAY_AP_WIFI_PASS,
-             CONFIG_AIR_GATEWAY_AP_WIFI_CHANNEL);
+             config.ssid,
+             config.password,
+             config.channel);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Only the subsystem a change belongs to is touched, the PPP session survives a Wi-Fi change */
+static void _apply_config(uint32_t changes) {
+    app_config_t config;
+    app_config_get(&config);
+
+    if (changes & APP_CONFIG_CHANGE_WIFI) {
+        // Starts from the running configuration, so the governor's beacon interval is kept
+        wifi_config_t wifi_config;
+        esp_err_t err = esp_wifi_get_config(ESP_IF_WIFI_AP, &wifi_config);
+        if (err == ESP_OK) {
+            _fill_wifi_config(&config, &wifi_config);
+#if CONFIG_AIR_GATEWAY_CHANNEL_PLANNER
+            // The planner owns the channel, the configured one is only where the SoftAP starts
+            wifi_config.ap.channel = app_channel_current();
+#endif
+            err = esp_wifi_set_config(ESP_IF_WIFI_AP, &wifi_config);
+        }
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "esp_wifi_set_config failed with %d", err);
+        } else {
+            ESP_LOGW(TAG, "SoftAP reconfigured: SSID %s, channel %d", config.ssid, config.channel);
+        }
+    }
+    if (changes & APP_CONFIG_CHANGE_APN) {
+        bsp_modem_set_apn(config.apn);
+        ESP_LOGW(TAG, "APN %s is used from the next dial", config.apn);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* HTTP worker context, the work itself runs in the supervisor */
+static void _on_config_changed(uint32_t changes) {
+    const app_supervisor_event_t event = { .type = APP_SUPERVISOR_EVENT_CONFIG_CHANGED, .changes = changes };
+    app_supervisor_post(&event);
 }
 
 /* -------------------------------------------------------------------------- */
 
 static void _periodic_system_status_log(void) {
 
+    bsp_battery_snapshot_t battery;
+    bsp_battery_get_snapshot(&battery);
     ESP_LOGI(TAG,
-             "Battery: %dmV (%d%%), Solar %dmV",
-             bsp_battery_read_voltage_mv(),
-             bsp_battery_get_capacity(),
-             bsp_solar_battery_read_voltage_mv());
+             "Battery: %" PRIu32 "mV (%" PRIu32 "%%), Solar %" PRIu32 "mV",
+             battery.battery_mv,
+             battery.capacity_percent,
+             battery.solar_mv);
+
+    app_connection_stats_t uplink;
+    app_connection_get_stats(&uplink);
+    ESP_LOGI(TAG,
+             "Uplink: %s, reconnects %" PRIu32 ", last outage %" PRIu32 " ms, total outage %" PRIu32 " ms",
+             uplink.is_up ? "up" : "down",
+             uplink.reconnects,
+             uplink.last_outage_ms,
+             uplink.total_outage_ms);
+
+    app_telemetry_log();
+#if CONFIG_AIR_GATEWAY_RAT_OPTIMIZER
+    app_rat_log();
+#endif
+#if CONFIG_AIR_GATEWAY_GOVERNOR
+    app_governor_log();
+#endif
+#if CONFIG_AIR_GATEWAY_IDLE_SLEEP
+    app_idle_log();
+#endif
+    app_stats_log();
+    bsp_mem_log();
+    app_stations_log();
+#if CONFIG_AIR_GATEWAY_ADMISSION
+    app_admission_log();
+#endif
+#if CONFIG_AIR_GATEWAY_CHANNEL_PLANNER
+    app_channel_log();
+#endif
+#if CONFIG_AIR_GATEWAY_NAPT
+    app_napt_log();
+#endif
+#if CONFIG_AIR_GATEWAY_PMTU
+    app_pmtu_log();
+#endif
+#if CONFIG_AIR_GATEWAY_DNS_FORWARDER
+    app_dns_log();
+#endif
+#if CONFIG_AIR_GATEWAY_UPLINK_FQ_CODEL
+    app_uplink_queue_log();
+#endif
+    app_supervisor_log();
+    app_affinity_log();
+#if CONFIG_GATEWAY_PACKET_TRACE
+    bsp_trace_dump();
+#endif
+#if CONFIG_GATEWAY_BINLOG
+    bsp_binlog_log();
+#endif
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _uplink_up(esp_netif_t *modem_netif) {
+    // The PPP peer may hand out a different resolver after every renegotiation
+#if CONFIG_AIR_GATEWAY_DNS_FORWARDER
+    app_dns_set_upstream(modem_netif);
+#else
+    esp_netif_dns_info_t dns;
+    if (esp_netif_get_dns_info(modem_netif, ESP_NETIF_DNS_MAIN, &dns) == ESP_OK) {
+        set_dhcps_dns(_p_ap_netif, dns.ip.u_addr.ip4.addr);
+    }
+#endif
+    ESP_LOGW(TAG, "Uplink is up, hotspot should now be functional...");
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Connection task context, the work itself runs in the supervisor */
+static void _on_uplink_up(esp_netif_t *modem_netif) {
+    const app_supervisor_event_t event = { .type = APP_SUPERVISOR_EVENT_UPLINK_UP, .netif = modem_netif };
+    app_supervisor_post(&event);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _on_supervisor_event(const app_supervisor_event_t *event) {
+    switch (event->type) {
+        case APP_SUPERVISOR_EVENT_STATUS_LOG:
+            _periodic_system_status_log();
+            break;
+
+        case APP_SUPERVISOR_EVENT_STATION_JOIN:
+            app_stations_join(event->mac);
+#if CONFIG_AIR_GATEWAY_ADMISSION
+            app_admission_station_joined(event->mac);
+#endif
+#if CONFIG_AIR_GATEWAY_IDLE_SLEEP
+            app_idle_station_joined();
+#endif
+            app_blinking_station_connected();
+            break;
+
+        case APP_SUPERVISOR_EVENT_STATION_LEAVE:
+            app_stations_leave(event->mac);
+            app_blinking_station_disconnected();
+            break;
+
+        case APP_SUPERVISOR_EVENT_UPLINK_UP:
+            _uplink_up(event->netif);
+            break;
+
+        case APP_SUPERVISOR_EVENT_CONFIG_CHANGED:
+            _apply_config(event->changes);
+            break;
+
+#if CONFIG_AIR_GATEWAY_CHANNEL_PLANNER
+        case APP_SUPERVISOR_EVENT_CHANNEL_CHECK:
+            app_channel_check();
+            break;
+
+        case APP_SUPERVISOR_EVENT_CHANNEL_SCAN_DONE:
+            app_channel_scan_done();
+            break;
+#endif
+
+#if CONFIG_AIR_GATEWAY_GOVERNOR
+        case APP_SUPERVISOR_EVENT_BEACON_INTERVAL:
+            app_governor_apply_beacon_interval(event->beacon_interval_tu);
+            break;
+#endif
+
+        default:
+            break;
+    }
 }
 
 /* -------------------------------------------------------------------------- */
@@ -105,48 +332,79 @@ void app_main(void) {
         ret = nvs_flash_init();
     }
     ESP_ERROR_CHECK(ret);
+    app_affinity_init();
+    app_config_init();
+    // Read once before the configuration endpoint can change it, later changes arrive as events
+    app_config_t config;
+    app_config_get(&config);
+    bsp_modem_set_apn(config.apn);
 
     bsp_led_init();
     bsp_battery_init();
-
-    bsp_modem_power_up_por();
+#if CONFIG_GATEWAY_PACKET_TRACE
+    bsp_trace_init();
+#endif
+#if CONFIG_GATEWAY_BINLOG
+    bsp_binlog_init(app_affinity_core(APP_AFFINITY_ROLE_BACKGROUND));
+#endif
 
     _periodic_system_status_log();
 
     ESP_ERROR_CHECK(esp_netif_init());
     ESP_ERROR_CHECK(esp_event_loop_create_default());
 
-    bsp_modem_setup();
+    _p_ap_netif = esp_netif_create_default_wifi_ap();
+    assert(_p_ap_netif);
 
-    ESP_LOGI(TAG, "Waiting for IP address...");
-    xEventGroupWaitBits(bsp_modem_eventgroup(), MODEM_CONNECT_BIT, pdFALSE, pdFALSE, portMAX_DELAY);
+    _enable_dhcps_dns_offer(_p_ap_netif);
+#if CONFIG_AIR_GATEWAY_DNS_FORWARDER
+    // Stations always resolve through the gateway, the forwarder follows the PPP resolvers
+    set_dhcps_dns(_p_ap_netif, _g_esp_netif_soft_ap_ip.ip.addr);
+    app_dns_start(_p_ap_netif);
+#else
+    // Clients joining before the uplink is up get the fallback resolver, replaced by the PPP one later
+    set_dhcps_dns(_p_ap_netif, esp_ip4addr_aton(CONFIG_AIR_GATEWAY_FALLBACK_DNS));
+#endif
 
-    esp_netif_t *ap_netif = esp_netif_create_default_wifi_ap();
-    assert(ap_netif);
-    esp_netif_dns_info_t dns;
+    app_stations_init();
+    app_forward_init(_p_ap_netif);
 
-    esp_netif_t *modem_netif;
-    modem_netif = air_gateway_get_modem_netif();
-    assert(modem_netif);
-    ESP_ERROR_CHECK(esp_netif_get_dns_info(modem_netif, ESP_NETIF_DNS_MAIN, &dns));
-    set_dhcps_dns(ap_netif, dns.ip.u_addr.ip4.addr);
+    // Started before the SoftAP, so no station event is posted into a missing queue
+    app_supervisor_start(_on_supervisor_event);
 
     wifi_init_softap();
+    app_affinity_check_stack();
+#if CONFIG_AIR_GATEWAY_CHANNEL_PLANNER
+    app_channel_start(config.channel);
+#endif
+#if CONFIG_AIR_GATEWAY_METRICS || CONFIG_AIR_GATEWAY_CONFIG_API
+    app_http_start(_p_ap_netif);
+#endif
+#if CONFIG_AIR_GATEWAY_METRICS
+    app_metrics_start();
+#endif
+    app_config_start(_on_config_changed);
+#if !CONFIG_AIR_GATEWAY_NAPT
     ip_napt_enable(_g_esp_netif_soft_ap_ip.ip.addr, 1);
+#endif
 
-    ESP_LOGW(TAG, "Hotspot should now be functional...");
     app_blinking_init();
 
-    uint32_t periodic_log_ts_ticks = 0;
-    while (1) {
-        if ((xTaskGetTickCount() - periodic_log_ts_ticks) > pdMS_TO_TICKS(30000)) {
-            _periodic_system_status_log();
-            periodic_log_ts_ticks = xTaskGetTickCount();
-        }
-        vTaskDelay(100);
-    }
+    // Modem power up and PPP attach take seconds, run them alongside the SoftAP
+    app_connection_start(_on_uplink_up);
+    app_telemetry_start();
+#if CONFIG_AIR_GATEWAY_RAT_OPTIMIZER
+    app_rat_start();
+#endif
+#if CONFIG_AIR_GATEWAY_GOVERNOR
+    app_governor_start();
+#endif
+#if CONFIG_AIR_GATEWAY_IDLE_SLEEP
+    app_idle_start();
+#endif
+    bsp_mem_log();
 
-    bsp_modem_deinit();
+    // Everything else runs from events, the main task simply ends here
 }
 
 /* -------------------------------------------------------------------------- */
@@ -0,0 +1,248 @@
+#include "app_channel.h"
+
+#include "app_channel_plan.h"
+#include "app_supervisor.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "sdkconfig.h"
+
+/* -------------------------------------------------------------------------- */
+
+static const char *TAG = "app_channel.c";
+
+#define CHANNEL_CHECK_INTERVAL_US (60 * 1000000ULL)
+#define CHANNEL_SCAN_RECORDS_MAX  (32)
+// Per channel, short enough that stations only see a brief gap in beacons
+#define CHANNEL_SCAN_DWELL_MS     (60)
+#define CHANNEL_HT40_OFFSET       (4)
+
+typedef struct {
+    atomic_uint_fast32_t scans;
+    atomic_uint_fast32_t deferred;
+    atomic_uint_fast32_t switches;
+    atomic_uint_fast32_t last_ap_count;
+} _channel_stats_t;
+
+static esp_timer_handle_t _p_check_timer;
+static atomic_uint_fast32_t _channel;
+static _channel_stats_t _stats;
+
+// Supervisor task only
+static bool _is_scanning;
+static bool _has_scanned;
+static uint32_t _last_scan_ms;
+static app_channel_scores_t _scores;
+
+/* -------------------------------------------------------------------------- */
+
+static uint32_t _now_ms(void) {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _on_check_timer(void *arg) {
+    (void)arg;
+    const app_supervisor_event_t event = { .type = APP_SUPERVISOR_EVENT_CHANNEL_CHECK };
+    app_supervisor_post(&event);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint8_t _secondary(const wifi_ap_record_t *record) {
+    if (record->second == WIFI_SECOND_CHAN_ABOVE) {
+        return record->primary + CHANNEL_HT40_OFFSET;
+    }
+    if ((record->second == WIFI_SECOND_CHAN_BELOW) && (record->primary > CHANNEL_HT40_OFFSET)) {
+        return record->primary - CHANNEL_HT40_OFFSET;
+    }
+    return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Scan results without the gateway itself, returns the number of observations */
+static size_t _collect(app_channel_observation_t *out, size_t max) {
+    uint16_t count = max;
+    wifi_ap_record_t *records = calloc(max, sizeof(wifi_ap_record_t));
+    if (records == NULL) {
+        esp_wifi_clear_ap_list();
+        return 0;
+    }
+    // Also frees the driver's list, APs beyond max are dropped
+    if (esp_wifi_scan_get_ap_records(&count, records) != ESP_OK) {
+        count = 0;
+    }
+
+    uint8_t own_mac[6] = { 0 };
+    esp_wifi_get_mac(WIFI_IF_AP, own_mac);
+    size_t used = 0;
+    for (uint16_t i = 0; i < count; i++) {
+        if (memcmp(records[i].bssid, own_mac, sizeof(own_mac)) == 0) {
+            continue;
+        }
+        out[used].primary = records[i].primary;
+        out[used].secondary = _secondary(&records[i]);
+        out[used].rssi = records[i].rssi;
+        // Debug builds print every scan in the form test/host/scans/ replays
+        ESP_LOGD(TAG, "AP %u %u %d", out[used].primary, out[used].secondary, out[used].rssi);
+        used++;
+    }
+    free(records);
+    return used;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* With a CSA count the driver announces the move in its beacons, stations follow without reassociating. Like every
+ * other write of the SoftAP configuration this runs in the supervisor task, see
+ * app_governor_apply_beacon_interval(). */
+static void _switch(uint8_t channel) {
+    wifi_config_t config;
+    if (esp_wifi_get_config(WIFI_IF_AP, &config) != ESP_OK) {
+        return;
+    }
+    uint8_t previous = config.ap.channel;
+    config.ap.channel = channel;
+    config.ap.csa_count = CONFIG_AIR_GATEWAY_CHANNEL_CSA_COUNT;
+    esp_err_t err = esp_wifi_set_config(WIFI_IF_AP, &config);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to move the SoftAP to channel %u with %d", channel, err);
+        return;
+    }
+    atomic_store_explicit(&_channel, channel, memory_order_relaxed);
+    atomic_fetch_add_explicit(&_stats.switches, 1, memory_order_relaxed);
+    ESP_LOGW(TAG, "SoftAP moves from channel %u to %u", previous, channel);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Supervisor context. Scanning takes the radio off the SoftAP channel, so later scans wait for idle forwarding */
+void app_channel_check(void) {
+    if (_is_scanning) {
+        return;
+    }
+    uint32_t now_ms = _now_ms();
+    if (_has_scanned && ((now_ms - _last_scan_ms) < CONFIG_AIR_GATEWAY_CHANNEL_SCAN_INTERVAL_S * 1000U)) {
+        return;
+    }
+    if (_has_scanned && (app_supervisor_idle_ms() < CONFIG_AIR_GATEWAY_CHANNEL_IDLE_MS)) {
+        atomic_fetch_add_explicit(&_stats.deferred, 1, memory_order_relaxed);
+        return;
+    }
+
+    const wifi_scan_config_t config = {
+        // Hidden networks take airtime all the same
+        .show_hidden = true,
+        .scan_type = WIFI_SCAN_TYPE_ACTIVE,
+        .scan_time.active.max = CHANNEL_SCAN_DWELL_MS,
+    };
+    esp_err_t err = esp_wifi_scan_start(&config, false);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "esp_wifi_scan_start failed with %d", err);
+        return;
+    }
+    _is_scanning = true;
+    _last_scan_ms = now_ms;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Supervisor context, after WIFI_EVENT_SCAN_DONE */
+void app_channel_scan_done(void) {
+    if (_is_scanning == false) {
+        return;
+    }
+    _is_scanning = false;
+    _has_scanned = true;
+
+    app_channel_observation_t *observations = calloc(CHANNEL_SCAN_RECORDS_MAX, sizeof(app_channel_observation_t));
+    if (observations == NULL) {
+        esp_wifi_clear_ap_list();
+        return;
+    }
+    size_t count = _collect(observations, CHANNEL_SCAN_RECORDS_MAX);
+    app_channel_plan_score(observations, count, &_scores);
+    free(observations);
+
+    uint8_t first = 1;
+    uint8_t last = APP_CHANNEL_PLAN_MAX;
+    wifi_country_t country;
+    if ((esp_wifi_get_country(&country) == ESP_OK) && (country.nchan != 0)) {
+        first = country.schan;
+        last = country.schan + country.nchan - 1;
+    }
+
+    uint8_t current = atomic_load_explicit(&_channel, memory_order_relaxed);
+    uint8_t best = app_channel_plan_pick(&_scores, first, last, current, CONFIG_AIR_GATEWAY_CHANNEL_HYSTERESIS_PERCENT);
+    atomic_fetch_add_explicit(&_stats.scans, 1, memory_order_relaxed);
+    atomic_store_explicit(&_stats.last_ap_count, count, memory_order_relaxed);
+    ESP_LOGI(TAG,
+             "Scan found %u APs, channel %u costs %" PRIu32 ", best is %u at %" PRIu32,
+             (unsigned)count,
+             current,
+             _scores.cost[current],
+             best,
+             _scores.cost[best]);
+
+    if (best != current) {
+        _switch(best);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* After the SoftAP started on channel, the first scan runs right away */
+void app_channel_start(uint8_t channel) {
+    atomic_store_explicit(&_channel, channel, memory_order_relaxed);
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = _on_check_timer,
+        .name = "channel",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &_p_check_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(_p_check_timer, CHANNEL_CHECK_INTERVAL_US));
+
+    _on_check_timer(NULL);
+}
+
+/* -------------------------------------------------------------------------- */
+
+uint8_t app_channel_current(void) {
+    return atomic_load_explicit(&_channel, memory_order_relaxed);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_channel_get_stats(app_channel_stats_t *out) {
+    out->channel = atomic_load_explicit(&_channel, memory_order_relaxed);
+    out->scans = atomic_load_explicit(&_stats.scans, memory_order_relaxed);
+    out->deferred = atomic_load_explicit(&_stats.deferred, memory_order_relaxed);
+    out->switches = atomic_load_explicit(&_stats.switches, memory_order_relaxed);
+    out->last_ap_count = atomic_load_explicit(&_stats.last_ap_count, memory_order_relaxed);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_channel_log(void) {
+    app_channel_stats_t stats;
+    app_channel_get_stats(&stats);
+    ESP_LOGI(TAG,
+             "Channel %u: %" PRIu32 " scans, %" PRIu32 " deferred by traffic, %" PRIu32 " switches, %" PRIu32
+             " APs seen last",
+             stats.channel,
+             stats.scans,
+             stats.deferred,
+             stats.switches,
+             stats.last_ap_count);
+}
+
+/* -------------------------------------------------------------------------- */
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef struct {
+    uint8_t channel;
+    uint32_t scans;
+    uint32_t deferred;
+    uint32_t switches;
+    uint32_t last_ap_count;
+} app_channel_stats_t;
+
+void app_channel_start(uint8_t channel);
+void app_channel_check(void);
+void app_channel_scan_done(void);
+uint8_t app_channel_current(void);
+void app_channel_get_stats(app_channel_stats_t *out);
+void app_channel_log(void);
@@ -0,0 +1,113 @@
+#include "app_channel_plan.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+/* -------------------------------------------------------------------------- */
+
+// Scan results in, a channel out. Running the scan and switching the SoftAP stay in app_channel.c.
+
+#define PLAN_RSSI_FLOOR      (-100)
+#define PLAN_STRENGTH_MAX    (70)
+// Airtime an AP on the same channel takes, in the units of one percent of strength
+#define PLAN_CO_CHANNEL_COST (2000)
+#define PLAN_OVERLAP_SPAN    (5)
+
+// Spectrum shared by two 22 MHz wide channels 5 MHz apart per step, in percent
+static const uint32_t OVERLAP_PERCENT[PLAN_OVERLAP_SPAN] = { 100, 77, 55, 32, 9 };
+
+/* -------------------------------------------------------------------------- */
+
+static uint32_t _strength(int8_t rssi) {
+    int strength = rssi - PLAN_RSSI_FLOOR;
+    if (strength < 1) {
+        return 1;
+    }
+    return (strength > PLAN_STRENGTH_MAX) ? PLAN_STRENGTH_MAX : (uint32_t)strength;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _add_energy(app_channel_scores_t *out, uint8_t occupied, uint32_t strength) {
+    if ((occupied == 0) || (occupied > APP_CHANNEL_PLAN_MAX)) {
+        return;
+    }
+    for (int channel = 1; channel <= APP_CHANNEL_PLAN_MAX; channel++) {
+        int distance = (channel > occupied) ? channel - occupied : occupied - channel;
+        if (distance < PLAN_OVERLAP_SPAN) {
+            out->cost[channel] += OVERLAP_PERCENT[distance] * strength;
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Co-channel APs share airtime, overlapping ones only add noise scaled by how much spectrum they share */
+void app_channel_plan_score(const app_channel_observation_t *observations, size_t count, app_channel_scores_t *out) {
+    memset(out, 0, sizeof(*out));
+    for (size_t i = 0; i < count; i++) {
+        const app_channel_observation_t *ap = &observations[i];
+        if ((ap->primary == 0) || (ap->primary > APP_CHANNEL_PLAN_MAX)) {
+            continue;
+        }
+        uint32_t strength = _strength(ap->rssi);
+        out->ap_count[ap->primary]++;
+        out->cost[ap->primary] += PLAN_CO_CHANNEL_COST;
+        _add_energy(out, ap->primary, strength);
+        _add_energy(out, ap->secondary, strength);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool _is_non_overlapping(uint8_t channel) {
+    return (channel == 1) || (channel == 6) || (channel == 11);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Ties prefer the current channel, then 1, 6 and 11, which leave the most room to neighbours */
+static bool _is_better(const app_channel_scores_t *scores, uint8_t candidate, uint8_t best, uint8_t current) {
+    if (scores->cost[candidate] != scores->cost[best]) {
+        return scores->cost[candidate] < scores->cost[best];
+    }
+    if ((best == current) || (candidate == current)) {
+        return candidate == current;
+    }
+    return _is_non_overlapping(candidate) && (_is_non_overlapping(best) == false);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* The current channel is kept unless the best one costs at least hysteresis_percent less */
+uint8_t app_channel_plan_pick(const app_channel_scores_t *scores,
+                              uint8_t first,
+                              uint8_t last,
+                              uint8_t current,
+                              uint32_t hysteresis_percent) {
+    if (last > APP_CHANNEL_PLAN_MAX) {
+        last = APP_CHANNEL_PLAN_MAX;
+    }
+    if ((first == 0) || (first > last)) {
+        return current;
+    }
+    if (hysteresis_percent > 100) {
+        hysteresis_percent = 100;
+    }
+
+    uint8_t best = first;
+    for (uint8_t channel = first + 1; channel <= last; channel++) {
+        if (_is_better(scores, channel, best, current)) {
+            best = channel;
+        }
+    }
+
+    bool is_current_allowed = (current >= first) && (current <= last);
+    if ((is_current_allowed == false) || (best == current)) {
+        return best;
+    }
+    uint64_t kept_cost = (uint64_t)scores->cost[current] * (100 - hysteresis_percent);
+    return ((uint64_t)scores->cost[best] * 100 < kept_cost) ? best : current;
+}
+
+/* -------------------------------------------------------------------------- */
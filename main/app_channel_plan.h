@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define APP_CHANNEL_PLAN_MAX (13)
+
+typedef struct {
+    uint8_t primary;
+    // 0 unless the AP uses a 40 MHz channel, then primary +/- 4
+    uint8_t secondary;
+    int8_t rssi;
+} app_channel_observation_t;
+
+typedef struct {
+    // Indexed by channel, entry 0 is unused
+    uint32_t cost[APP_CHANNEL_PLAN_MAX + 1];
+    uint8_t ap_count[APP_CHANNEL_PLAN_MAX + 1];
+} app_channel_scores_t;
+
+void app_channel_plan_score(const app_channel_observation_t *observations, size_t count, app_channel_scores_t *out);
+uint8_t app_channel_plan_pick(const app_channel_scores_t *scores,
+                              uint8_t first,
+                              uint8_t last,
+                              uint8_t current,
+                              uint32_t hysteresis_percent);
@@ -0,0 +1,491 @@
+#include "app_config.h"
+
+#include "app_http.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+
+/* -------------------------------------------------------------------------- */
+
+static const char *TAG = "app_config.c";
+
+#define STORE_NVS_NAMESPACE "gateway"
+#define STORE_NVS_KEY       "config"
+// Bump when app_config_t changes layout, blobs of another version fall back to the Kconfig defaults
+#define STORE_VERSION       (1)
+#define WIFI_CHANNEL_MAX    (13)
+#define WIFI_PASSWORD_MIN   (8)
+#define API_BODY_MAX        (512)
+#define API_FIELD_MAX       (3 * APP_CONFIG_PASSWORD_MAX + 1)
+#define API_NUMBER_MAX      (8)
+#define API_REPLY_MAX       (1024)
+#define API_CONTENT_TYPE    "application/json"
+
+_Static_assert(APP_CONFIG_STATIONS_MAX <= ESP_WIFI_MAX_CONN_NUM, "More stations than the Wi-Fi driver accepts");
+_Static_assert(CONFIG_LWIP_DHCPS_MAX_STATION_NUM >= APP_CONFIG_STATIONS_MAX, "DHCP server leases fewer stations");
+
+typedef struct {
+    uint16_t version;
+    uint16_t size;
+    uint32_t revision;
+    app_config_t config;
+} _stored_t;
+
+static portMUX_TYPE _config_lock = portMUX_INITIALIZER_UNLOCKED;
+static app_config_t _config;
+static uint32_t _revision;
+// Keeps NVS and the live copy in the same order when writers race
+static SemaphoreHandle_t _p_write_lock;
+static app_config_changed_cb_t _p_on_changed;
+
+/* -------------------------------------------------------------------------- */
+
+static void _load_defaults(app_config_t *config) {
+    memset(config, 0, sizeof(*config));
+    strlcpy(config->ssid, CONFIG_AIR_GATEWAY_AP_WIFI_SSID, sizeof(config->ssid));
+    strlcpy(config->password, CONFIG_AIR_GATEWAY_AP_WIFI_PASS, sizeof(config->password));
+    config->channel = CONFIG_AIR_GATEWAY_AP_WIFI_CHANNEL;
+    config->max_stations = CONFIG_AIR_GATEWAY_AP_MAX_STA_CONN;
+    strlcpy(config->apn, CONFIG_GATEWAY_MODEM_PPP_APN, sizeof(config->apn));
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool _load_stored(_stored_t *stored) {
+    nvs_handle_t nvs;
+    if (nvs_open(STORE_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return false;
+    }
+    size_t len = sizeof(*stored);
+    esp_err_t err = nvs_get_blob(nvs, STORE_NVS_KEY, stored, &len);
+    nvs_close(nvs);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        return false;
+    }
+
+    if ((err != ESP_OK) || (len != sizeof(*stored)) || (stored->version != STORE_VERSION) ||
+        (stored->size != sizeof(stored->config)) || (app_config_validate(&stored->config) != ESP_OK)) {
+        ESP_LOGW(TAG, "Stored configuration is unreadable or of another version, using the defaults");
+        return false;
+    }
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static esp_err_t _save(const _stored_t *stored) {
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(STORE_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_blob(nvs, STORE_NVS_KEY, stored, sizeof(*stored));
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    return err;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool _is_printable(const char *text) {
+    for (; *text != '\0'; text++) {
+        if (((unsigned char)*text < 0x20) || (*text == 0x7F)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint32_t _changes(const app_config_t *from, const app_config_t *to) {
+    uint32_t changes = 0;
+    if ((strcmp(from->ssid, to->ssid) != 0) || (strcmp(from->password, to->password) != 0) ||
+        (from->channel != to->channel) || (from->max_stations != to->max_stations)) {
+        changes |= APP_CONFIG_CHANGE_WIFI;
+    }
+    if (strcmp(from->apn, to->apn) != 0) {
+        changes |= APP_CONFIG_CHANGE_APN;
+    }
+    return changes;
+}
+
+/* -------------------------------------------------------------------------- */
+
+esp_err_t app_config_validate(const app_config_t *config) {
+    size_t ssid_len = strnlen(config->ssid, sizeof(config->ssid));
+    size_t password_len = strnlen(config->password, sizeof(config->password));
+    size_t apn_len = strnlen(config->apn, sizeof(config->apn));
+
+    if ((ssid_len == 0) || (ssid_len == sizeof(config->ssid))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // WPA2 passphrases are 8 to 63 characters, an empty one leaves the SoftAP open
+    if ((password_len == sizeof(config->password)) || ((password_len != 0) && (password_len < WIFI_PASSWORD_MIN))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if ((config->channel < 1) || (config->channel > WIFI_CHANNEL_MAX)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if ((config->max_stations < 1) || (config->max_stations > APP_CONFIG_STATIONS_MAX)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // The APN is sent inside a quoted AT+CGDCONT argument
+    if ((apn_len == 0) || (apn_len == sizeof(config->apn)) || (strchr(config->apn, '"') != NULL) ||
+        (_is_printable(config->apn) == false)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_config_get(app_config_t *out) {
+    portENTER_CRITICAL(&_config_lock);
+    *out = _config;
+    portEXIT_CRITICAL(&_config_lock);
+}
+
+/* -------------------------------------------------------------------------- */
+
+uint32_t app_config_revision(void) {
+    portENTER_CRITICAL(&_config_lock);
+    uint32_t revision = _revision;
+    portEXIT_CRITICAL(&_config_lock);
+    return revision;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Stored before it is applied, so a reboot in between comes up with the new configuration */
+esp_err_t app_config_set(const app_config_t *config, uint32_t *out_changes) {
+    *out_changes = 0;
+    esp_err_t err = app_config_validate(config);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    xSemaphoreTake(_p_write_lock, portMAX_DELAY);
+    app_config_t current;
+    app_config_get(&current);
+    uint32_t changes = _changes(&current, config);
+    _stored_t stored = {
+        .version = STORE_VERSION,
+        .size = sizeof(stored.config),
+        .revision = app_config_revision() + 1,
+        .config = *config,
+    };
+    if (changes != 0) {
+        err = _save(&stored);
+    }
+    if ((changes != 0) && (err == ESP_OK)) {
+        portENTER_CRITICAL(&_config_lock);
+        _config = stored.config;
+        _revision = stored.revision;
+        portEXIT_CRITICAL(&_config_lock);
+    }
+    xSemaphoreGive(_p_write_lock);
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to store the configuration with %d", err);
+        return err;
+    }
+    if (changes == 0) {
+        return ESP_OK;
+    }
+
+    ESP_LOGI(TAG, "Configuration revision %" PRIu32 " stored, changes 0x%" PRIx32, stored.revision, changes);
+    if (_p_on_changed != NULL) {
+        _p_on_changed(changes);
+    }
+    *out_changes = changes;
+    return ESP_OK;
+}
+
+/* -------------------------------------------------------------------------- */
+
+#if CONFIG_AIR_GATEWAY_CONFIG_API
+
+// The HTTP server has a single worker task, requests never overlap
+static char _body[API_BODY_MAX];
+static char _reply[API_REPLY_MAX];
+
+/* -------------------------------------------------------------------------- */
+
+static int _hex_value(char c) {
+    if ((c >= '0') && (c <= '9')) {
+        return c - '0';
+    }
+    if ((c >= 'a') && (c <= 'f')) {
+        return c - 'a' + 10;
+    }
+    if ((c >= 'A') && (c <= 'F')) {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Form values arrive URL encoded, decoding never makes them longer */
+static bool _url_decode(char *text) {
+    char *out = text;
+    for (const char *in = text; *in != '\0'; in++) {
+        if (*in == '+') {
+            *out++ = ' ';
+        } else if (*in == '%') {
+            int high = _hex_value(in[1]);
+            int low = (high < 0) ? -1 : _hex_value(in[2]);
+            if (low < 0) {
+                return false;
+            }
+            *out++ = (char)((high << 4) | low);
+            in += 2;
+        } else {
+            *out++ = *in;
+        }
+    }
+    *out = '\0';
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* A missing key leaves out untouched, a value that does not decode or fit fails the request */
+static bool _form_string(const char *body, const char *key, char *out, size_t out_size) {
+    char value[API_FIELD_MAX];
+    esp_err_t err = httpd_query_key_value(body, key, value, sizeof(value));
+    if (err == ESP_ERR_NOT_FOUND) {
+        return true;
+    }
+    if ((err != ESP_OK) || (_url_decode(value) == false)) {
+        return false;
+    }
+    size_t len = strlen(value);
+    if (len >= out_size) {
+        return false;
+    }
+    memcpy(out, value, len + 1);
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool _form_number(const char *body, const char *key, uint8_t *out) {
+    char text[API_NUMBER_MAX] = { 0 };
+    if (_form_string(body, key, text, sizeof(text)) == false) {
+        return false;
+    }
+    if (text[0] == '\0') {
+        return true;
+    }
+    char *end = NULL;
+    unsigned long value = strtoul(text, &end, 10);
+    if ((*end != '\0') || (value > UINT8_MAX)) {
+        return false;
+    }
+    *out = (uint8_t)value;
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Writes need the current SoftAP password, an open SoftAP already trusts every station that joined */
+static bool _is_authorized(const char *body, const app_config_t *current) {
+    if (current->password[0] == '\0') {
+        return true;
+    }
+    char key[APP_CONFIG_PASSWORD_MAX + 1] = { 0 };
+    if (_form_string(body, "key", key, sizeof(key)) == false) {
+        return false;
+    }
+    // Both zero padded and compared in full, the time taken does not tell how many characters matched
+    char expected[APP_CONFIG_PASSWORD_MAX + 1];
+    strncpy(expected, current->password, sizeof(expected));
+    uint8_t diff = 0;
+    for (size_t i = 0; i < sizeof(key); i++) {
+        diff |= (uint8_t)(key[i] ^ expected[i]);
+    }
+    return diff == 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static size_t _json_string(char *out, size_t size, const char *text) {
+    size_t len = 0;
+    for (; (*text != '\0') && (len + 7 < size); text++) {
+        unsigned char c = (unsigned char)*text;
+        if ((c == '"') || (c == '\\')) {
+            out[len++] = '\\';
+            out[len++] = (char)c;
+        } else if (c < 0x20) {
+            len += snprintf(&out[len], size - len, "\\u%04x", c);
+        } else {
+            out[len++] = (char)c;
+        }
+    }
+    out[len] = '\0';
+    return len;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* The password itself is never sent back, only whether the SoftAP is secured */
+static esp_err_t _send_config(httpd_req_t *req, bool is_update, uint32_t changes) {
+    app_config_t config;
+    app_config_get(&config);
+    char ssid[6 * APP_CONFIG_SSID_MAX + 1];
+    char apn[6 * APP_CONFIG_APN_MAX + 1];
+    _json_string(ssid, sizeof(ssid), config.ssid);
+    _json_string(apn, sizeof(apn), config.apn);
+
+    int len = snprintf(_reply,
+                       sizeof(_reply),
+                       "{\"revision\":%" PRIu32 ",\"ssid\":\"%s\",\"secured\":%s,\"channel\":%u,"
+                       "\"max_stations\":%u,\"apn\":\"%s\"",
+                       app_config_revision(),
+                       ssid,
+                       (config.password[0] != '\0') ? "true" : "false",
+                       (unsigned)config.channel,
+                       (unsigned)config.max_stations,
+                       apn);
+    if (is_update && (len > 0) && ((size_t)len < sizeof(_reply))) {
+        len += snprintf(&_reply[len],
+                        sizeof(_reply) - len,
+                        ",\"wifi_changed\":%s,\"apn_changed\":%s",
+                        (changes & APP_CONFIG_CHANGE_WIFI) ? "true" : "false",
+                        (changes & APP_CONFIG_CHANGE_APN) ? "true" : "false");
+    }
+    if ((len < 0) || ((size_t)len + 2 > sizeof(_reply))) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, NULL);
+    }
+    _reply[len++] = '}';
+    _reply[len] = '\0';
+
+    httpd_resp_set_type(req, API_CONTENT_TYPE);
+    return httpd_resp_send(req, _reply, len);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool _read_body(httpd_req_t *req) {
+    if (req->content_len >= sizeof(_body)) {
+        return false;
+    }
+    size_t received = 0;
+    while (received < req->content_len) {
+        int len = httpd_req_recv(req, &_body[received], req->content_len - received);
+        if (len <= 0) {
+            return false;
+        }
+        received += len;
+    }
+    _body[received] = '\0';
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static esp_err_t _on_get_config(httpd_req_t *req) {
+    if (app_http_is_from_softap(req) == false) {
+        return httpd_resp_send_err(req, HTTPD_403_FORBIDDEN, NULL);
+    }
+    return _send_config(req, false, 0);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Form encoded fields ssid, password, channel, max_stations and apn, omitted ones keep their value */
+static esp_err_t _on_post_config(httpd_req_t *req) {
+    if (app_http_is_from_softap(req) == false) {
+        return httpd_resp_send_err(req, HTTPD_403_FORBIDDEN, NULL);
+    }
+    if (_read_body(req) == false) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Body missing or too large");
+    }
+
+    app_config_t config;
+    app_config_get(&config);
+    if (_is_authorized(_body, &config) == false) {
+        return httpd_resp_send_err(req, HTTPD_403_FORBIDDEN, "Wrong key");
+    }
+
+    bool is_parsed = _form_string(_body, "ssid", config.ssid, sizeof(config.ssid)) &&
+                     _form_string(_body, "password", config.password, sizeof(config.password)) &&
+                     _form_number(_body, "channel", &config.channel) &&
+                     _form_number(_body, "max_stations", &config.max_stations) &&
+                     _form_string(_body, "apn", config.apn, sizeof(config.apn));
+    if ((is_parsed == false) || (app_config_validate(&config) != ESP_OK)) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid configuration");
+    }
+
+    uint32_t changes = 0;
+    if (app_config_set(&config, &changes) != ESP_OK) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to store the configuration");
+    }
+    return _send_config(req, true, changes);
+}
+
+#endif
+
+/* -------------------------------------------------------------------------- */
+
+/* Before the SoftAP and the modem read their settings */
+void app_config_init(void) {
+    _p_write_lock = xSemaphoreCreateMutex();
+    assert(_p_write_lock);
+
+    _stored_t stored;
+    bool is_stored = _load_stored(&stored);
+    if (is_stored) {
+        _config = stored.config;
+        _revision = stored.revision;
+    } else {
+        _load_defaults(&_config);
+        _revision = 0;
+    }
+    ESP_LOGI(TAG,
+             "Configuration revision %" PRIu32 " (%s): SSID %s, channel %u, max stations %u, APN %s",
+             _revision,
+             is_stored ? "NVS" : "defaults",
+             _config.ssid,
+             (unsigned)_config.channel,
+             (unsigned)_config.max_stations,
+             _config.apn);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* After the HTTP server, changes are reported to on_changed from the writer's context */
+void app_config_start(app_config_changed_cb_t on_changed) {
+    _p_on_changed = on_changed;
+
+#if CONFIG_AIR_GATEWAY_CONFIG_API
+    const httpd_uri_t get_uri = {
+        .uri = "/config",
+        .method = HTTP_GET,
+        .handler = _on_get_config,
+    };
+    const httpd_uri_t post_uri = {
+        .uri = "/config",
+        .method = HTTP_POST,
+        .handler = _on_post_config,
+    };
+    if ((app_http_register(&get_uri) == ESP_OK) && (app_http_register(&post_uri) == ESP_OK)) {
+        ESP_LOGI(TAG, "Runtime configuration at /config");
+    }
+#endif
+}
+
+/* -------------------------------------------------------------------------- */
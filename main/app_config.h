@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_wifi_types.h"
+
+#define APP_CONFIG_SSID_MAX     (32)
+#define APP_CONFIG_PASSWORD_MAX (63)
+#define APP_CONFIG_APN_MAX      (63)
+// Upper end of the AIR_GATEWAY_AP_MAX_STA_CONN range, all the driver accepts. The station tables are sized for it.
+#define APP_CONFIG_STATIONS_MAX (15)
+
+#define APP_CONFIG_CHANGE_WIFI (1U << 0)
+#define APP_CONFIG_CHANGE_APN  (1U << 1)
+
+typedef struct {
+    char ssid[APP_CONFIG_SSID_MAX + 1];
+    char password[APP_CONFIG_PASSWORD_MAX + 1];
+    uint8_t channel;
+    uint8_t max_stations;
+    char apn[APP_CONFIG_APN_MAX + 1];
+} app_config_t;
+
+typedef void (*app_config_changed_cb_t)(uint32_t changes);
+
+void app_config_init(void);
+void app_config_start(app_config_changed_cb_t on_changed);
+void app_config_get(app_config_t *out);
+uint32_t app_config_revision(void);
+esp_err_t app_config_validate(const app_config_t *config);
+esp_err_t app_config_set(const app_config_t *config, uint32_t *out_changes);
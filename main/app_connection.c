@@ -0,0 +1,245 @@
+#include "app_connection.h"
+
+#include "app_affinity.h"
+#include "app_forward.h"
+#include "app_stats.h"
+
+#include <inttypes.h>
+
+#include "esp_log.h"
+#include "esp_modem_api.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#include "bsp_modem.h"
+
+/* -------------------------------------------------------------------------- */
+
+static const char *TAG = "app_connection.c";
+
+#define CONNECTION_TASK_STACK_SIZE (4096)
+#define CONNECTION_TASK_PRIORITY   (5)
+#define LINK_CHECK_INTERVAL_MS     (5000)
+#define BACKOFF_MAX_SHIFT          (10)
+
+static app_connection_up_cb_t _on_uplink_up;
+static app_connection_stats_t _stats;
+static portMUX_TYPE _stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* -------------------------------------------------------------------------- */
+
+static uint32_t _now_ms(void) {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool _wait_for_uplink(uint32_t timeout_ms) {
+    EventGroupHandle_t event_group = bsp_modem_eventgroup();
+    if (event_group == NULL) {
+        return false;
+    }
+    EventBits_t bits =
+        xEventGroupWaitBits(event_group, MODEM_CONNECT_BIT, pdFALSE, pdFALSE, pdMS_TO_TICKS(timeout_ms));
+    return (bits & MODEM_CONNECT_BIT) != 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _wait_for_uplink_loss(void) {
+    EventGroupHandle_t event_group = bsp_modem_eventgroup();
+    while (1) {
+        EventBits_t bits =
+            xEventGroupWaitBits(event_group, MODEM_LOST_BIT, pdTRUE, pdFALSE, pdMS_TO_TICKS(LINK_CHECK_INTERVAL_MS));
+        if ((bits & MODEM_LOST_BIT) != 0) {
+            return;
+        }
+        // Covers a loss reported between the connect event and clearing MODEM_LOST_BIT
+        if ((xEventGroupGetBits(event_group) & MODEM_CONNECT_BIT) == 0) {
+            return;
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint32_t _backoff_ms(uint32_t failures) {
+    uint32_t shift = (failures < BACKOFF_MAX_SHIFT) ? failures : BACKOFF_MAX_SHIFT;
+    uint32_t delay_ms = (uint32_t)CONFIG_AIR_GATEWAY_UPLINK_BACKOFF_MIN_MS << shift;
+    return (delay_ms < CONFIG_AIR_GATEWAY_UPLINK_BACKOFF_MAX_MS) ? delay_ms : CONFIG_AIR_GATEWAY_UPLINK_BACKOFF_MAX_MS;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static esp_err_t _run_recovery(app_connection_recovery_e recovery) {
+    ESP_LOGW(TAG, "Uplink recovery: %s", app_connection_recovery_name(recovery));
+
+    switch (recovery) {
+        case APP_CONNECTION_RECOVERY_REDIAL:
+            return bsp_modem_redial();
+
+        case APP_CONNECTION_RECOVERY_DATA_REENTRY:
+            return bsp_modem_reenter_data_mode();
+
+        case APP_CONNECTION_RECOVERY_RADIO_RESET:
+            return bsp_modem_radio_reset();
+
+        case APP_CONNECTION_RECOVERY_POWER_CYCLE:
+        default:
+            // The only rung that rebuilds the DTE and DCE
+            bsp_modem_deinit();
+            bsp_modem_power_up_por();
+            return bsp_modem_setup();
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _uplink_up(bool is_reconnect,
+                       app_connection_recovery_e recovery,
+                       uint32_t outage_start_ms,
+                       uint32_t attempt_start_ms) {
+    EventGroupHandle_t event_group = bsp_modem_eventgroup();
+    xEventGroupClearBits(event_group, MODEM_LOST_BIT);
+
+    esp_netif_t *modem_netif = air_gateway_get_modem_netif();
+    app_forward_set_uplink(modem_netif);
+    app_stats_mark_milestone(APP_STATS_MILESTONE_PPP_UP);
+
+    uint32_t now_ms = _now_ms();
+    uint32_t outage_ms = now_ms - outage_start_ms;
+    uint32_t reconnect_ms = now_ms - attempt_start_ms;
+
+    portENTER_CRITICAL(&_stats_lock);
+    _stats.is_up = true;
+    _stats.up_since_ms = now_ms;
+    if (is_reconnect == true) {
+        _stats.reconnects++;
+        _stats.last_outage_ms = outage_ms;
+        _stats.total_outage_ms += outage_ms;
+        if (outage_ms > _stats.max_outage_ms) {
+            _stats.max_outage_ms = outage_ms;
+        }
+        _stats.last_reconnect_latency_ms = reconnect_ms;
+        _stats.last_recovery = recovery;
+    }
+    portEXIT_CRITICAL(&_stats_lock);
+
+    if (is_reconnect == true) {
+        ESP_LOGW(TAG,
+                 "Uplink restored by %s: outage %" PRIu32 " ms, reconnect %" PRIu32 " ms",
+                 app_connection_recovery_name(recovery),
+                 outage_ms,
+                 reconnect_ms);
+    }
+
+    if (_on_uplink_up != NULL) {
+        _on_uplink_up(modem_netif);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _uplink_down(void) {
+    app_forward_set_uplink(NULL);
+
+    portENTER_CRITICAL(&_stats_lock);
+    _stats.is_up = false;
+    portEXIT_CRITICAL(&_stats_lock);
+
+    ESP_LOGW(TAG, "Uplink lost");
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _connection_task(void *arg) {
+    (void)arg;
+
+    bsp_modem_power_up_por();
+    app_stats_mark_milestone(APP_STATS_MILESTONE_MODEM_POWERED);
+
+    uint32_t outage_start_ms = _now_ms();
+    uint32_t attempt_start_ms = outage_start_ms;
+    bool is_reconnect = false;
+    app_connection_recovery_e recovery = APP_CONNECTION_RECOVERY_REDIAL;
+    uint32_t level_attempts = 0;
+    uint32_t failures = 0;
+
+    esp_err_t err = bsp_modem_setup();
+
+    while (1) {
+        if ((err == ESP_OK) && (_wait_for_uplink(CONFIG_AIR_GATEWAY_UPLINK_CONNECT_TIMEOUT_MS) == true)) {
+            _uplink_up(is_reconnect, recovery, outage_start_ms, attempt_start_ms);
+
+            _wait_for_uplink_loss();
+            _uplink_down();
+
+            outage_start_ms = _now_ms();
+            is_reconnect = true;
+            recovery = APP_CONNECTION_RECOVERY_REDIAL;
+            level_attempts = 0;
+            failures = 0;
+        } else {
+            ESP_LOGW(TAG, "Uplink attempt failed (%s)", (err == ESP_OK) ? "timeout" : esp_err_to_name(err));
+
+            failures++;
+            level_attempts++;
+            if ((level_attempts >= CONFIG_AIR_GATEWAY_UPLINK_ATTEMPTS_PER_LEVEL) &&
+                (recovery < APP_CONNECTION_RECOVERY_POWER_CYCLE)) {
+                recovery++;
+                level_attempts = 0;
+            }
+            vTaskDelay(pdMS_TO_TICKS(_backoff_ms(failures - 1)));
+        }
+
+        portENTER_CRITICAL(&_stats_lock);
+        _stats.recovery_attempts++;
+        portEXIT_CRITICAL(&_stats_lock);
+
+        attempt_start_ms = _now_ms();
+        err = _run_recovery(recovery);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_connection_start(app_connection_up_cb_t on_uplink_up) {
+    _on_uplink_up = on_uplink_up;
+    xTaskCreatePinnedToCore(_connection_task,
+                            "uplink",
+                            CONNECTION_TASK_STACK_SIZE,
+                            NULL,
+                            CONNECTION_TASK_PRIORITY,
+                            NULL,
+                            app_affinity_core(APP_AFFINITY_ROLE_MODEM));
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_connection_get_stats(app_connection_stats_t *out) {
+    portENTER_CRITICAL(&_stats_lock);
+    *out = _stats;
+    portEXIT_CRITICAL(&_stats_lock);
+}
+
+/* -------------------------------------------------------------------------- */
+
+const char *app_connection_recovery_name(app_connection_recovery_e recovery) {
+    switch (recovery) {
+        case APP_CONNECTION_RECOVERY_REDIAL:
+            return "PPP redial";
+        case APP_CONNECTION_RECOVERY_DATA_REENTRY:
+            return "data mode re-entry";
+        case APP_CONNECTION_RECOVERY_RADIO_RESET:
+            return "CFUN reset";
+        case APP_CONNECTION_RECOVERY_POWER_CYCLE:
+            return "PWR_KEY cycle";
+        default:
+            return "unknown";
+    }
+}
+
+/* -------------------------------------------------------------------------- */
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_netif.h"
+
+typedef enum {
+    APP_CONNECTION_RECOVERY_REDIAL = 0,
+    APP_CONNECTION_RECOVERY_DATA_REENTRY,
+    APP_CONNECTION_RECOVERY_RADIO_RESET,
+    APP_CONNECTION_RECOVERY_POWER_CYCLE,
+    APP_CONNECTION_RECOVERY_MAX,
+} app_connection_recovery_e;
+
+typedef struct {
+    bool is_up;
+    uint32_t up_since_ms;
+    uint32_t reconnects;
+    uint32_t recovery_attempts;
+    uint32_t last_outage_ms;
+    uint32_t max_outage_ms;
+    uint32_t total_outage_ms;
+    uint32_t last_reconnect_latency_ms;
+    app_connection_recovery_e last_recovery;
+} app_connection_stats_t;
+
+typedef void (*app_connection_up_cb_t)(esp_netif_t *modem_netif);
+
+void app_connection_start(app_connection_up_cb_t on_uplink_up);
+void app_connection_get_stats(app_connection_stats_t *out);
+const char *app_connection_recovery_name(app_connection_recovery_e recovery);
@@ -0,0 +1,661 @@
+#include "app_dns.h"
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcpip.h"
+#include "lwip/timeouts.h"
+#include "lwip/udp.h"
+#include "sdkconfig.h"
+
+#include "bsp_mem.h"
+
+/* -------------------------------------------------------------------------- */
+
+static const char *TAG = "app_dns.c";
+
+#define DNS_PORT                (53)
+#define DNS_HEADER_LEN          (12)
+#define DNS_MESSAGE_MAX         (512)
+#define DNS_QUERY_MAX           (320)
+#define DNS_SERVERS             (2)
+#define DNS_PENDING_MAX         (16)
+#define DNS_WAITERS_MAX         (4)
+#define DNS_PROBE_LEN           (4)
+#define DNS_TIMER_MS            (250)
+#define DNS_UPSTREAM_TIMEOUT_MS (1500)
+#define DNS_UPSTREAM_RETRIES    (2)
+
+#define DNS_FLAG_QR     (0x8000)
+#define DNS_FLAG_OPCODE (0x7800)
+#define DNS_FLAG_TC     (0x0200)
+#define DNS_RCODE_MASK  (0x000F)
+
+#define DNS_RCODE_NOERROR  (0)
+#define DNS_RCODE_NXDOMAIN (3)
+#define DNS_TYPE_SOA       (6)
+#define DNS_TYPE_OPT       (41)
+
+typedef struct {
+    uint32_t hash;
+    uint32_t stored_s;
+    uint32_t expires_s;
+    uint32_t last_used_s;
+    uint16_t question_end;
+    uint16_t response_len;
+    bool is_negative;
+} _dns_entry_t;
+
+typedef struct {
+    ip_addr_t addr;
+    uint16_t port;
+    uint16_t id;
+} _dns_waiter_t;
+
+typedef struct {
+    bool in_use;
+    uint32_t hash;
+    uint16_t upstream_id;
+    uint8_t server;
+    uint8_t retries;
+    uint32_t sent_ms;
+    uint16_t query_len;
+    uint16_t question_end;
+    uint8_t waiter_count;
+    _dns_waiter_t waiters[DNS_WAITERS_MAX];
+    uint8_t query[DNS_QUERY_MAX];
+} _dns_pending_t;
+
+// Everything below is owned by the tcpip thread, except the upstream hand-over
+static struct udp_pcb *_p_client_pcb;
+static struct udp_pcb *_p_upstream_pcb;
+static ip_addr_t _ap_ip;
+static ip_addr_t _servers[DNS_SERVERS];
+static _dns_entry_t _entries[CONFIG_AIR_GATEWAY_DNS_CACHE_ENTRIES];
+static uint8_t *_p_responses;
+static _dns_pending_t _pending[DNS_PENDING_MAX];
+static bool _is_timer_running;
+static uint8_t _scratch[DNS_MESSAGE_MAX];
+static uint64_t _latency_sum_ms;
+
+static ip4_addr_t _next_servers[DNS_SERVERS];
+static portMUX_TYPE _next_servers_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static app_dns_stats_t _stats;
+
+/* -------------------------------------------------------------------------- */
+
+static uint32_t _now_ms(void) {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint16_t _read16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint32_t _read32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _write32(uint8_t *p, uint32_t value) {
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static int _skip_name(const uint8_t *msg, int len, int offset) {
+    while (offset < len) {
+        uint8_t label = msg[offset];
+        if (label == 0) {
+            return offset + 1;
+        }
+        if ((label & 0xC0) == 0xC0) {
+            return (offset + 2 <= len) ? offset + 2 : -1;
+        }
+        offset += label + 1;
+    }
+    return -1;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Returns the offset just past the single question, the name is hashed case-insensitively with type and class */
+static int _parse_question(const uint8_t *msg, int len, uint32_t *hash) {
+    if ((len < DNS_HEADER_LEN) || (_read16(&msg[4]) != 1)) {
+        return -1;
+    }
+
+    uint32_t h = 2166136261u;
+    int offset = DNS_HEADER_LEN;
+    while ((offset < len) && (msg[offset] != 0)) {
+        if ((msg[offset] & 0xC0) != 0) {
+            return -1;
+        }
+        h = (h ^ msg[offset]) * 16777619u;
+        for (int i = 1; i <= msg[offset]; i++) {
+            if (offset + i >= len) {
+                return -1;
+            }
+            h = (h ^ (uint8_t)tolower(msg[offset + i])) * 16777619u;
+        }
+        offset += msg[offset] + 1;
+    }
+
+    offset += 1 + 4;
+    if (offset > len) {
+        return -1;
+    }
+    for (int i = offset - 4; i < offset; i++) {
+        h = (h ^ msg[i]) * 16777619u;
+    }
+    *hash = h;
+    return offset;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool _question_equal(const uint8_t *a, const uint8_t *b, int question_end) {
+    // Label length bytes are below 64 and unaffected by tolower()
+    for (int i = DNS_HEADER_LEN; i < question_end; i++) {
+        if (tolower(a[i]) != tolower(b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Walks all resource records after the question, calling back with the offset of each TTL field */
+typedef void (*_rr_cb_t)(uint8_t *msg, int section, uint16_t type, int ttl_offset, int rdata_offset, void *ctx);
+
+static bool _walk_records(uint8_t *msg, int len, int question_end, _rr_cb_t cb, void *ctx) {
+    int counts[3] = { _read16(&msg[6]), _read16(&msg[8]), _read16(&msg[10]) };
+    int offset = question_end;
+
+    for (int section = 0; section < 3; section++) {
+        for (int i = 0; i < counts[section]; i++) {
+            offset = _skip_name(msg, len, offset);
+            if ((offset < 0) || (offset + 10 > len)) {
+                return false;
+            }
+            uint16_t type = _read16(&msg[offset]);
+            uint16_t rdlen = _read16(&msg[offset + 8]);
+            if (offset + 10 + rdlen > len) {
+                return false;
+            }
+            cb(msg, section, type, offset + 4, offset + 10, ctx);
+            offset += 10 + rdlen;
+        }
+    }
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+typedef struct {
+    uint32_t min_ttl;
+    uint32_t soa_ttl;
+    bool has_soa;
+} _ttl_scan_t;
+
+static void _scan_ttl_cb(uint8_t *msg, int section, uint16_t type, int ttl_offset, int rdata_offset, void *ctx) {
+    _ttl_scan_t *scan = ctx;
+    uint32_t ttl = _read32(&msg[ttl_offset]);
+    uint16_t rdlen = _read16(&msg[ttl_offset + 4]);
+
+    if (type == DNS_TYPE_OPT) {
+        return;
+    }
+    if ((section == 0) && (ttl < scan->min_ttl)) {
+        scan->min_ttl = ttl;
+    }
+    // RFC 2308: negative answers live for min(SOA TTL, SOA MINIMUM)
+    if ((section == 1) && (type == DNS_TYPE_SOA) && (rdlen >= 4)) {
+        uint32_t minimum = _read32(&msg[rdata_offset + rdlen - 4]);
+        scan->soa_ttl = (ttl < minimum) ? ttl : minimum;
+        scan->has_soa = true;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _age_ttl_cb(uint8_t *msg, int section, uint16_t type, int ttl_offset, int rdata_offset, void *ctx) {
+    (void)section;
+    (void)rdata_offset;
+    uint32_t elapsed_s = *(const uint32_t *)ctx;
+    if (type == DNS_TYPE_OPT) {
+        return;
+    }
+    uint32_t ttl = _read32(&msg[ttl_offset]);
+    _write32(&msg[ttl_offset], (ttl > elapsed_s) ? ttl - elapsed_s : 0);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static _dns_entry_t *_cache_find(const uint8_t *query, uint32_t hash, int question_end) {
+    for (int i = 0; i < DNS_PROBE_LEN; i++) {
+        _dns_entry_t *entry = &_entries[(hash + i) % CONFIG_AIR_GATEWAY_DNS_CACHE_ENTRIES];
+        uint8_t *response = &_p_responses[(entry - _entries) * DNS_MESSAGE_MAX];
+        if ((entry->response_len != 0) && (entry->hash == hash) && (entry->question_end == question_end) &&
+            (_question_equal(query, response, question_end) == true)) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _cache_store(uint8_t *msg, int len, uint32_t hash, int question_end) {
+    if ((len > DNS_MESSAGE_MAX) || ((_read16(&msg[2]) & DNS_FLAG_TC) != 0)) {
+        return;
+    }
+
+    uint16_t rcode = _read16(&msg[2]) & DNS_RCODE_MASK;
+    if ((rcode != DNS_RCODE_NOERROR) && (rcode != DNS_RCODE_NXDOMAIN)) {
+        return;
+    }
+
+    _ttl_scan_t scan = { .min_ttl = UINT32_MAX };
+    if (_walk_records(msg, len, question_end, _scan_ttl_cb, &scan) == false) {
+        return;
+    }
+
+    bool is_negative = (rcode == DNS_RCODE_NXDOMAIN) || (_read16(&msg[6]) == 0);
+    uint32_t ttl = 0;
+    if (is_negative == true) {
+        ttl = (scan.has_soa == true) ? scan.soa_ttl : CONFIG_AIR_GATEWAY_DNS_NEGATIVE_TTL_S;
+        ttl = (ttl < CONFIG_AIR_GATEWAY_DNS_NEGATIVE_TTL_S) ? ttl : CONFIG_AIR_GATEWAY_DNS_NEGATIVE_TTL_S;
+    } else {
+        ttl = (scan.min_ttl < CONFIG_AIR_GATEWAY_DNS_MAX_TTL_S) ? scan.min_ttl : CONFIG_AIR_GATEWAY_DNS_MAX_TTL_S;
+    }
+    if (ttl == 0) {
+        return;
+    }
+
+    // Same question, an empty or expired slot, or else the least recently used one in the probe window
+    uint32_t now_s = _now_ms() / 1000;
+    _dns_entry_t *victim = _cache_find(msg, hash, question_end);
+    for (int i = 0; (victim == NULL) && (i < DNS_PROBE_LEN); i++) {
+        _dns_entry_t *entry = &_entries[(hash + i) % CONFIG_AIR_GATEWAY_DNS_CACHE_ENTRIES];
+        if ((entry->response_len == 0) || ((int32_t)(now_s - entry->expires_s) >= 0)) {
+            victim = entry;
+        }
+    }
+    for (int i = 0; (victim == NULL) && (i < DNS_PROBE_LEN); i++) {
+        _dns_entry_t *entry = &_entries[(hash + i) % CONFIG_AIR_GATEWAY_DNS_CACHE_ENTRIES];
+        if ((victim == NULL) || (entry->last_used_s < victim->last_used_s)) {
+            victim = entry;
+        }
+    }
+
+    if (victim->response_len == 0) {
+        _stats.cached_entries++;
+    }
+    victim->hash = hash;
+    victim->stored_s = now_s;
+    victim->expires_s = now_s + ttl;
+    victim->last_used_s = now_s;
+    victim->question_end = (uint16_t)question_end;
+    victim->response_len = (uint16_t)len;
+    victim->is_negative = is_negative;
+    memcpy(&_p_responses[(victim - _entries) * DNS_MESSAGE_MAX], msg, len);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _send_udp(struct udp_pcb *pcb, const uint8_t *msg, int len, const ip_addr_t *addr, uint16_t port) {
+    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, (u16_t)len, PBUF_RAM);
+    if (p == NULL) {
+        _stats.dropped++;
+        return;
+    }
+    pbuf_take(p, msg, (u16_t)len);
+    udp_sendto(pcb, p, addr, port);
+    pbuf_free(p);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool _reply_from_cache(const uint8_t *query,
+                              uint32_t hash,
+                              int question_end,
+                              const ip_addr_t *addr,
+                              uint16_t port) {
+    _dns_entry_t *entry = _cache_find(query, hash, question_end);
+    uint32_t now_s = _now_ms() / 1000;
+    if ((entry == NULL) || ((int32_t)(now_s - entry->expires_s) >= 0)) {
+        return false;
+    }
+
+    // Scratch already holds the query, it is no longer needed once the answer is built
+    uint16_t id = _read16(query);
+    memcpy(_scratch, &_p_responses[(entry - _entries) * DNS_MESSAGE_MAX], entry->response_len);
+    _scratch[0] = (uint8_t)(id >> 8);
+    _scratch[1] = (uint8_t)id;
+    uint32_t elapsed_s = now_s - entry->stored_s;
+    _walk_records(_scratch, entry->response_len, entry->question_end, _age_ttl_cb, &elapsed_s);
+
+    entry->last_used_s = now_s;
+    if (entry->is_negative == true) {
+        _stats.negative_hits++;
+    } else {
+        _stats.hits++;
+    }
+    _send_udp(_p_client_pcb, _scratch, entry->response_len, addr, port);
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _send_upstream(_dns_pending_t *pending) {
+    pending->upstream_id = (uint16_t)esp_random();
+    pending->query[0] = (uint8_t)(pending->upstream_id >> 8);
+    pending->query[1] = (uint8_t)pending->upstream_id;
+    pending->sent_ms = _now_ms();
+
+    if (ip_addr_isany(&_servers[pending->server])) {
+        pending->server = 0;
+    }
+    _send_udp(_p_upstream_pcb, pending->query, pending->query_len, &_servers[pending->server], DNS_PORT);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _on_timer(void *arg) {
+    (void)arg;
+    uint32_t now_ms = _now_ms();
+    bool has_pending = false;
+
+    for (int i = 0; i < DNS_PENDING_MAX; i++) {
+        _dns_pending_t *pending = &_pending[i];
+        if (pending->in_use == false) {
+            continue;
+        }
+        if ((now_ms - pending->sent_ms) >= DNS_UPSTREAM_TIMEOUT_MS) {
+            _stats.upstream_timeouts++;
+            if (pending->retries >= DNS_UPSTREAM_RETRIES) {
+                // Clients retry on their own, nothing is answered on their behalf
+                _stats.dropped += pending->waiter_count;
+                pending->in_use = false;
+                continue;
+            }
+            pending->retries++;
+            pending->server = (pending->server + 1) % DNS_SERVERS;
+            _send_upstream(pending);
+        }
+        has_pending = true;
+    }
+
+    _is_timer_running = has_pending;
+    if (has_pending == true) {
+        sys_timeout(DNS_TIMER_MS, _on_timer, NULL);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _on_client_query(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+    (void)arg;
+    (void)pcb;
+
+    int len = pbuf_copy_partial(p, _scratch, sizeof(_scratch), 0);
+    pbuf_free(p);
+
+    uint32_t hash = 0;
+    int question_end = _parse_question(_scratch, len, &hash);
+    if ((question_end < 0) || ((_read16(&_scratch[2]) & (DNS_FLAG_QR | DNS_FLAG_OPCODE)) != 0)) {
+        _stats.dropped++;
+        return;
+    }
+    _stats.queries++;
+
+    if (_reply_from_cache(_scratch, hash, question_end, addr, port) == true) {
+        return;
+    }
+    _stats.misses++;
+
+    _dns_pending_t *free_slot = NULL;
+    for (int i = 0; i < DNS_PENDING_MAX; i++) {
+        _dns_pending_t *pending = &_pending[i];
+        if (pending->in_use == false) {
+            free_slot = (free_slot != NULL) ? free_slot : pending;
+            continue;
+        }
+        // The same question is already on its way upstream, wait for that answer
+        if ((pending->hash == hash) && (pending->question_end == question_end) &&
+            (_question_equal(pending->query, _scratch, question_end) == true)) {
+            if (pending->waiter_count >= DNS_WAITERS_MAX) {
+                _stats.dropped++;
+                return;
+            }
+            _dns_waiter_t *waiter = &pending->waiters[pending->waiter_count++];
+            ip_addr_copy(waiter->addr, *addr);
+            waiter->port = port;
+            waiter->id = _read16(_scratch);
+            _stats.coalesced++;
+            return;
+        }
+    }
+
+    if ((free_slot == NULL) || (len > DNS_QUERY_MAX)) {
+        _stats.dropped++;
+        return;
+    }
+
+    free_slot->in_use = true;
+    free_slot->hash = hash;
+    free_slot->server = 0;
+    free_slot->retries = 0;
+    free_slot->query_len = (uint16_t)len;
+    free_slot->question_end = (uint16_t)question_end;
+    free_slot->waiter_count = 1;
+    ip_addr_copy(free_slot->waiters[0].addr, *addr);
+    free_slot->waiters[0].port = port;
+    free_slot->waiters[0].id = _read16(_scratch);
+    memcpy(free_slot->query, _scratch, len);
+    _send_upstream(free_slot);
+
+    if (_is_timer_running == false) {
+        _is_timer_running = true;
+        sys_timeout(DNS_TIMER_MS, _on_timer, NULL);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _on_upstream_reply(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port) {
+    (void)arg;
+    (void)pcb;
+
+    int len = pbuf_copy_partial(p, _scratch, sizeof(_scratch), 0);
+    uint16_t id = (len >= 2) ? _read16(_scratch) : 0;
+
+    _dns_pending_t *pending = NULL;
+    for (int i = 0; i < DNS_PENDING_MAX; i++) {
+        if ((_pending[i].in_use == true) && (_pending[i].upstream_id == id)) {
+            pending = &_pending[i];
+            break;
+        }
+    }
+
+    uint32_t hash = 0;
+    if ((pending == NULL) || (port != DNS_PORT) || (ip_addr_cmp(addr, &_servers[pending->server]) == 0) ||
+        (_parse_question(_scratch, len, &hash) != pending->question_end) ||
+        (_question_equal(_scratch, pending->query, pending->question_end) == false)) {
+        pbuf_free(p);
+        return;
+    }
+
+    uint32_t latency_ms = _now_ms() - pending->sent_ms;
+    _stats.upstream_replies++;
+    _latency_sum_ms += latency_ms;
+    _stats.upstream_latency_avg_ms = (uint32_t)(_latency_sum_ms / _stats.upstream_replies);
+    if (latency_ms > _stats.upstream_latency_max_ms) {
+        _stats.upstream_latency_max_ms = latency_ms;
+    }
+
+    if (p->tot_len <= DNS_MESSAGE_MAX) {
+        _cache_store(_scratch, len, hash, pending->question_end);
+    }
+
+    // Answers above the classic size (EDNS) are relayed from the pbuf without being cached
+    for (int i = 0; i < pending->waiter_count; i++) {
+        _dns_waiter_t *waiter = &pending->waiters[i];
+        struct pbuf *reply = pbuf_clone(PBUF_TRANSPORT, PBUF_RAM, p);
+        if (reply == NULL) {
+            _stats.dropped++;
+            continue;
+        }
+        pbuf_put_at(reply, 0, (u8_t)(waiter->id >> 8));
+        pbuf_put_at(reply, 1, (u8_t)waiter->id);
+        udp_sendto(_p_client_pcb, reply, &waiter->addr, waiter->port);
+        pbuf_free(reply);
+    }
+
+    pending->in_use = false;
+    pbuf_free(p);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _apply_upstream_in_tcpip(void *ctx) {
+    (void)ctx;
+
+    portENTER_CRITICAL(&_next_servers_lock);
+    for (int i = 0; i < DNS_SERVERS; i++) {
+        ip_addr_set_ip4_u32(&_servers[i], _next_servers[i].addr);
+    }
+    portEXIT_CRITICAL(&_next_servers_lock);
+
+    // Queries in flight towards a server of the previous session are re-sent right away
+    for (int i = 0; i < DNS_PENDING_MAX; i++) {
+        if (_pending[i].in_use == true) {
+            _pending[i].server = 0;
+            _send_upstream(&_pending[i]);
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _start_in_tcpip(void *ctx) {
+    (void)ctx;
+
+    _p_client_pcb = udp_new_ip_type(IPADDR_TYPE_V4);
+    _p_upstream_pcb = udp_new_ip_type(IPADDR_TYPE_V4);
+    assert(_p_client_pcb && _p_upstream_pcb);
+
+    if ((udp_bind(_p_client_pcb, &_ap_ip, DNS_PORT) != ERR_OK) ||
+        (udp_bind(_p_upstream_pcb, IP4_ADDR_ANY, 0) != ERR_OK)) {
+        ESP_LOGE(TAG, "Failed to bind DNS forwarder sockets");
+        return;
+    }
+    udp_recv(_p_client_pcb, _on_client_query, NULL);
+    udp_recv(_p_upstream_pcb, _on_upstream_reply, NULL);
+
+    _apply_upstream_in_tcpip(NULL);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _set_next_servers(uint32_t main, uint32_t backup) {
+    portENTER_CRITICAL(&_next_servers_lock);
+    _next_servers[0].addr = main;
+    _next_servers[1].addr = backup;
+    portEXIT_CRITICAL(&_next_servers_lock);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_dns_start(esp_netif_t *ap_netif) {
+    esp_netif_ip_info_t ip_info;
+    ESP_ERROR_CHECK(esp_netif_get_ip_info(ap_netif, &ip_info));
+    ip_addr_set_ip4_u32(&_ap_ip, ip_info.ip.addr);
+
+    // Cached answers are only touched on a cache hit, PSRAM is good enough for them
+    _p_responses = bsp_mem_calloc(BSP_MEM_DNS, BSP_MEM_BULK, CONFIG_AIR_GATEWAY_DNS_CACHE_ENTRIES, DNS_MESSAGE_MAX);
+    assert(_p_responses);
+
+    uint32_t fallback = esp_ip4addr_aton(CONFIG_AIR_GATEWAY_FALLBACK_DNS);
+    _set_next_servers(fallback, fallback);
+    if (tcpip_callback(_start_in_tcpip, NULL) != ERR_OK) {
+        ESP_LOGE(TAG, "Failed to start DNS forwarder");
+        return;
+    }
+
+    ESP_LOGI(TAG,
+             "DNS forwarder on " IPSTR ", %d cache entries",
+             IP2STR(&ip_info.ip),
+             CONFIG_AIR_GATEWAY_DNS_CACHE_ENTRIES);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_dns_set_upstream(esp_netif_t *uplink_netif) {
+    uint32_t fallback = esp_ip4addr_aton(CONFIG_AIR_GATEWAY_FALLBACK_DNS);
+    uint32_t servers[DNS_SERVERS] = { fallback, fallback };
+    esp_netif_dns_type_t types[DNS_SERVERS] = { ESP_NETIF_DNS_MAIN, ESP_NETIF_DNS_BACKUP };
+
+    for (int i = 0; i < DNS_SERVERS; i++) {
+        esp_netif_dns_info_t dns;
+        if ((esp_netif_get_dns_info(uplink_netif, types[i], &dns) == ESP_OK) && (dns.ip.u_addr.ip4.addr != 0)) {
+            servers[i] = dns.ip.u_addr.ip4.addr;
+        }
+    }
+    // A peer that hands out a single resolver still leaves the fallback as the second choice
+    if (servers[0] == fallback) {
+        ESP_LOGW(TAG, "Uplink provided no DNS server, using " CONFIG_AIR_GATEWAY_FALLBACK_DNS);
+    }
+
+    _set_next_servers(servers[0], servers[1]);
+    if (tcpip_callback(_apply_upstream_in_tcpip, NULL) != ERR_OK) {
+        ESP_LOGE(TAG, "Failed to switch DNS upstream");
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_dns_get_stats(app_dns_stats_t *out) {
+    *out = _stats;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_dns_log(void) {
+    app_dns_stats_t stats;
+    app_dns_get_stats(&stats);
+
+    uint32_t answered = stats.hits + stats.negative_hits;
+    ESP_LOGI(TAG,
+             "DNS: %" PRIu32 " queries, hit rate %" PRIu32 "%% (%" PRIu32 " negative), %" PRIu32 " coalesced, %" PRIu32
+             " cached; upstream avg %" PRIu32 " ms, max %" PRIu32 " ms, %" PRIu32 " timeouts, %" PRIu32 " dropped",
+             stats.queries,
+             (stats.queries > 0) ? (answered * 100) / stats.queries : 0,
+             stats.negative_hits,
+             stats.coalesced,
+             stats.cached_entries,
+             stats.upstream_latency_avg_ms,
+             stats.upstream_latency_max_ms,
+             stats.upstream_timeouts,
+             stats.dropped);
+}
+
+/* -------------------------------------------------------------------------- */
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_netif.h"
+
+typedef struct {
+    uint32_t queries;
+    uint32_t hits;
+    uint32_t negative_hits;
+    uint32_t misses;
+    uint32_t coalesced;
+    uint32_t upstream_timeouts;
+    uint32_t dropped;
+    uint32_t upstream_replies;
+    uint32_t upstream_latency_avg_ms;
+    uint32_t upstream_latency_max_ms;
+    uint32_t cached_entries;
+} app_dns_stats_t;
+
+void app_dns_start(esp_netif_t *ap_netif);
+void app_dns_set_upstream(esp_netif_t *uplink_netif);
+void app_dns_get_stats(app_dns_stats_t *out);
+void app_dns_log(void);
@@ -0,0 +1,166 @@
+#include "app_forward.h"
+
+#include "app_idle.h"
+#include "app_lwip_hooks.h"
+#include "app_napt.h"
+#include "app_pmtu.h"
+#include "app_stations.h"
+#include "app_stats.h"
+#include "app_supervisor.h"
+#include "app_uplink_queue.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <lwip/netif.h>
+#include <lwip/pbuf.h>
+#include <lwip/prot/ethernet.h>
+#include <lwip/prot/ip4.h>
+#include <lwip/tcpip.h>
+
+#include "sdkconfig.h"
+
+#include "bsp_trace.h"
+
+/* -------------------------------------------------------------------------- */
+
+static struct netif *_p_ap_netif;
+static struct netif *_p_ppp_netif;
+static netif_linkoutput_fn _ap_linkoutput;
+static netif_output_fn _ppp_output;
+
+/* -------------------------------------------------------------------------- */
+
+/* The IPv4 header of a frame on its way to a station, NULL for anything else */
+static const uint8_t *_frame_ip(const struct pbuf *p) {
+    const uint8_t *frame = p->payload;
+    if ((p->len < SIZEOF_ETH_HDR + IP_HLEN) || (frame[12] != (ETHTYPE_IP >> 8)) || (frame[13] != (ETHTYPE_IP & 0xFF))) {
+        return NULL;
+    }
+    return &frame[SIZEOF_ETH_HDR];
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Everything sent to a station passes here, after NAPT has restored the private destination */
+static err_t _ap_linkoutput_counted(struct netif *netif, struct pbuf *p) {
+#if CONFIG_GATEWAY_PACKET_TRACE
+    if (_frame_ip(p) != NULL) {
+        BSP_TRACE(BSP_TRACE_AP_TX, _frame_ip(p), p->len - SIZEOF_ETH_HDR);
+    }
+#endif
+    app_stats_count_tx(APP_STATS_IF_AP, (p->tot_len > SIZEOF_ETH_HDR) ? p->tot_len - SIZEOF_ETH_HDR : 0);
+    // Counted here rather than on PPP ingress, traffic of the gateway itself such as the RAT probe is not activity
+    app_supervisor_note_traffic();
+    app_stations_count_down(p);
+    // DHCP and DNS answers of the gateway itself come from its own address, only the rest was forwarded
+    const uint8_t *ip = _frame_ip(p);
+    if ((ip != NULL) && (memcmp(&ip[12], &netif_ip4_addr(netif)->addr, sizeof(uint32_t)) != 0)) {
+        app_stats_mark_milestone(APP_STATS_MILESTONE_FIRST_FORWARD);
+#if CONFIG_AIR_GATEWAY_IDLE_SLEEP
+        app_idle_note_station_tx();
+#endif
+    }
+    return _ap_linkoutput(netif, p);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Below the uplink queue when it is enabled, so only packets actually handed to PPP are counted */
+static err_t _ppp_output_counted(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr) {
+    app_stats_count_tx(APP_STATS_IF_PPP, p->tot_len);
+    return _ppp_output(netif, p, ipaddr);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Queued ahead of the uplink queue attach, which then wraps the counted output */
+static void _count_uplink_in_tcpip(void *ctx) {
+    struct netif *netif = ctx;
+    if ((netif == NULL) || (netif->output == _ppp_output_counted)) {
+        return;
+    }
+#if CONFIG_AIR_GATEWAY_UPLINK_FQ_CODEL
+    // After the first attach the uplink queue sits on top and the counter is already below it
+    if (app_uplink_queue_is_wrapping(netif) == true) {
+        return;
+    }
+#endif
+    // The PPP netif survives redials, its output is wrapped only once
+    _ppp_output = netif->output;
+    netif->output = _ppp_output_counted;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_forward_init(esp_netif_t *ap_netif) {
+    _p_ap_netif = esp_netif_get_netif_impl(ap_netif);
+    assert(_p_ap_netif && _p_ap_netif->linkoutput);
+
+    // Installed before the SoftAP starts, so no frame is in flight through the old pointer
+    _ap_linkoutput = _p_ap_netif->linkoutput;
+    _p_ap_netif->linkoutput = _ap_linkoutput_counted;
+#if CONFIG_AIR_GATEWAY_PMTU
+    app_pmtu_init(_p_ap_netif);
+#endif
+#if CONFIG_AIR_GATEWAY_NAPT
+    app_napt_init(_p_ap_netif);
+#endif
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_forward_set_uplink(esp_netif_t *ppp_netif) {
+    _p_ppp_netif = (ppp_netif != NULL) ? esp_netif_get_netif_impl(ppp_netif) : NULL;
+    tcpip_callback(_count_uplink_in_tcpip, _p_ppp_netif);
+#if CONFIG_AIR_GATEWAY_PMTU
+    app_pmtu_set_uplink(_p_ppp_netif);
+#endif
+#if CONFIG_AIR_GATEWAY_NAPT
+    app_napt_set_uplink(_p_ppp_netif);
+#endif
+#if CONFIG_AIR_GATEWAY_UPLINK_FQ_CODEL
+    app_uplink_queue_attach(_p_ppp_netif);
+#endif
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Runs in the tcpip thread for every IPv4 packet, before lwIP routes it. Non-zero return means the packet is eaten. */
+int app_forward_ip4_input(struct pbuf *p, struct netif *inp) {
+    if (inp == _p_ap_netif) {
+        BSP_TRACE(BSP_TRACE_AP_RX, p->payload, p->len);
+        app_stats_count_rx(APP_STATS_IF_AP, p->tot_len);
+        app_supervisor_note_traffic();
+        app_stations_count_up(p);
+#if CONFIG_AIR_GATEWAY_PMTU
+        if (app_pmtu_outbound(p) != 0) {
+            return 1;
+        }
+#endif
+#if CONFIG_AIR_GATEWAY_NAPT
+        if (app_napt_outbound(p) != 0) {
+            return 1;
+        }
+#endif
+        BSP_TRACE(BSP_TRACE_AP_ROUTED, p->payload, p->len);
+    } else if (inp == _p_ppp_netif) {
+        BSP_TRACE(BSP_TRACE_PPP_INPUT, p->payload, p->len);
+        app_stats_count_rx(APP_STATS_IF_PPP, p->tot_len);
+#if CONFIG_AIR_GATEWAY_IDLE_SLEEP
+        app_idle_note_uplink_rx();
+#endif
+#if CONFIG_AIR_GATEWAY_PMTU
+        app_pmtu_inbound(p);
+#endif
+#if CONFIG_AIR_GATEWAY_NAPT
+        if (app_napt_inbound(p) != 0) {
+            return 1;
+        }
+#endif
+        BSP_TRACE(BSP_TRACE_PPP_ROUTED, p->payload, p->len);
+    }
+    return 0;
+}
+
+/* -------------------------------------------------------------------------- */
@@ -0,0 +1,6 @@
+#pragma once
+
+#include "esp_netif.h"
+
+void app_forward_init(esp_netif_t *ap_netif);
+void app_forward_set_uplink(esp_netif_t *ppp_netif);
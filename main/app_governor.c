@@ -0,0 +1,336 @@
+#include "app_governor.h"
+
+#include "app_affinity.h"
+#include "app_connection.h"
+#include "app_stats.h"
+#include "app_supervisor.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+
+#include "esp_log.h"
+#include "esp_modem_api.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#if CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#endif
+
+#include "bsp_battery.h"
+#include "bsp_modem.h"
+
+/* -------------------------------------------------------------------------- */
+
+static const char *TAG = "app_governor.c";
+
+#define GOVERNOR_TASK_STACK_SIZE (3072)
+#define GOVERNOR_TASK_PRIORITY   (2)
+
+// Automatic light sleep needs the tick-less idle, the PM locks decide when it may actually happen
+#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+#define GOVERNOR_LIGHT_SLEEP (true)
+#else
+#define GOVERNOR_LIGHT_SLEEP (false)
+#endif
+
+typedef struct {
+    uint16_t cpu_max_mhz;
+    uint16_t cpu_min_mhz;
+    // esp_wifi_set_max_tx_power() units of 0.25 dBm
+    int8_t tx_power_qdbm;
+    uint16_t beacon_interval_tu;
+    bool is_modem_power_save;
+} _operating_point_t;
+
+typedef struct {
+    atomic_uint_fast32_t level;
+    atomic_bool is_boosted;
+    atomic_uint_fast32_t traffic_kbps;
+    atomic_uint_fast32_t transitions;
+    atomic_uint_fast32_t level_since_ms;
+} _governor_stats_t;
+
+static const _operating_point_t OPERATING_POINTS[APP_GOVERNOR_LEVEL_MAX] = {
+    [APP_GOVERNOR_LEVEL_FULL] = { 240, 80, 78, 100, false },
+    [APP_GOVERNOR_LEVEL_BALANCED] = { 160, 80, 68, 100, false },
+    [APP_GOVERNOR_LEVEL_SAVER] = { 80, 40, 52, 200, true },
+    [APP_GOVERNOR_LEVEL_CRITICAL] = { 80, 40, 34, 300, true },
+};
+
+// Beacon interval still to be applied by the supervisor, 0 when none
+static atomic_uint_fast16_t _beacon_pending_tu;
+
+// Owned by the governor task
+static app_governor_level_e _level = APP_GOVERNOR_LEVEL_FULL;
+static uint32_t _level_since_ms;
+static bool _is_modem_pending;
+static uint32_t _uplink_reconnects;
+static uint32_t _last_traffic_bytes;
+static uint32_t _last_traffic_ms;
+#if CONFIG_PM_ENABLE
+static esp_pm_lock_handle_t _p_boost_lock;
+#endif
+
+static _governor_stats_t _stats;
+
+/* -------------------------------------------------------------------------- */
+
+static uint32_t _now_ms(void) {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint32_t _traffic_kbps(void) {
+    app_stats_if_t ap;
+    app_stats_if_t ppp;
+    app_stats_get_if(APP_STATS_IF_AP, &ap);
+    app_stats_get_if(APP_STATS_IF_PPP, &ppp);
+
+    uint32_t bytes = ap.rx_bytes + ppp.rx_bytes;
+    uint32_t now_ms = _now_ms();
+    uint32_t elapsed_ms = now_ms - _last_traffic_ms;
+    uint32_t kbps = (elapsed_ms == 0) ? 0 : (uint32_t)(((uint64_t)(bytes - _last_traffic_bytes) * 8) / elapsed_ms);
+    _last_traffic_bytes = bytes;
+    _last_traffic_ms = now_ms;
+    return kbps;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _apply_level(app_governor_level_e level) {
+    const _operating_point_t *point = &OPERATING_POINTS[level];
+
+#if CONFIG_PM_ENABLE
+    esp_pm_config_t pm_config = {
+        .max_freq_mhz = point->cpu_max_mhz,
+        .min_freq_mhz = point->cpu_min_mhz,
+        .light_sleep_enable = GOVERNOR_LIGHT_SLEEP,
+    };
+    esp_err_t err = esp_pm_configure(&pm_config);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to set CPU %u-%u MHz: %s", point->cpu_min_mhz, point->cpu_max_mhz, esp_err_to_name(err));
+    }
+#endif
+
+    if (esp_wifi_set_max_tx_power(point->tx_power_qdbm) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to set TX power to %d", point->tx_power_qdbm);
+    }
+
+    // Both need conditions that may not hold right now, they are retried every interval
+    atomic_store_explicit(&_beacon_pending_tu, point->beacon_interval_tu, memory_order_relaxed);
+    _is_modem_pending = true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* The channel planner and runtime configuration write the SoftAP configuration from the supervisor task as well, so
+ * the governor leaves the write to it instead of racing their get and set */
+static void _request_beacon_interval(void) {
+    uint16_t beacon_interval_tu = atomic_load_explicit(&_beacon_pending_tu, memory_order_relaxed);
+    wifi_sta_list_t stations;
+    if ((beacon_interval_tu == 0) || (esp_wifi_ap_get_sta_list(&stations) != ESP_OK) || (stations.num != 0)) {
+        return;
+    }
+    const app_supervisor_event_t event = {
+        .type = APP_SUPERVISOR_EVENT_BEACON_INTERVAL,
+        .beacon_interval_tu = beacon_interval_tu,
+    };
+    app_supervisor_post(&event);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _apply_modem_power_save(bool is_enabled) {
+    app_connection_stats_t uplink;
+    app_connection_get_stats(&uplink);
+
+    // A power cycle during recovery resets the modem to its defaults
+    if (uplink.reconnects != _uplink_reconnects) {
+        _uplink_reconnects = uplink.reconnects;
+        _is_modem_pending = true;
+    }
+    if ((_is_modem_pending == false) || (uplink.is_up == false)) {
+        return;
+    }
+
+    esp_err_t err = bsp_modem_set_power_save(is_enabled);
+    if (err == ESP_OK) {
+        _is_modem_pending = false;
+    } else if (err != ESP_ERR_TIMEOUT) {
+        ESP_LOGD(TAG, "Modem power save change failed with %s", esp_err_to_name(err));
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _set_boost(bool is_boosted) {
+    if (atomic_load_explicit(&_stats.is_boosted, memory_order_relaxed) == is_boosted) {
+        return;
+    }
+#if CONFIG_PM_ENABLE
+    if (_p_boost_lock != NULL) {
+        if (is_boosted) {
+            esp_pm_lock_acquire(_p_boost_lock);
+        } else {
+            esp_pm_lock_release(_p_boost_lock);
+        }
+    }
+#endif
+    atomic_store_explicit(&_stats.is_boosted, is_boosted, memory_order_relaxed);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _governor_step(void) {
+    bsp_battery_snapshot_t battery;
+    bsp_battery_get_snapshot(&battery);
+    app_governor_input_t input = {
+        .battery_mv = battery.battery_mv,
+        .capacity_percent = battery.capacity_percent,
+        .solar_mv = battery.solar_mv,
+    };
+
+    app_governor_level_e level = app_governor_plan_decide(_level, &input);
+    uint32_t now_ms = _now_ms();
+    if (app_governor_plan_may_switch(_level, level, now_ms - _level_since_ms) == true) {
+        ESP_LOGW(TAG,
+                 "%s -> %s at %" PRIu32 "mV (%" PRIu32 "%%), solar %" PRIu32 "mV",
+                 app_governor_level_name(_level),
+                 app_governor_level_name(level),
+                 input.battery_mv,
+                 input.capacity_percent,
+                 input.solar_mv);
+        _level = level;
+        _level_since_ms = now_ms;
+        _apply_level(level);
+        atomic_store_explicit(&_stats.level, level, memory_order_relaxed);
+        atomic_store_explicit(&_stats.level_since_ms, now_ms, memory_order_relaxed);
+        atomic_fetch_add_explicit(&_stats.transitions, 1, memory_order_relaxed);
+    }
+
+    const _operating_point_t *point = &OPERATING_POINTS[_level];
+    _request_beacon_interval();
+    _apply_modem_power_save(point->is_modem_power_save);
+
+    // Traffic bursts get the top CPU clock of the level at once, without waiting for the dwell time
+    uint32_t kbps = _traffic_kbps();
+    atomic_store_explicit(&_stats.traffic_kbps, kbps, memory_order_relaxed);
+    _set_boost((kbps >= CONFIG_AIR_GATEWAY_GOVERNOR_BUSY_KBPS) && (_level <= APP_GOVERNOR_LEVEL_BALANCED));
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _governor_task(void *arg) {
+    (void)arg;
+
+    _level_since_ms = _now_ms();
+    _last_traffic_ms = _level_since_ms;
+    atomic_store_explicit(&_stats.level_since_ms, _level_since_ms, memory_order_relaxed);
+    _apply_level(_level);
+
+    TickType_t last_wake = xTaskGetTickCount();
+    while (1) {
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(CONFIG_AIR_GATEWAY_GOVERNOR_INTERVAL_MS));
+        _governor_step();
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_governor_start(void) {
+#if CONFIG_PM_ENABLE
+    if (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "governor", &_p_boost_lock) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create the CPU boost lock");
+    }
+#else
+    ESP_LOGW(TAG, "Power management is disabled, the CPU clock stays fixed");
+#endif
+    xTaskCreatePinnedToCore(_governor_task,
+                            "governor",
+                            GOVERNOR_TASK_STACK_SIZE,
+                            NULL,
+                            GOVERNOR_TASK_PRIORITY,
+                            NULL,
+                            app_affinity_core(APP_AFFINITY_ROLE_BACKGROUND));
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Supervisor context. Changing the AP configuration restarts the SoftAP, so this waits until no station is
+ * associated. */
+void app_governor_apply_beacon_interval(uint16_t beacon_interval_tu) {
+    wifi_sta_list_t stations;
+    if ((esp_wifi_ap_get_sta_list(&stations) != ESP_OK) || (stations.num != 0)) {
+        return;
+    }
+
+    wifi_config_t config;
+    if (esp_wifi_get_config(WIFI_IF_AP, &config) != ESP_OK) {
+        return;
+    }
+    if (config.ap.beacon_interval != beacon_interval_tu) {
+        config.ap.beacon_interval = beacon_interval_tu;
+        if (esp_wifi_set_config(WIFI_IF_AP, &config) != ESP_OK) {
+            ESP_LOGW(TAG, "Failed to set beacon interval to %u TU", beacon_interval_tu);
+            return;
+        }
+    }
+    // A level change in the meantime has queued another interval, that one stays pending
+    uint_fast16_t applied_tu = beacon_interval_tu;
+    atomic_compare_exchange_strong_explicit(
+        &_beacon_pending_tu, &applied_tu, 0, memory_order_relaxed, memory_order_relaxed);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_governor_get_stats(app_governor_stats_t *out) {
+    out->level = (app_governor_level_e)atomic_load_explicit(&_stats.level, memory_order_relaxed);
+    out->is_boosted = atomic_load_explicit(&_stats.is_boosted, memory_order_relaxed);
+    out->traffic_kbps = atomic_load_explicit(&_stats.traffic_kbps, memory_order_relaxed);
+    out->transitions = atomic_load_explicit(&_stats.transitions, memory_order_relaxed);
+    out->level_since_ms = atomic_load_explicit(&_stats.level_since_ms, memory_order_relaxed);
+}
+
+/* -------------------------------------------------------------------------- */
+
+const char *app_governor_level_name(app_governor_level_e level) {
+    switch (level) {
+        case APP_GOVERNOR_LEVEL_FULL:
+            return "full";
+        case APP_GOVERNOR_LEVEL_BALANCED:
+            return "balanced";
+        case APP_GOVERNOR_LEVEL_SAVER:
+            return "saver";
+        case APP_GOVERNOR_LEVEL_CRITICAL:
+            return "critical";
+        default:
+            return "unknown";
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_governor_log(void) {
+    app_governor_stats_t stats;
+    app_governor_get_stats(&stats);
+    const _operating_point_t *point = &OPERATING_POINTS[stats.level];
+    ESP_LOGI(TAG,
+             "Power: %s%s for %" PRIu32 " s, CPU %u MHz, TX %d.%02d dBm, traffic %" PRIu32 " kbit/s, %" PRIu32
+             " transitions",
+             app_governor_level_name(stats.level),
+             stats.is_boosted ? " (boosted)" : "",
+             (_now_ms() - stats.level_since_ms) / 1000,
+             point->cpu_max_mhz,
+             point->tx_power_qdbm / 4,
+             (point->tx_power_qdbm % 4) * 25,
+             stats.traffic_kbps,
+             stats.transitions);
+}
+
+/* -------------------------------------------------------------------------- */
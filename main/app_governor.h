@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "app_governor_plan.h"
+
+typedef struct {
+    app_governor_level_e level;
+    bool is_boosted;
+    uint32_t traffic_kbps;
+    uint32_t transitions;
+    uint32_t level_since_ms;
+} app_governor_stats_t;
+
+void app_governor_start(void);
+void app_governor_apply_beacon_interval(uint16_t beacon_interval_tu);
+void app_governor_get_stats(app_governor_stats_t *out);
+const char *app_governor_level_name(app_governor_level_e level);
+void app_governor_log(void);
@@ -0,0 +1,60 @@
+#include "app_governor_plan.h"
+
+#include "sdkconfig.h"
+
+/* -------------------------------------------------------------------------- */
+
+// Battery state in, level out, the governor task owns the clock and the hardware
+
+// Charging counts as this much extra capacity when picking a level
+#define PLAN_SOLAR_BONUS_PERCENT (10)
+#define PLAN_FLOOR_HYSTERESIS_MV (50)
+
+// Capacity below which each level is entered, it is left again above the threshold plus the hysteresis
+static const uint32_t ENTER_PERCENT[APP_GOVERNOR_LEVEL_MAX] = {
+    [APP_GOVERNOR_LEVEL_FULL] = 100,
+    [APP_GOVERNOR_LEVEL_BALANCED] = CONFIG_AIR_GATEWAY_GOVERNOR_BALANCED_PERCENT,
+    [APP_GOVERNOR_LEVEL_SAVER] = CONFIG_AIR_GATEWAY_GOVERNOR_SAVER_PERCENT,
+    [APP_GOVERNOR_LEVEL_CRITICAL] = CONFIG_AIR_GATEWAY_GOVERNOR_CRITICAL_PERCENT,
+};
+
+/* -------------------------------------------------------------------------- */
+
+app_governor_level_e app_governor_plan_decide(app_governor_level_e current, const app_governor_input_t *input) {
+    if (input->battery_mv == 0) {
+        // No ADC reading yet
+        return current;
+    }
+    if (input->battery_mv < CONFIG_AIR_GATEWAY_GOVERNOR_CRITICAL_MV) {
+        return APP_GOVERNOR_LEVEL_CRITICAL;
+    }
+    if ((current == APP_GOVERNOR_LEVEL_CRITICAL) &&
+        (input->battery_mv < CONFIG_AIR_GATEWAY_GOVERNOR_CRITICAL_MV + PLAN_FLOOR_HYSTERESIS_MV)) {
+        return APP_GOVERNOR_LEVEL_CRITICAL;
+    }
+
+    uint32_t capacity = input->capacity_percent;
+    if (input->solar_mv >= CONFIG_AIR_GATEWAY_GOVERNOR_SOLAR_MV) {
+        capacity += PLAN_SOLAR_BONUS_PERCENT;
+    }
+
+    app_governor_level_e level = current;
+    while ((level + 1 < APP_GOVERNOR_LEVEL_MAX) && (capacity < ENTER_PERCENT[level + 1])) {
+        level++;
+    }
+    while ((level > APP_GOVERNOR_LEVEL_FULL) &&
+           (capacity >= ENTER_PERCENT[level] + CONFIG_AIR_GATEWAY_GOVERNOR_HYSTERESIS_PERCENT)) {
+        level--;
+    }
+    return level;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Brown-out protection never waits, every other change has to outlast the dwell time */
+bool app_governor_plan_may_switch(app_governor_level_e current, app_governor_level_e next, uint32_t dwell_ms) {
+    if (next == current) {
+        return false;
+    }
+    return (dwell_ms >= CONFIG_AIR_GATEWAY_GOVERNOR_MIN_DWELL_S * 1000U) || (next == APP_GOVERNOR_LEVEL_CRITICAL);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+    APP_GOVERNOR_LEVEL_FULL = 0,
+    APP_GOVERNOR_LEVEL_BALANCED,
+    APP_GOVERNOR_LEVEL_SAVER,
+    APP_GOVERNOR_LEVEL_CRITICAL,
+    APP_GOVERNOR_LEVEL_MAX,
+} app_governor_level_e;
+
+typedef struct {
+    uint32_t battery_mv;
+    uint32_t capacity_percent;
+    uint32_t solar_mv;
+} app_governor_input_t;
+
+app_governor_level_e app_governor_plan_decide(app_governor_level_e current, const app_governor_input_t *input);
+bool app_governor_plan_may_switch(app_governor_level_e current, app_governor_level_e next, uint32_t dwell_ms);
@@ -0,0 +1,79 @@
+#include "app_http.h"
+
+#include "app_affinity.h"
+
+#include "esp_log.h"
+#include "lwip/sockets.h"
+#include "sdkconfig.h"
+
+/* -------------------------------------------------------------------------- */
+
+static const char *TAG = "app_http.c";
+
+#define HTTP_TASK_STACK_SIZE  (4096)
+#define HTTP_MAX_OPEN_SOCKETS (2)
+#define HTTP_MAX_URI_HANDLERS (4)
+
+static httpd_handle_t _p_server;
+static uint32_t _ap_ip;
+
+/* -------------------------------------------------------------------------- */
+
+/* One server for every local endpoint, its single worker task is shared by them */
+void app_http_start(esp_netif_t *ap_netif) {
+    esp_netif_ip_info_t ip_info;
+    ESP_ERROR_CHECK(esp_netif_get_ip_info(ap_netif, &ip_info));
+    _ap_ip = ip_info.ip.addr;
+
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = CONFIG_AIR_GATEWAY_HTTP_PORT;
+    config.stack_size = HTTP_TASK_STACK_SIZE;
+    config.core_id = app_affinity_core(APP_AFFINITY_ROLE_BACKGROUND);
+    config.max_open_sockets = HTTP_MAX_OPEN_SOCKETS;
+    config.max_uri_handlers = HTTP_MAX_URI_HANDLERS;
+    config.lru_purge_enable = true;
+    if (httpd_start(&_p_server, &config) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start the HTTP server");
+        return;
+    }
+
+    ESP_LOGI(TAG, "HTTP server on http://" IPSTR ":%d", IP2STR(&ip_info.ip), CONFIG_AIR_GATEWAY_HTTP_PORT);
+}
+
+/* -------------------------------------------------------------------------- */
+
+esp_err_t app_http_register(const httpd_uri_t *uri) {
+    if (_p_server == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = httpd_register_uri_handler(_p_server, uri);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register %s with %d", uri->uri, err);
+    }
+    return err;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Stations reach the server through the SoftAP address, anything else arrived over the uplink */
+bool app_http_is_from_softap(httpd_req_t *req) {
+    struct sockaddr_storage local;
+    socklen_t len = sizeof(local);
+    if (getsockname(httpd_req_to_sockfd(req), (struct sockaddr *)&local, &len) != 0) {
+        return false;
+    }
+    if (local.ss_family == AF_INET) {
+        return ((struct sockaddr_in *)&local)->sin_addr.s_addr == _ap_ip;
+    }
+#if CONFIG_LWIP_IPV6
+    // The server listens on an IPv6 socket, IPv4 peers show up with a mapped address
+    if (local.ss_family == AF_INET6) {
+        const uint32_t *words = ((struct sockaddr_in6 *)&local)->sin6_addr.un.u32_addr;
+        // ::ffff:a.b.c.d only, a native IPv6 address may well end in the same 32 bits
+        return (words[0] == 0) && (words[1] == 0) && (words[2] == PP_HTONL(0x0000FFFFUL)) && (words[3] == _ap_ip);
+    }
+#endif
+    return false;
+}
+
+/* -------------------------------------------------------------------------- */
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "esp_http_server.h"
+#include "esp_netif.h"
+
+void app_http_start(esp_netif_t *ap_netif);
+esp_err_t app_http_register(const httpd_uri_t *uri);
+bool app_http_is_from_softap(httpd_req_t *req);
@@ -0,0 +1,220 @@
+#include "app_idle.h"
+
+#include "app_affinity.h"
+#include "app_connection.h"
+#include "app_stations.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "esp_log.h"
+#include "esp_modem_api.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#include "bsp_modem.h"
+
+/* -------------------------------------------------------------------------- */
+
+static const char *TAG = "app_idle.c";
+
+#define IDLE_TASK_STACK_SIZE (3072)
+// Above the uplink supervisor, a station waiting for its first packet should not queue behind it
+#define IDLE_TASK_PRIORITY (6)
+#define IDLE_POLL_MS       (1000)
+
+typedef struct {
+    atomic_uint_fast32_t is_sleeping;
+    atomic_uint_fast32_t sleeps;
+    atomic_uint_fast32_t wakes[APP_IDLE_WAKE_MAX];
+    atomic_uint_fast32_t asleep_ms;
+    atomic_uint_fast32_t last_wake_latency_ms;
+    atomic_uint_fast32_t max_wake_latency_ms;
+} _idle_stats_t;
+
+static TaskHandle_t _p_task;
+// Set when the modem is woken, cleared by the first packet forwarded to a station after that
+static atomic_uint_fast32_t _wake_ts_ms;
+
+// Owned by the idle task
+static uint32_t _idle_since_ms;
+static uint32_t _sleep_since_ms;
+
+static _idle_stats_t _stats;
+
+/* -------------------------------------------------------------------------- */
+
+static uint32_t _now_ms(void) {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _on_ring(void) {
+    BaseType_t is_woken = pdFALSE;
+    if (_p_task != NULL) {
+        xTaskNotifyFromISR(_p_task, 1U << APP_IDLE_WAKE_RING, eSetBits, &is_woken);
+    }
+    portYIELD_FROM_ISR(is_woken);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _notify(app_idle_wake_e reason) {
+    if (_p_task != NULL) {
+        xTaskNotify(_p_task, 1U << reason, eSetBits);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _wake(uint32_t reasons) {
+    if (atomic_load_explicit(&_stats.is_sleeping, memory_order_relaxed) == 0) {
+        return;
+    }
+
+    // Stamped before DTR falls, the measured latency includes the modem wake time
+    uint32_t now_ms = _now_ms();
+    atomic_store_explicit(&_wake_ts_ms, (now_ms != 0) ? now_ms : 1, memory_order_relaxed);
+    bsp_modem_wake();
+
+    atomic_fetch_add_explicit(&_stats.asleep_ms, now_ms - _sleep_since_ms, memory_order_relaxed);
+    atomic_store_explicit(&_stats.is_sleeping, 0, memory_order_relaxed);
+    for (int i = 0; i < APP_IDLE_WAKE_MAX; i++) {
+        if ((reasons & (1U << i)) != 0) {
+            atomic_fetch_add_explicit(&_stats.wakes[i], 1, memory_order_relaxed);
+        }
+    }
+    _idle_since_ms = now_ms;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _try_sleep(void) {
+    if ((app_stations_connected() != 0) || bsp_modem_is_sleeping()) {
+        return;
+    }
+
+    app_connection_stats_t uplink;
+    app_connection_get_stats(&uplink);
+    uint32_t now_ms = _now_ms();
+    if ((uplink.is_up == false) || ((now_ms - _idle_since_ms) < (CONFIG_AIR_GATEWAY_IDLE_SLEEP_DELAY_S * 1000))) {
+        return;
+    }
+
+    if (bsp_modem_sleep() == ESP_OK) {
+        _sleep_since_ms = now_ms;
+        atomic_store_explicit(&_wake_ts_ms, 0, memory_order_relaxed);
+        atomic_store_explicit(&_stats.is_sleeping, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&_stats.sleeps, 1, memory_order_relaxed);
+        ESP_LOGI(TAG, "No stations for %d s, modem sleeps", CONFIG_AIR_GATEWAY_IDLE_SLEEP_DELAY_S);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _idle_task(void *arg) {
+    (void)arg;
+
+    _idle_since_ms = _now_ms();
+    while (1) {
+        uint32_t reasons = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &reasons, pdMS_TO_TICKS(IDLE_POLL_MS));
+
+        // Uplink recovery wakes the modem on its own before talking to it
+        if ((reasons != 0) || (bsp_modem_is_sleeping() == false)) {
+            _wake(reasons);
+        }
+        if (app_stations_connected() != 0) {
+            _idle_since_ms = _now_ms();
+        }
+        _try_sleep();
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_idle_start(void) {
+    xTaskCreatePinnedToCore(_idle_task,
+                            "idle_mgr",
+                            IDLE_TASK_STACK_SIZE,
+                            NULL,
+                            IDLE_TASK_PRIORITY,
+                            &_p_task,
+                            app_affinity_core(APP_AFFINITY_ROLE_BACKGROUND));
+    if (bsp_modem_set_ring_callback(_on_ring) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to watch the modem RING line");
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_idle_station_joined(void) {
+    _notify(APP_IDLE_WAKE_STATION);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Tcpip thread, every packet received over PPP */
+void app_idle_note_uplink_rx(void) {
+    if ((atomic_load_explicit(&_stats.is_sleeping, memory_order_relaxed) != 0) &&
+        (atomic_load_explicit(&_wake_ts_ms, memory_order_relaxed) == 0)) {
+        // The modem had data for us while DTR was high
+        _notify(APP_IDLE_WAKE_DATA);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Every packet from the uplink handed to the Wi-Fi driver, ends the wake latency measurement */
+void app_idle_note_station_tx(void) {
+    if (atomic_load_explicit(&_wake_ts_ms, memory_order_relaxed) == 0) {
+        return;
+    }
+    uint32_t wake_ts_ms = atomic_exchange_explicit(&_wake_ts_ms, 0, memory_order_relaxed);
+    if (wake_ts_ms == 0) {
+        return;
+    }
+    uint32_t latency_ms = _now_ms() - wake_ts_ms;
+    atomic_store_explicit(&_stats.last_wake_latency_ms, latency_ms, memory_order_relaxed);
+    if (latency_ms > atomic_load_explicit(&_stats.max_wake_latency_ms, memory_order_relaxed)) {
+        atomic_store_explicit(&_stats.max_wake_latency_ms, latency_ms, memory_order_relaxed);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_idle_get_stats(app_idle_stats_t *out) {
+    out->is_sleeping = atomic_load_explicit(&_stats.is_sleeping, memory_order_relaxed);
+    out->sleeps = atomic_load_explicit(&_stats.sleeps, memory_order_relaxed);
+    for (int i = 0; i < APP_IDLE_WAKE_MAX; i++) {
+        out->wakes[i] = atomic_load_explicit(&_stats.wakes[i], memory_order_relaxed);
+    }
+    out->asleep_ms = atomic_load_explicit(&_stats.asleep_ms, memory_order_relaxed);
+    out->last_wake_latency_ms = atomic_load_explicit(&_stats.last_wake_latency_ms, memory_order_relaxed);
+    out->max_wake_latency_ms = atomic_load_explicit(&_stats.max_wake_latency_ms, memory_order_relaxed);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_idle_log(void) {
+    app_idle_stats_t stats;
+    app_idle_get_stats(&stats);
+    ESP_LOGI(TAG,
+             "Modem sleep: %s, %" PRIu32 " sleeps, %" PRIu32 " s asleep, wakes %" PRIu32 "/%" PRIu32 "/%" PRIu32
+             " (station/ring/data), wake latency %" PRIu32 " ms (max %" PRIu32 " ms)",
+             (stats.is_sleeping != 0) ? "asleep" : "awake",
+             stats.sleeps,
+             stats.asleep_ms / 1000,
+             stats.wakes[APP_IDLE_WAKE_STATION],
+             stats.wakes[APP_IDLE_WAKE_RING],
+             stats.wakes[APP_IDLE_WAKE_DATA],
+             stats.last_wake_latency_ms,
+             stats.max_wake_latency_ms);
+}
+
+/* -------------------------------------------------------------------------- */
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef enum {
+    APP_IDLE_WAKE_STATION = 0,
+    APP_IDLE_WAKE_RING,
+    APP_IDLE_WAKE_DATA,
+    APP_IDLE_WAKE_MAX,
+} app_idle_wake_e;
+
+typedef struct {
+    uint32_t is_sleeping;
+    uint32_t sleeps;
+    uint32_t wakes[APP_IDLE_WAKE_MAX];
+    uint32_t asleep_ms;
+    uint32_t last_wake_latency_ms;
+    uint32_t max_wake_latency_ms;
+} app_idle_stats_t;
+
+void app_idle_start(void);
+void app_idle_station_joined(void);
+void app_idle_note_uplink_rx(void);
+void app_idle_note_station_tx(void);
+void app_idle_get_stats(app_idle_stats_t *out);
+void app_idle_log(void);
@@ -0,0 +1,10 @@
+#pragma once
+
+/* Included by lwIP through ESP_IDF_LWIP_HOOK_FILENAME, see main/CMakeLists.txt */
+
+struct pbuf;
+struct netif;
+
+int app_forward_ip4_input(struct pbuf *p, struct netif *inp);
+
+#define LWIP_HOOK_IP4_INPUT(p, inp) app_forward_ip4_input((p), (inp))
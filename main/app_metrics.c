@@ -0,0 +1,369 @@
+#include "app_metrics.h"
+
+#include "app_admission.h"
+#include "app_affinity.h"
+#include "app_channel.h"
+#include "app_config.h"
+#include "app_connection.h"
+#include "app_http.h"
+#include "app_rat.h"
+#include "app_stations.h"
+#include "app_stats.h"
+#include "app_telemetry.h"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#include "bsp_battery.h"
+#include "bsp_mem.h"
+#include "bsp_modem.h"
+#include "bsp_ppp_rx.h"
+
+/* -------------------------------------------------------------------------- */
+
+static const char *TAG = "app_metrics.c";
+
+#define METRICS_CHUNK_SIZE   (1024)
+#define METRICS_STATIONS_MAX (APP_CONFIG_STATIONS_MAX + 4)
+#define METRICS_CONTENT_TYPE "text/plain; version=0.0.4"
+#define CSQ_RSSI_MAX         (31)
+#define CSQ_BER_MAX          (7)
+
+typedef struct {
+    httpd_req_t *req;
+    size_t len;
+    esp_err_t err;
+} _writer_t;
+
+// The server has a single worker task, so one chunk buffer serves every scrape
+static char _chunk[METRICS_CHUNK_SIZE];
+static app_station_t _stations[METRICS_STATIONS_MAX];
+
+/* -------------------------------------------------------------------------- */
+
+static void _flush(_writer_t *writer) {
+    if ((writer->len > 0) && (writer->err == ESP_OK)) {
+        writer->err = httpd_resp_send_chunk(writer->req, _chunk, writer->len);
+    }
+    writer->len = 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _write(_writer_t *writer, const char *format, ...) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        va_list args;
+        va_start(args, format);
+        int len = vsnprintf(&_chunk[writer->len], sizeof(_chunk) - writer->len, format, args);
+        va_end(args);
+        if ((len >= 0) && ((size_t)len < sizeof(_chunk) - writer->len)) {
+            writer->len += len;
+            return;
+        }
+        // Lines are far shorter than a chunk, a line that still does not fit is dropped
+        _flush(writer);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _family(_writer_t *writer, const char *name, const char *type, const char *help) {
+    _write(writer, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _metric(_writer_t *writer, const char *name, const char *type, const char *help, uint32_t value) {
+    _family(writer, name, type, help);
+    _write(writer, "%s %" PRIu32 "\n", name, value);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _write_interfaces(_writer_t *writer) {
+    static const char *const IF_NAMES[APP_STATS_IF_MAX] = { "ap", "ppp" };
+    app_stats_if_t stats[APP_STATS_IF_MAX];
+    for (int i = 0; i < APP_STATS_IF_MAX; i++) {
+        app_stats_get_if(i, &stats[i]);
+    }
+
+    _family(writer, "air_gateway_rx_packets_total", "counter", "IPv4 packets received per interface");
+    for (int i = 0; i < APP_STATS_IF_MAX; i++) {
+        _write(writer, "air_gateway_rx_packets_total{iface=\"%s\"} %" PRIu32 "\n", IF_NAMES[i], stats[i].rx_packets);
+    }
+    _family(writer, "air_gateway_rx_bytes_total", "counter", "IPv4 bytes received per interface");
+    for (int i = 0; i < APP_STATS_IF_MAX; i++) {
+        _write(writer, "air_gateway_rx_bytes_total{iface=\"%s\"} %" PRIu32 "\n", IF_NAMES[i], stats[i].rx_bytes);
+    }
+    _family(writer, "air_gateway_tx_packets_total", "counter", "IPv4 packets sent per interface");
+    for (int i = 0; i < APP_STATS_IF_MAX; i++) {
+        _write(writer, "air_gateway_tx_packets_total{iface=\"%s\"} %" PRIu32 "\n", IF_NAMES[i], stats[i].tx_packets);
+    }
+    _family(writer, "air_gateway_tx_bytes_total", "counter", "IPv4 bytes sent per interface");
+    for (int i = 0; i < APP_STATS_IF_MAX; i++) {
+        _write(writer, "air_gateway_tx_bytes_total{iface=\"%s\"} %" PRIu32 "\n", IF_NAMES[i], stats[i].tx_bytes);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _write_uplink(_writer_t *writer) {
+    uint32_t now_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    app_connection_stats_t uplink;
+    app_connection_get_stats(&uplink);
+    _metric(writer, "air_gateway_ppp_up", "gauge", "1 while the PPP session is up", uplink.is_up ? 1 : 0);
+    _metric(writer,
+            "air_gateway_ppp_up_seconds",
+            "gauge",
+            "Age of the current PPP session",
+            uplink.is_up ? (now_ms - uplink.up_since_ms) / 1000 : 0);
+    _metric(writer, "air_gateway_ppp_reconnects_total", "counter", "PPP sessions re-established", uplink.reconnects);
+    _metric(writer,
+            "air_gateway_ppp_outage_seconds_total",
+            "counter",
+            "Time without a PPP session",
+            uplink.total_outage_ms / 1000);
+
+    bsp_modem_link_stats_t link;
+    bsp_modem_get_link_stats(&link);
+    _metric(writer, "air_gateway_uart_baud", "gauge", "Modem UART baud rate", link.baud);
+    _metric(writer, "air_gateway_uart_overflows_total", "counter", "Modem UART RX overflows", link.buffer_overflows);
+    _metric(writer, "air_gateway_uart_errors_total", "counter", "Modem UART terminal errors", link.terminal_errors);
+#if CONFIG_GATEWAY_MODEM_PPP_RX_DIRECT
+    bsp_ppp_rx_stats_t ppp_rx;
+    bsp_ppp_rx_get_stats(&ppp_rx);
+    _metric(writer, "air_gateway_ppp_fcs_errors_total", "counter", "PPP frames with a bad FCS", ppp_rx.fcs_errors);
+    _family(writer, "air_gateway_ppp_rx_drops_total", "counter", "PPP frames dropped by the RX path");
+    _write(writer,
+           "air_gateway_ppp_rx_drops_total{reason=\"pool\"} %" PRIu32 "\n"
+           "air_gateway_ppp_rx_drops_total{reason=\"oversize\"} %" PRIu32 "\n"
+           "air_gateway_ppp_rx_drops_total{reason=\"queue\"} %" PRIu32 "\n",
+           ppp_rx.pool_empty_drops,
+           ppp_rx.oversize_drops,
+           ppp_rx.queue_full_drops);
+#endif
+
+#if CONFIG_AIR_GATEWAY_RAT_OPTIMIZER
+    app_rat_stats_t rat;
+    app_rat_get_stats(&rat);
+    _family(writer, "air_gateway_modem_rat_lock", "gauge", "RAT/band lock in use");
+    _write(writer, "air_gateway_modem_rat_lock{name=\"%s\"} 1\n", rat.lock);
+    _metric(writer, "air_gateway_modem_rat_probe_kbps", "gauge", "Probe throughput of the lock in use", rat.kbps);
+    _metric(writer, "air_gateway_modem_rat_trials_total", "counter", "RAT/band locks measured", rat.trials);
+    _metric(writer, "air_gateway_modem_rat_switches_total", "counter", "RAT/band lock changes", rat.switches);
+#endif
+
+    app_telemetry_t telemetry;
+    app_telemetry_get(&telemetry);
+    _metric(writer, "air_gateway_modem_polls_total", "counter", "Modem telemetry polls", telemetry.polls);
+    _metric(writer,
+            "air_gateway_modem_poll_failures_total",
+            "counter",
+            "Failed modem telemetry polls",
+            telemetry.poll_failures);
+    if (telemetry.is_valid == false) {
+        return;
+    }
+    // Unknown values (99) are left out rather than reported as a number
+    if ((telemetry.modem.rssi >= 0) && (telemetry.modem.rssi <= CSQ_RSSI_MAX)) {
+        _family(writer, "air_gateway_modem_rssi_dbm", "gauge", "Received signal strength from AT+CSQ");
+        _write(writer, "air_gateway_modem_rssi_dbm %d\n", -113 + (2 * telemetry.modem.rssi));
+    }
+    if ((telemetry.modem.ber >= 0) && (telemetry.modem.ber <= CSQ_BER_MAX)) {
+        _family(writer, "air_gateway_modem_ber", "gauge", "Bit error rate class from AT+CSQ");
+        _write(writer, "air_gateway_modem_ber %d\n", telemetry.modem.ber);
+    }
+    if (telemetry.modem.rsrp_dbm_x10 != 0) {
+        _family(writer, "air_gateway_modem_rsrp_dbm", "gauge", "LTE reference signal received power");
+        _write(writer,
+               "air_gateway_modem_rsrp_dbm %d.%d\n",
+               telemetry.modem.rsrp_dbm_x10 / 10,
+               abs(telemetry.modem.rsrp_dbm_x10 % 10));
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _write_system(_writer_t *writer) {
+    _metric(writer,
+            "air_gateway_uptime_seconds",
+            "gauge",
+            "Time since boot",
+            (uint32_t)(esp_timer_get_time() / 1000000));
+    _family(writer, "air_gateway_affinity_profile", "gauge", "Task placement profile in use");
+    _write(writer, "air_gateway_affinity_profile{name=\"%s\"} 1\n", app_affinity_profile_name());
+    _metric(writer,
+            "air_gateway_config_revision",
+            "gauge",
+            "Revision of the stored runtime configuration",
+            app_config_revision());
+
+    app_stats_heap_t heap;
+    app_stats_get_heap(&heap);
+    _family(writer, "air_gateway_heap_free_bytes", "gauge", "Free heap per region");
+    _write(writer,
+           "air_gateway_heap_free_bytes{region=\"internal\"} %" PRIu32 "\n"
+           "air_gateway_heap_free_bytes{region=\"psram\"} %" PRIu32 "\n",
+           heap.heap_free_internal,
+           heap.heap_free_psram);
+    _family(writer, "air_gateway_heap_min_free_bytes", "gauge", "Lowest free heap since boot per region");
+    _write(writer,
+           "air_gateway_heap_min_free_bytes{region=\"internal\"} %" PRIu32 "\n"
+           "air_gateway_heap_min_free_bytes{region=\"psram\"} %" PRIu32 "\n",
+           heap.heap_min_free_internal,
+           heap.heap_min_free_psram);
+    _family(writer, "air_gateway_heap_largest_block_bytes", "gauge", "Largest free heap block per region");
+    _write(writer,
+           "air_gateway_heap_largest_block_bytes{region=\"internal\"} %" PRIu32 "\n"
+           "air_gateway_heap_largest_block_bytes{region=\"psram\"} %" PRIu32 "\n",
+           heap.heap_largest_block_internal,
+           heap.heap_largest_block_psram);
+    _family(writer, "air_gateway_memory_bytes", "gauge", "Heap held per subsystem and region");
+    for (int i = 0; i < BSP_MEM_OWNER_MAX; i++) {
+        bsp_mem_usage_t usage;
+        bsp_mem_get_usage(i, &usage);
+        _write(writer,
+               "air_gateway_memory_bytes{owner=\"%s\",region=\"internal\"} %" PRIu32 "\n"
+               "air_gateway_memory_bytes{owner=\"%s\",region=\"psram\"} %" PRIu32 "\n",
+               bsp_mem_owner_name(i),
+               usage.internal_bytes,
+               bsp_mem_owner_name(i),
+               usage.psram_bytes);
+    }
+
+    bsp_battery_snapshot_t battery;
+    bsp_battery_get_snapshot(&battery);
+    _metric(writer, "air_gateway_battery_millivolts", "gauge", "Filtered battery voltage", battery.battery_mv);
+    _metric(writer, "air_gateway_battery_percent", "gauge", "Estimated battery capacity", battery.capacity_percent);
+    _metric(writer, "air_gateway_solar_millivolts", "gauge", "Filtered solar panel voltage", battery.solar_mv);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _write_stations(_writer_t *writer) {
+    size_t count = app_stations_snapshot(_stations, METRICS_STATIONS_MAX);
+    uint32_t connected = 0;
+    for (size_t i = 0; i < count; i++) {
+        connected += _stations[i].is_connected ? 1 : 0;
+    }
+    _metric(writer, "air_gateway_stations", "gauge", "Associated stations", connected);
+#if CONFIG_AIR_GATEWAY_ADMISSION
+    app_admission_stats_t admission;
+    app_admission_get_stats(&admission);
+    _family(writer, "air_gateway_admission_total", "counter", "Station admission decisions");
+    _write(writer,
+           "air_gateway_admission_total{result=\"admitted\"} %" PRIu32 "\n"
+           "air_gateway_admission_total{result=\"evicted_idle\"} %" PRIu32 "\n"
+           "air_gateway_admission_total{result=\"refused\"} %" PRIu32 "\n"
+           "air_gateway_admission_total{result=\"held_off\"} %" PRIu32 "\n",
+           admission.admitted,
+           admission.evicted,
+           admission.refused,
+           admission.held_off);
+    _family(writer, "air_gateway_admission_over_budget_total", "counter", "Joins that exceeded a budget");
+    for (int i = 0; i < APP_ADMISSION_BUDGET_MAX; i++) {
+        _write(writer,
+               "air_gateway_admission_over_budget_total{budget=\"%s\"} %" PRIu32 "\n",
+               app_admission_budget_name(i),
+               admission.over_budget[i]);
+    }
+#endif
+#if CONFIG_AIR_GATEWAY_CHANNEL_PLANNER
+    app_channel_stats_t channel;
+    app_channel_get_stats(&channel);
+    _metric(writer, "air_gateway_wifi_channel", "gauge", "SoftAP channel", channel.channel);
+    _metric(writer, "air_gateway_wifi_channel_switches_total", "counter", "SoftAP channel changes", channel.switches);
+    _metric(writer, "air_gateway_wifi_scan_aps", "gauge", "APs seen by the last scan", channel.last_ap_count);
+#endif
+
+    _family(writer, "air_gateway_station_bytes_total", "counter", "Bytes forwarded per station and direction");
+    for (size_t i = 0; i < count; i++) {
+        _write(writer,
+               "air_gateway_station_bytes_total{mac=\"" MACSTR "\",dir=\"up\"} %" PRIu32 "\n"
+               "air_gateway_station_bytes_total{mac=\"" MACSTR "\",dir=\"down\"} %" PRIu32 "\n",
+               MAC2STR(_stations[i].mac),
+               _stations[i].up_bytes,
+               MAC2STR(_stations[i].mac),
+               _stations[i].down_bytes);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS && CONFIG_FREERTOS_RUN_TIME_STATS_USING_ESP_TIMER
+static void _write_tasks(_writer_t *writer) {
+    UBaseType_t capacity = uxTaskGetNumberOfTasks() + 4;
+    TaskStatus_t *tasks = malloc(capacity * sizeof(TaskStatus_t));
+    if (tasks == NULL) {
+        return;
+    }
+    UBaseType_t count = uxTaskGetSystemState(tasks, capacity, NULL);
+
+    // Run time is counted in microseconds of esp_timer, rate() of the counter gives the CPU share
+    _family(writer, "air_gateway_task_cpu_seconds_total", "counter", "CPU time spent per task");
+    for (UBaseType_t i = 0; i < count; i++) {
+        uint64_t run_us = tasks[i].ulRunTimeCounter;
+        _write(writer,
+               "air_gateway_task_cpu_seconds_total{task=\"%s\"} %" PRIu32 ".%06" PRIu32 "\n",
+               tasks[i].pcTaskName,
+               (uint32_t)(run_us / 1000000),
+               (uint32_t)(run_us % 1000000));
+    }
+    _family(writer, "air_gateway_task_stack_free_bytes", "gauge", "Lowest free stack per task");
+    for (UBaseType_t i = 0; i < count; i++) {
+        _write(writer,
+               "air_gateway_task_stack_free_bytes{task=\"%s\"} %" PRIu32 "\n",
+               tasks[i].pcTaskName,
+               (uint32_t)tasks[i].usStackHighWaterMark);
+    }
+    free(tasks);
+}
+#endif
+
+/* -------------------------------------------------------------------------- */
+
+/* Counters are kept by their owners with relaxed atomics, the text is only built here on a scrape */
+static esp_err_t _on_metrics(httpd_req_t *req) {
+    if (app_http_is_from_softap(req) == false) {
+        return httpd_resp_send_err(req, HTTPD_403_FORBIDDEN, NULL);
+    }
+
+    httpd_resp_set_type(req, METRICS_CONTENT_TYPE);
+    _writer_t writer = { .req = req };
+    _write_system(&writer);
+    _write_interfaces(&writer);
+    _write_uplink(&writer);
+    _write_stations(&writer);
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS && CONFIG_FREERTOS_RUN_TIME_STATS_USING_ESP_TIMER
+    _write_tasks(&writer);
+#endif
+    _flush(&writer);
+    if (writer.err != ESP_OK) {
+        return writer.err;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_metrics_start(void) {
+    const httpd_uri_t metrics_uri = {
+        .uri = "/metrics",
+        .method = HTTP_GET,
+        .handler = _on_metrics,
+    };
+    if (app_http_register(&metrics_uri) == ESP_OK) {
+        ESP_LOGI(TAG, "Metrics at /metrics");
+    }
+}
+
+/* -------------------------------------------------------------------------- */
@@ -0,0 +1,3 @@
+#pragma once
+
+void app_metrics_start(void);
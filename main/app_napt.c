@@ -0,0 +1,775 @@
+#include "app_napt.h"
+
+#include "app_config.h"
+#include "app_packet.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "lwip/ip4_addr.h"
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "lwip/prot/icmp.h"
+#include "lwip/prot/ip.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/tcp.h"
+#include "lwip/tcpip.h"
+#include "lwip/timeouts.h"
+#include "sdkconfig.h"
+
+#include "bsp_mem.h"
+
+/* -------------------------------------------------------------------------- */
+
+static const char *TAG = "app_napt.c";
+
+#define NAPT_CAPACITY          (CONFIG_AIR_GATEWAY_NAPT_ENTRIES)
+#define NAPT_NONE              (UINT16_MAX)
+// Public ports stay below the lwIP ephemeral range, the gateway's own sockets never collide with a mapping
+#define NAPT_PORT_FIRST        (10000)
+#define NAPT_PORT_COUNT        (0xC000 - NAPT_PORT_FIRST)
+#define NAPT_PORT_PROBES       (32)
+#define NAPT_SWEEP_INTERVAL_MS (250)
+#define NAPT_SWEEP_CHUNK       (128)
+#define NAPT_ICMP_ERROR_MIN    (8 + IP_HLEN + 8)
+// Addresses handed out to stations that left recently still hold mappings for a while
+#define NAPT_STATIONS_MAX      (APP_CONFIG_STATIONS_MAX + 4)
+
+#define NAPT_TCP_TIMEOUT_MS            (CONFIG_AIR_GATEWAY_NAPT_TCP_TIMEOUT_S * 1000u)
+#define NAPT_TCP_TRANSITORY_TIMEOUT_MS (240 * 1000u)
+#define NAPT_UDP_TIMEOUT_MS            (CONFIG_AIR_GATEWAY_NAPT_UDP_TIMEOUT_S * 1000u)
+#define NAPT_ICMP_TIMEOUT_MS           (60 * 1000u)
+
+typedef enum {
+    NAPT_STATE_FREE = 0,
+    NAPT_STATE_TCP_OPENING,
+    NAPT_STATE_TCP_ESTABLISHED,
+    NAPT_STATE_TCP_CLOSING,
+    NAPT_STATE_UDP,
+    NAPT_STATE_ICMP,
+} _napt_state_e;
+
+// Addresses are kept as they sit in the header, ports in host order
+typedef struct {
+    uint32_t private_ip;
+    uint32_t remote_ip;
+    uint16_t private_port;
+    uint16_t remote_port;
+    uint16_t public_port;
+    uint8_t proto;
+    uint8_t state;
+    uint32_t last_used_ms;
+    uint16_t out_next;
+    uint16_t in_next;
+    uint16_t lru_prev;
+    uint16_t lru_next;
+} _napt_entry_t;
+
+typedef struct {
+    uint32_t private_ip;
+    uint32_t entries;
+} _napt_station_t;
+
+typedef struct {
+    atomic_uint_fast32_t entries;
+    atomic_uint_fast32_t max_entries;
+    atomic_uint_fast32_t created;
+    atomic_uint_fast32_t expired;
+    atomic_uint_fast32_t evicted;
+    atomic_uint_fast32_t icmp_errors;
+    atomic_uint_fast32_t fragments_dropped;
+    atomic_uint_fast32_t malformed_dropped;
+    atomic_uint_fast32_t port_exhausted;
+} _napt_stats_t;
+
+// Everything below is owned by the tcpip thread, the table only changes there
+static struct netif *_p_ap;
+static struct netif *_p_uplink;
+static _napt_entry_t *_p_entries;
+static uint16_t *_p_out_buckets;
+static uint16_t *_p_in_buckets;
+static uint32_t _bucket_mask;
+static uint16_t _free_head = NAPT_NONE;
+static uint16_t _lru_head = NAPT_NONE;
+static uint16_t _lru_tail = NAPT_NONE;
+static uint32_t _entries;
+static uint32_t _sweep_cursor;
+static uint32_t _public_ip;
+
+// Entries per station, read from other tasks
+static portMUX_TYPE _stations_lock = portMUX_INITIALIZER_UNLOCKED;
+static _napt_station_t _stations[NAPT_STATIONS_MAX];
+
+static _napt_stats_t _stats;
+
+/* -------------------------------------------------------------------------- */
+
+static uint32_t _now_ms(void) {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _stat_add(atomic_uint_fast32_t *counter, uint32_t value) {
+    atomic_fetch_add_explicit(counter, value, memory_order_relaxed);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* A station beyond NAPT_STATIONS_MAX addresses goes uncounted, its mappings work all the same */
+static void _count_station(uint32_t private_ip, bool is_added) {
+    portENTER_CRITICAL(&_stations_lock);
+    _napt_station_t *free_slot = NULL;
+    for (int i = 0; i < NAPT_STATIONS_MAX; i++) {
+        _napt_station_t *station = &_stations[i];
+        if ((station->entries != 0) && (station->private_ip == private_ip)) {
+            if (is_added) {
+                station->entries++;
+            } else {
+                station->entries--;
+            }
+            portEXIT_CRITICAL(&_stations_lock);
+            return;
+        }
+        if ((station->entries == 0) && (free_slot == NULL)) {
+            free_slot = station;
+        }
+    }
+    if (is_added && (free_slot != NULL)) {
+        free_slot->private_ip = private_ip;
+        free_slot->entries = 1;
+    }
+    portEXIT_CRITICAL(&_stations_lock);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Overwrites a header field, keeping up to two checksums that cover it valid */
+static void _rewrite(uint8_t *field, const uint8_t *value, int len, uint8_t *csum_a, uint8_t *csum_b) {
+    if (csum_a != NULL) {
+        app_packet_csum_fixup(csum_a, field, value, len);
+    }
+    if (csum_b != NULL) {
+        app_packet_csum_fixup(csum_b, field, value, len);
+    }
+    memcpy(field, value, len);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint32_t _mix(uint32_t h) {
+    h ^= h >> 16;
+    h *= 0x7FEB352Du;
+    h ^= h >> 15;
+    h *= 0x846CA68Bu;
+    h ^= h >> 16;
+    return h;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint32_t _hash_out(uint8_t proto,
+                          uint32_t private_ip,
+                          uint16_t private_port,
+                          uint32_t remote_ip,
+                          uint16_t remote_port) {
+    uint32_t ports = ((uint32_t)private_port << 16) | remote_port;
+    return _mix(private_ip ^ _mix(remote_ip ^ _mix(ports ^ proto))) & _bucket_mask;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint32_t _hash_in(uint8_t proto, uint16_t public_port) {
+    return _mix(((uint32_t)proto << 16) | public_port) & _bucket_mask;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint16_t _find_out(uint8_t proto,
+                          uint32_t private_ip,
+                          uint16_t private_port,
+                          uint32_t remote_ip,
+                          uint16_t remote_port) {
+    uint16_t index = _p_out_buckets[_hash_out(proto, private_ip, private_port, remote_ip, remote_port)];
+    while (index != NAPT_NONE) {
+        const _napt_entry_t *entry = &_p_entries[index];
+        if ((entry->private_ip == private_ip) && (entry->remote_ip == remote_ip) &&
+            (entry->private_port == private_port) && (entry->remote_port == remote_port) && (entry->proto == proto)) {
+            return index;
+        }
+        index = entry->out_next;
+    }
+    return NAPT_NONE;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint16_t _find_in(uint8_t proto, uint16_t public_port) {
+    uint16_t index = _p_in_buckets[_hash_in(proto, public_port)];
+    while (index != NAPT_NONE) {
+        const _napt_entry_t *entry = &_p_entries[index];
+        if ((entry->public_port == public_port) && (entry->proto == proto)) {
+            return index;
+        }
+        index = entry->in_next;
+    }
+    return NAPT_NONE;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool _is_expired(const _napt_entry_t *entry, uint32_t now_ms) {
+    uint32_t idle_ms = now_ms - entry->last_used_ms;
+    switch (entry->state) {
+        case NAPT_STATE_TCP_ESTABLISHED:
+            return idle_ms >= NAPT_TCP_TIMEOUT_MS;
+        case NAPT_STATE_TCP_OPENING:
+        case NAPT_STATE_TCP_CLOSING:
+            return idle_ms >= NAPT_TCP_TRANSITORY_TIMEOUT_MS;
+        case NAPT_STATE_UDP:
+            return idle_ms >= NAPT_UDP_TIMEOUT_MS;
+        case NAPT_STATE_ICMP:
+            return idle_ms >= NAPT_ICMP_TIMEOUT_MS;
+        default:
+            return false;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _lru_unlink(uint16_t index) {
+    _napt_entry_t *entry = &_p_entries[index];
+    if (entry->lru_prev != NAPT_NONE) {
+        _p_entries[entry->lru_prev].lru_next = entry->lru_next;
+    } else {
+        _lru_head = entry->lru_next;
+    }
+    if (entry->lru_next != NAPT_NONE) {
+        _p_entries[entry->lru_next].lru_prev = entry->lru_prev;
+    } else {
+        _lru_tail = entry->lru_prev;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _lru_push(uint16_t index) {
+    _napt_entry_t *entry = &_p_entries[index];
+    entry->lru_prev = NAPT_NONE;
+    entry->lru_next = _lru_head;
+    if (_lru_head != NAPT_NONE) {
+        _p_entries[_lru_head].lru_prev = index;
+    } else {
+        _lru_tail = index;
+    }
+    _lru_head = index;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _remove(uint16_t index) {
+    _napt_entry_t *entry = &_p_entries[index];
+
+    uint32_t out_hash =
+        _hash_out(entry->proto, entry->private_ip, entry->private_port, entry->remote_ip, entry->remote_port);
+    uint16_t *link = &_p_out_buckets[out_hash];
+    while (*link != index) {
+        link = &_p_entries[*link].out_next;
+    }
+    *link = entry->out_next;
+
+    link = &_p_in_buckets[_hash_in(entry->proto, entry->public_port)];
+    while (*link != index) {
+        link = &_p_entries[*link].in_next;
+    }
+    *link = entry->in_next;
+
+    _lru_unlink(index);
+    _count_station(entry->private_ip, false);
+    entry->state = NAPT_STATE_FREE;
+    entry->lru_next = _free_head;
+    _free_head = index;
+
+    _entries--;
+    atomic_store_explicit(&_stats.entries, _entries, memory_order_relaxed);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _reset(void) {
+    memset(_p_out_buckets, 0xFF, (_bucket_mask + 1) * sizeof(uint16_t));
+    memset(_p_in_buckets, 0xFF, (_bucket_mask + 1) * sizeof(uint16_t));
+    for (uint32_t i = 0; i < NAPT_CAPACITY; i++) {
+        _p_entries[i].state = NAPT_STATE_FREE;
+        _p_entries[i].lru_next = (i + 1 < NAPT_CAPACITY) ? (uint16_t)(i + 1) : NAPT_NONE;
+    }
+    _free_head = 0;
+    _lru_head = NAPT_NONE;
+    _lru_tail = NAPT_NONE;
+    _entries = 0;
+    atomic_store_explicit(&_stats.entries, 0, memory_order_relaxed);
+
+    portENTER_CRITICAL(&_stations_lock);
+    memset(_stations, 0, sizeof(_stations));
+    portEXIT_CRITICAL(&_stations_lock);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint16_t _alloc_port(uint8_t proto, uint16_t private_port) {
+    // The station's own port is kept when free, anything else is picked at random
+    uint16_t port = private_port;
+    for (int i = 0; i < NAPT_PORT_PROBES; i++) {
+        if ((port >= NAPT_PORT_FIRST) && (port < NAPT_PORT_FIRST + NAPT_PORT_COUNT) &&
+            (_find_in(proto, port) == NAPT_NONE)) {
+            return port;
+        }
+        port = (uint16_t)(NAPT_PORT_FIRST + (esp_random() % NAPT_PORT_COUNT));
+    }
+    return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint16_t _create(uint8_t proto,
+                        uint32_t private_ip,
+                        uint16_t private_port,
+                        uint32_t remote_ip,
+                        uint16_t remote_port,
+                        uint32_t now_ms) {
+    uint16_t public_port = _alloc_port(proto, private_port);
+    if (public_port == 0) {
+        _stat_add(&_stats.port_exhausted, 1);
+        return NAPT_NONE;
+    }
+
+    if (_free_head == NAPT_NONE) {
+        // A full table gives up its least recently used entry, timed out or not
+        uint16_t victim = _lru_tail;
+        _stat_add(_is_expired(&_p_entries[victim], now_ms) ? &_stats.expired : &_stats.evicted, 1);
+        _remove(victim);
+    }
+
+    uint16_t index = _free_head;
+    _napt_entry_t *entry = &_p_entries[index];
+    _free_head = entry->lru_next;
+
+    entry->private_ip = private_ip;
+    entry->remote_ip = remote_ip;
+    entry->private_port = private_port;
+    entry->remote_port = remote_port;
+    entry->public_port = public_port;
+    entry->proto = proto;
+    entry->state = (proto == IP_PROTO_TCP)   ? NAPT_STATE_TCP_OPENING
+                   : (proto == IP_PROTO_UDP) ? NAPT_STATE_UDP
+                                             : NAPT_STATE_ICMP;
+    entry->last_used_ms = now_ms;
+
+    uint16_t *out_bucket = &_p_out_buckets[_hash_out(proto, private_ip, private_port, remote_ip, remote_port)];
+    entry->out_next = *out_bucket;
+    *out_bucket = index;
+    uint16_t *in_bucket = &_p_in_buckets[_hash_in(proto, public_port)];
+    entry->in_next = *in_bucket;
+    *in_bucket = index;
+    _lru_push(index);
+    _count_station(private_ip, true);
+
+    _entries++;
+    atomic_store_explicit(&_stats.entries, _entries, memory_order_relaxed);
+    if (_entries > atomic_load_explicit(&_stats.max_entries, memory_order_relaxed)) {
+        atomic_store_explicit(&_stats.max_entries, _entries, memory_order_relaxed);
+    }
+    _stat_add(&_stats.created, 1);
+    return index;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _touch(uint16_t index, const uint8_t *tcp, bool is_inbound, uint32_t now_ms) {
+    _napt_entry_t *entry = &_p_entries[index];
+    entry->last_used_ms = now_ms;
+    if (_lru_head != index) {
+        _lru_unlink(index);
+        _lru_push(index);
+    }
+
+    if (tcp == NULL) {
+        return;
+    }
+    // A reply from the remote end establishes the connection, FIN or RST in either direction starts its teardown
+    if ((tcp[13] & (TCP_FIN | TCP_RST)) != 0) {
+        entry->state = NAPT_STATE_TCP_CLOSING;
+    } else if ((is_inbound == true) && (entry->state == NAPT_STATE_TCP_OPENING)) {
+        entry->state = NAPT_STATE_TCP_ESTABLISHED;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static int _l4_min_len(uint8_t proto) {
+    switch (proto) {
+        case IP_PROTO_TCP:
+            return TCP_HLEN;
+        case IP_PROTO_UDP:
+        case IP_PROTO_ICMP:
+            return 8;
+        default:
+            return -1;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Checksum field of a TCP, UDP or ICMP header, NULL for UDP sent without one */
+static uint8_t *_l4_csum(uint8_t proto, uint8_t *l4) {
+    switch (proto) {
+        case IP_PROTO_TCP:
+            return &l4[16];
+        case IP_PROTO_UDP:
+            return (app_packet_read16(&l4[6]) != 0) ? &l4[6] : NULL;
+        default:
+            return &l4[2];
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static int _drop(struct pbuf *p, atomic_uint_fast32_t *counter) {
+    _stat_add(counter, 1);
+    pbuf_free(p);
+    return 1;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* ICMP errors quote the translated packet, the quoted source has to be restored together with the outer destination */
+static int _inbound_icmp_error(uint8_t *ip, uint8_t *icmp, int icmp_len) {
+    uint8_t *inner_ip = &icmp[8];
+    int inner_hlen = IPH_HL_BYTES((struct ip_hdr *)inner_ip);
+    uint8_t inner_proto = IPH_PROTO((struct ip_hdr *)inner_ip);
+    if ((inner_hlen < IP_HLEN) || (icmp_len < 8 + inner_hlen + 8) || (memcmp(&inner_ip[12], &ip[16], 4) != 0)) {
+        return 0;
+    }
+
+    uint8_t *inner_l4 = &inner_ip[inner_hlen];
+    uint8_t *inner_port = NULL;
+    uint16_t remote_port = 0;
+    if ((inner_proto == IP_PROTO_TCP) || (inner_proto == IP_PROTO_UDP)) {
+        inner_port = &inner_l4[0];
+        remote_port = app_packet_read16(&inner_l4[2]);
+    } else if ((inner_proto == IP_PROTO_ICMP) && (inner_l4[0] == ICMP_ECHO)) {
+        inner_port = &inner_l4[4];
+    } else {
+        return 0;
+    }
+
+    uint16_t index = _find_in(inner_proto, app_packet_read16(inner_port));
+    uint32_t remote_ip;
+    memcpy(&remote_ip, &inner_ip[16], 4);
+    if ((index == NAPT_NONE) || (_p_entries[index].remote_ip != remote_ip) ||
+        (_p_entries[index].remote_port != remote_port)) {
+        return 0;
+    }
+    const _napt_entry_t *entry = &_p_entries[index];
+
+    uint8_t private_ip[4];
+    uint8_t private_port[2];
+    uint8_t inner_csum[2];
+    memcpy(private_ip, &entry->private_ip, 4);
+    app_packet_write16(private_port, entry->private_port);
+
+    // The quoted transport checksum is left alone, it usually covers bytes the router did not quote
+    uint8_t *icmp_csum = &icmp[2];
+    memcpy(inner_csum, &inner_ip[10], 2);
+    _rewrite(&inner_ip[12], private_ip, 4, &inner_ip[10], icmp_csum);
+    app_packet_csum_fixup(icmp_csum, inner_csum, &inner_ip[10], 2);
+    _rewrite(inner_port, private_port, 2, icmp_csum, NULL);
+    _rewrite(&ip[16], private_ip, 4, &ip[10], NULL);
+
+    _stat_add(&_stats.icmp_errors, 1);
+    return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* AP ingress in the tcpip thread, ahead of lwIP's own header checks. The source is rewritten to the PPP address. */
+int app_napt_outbound(struct pbuf *p) {
+    if ((_p_uplink == NULL) || (p->len < IP_HLEN)) {
+        return 0;
+    }
+
+    uint8_t *ip = (uint8_t *)p->payload;
+    struct ip_hdr *iphdr = (struct ip_hdr *)ip;
+    ip4_addr_t src;
+    ip4_addr_t dest;
+    ip4_addr_copy(src, iphdr->src);
+    ip4_addr_copy(dest, iphdr->dest);
+    const ip4_addr_t *public_ip = netif_ip4_addr(_p_uplink);
+
+    // Local, broadcast and multicast traffic stays on the SoftAP side
+    if (ip4_addr_isany(public_ip) || ip4_addr_ismulticast(&dest) || ip4_addr_isbroadcast(&dest, _p_ap) ||
+        ip4_addr_netcmp(&dest, netif_ip4_addr(_p_ap), netif_ip4_netmask(_p_ap)) || ip4_addr_cmp(&dest, public_ip) ||
+        !ip4_addr_netcmp(&src, netif_ip4_addr(_p_ap), netif_ip4_netmask(_p_ap))) {
+        return 0;
+    }
+
+    uint8_t proto = IPH_PROTO(iphdr);
+    int hlen = IPH_HL_BYTES(iphdr);
+    int l4_min_len = _l4_min_len(proto);
+    if (l4_min_len < 0) {
+        return 0;
+    }
+    // Trailing fragments carry no ports to translate by
+    if ((IPH_OFFSET(iphdr) & PP_HTONS(IP_OFFMASK)) != 0) {
+        return _drop(p, &_stats.fragments_dropped);
+    }
+    if ((hlen < IP_HLEN) || (p->len < hlen + l4_min_len)) {
+        return _drop(p, &_stats.malformed_dropped);
+    }
+
+    uint8_t *l4 = &ip[hlen];
+    uint8_t *port_field = &l4[0];
+    uint16_t remote_port = 0;
+    if (proto == IP_PROTO_ICMP) {
+        // Only echo requests open a mapping, the echo identifier stands in for the port
+        if (l4[0] != ICMP_ECHO) {
+            return 0;
+        }
+        port_field = &l4[4];
+    } else {
+        remote_port = app_packet_read16(&l4[2]);
+    }
+
+    uint32_t now_ms = _now_ms();
+    uint16_t private_port = app_packet_read16(port_field);
+    uint16_t index = _find_out(proto, src.addr, private_port, dest.addr, remote_port);
+    if (index == NAPT_NONE) {
+        index = _create(proto, src.addr, private_port, dest.addr, remote_port, now_ms);
+        if (index == NAPT_NONE) {
+            pbuf_free(p);
+            return 1;
+        }
+    }
+    _touch(index, (proto == IP_PROTO_TCP) ? l4 : NULL, false, now_ms);
+
+    uint8_t *l4_csum = _l4_csum(proto, l4);
+    uint8_t public_port[2];
+    app_packet_write16(public_port, _p_entries[index].public_port);
+    _rewrite(&ip[12], (const uint8_t *)&public_ip->addr, 4, &ip[10], (proto == IP_PROTO_ICMP) ? NULL : l4_csum);
+    _rewrite(port_field, public_port, 2, l4_csum, NULL);
+    return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* PPP ingress in the tcpip thread. Packets without a mapping are left to the gateway's own stack. */
+int app_napt_inbound(struct pbuf *p) {
+    if ((_p_uplink == NULL) || (p->len < IP_HLEN)) {
+        return 0;
+    }
+
+    uint8_t *ip = (uint8_t *)p->payload;
+    struct ip_hdr *iphdr = (struct ip_hdr *)ip;
+    ip4_addr_t dest;
+    ip4_addr_copy(dest, iphdr->dest);
+    if (!ip4_addr_cmp(&dest, netif_ip4_addr(_p_uplink))) {
+        return 0;
+    }
+
+    uint8_t proto = IPH_PROTO(iphdr);
+    int hlen = IPH_HL_BYTES(iphdr);
+    int l4_min_len = _l4_min_len(proto);
+    if ((l4_min_len < 0) || ((IPH_OFFSET(iphdr) & PP_HTONS(IP_OFFMASK)) != 0) || (hlen < IP_HLEN) ||
+        (p->len < hlen + l4_min_len)) {
+        return 0;
+    }
+
+    uint8_t *l4 = &ip[hlen];
+    uint8_t *port_field = &l4[2];
+    uint16_t remote_port = 0;
+    if (proto == IP_PROTO_ICMP) {
+        if ((l4[0] == ICMP_DUR) || (l4[0] == ICMP_TE) || (l4[0] == ICMP_PP)) {
+            int icmp_len = p->len - hlen;
+            return (icmp_len >= NAPT_ICMP_ERROR_MIN) ? _inbound_icmp_error(ip, l4, icmp_len) : 0;
+        }
+        if (l4[0] != ICMP_ER) {
+            return 0;
+        }
+        port_field = &l4[4];
+    } else {
+        remote_port = app_packet_read16(&l4[0]);
+    }
+
+    uint16_t index = _find_in(proto, app_packet_read16(port_field));
+    if (index == NAPT_NONE) {
+        return 0;
+    }
+    // Mappings are per connection, only the remote end they were opened towards may answer through them
+    _napt_entry_t *entry = &_p_entries[index];
+    if ((memcmp(&entry->remote_ip, &ip[12], 4) != 0) || (entry->remote_port != remote_port)) {
+        return 0;
+    }
+    _touch(index, (proto == IP_PROTO_TCP) ? l4 : NULL, true, _now_ms());
+
+    uint8_t *l4_csum = _l4_csum(proto, l4);
+    uint8_t private_port[2];
+    app_packet_write16(private_port, entry->private_port);
+    _rewrite(&ip[16], (const uint8_t *)&entry->private_ip, 4, &ip[10], (proto == IP_PROTO_ICMP) ? NULL : l4_csum);
+    _rewrite(port_field, private_port, 2, l4_csum, NULL);
+    return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _on_sweep_timer(void *arg) {
+    (void)arg;
+    uint32_t now_ms = _now_ms();
+
+    for (int i = 0; i < NAPT_SWEEP_CHUNK; i++) {
+        _napt_entry_t *entry = &_p_entries[_sweep_cursor];
+        if ((entry->state != NAPT_STATE_FREE) && (_is_expired(entry, now_ms) == true)) {
+            _remove((uint16_t)_sweep_cursor);
+            _stat_add(&_stats.expired, 1);
+        }
+        _sweep_cursor = (_sweep_cursor + 1) % NAPT_CAPACITY;
+    }
+    sys_timeout(NAPT_SWEEP_INTERVAL_MS, _on_sweep_timer, NULL);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _start_in_tcpip(void *ctx) {
+    (void)ctx;
+    sys_timeout(NAPT_SWEEP_INTERVAL_MS, _on_sweep_timer, NULL);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Remote ends of TCP connections only know the previous public address, those mappings are dead. UDP and ICMP
+ * mappings carry on from the new address and applications like DNS or QUIC follow. */
+static void _rebind(void) {
+    for (uint32_t i = 0; i < NAPT_CAPACITY; i++) {
+        uint8_t state = _p_entries[i].state;
+        if ((state == NAPT_STATE_TCP_OPENING) || (state == NAPT_STATE_TCP_ESTABLISHED) ||
+            (state == NAPT_STATE_TCP_CLOSING)) {
+            _remove((uint16_t)i);
+            _stat_add(&_stats.expired, 1);
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Mappings outlive the session, a redial that keeps the public address keeps every flow alive */
+static void _set_uplink_in_tcpip(void *ctx) {
+    struct netif *netif = ctx;
+    _p_uplink = netif;
+    if (netif == NULL) {
+        return;
+    }
+
+    uint32_t public_ip = netif_ip4_addr(netif)->addr;
+    if (public_ip == 0) {
+        return;
+    }
+    if ((_public_ip != 0) && (public_ip != _public_ip)) {
+        _rebind();
+    }
+    _public_ip = public_ip;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_napt_init(struct netif *ap_netif) {
+    _p_ap = ap_netif;
+
+    uint32_t buckets = 1;
+    while (buckets < NAPT_CAPACITY) {
+        buckets <<= 1;
+    }
+    _bucket_mask = buckets - 1;
+
+#if CONFIG_AIR_GATEWAY_NAPT_TABLE_IN_PSRAM
+    _p_entries = bsp_mem_calloc(BSP_MEM_NAPT, BSP_MEM_BULK, NAPT_CAPACITY, sizeof(_napt_entry_t));
+#else
+    _p_entries = bsp_mem_calloc(BSP_MEM_NAPT, BSP_MEM_HOT, NAPT_CAPACITY, sizeof(_napt_entry_t));
+#endif
+    // Buckets are read for every packet and stay in internal RAM
+    _p_out_buckets = bsp_mem_calloc(BSP_MEM_NAPT, BSP_MEM_HOT, buckets, sizeof(uint16_t));
+    _p_in_buckets = bsp_mem_calloc(BSP_MEM_NAPT, BSP_MEM_HOT, buckets, sizeof(uint16_t));
+    assert(_p_entries && _p_out_buckets && _p_in_buckets);
+    _reset();
+
+    if (tcpip_callback(_start_in_tcpip, NULL) != ERR_OK) {
+        ESP_LOGE(TAG, "Failed to start the NAPT sweep");
+    }
+    ESP_LOGI(TAG, "NAPT table: %d entries, %" PRIu32 " buckets", NAPT_CAPACITY, buckets);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_napt_set_uplink(struct netif *ppp_netif) {
+    if (tcpip_callback(_set_uplink_in_tcpip, ppp_netif) != ERR_OK) {
+        ESP_LOGE(TAG, "Failed to switch the NAPT uplink");
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+uint32_t app_napt_count_for(uint32_t private_ip) {
+    uint32_t count = 0;
+    portENTER_CRITICAL(&_stations_lock);
+    for (int i = 0; i < NAPT_STATIONS_MAX; i++) {
+        if ((_stations[i].entries != 0) && (_stations[i].private_ip == private_ip)) {
+            count = _stations[i].entries;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&_stations_lock);
+    return count;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_napt_get_stats(app_napt_stats_t *out) {
+    out->capacity = NAPT_CAPACITY;
+    out->entries = atomic_load_explicit(&_stats.entries, memory_order_relaxed);
+    out->max_entries = atomic_load_explicit(&_stats.max_entries, memory_order_relaxed);
+    out->created = atomic_load_explicit(&_stats.created, memory_order_relaxed);
+    out->expired = atomic_load_explicit(&_stats.expired, memory_order_relaxed);
+    out->evicted = atomic_load_explicit(&_stats.evicted, memory_order_relaxed);
+    out->icmp_errors = atomic_load_explicit(&_stats.icmp_errors, memory_order_relaxed);
+    out->fragments_dropped = atomic_load_explicit(&_stats.fragments_dropped, memory_order_relaxed);
+    out->malformed_dropped = atomic_load_explicit(&_stats.malformed_dropped, memory_order_relaxed);
+    out->port_exhausted = atomic_load_explicit(&_stats.port_exhausted, memory_order_relaxed);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_napt_log(void) {
+    app_napt_stats_t stats;
+    app_napt_get_stats(&stats);
+    ESP_LOGI(TAG,
+             "NAPT: %" PRIu32 "/%" PRIu32 " entries (max %" PRIu32 "), created %" PRIu32 ", expired %" PRIu32
+             ", evicted %" PRIu32 ", icmp errors %" PRIu32 ", drops %" PRIu32 " frag/%" PRIu32 " malformed/%" PRIu32
+             " no port",
+             stats.entries,
+             stats.capacity,
+             stats.max_entries,
+             stats.created,
+             stats.expired,
+             stats.evicted,
+             stats.icmp_errors,
+             stats.fragments_dropped,
+             stats.malformed_dropped,
+             stats.port_exhausted);
+}
+
+/* -------------------------------------------------------------------------- */
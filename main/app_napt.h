@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+struct pbuf;
+struct netif;
+
+typedef struct {
+    uint32_t capacity;
+    uint32_t entries;
+    uint32_t max_entries;
+    uint32_t created;
+    uint32_t expired;
+    uint32_t evicted;
+    uint32_t icmp_errors;
+    uint32_t fragments_dropped;
+    uint32_t malformed_dropped;
+    uint32_t port_exhausted;
+} app_napt_stats_t;
+
+void app_napt_init(struct netif *ap_netif);
+void app_napt_set_uplink(struct netif *ppp_netif);
+int app_napt_outbound(struct pbuf *p);
+int app_napt_inbound(struct pbuf *p);
+uint32_t app_napt_count_for(uint32_t private_ip);
+void app_napt_get_stats(app_napt_stats_t *out);
+void app_napt_log(void);
@@ -0,0 +1,41 @@
+#pragma once
+
+/* Byte order and checksum helpers for the packet rewriting in app_napt.c and app_pmtu.c */
+
+#include <stdint.h>
+
+static inline uint16_t app_packet_read16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline void app_packet_write16(uint8_t *p, uint16_t value) {
+    p[0] = (uint8_t)(value >> 8);
+    p[1] = (uint8_t)value;
+}
+
+/* Folds a sum of complemented words into csum, 0xFFFF verifies like 0x0000 everywhere and is the only valid form of
+ * a zero UDP checksum */
+static inline void app_packet_csum_store(uint8_t *csum, uint32_t sum) {
+    while ((sum >> 16) != 0) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    uint16_t result = (uint16_t)~sum;
+    app_packet_write16(csum, (result == 0) ? 0xFFFF : result);
+}
+
+/* RFC 1624 incremental update for len bytes of a field going from old_bytes to new_bytes, the field must start at an
+ * even offset from the start of what the checksum covers */
+static inline void app_packet_csum_fixup(uint8_t *csum, const uint8_t *old_bytes, const uint8_t *new_bytes, int len) {
+    uint32_t sum = (uint16_t)~app_packet_read16(csum);
+    for (int i = 0; i < len; i += 2) {
+        sum += (uint16_t)~app_packet_read16(&old_bytes[i]);
+        sum += app_packet_read16(&new_bytes[i]);
+    }
+    app_packet_csum_store(csum, sum);
+}
+
+/* Same for one word going from old_value to new_value, the caller swaps both for a word at an odd offset */
+static inline void app_packet_csum_fixup16(uint8_t *csum, uint16_t old_value, uint16_t new_value) {
+    uint32_t sum = (uint16_t)~app_packet_read16(csum) + (uint16_t)~old_value + new_value;
+    app_packet_csum_store(csum, sum);
+}
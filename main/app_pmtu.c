@@ -0,0 +1,214 @@
+#include "app_pmtu.h"
+
+#include "app_packet.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "lwip/inet_chksum.h"
+#include "lwip/ip4.h"
+#include "lwip/ip4_addr.h"
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "lwip/prot/icmp.h"
+#include "lwip/prot/ip.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/tcp.h"
+#include "lwip/tcpip.h"
+#include "sdkconfig.h"
+
+/* -------------------------------------------------------------------------- */
+
+static const char *TAG = "app_pmtu.c";
+
+#define PMTU_TCPIP_HLEN   (IP_HLEN + TCP_HLEN)
+#define TCP_OPT_END       (0)
+#define TCP_OPT_NOP       (1)
+#define TCP_OPT_MSS       (2)
+#define TCP_OPT_MSS_LEN   (4)
+#define ICMP_FRAG_NEEDED  (4)
+#define ICMP_QUOTE_L4_LEN (8)
+
+typedef struct {
+    atomic_uint_fast32_t mtu;
+    atomic_uint_fast32_t mss_clamped;
+    atomic_uint_fast32_t frag_needed_sent;
+    atomic_uint_fast32_t fragmented;
+} _pmtu_stats_t;
+
+// Owned by the tcpip thread
+static struct netif *_p_ap;
+static struct netif *_p_uplink;
+
+static _pmtu_stats_t _stats;
+
+/* -------------------------------------------------------------------------- */
+
+/* Lowers the MSS option of a SYN to what fits the uplink, p->payload is the IPv4 header */
+static void _clamp_mss(struct pbuf *p, uint16_t mtu) {
+    uint8_t *ip = (uint8_t *)p->payload;
+    int hlen = IPH_HL_BYTES((struct ip_hdr *)ip);
+    if ((IPH_PROTO((struct ip_hdr *)ip) != IP_PROTO_TCP) || (hlen < IP_HLEN) || (p->len < hlen + TCP_HLEN) ||
+        ((IPH_OFFSET((struct ip_hdr *)ip) & PP_HTONS(IP_OFFMASK)) != 0)) {
+        return;
+    }
+
+    uint8_t *tcp = &ip[hlen];
+    int tcp_hlen = (tcp[12] >> 4) * 4;
+    if (((tcp[13] & TCP_SYN) == 0) || (tcp_hlen <= TCP_HLEN) || (p->len < hlen + tcp_hlen)) {
+        return;
+    }
+
+    uint16_t max_mss = (uint16_t)(mtu - PMTU_TCPIP_HLEN);
+    int offset = TCP_HLEN;
+    while (offset < tcp_hlen) {
+        uint8_t kind = tcp[offset];
+        if (kind == TCP_OPT_END) {
+            return;
+        }
+        if (kind == TCP_OPT_NOP) {
+            offset++;
+            continue;
+        }
+        if ((offset + 1 >= tcp_hlen) || (tcp[offset + 1] < 2) || (offset + tcp[offset + 1] > tcp_hlen)) {
+            return;
+        }
+        if ((kind == TCP_OPT_MSS) && (tcp[offset + 1] == TCP_OPT_MSS_LEN)) {
+            uint16_t mss = app_packet_read16(&tcp[offset + 2]);
+            if (mss > max_mss) {
+                // An option after a single NOP straddles checksum words, its bytes then count swapped
+                bool is_odd = ((offset & 1) != 0);
+                app_packet_csum_fixup16(&tcp[16],
+                                        is_odd ? lwip_htons(mss) : mss,
+                                        is_odd ? lwip_htons(max_mss) : max_mss);
+                app_packet_write16(&tcp[offset + 2], max_mss);
+                atomic_fetch_add_explicit(&_stats.mss_clamped, 1, memory_order_relaxed);
+            }
+            return;
+        }
+        offset += tcp[offset + 1];
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* RFC 1191: tell the station the next-hop MTU instead of leaving it to guess from a silent drop */
+static void _send_frag_needed(const struct pbuf *p, uint16_t mtu) {
+    const struct ip_hdr *iphdr = (const struct ip_hdr *)p->payload;
+    uint16_t quote_len = IPH_HL_BYTES(iphdr) + ICMP_QUOTE_L4_LEN;
+    quote_len = (quote_len < p->len) ? quote_len : p->len;
+
+    struct pbuf *q = pbuf_alloc(PBUF_IP, 8 + quote_len, PBUF_RAM);
+    if (q == NULL) {
+        return;
+    }
+    uint8_t *icmp = (uint8_t *)q->payload;
+    memset(icmp, 0, 8);
+    icmp[0] = ICMP_DUR;
+    icmp[1] = ICMP_FRAG_NEEDED;
+    app_packet_write16(&icmp[6], mtu);
+    memcpy(&icmp[8], p->payload, quote_len);
+    uint16_t csum = inet_chksum(icmp, q->len);
+    memcpy(&icmp[2], &csum, 2);
+
+    ip4_addr_t dest;
+    ip4_addr_copy(dest, iphdr->src);
+    ip4_output_if(q, netif_ip4_addr(_p_ap), &dest, ICMP_TTL, 0, IP_PROTO_ICMP, _p_ap);
+    pbuf_free(q);
+    atomic_fetch_add_explicit(&_stats.frag_needed_sent, 1, memory_order_relaxed);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* AP ingress in the tcpip thread, before NAPT. Non-zero return means the packet was answered and eaten. */
+int app_pmtu_outbound(struct pbuf *p) {
+    if ((_p_uplink == NULL) || (_p_uplink->mtu == 0) || (p->len < IP_HLEN)) {
+        return 0;
+    }
+
+    struct ip_hdr *iphdr = (struct ip_hdr *)p->payload;
+    ip4_addr_t dest;
+    ip4_addr_copy(dest, iphdr->dest);
+    if (ip4_addr_ismulticast(&dest) || ip4_addr_isbroadcast(&dest, _p_ap) ||
+        ip4_addr_netcmp(&dest, netif_ip4_addr(_p_ap), netif_ip4_netmask(_p_ap))) {
+        return 0;
+    }
+
+    uint16_t mtu = _p_uplink->mtu;
+    if (lwip_ntohs(IPH_LEN(iphdr)) > mtu) {
+        if ((IPH_OFFSET(iphdr) & PP_HTONS(IP_DF)) != 0) {
+            _send_frag_needed(p, mtu);
+            pbuf_free(p);
+            return 1;
+        }
+        // lwIP fragments it on the way out
+        atomic_fetch_add_explicit(&_stats.fragmented, 1, memory_order_relaxed);
+    }
+
+    _clamp_mss(p, mtu);
+    return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* PPP ingress in the tcpip thread, SYN-ACKs towards the stations get the same clamp */
+void app_pmtu_inbound(struct pbuf *p) {
+    if ((_p_uplink == NULL) || (_p_uplink->mtu == 0) || (p->len < IP_HLEN)) {
+        return;
+    }
+    _clamp_mss(p, _p_uplink->mtu);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _set_uplink_in_tcpip(void *ctx) {
+    struct netif *netif = ctx;
+
+    // PPP sets the MTU from the peer's MRU on every link up, carrier tunnels may need less
+    if ((netif != NULL) && ((netif->mtu == 0) || (netif->mtu > CONFIG_AIR_GATEWAY_UPLINK_MTU))) {
+        netif->mtu = CONFIG_AIR_GATEWAY_UPLINK_MTU;
+    }
+    _p_uplink = netif;
+    atomic_store_explicit(&_stats.mtu, (netif != NULL) ? netif->mtu : 0, memory_order_relaxed);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_pmtu_init(struct netif *ap_netif) {
+    _p_ap = ap_netif;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_pmtu_set_uplink(struct netif *ppp_netif) {
+    if (tcpip_callback(_set_uplink_in_tcpip, ppp_netif) != ERR_OK) {
+        ESP_LOGE(TAG, "Failed to switch the PMTU uplink");
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_pmtu_get_stats(app_pmtu_stats_t *out) {
+    out->mtu = atomic_load_explicit(&_stats.mtu, memory_order_relaxed);
+    out->mss_clamped = atomic_load_explicit(&_stats.mss_clamped, memory_order_relaxed);
+    out->frag_needed_sent = atomic_load_explicit(&_stats.frag_needed_sent, memory_order_relaxed);
+    out->fragmented = atomic_load_explicit(&_stats.fragmented, memory_order_relaxed);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_pmtu_log(void) {
+    app_pmtu_stats_t stats;
+    app_pmtu_get_stats(&stats);
+    ESP_LOGI(TAG,
+             "Uplink MTU %" PRIu32 ": MSS clamped %" PRIu32 ", frag needed sent %" PRIu32 ", fragmented %" PRIu32,
+             stats.mtu,
+             stats.mss_clamped,
+             stats.frag_needed_sent,
+             stats.fragmented);
+}
+
+/* -------------------------------------------------------------------------- */
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+struct pbuf;
+struct netif;
+
+typedef struct {
+    uint32_t mtu;
+    uint32_t mss_clamped;
+    uint32_t frag_needed_sent;
+    uint32_t fragmented;
+} app_pmtu_stats_t;
+
+void app_pmtu_init(struct netif *ap_netif);
+void app_pmtu_set_uplink(struct netif *ppp_netif);
+int app_pmtu_outbound(struct pbuf *p);
+void app_pmtu_inbound(struct pbuf *p);
+void app_pmtu_get_stats(app_pmtu_stats_t *out);
+void app_pmtu_log(void);
@@ -0,0 +1,601 @@
+#include "app_rat.h"
+
+#include "app_affinity.h"
+#include "app_connection.h"
+#include "app_rat_plan.h"
+#include "app_supervisor.h"
+#include "app_telemetry.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_modem_api.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/task.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+
+#include "bsp_modem.h"
+
+/* -------------------------------------------------------------------------- */
+
+static const char *TAG = "app_rat.c";
+
+#define RAT_TASK_STACK_SIZE   (4096)
+#define RAT_TASK_PRIORITY     (2)
+#define RAT_POLL_MS           (10000)
+#define RAT_CANDIDATES_MAX    (8)
+// Rounds for a cell without a stored result, so a busy or flaky site is not trialed back to back
+#define RAT_RETRY_MS          (30 * 60 * 1000U)
+#define RAT_ATTACH_TIMEOUT_MS (90000)
+#define RAT_ATTACH_POLL_MS    (2000)
+#define RAT_AT_RETRIES        (5)
+#define RAT_AT_RETRY_MS       (200)
+#define RAT_PROBE_CHUNK       (2048)
+// Below this the result says more about round trip time than about the radio
+#define RAT_PROBE_MIN_BYTES   (32 * 1024)
+#define RAT_NVS_NAMESPACE     "gateway"
+#define RAT_NVS_KEY_MAX       (16)
+// Hashes of the cells with a stored lock, most recently measured first
+#define RAT_NVS_CELLS_KEY     "rat_cells"
+#define RAT_NVS_BANDS_KEY     "rat_bands"
+#define RAT_CELLS_MAX         (16)
+#define RAT_STORE_VERSION     (1)
+
+typedef struct {
+    char name[APP_RAT_NAME_MAX];
+    bsp_modem_rat_lock_t lock;
+} _candidate_t;
+
+typedef struct {
+    uint8_t version;
+    uint8_t rat;
+    uint64_t lte_bands;
+    uint32_t kbps;
+} _stored_t;
+
+static portMUX_TYPE _stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static app_rat_stats_t _stats;
+
+// RAT task only
+static _candidate_t _candidates[RAT_CANDIDATES_MAX];
+static size_t _candidate_count;
+static size_t _current;
+static bool _has_default_bands;
+static bool _has_anchor;
+static uint32_t _anchor_hash;
+static uint32_t _cell_hash;
+static uint32_t _next_round_ms;
+static uint32_t _settled_ms;
+
+/* -------------------------------------------------------------------------- */
+
+static uint32_t _now_ms(void) {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _add_candidate(const char *name, bsp_modem_rat_e rat, uint64_t lte_bands) {
+    if (_candidate_count >= RAT_CANDIDATES_MAX) {
+        return;
+    }
+    _candidate_t *candidate = &_candidates[_candidate_count++];
+    strlcpy(candidate->name, name, sizeof(candidate->name));
+    candidate->lock.rat = rat;
+    candidate->lock.lte_bands = lte_bands;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Automatic selection always comes first, it is what the modem falls back to */
+static void _build_candidates(void) {
+    _add_candidate("auto", BSP_MODEM_RAT_AUTO, 0);
+    _add_candidate("lte", BSP_MODEM_RAT_LTE, 0);
+#if CONFIG_AIR_GATEWAY_RAT_TRY_WCDMA
+    _add_candidate("wcdma", BSP_MODEM_RAT_WCDMA, 0);
+#endif
+
+    const char *p = CONFIG_AIR_GATEWAY_RAT_LTE_BANDS;
+    while (*p != '\0') {
+        char *end = NULL;
+        long band = strtol(p, &end, 10);
+        if (end == p) {
+            p++;
+            continue;
+        }
+        if ((band >= 1) && (band <= 64)) {
+            char name[APP_RAT_NAME_MAX] = { 0 };
+            snprintf(name, sizeof(name), "lte_b%ld", band);
+            _add_candidate(name, BSP_MODEM_RAT_LTE, 1ULL << (band - 1));
+        }
+        p = end;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static size_t _find(const bsp_modem_rat_lock_t *lock) {
+    for (size_t i = 0; i < _candidate_count; i++) {
+        if ((_candidates[i].lock.rat == lock->rat) && (_candidates[i].lock.lte_bands == lock->lte_bands)) {
+            return i;
+        }
+    }
+    return _candidate_count;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _set_stats_lock(size_t index, uint32_t kbps) {
+    portENTER_CRITICAL(&_stats_lock);
+    strlcpy(_stats.lock, _candidates[index].name, sizeof(_stats.lock));
+    _stats.kbps = kbps;
+    portEXIT_CRITICAL(&_stats_lock);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* The telemetry task shares the command channel, a busy one is retried for a moment */
+static esp_err_t _apply(size_t index) {
+    esp_err_t err = ESP_ERR_TIMEOUT;
+    for (int i = 0; (i < RAT_AT_RETRIES) && (err == ESP_ERR_TIMEOUT); i++) {
+        err = bsp_modem_set_rat_lock(&_candidates[index].lock);
+        if (err == ESP_ERR_TIMEOUT) {
+            vTaskDelay(pdMS_TO_TICKS(RAT_AT_RETRY_MS));
+        }
+    }
+    if (err == ESP_OK) {
+        _current = index;
+        _set_stats_lock(index, 0);
+    }
+    return err;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static esp_err_t _read_telemetry(bsp_modem_telemetry_t *out) {
+    esp_err_t err = ESP_ERR_TIMEOUT;
+    for (int i = 0; (i < RAT_AT_RETRIES) && (err == ESP_ERR_TIMEOUT); i++) {
+        memset(out, 0, sizeof(*out));
+        err = bsp_modem_read_telemetry(out);
+        if (err == ESP_ERR_TIMEOUT) {
+            vTaskDelay(pdMS_TO_TICKS(RAT_AT_RETRY_MS));
+        }
+    }
+    return err;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool _is_serving(const bsp_modem_rat_lock_t *lock, const bsp_modem_telemetry_t *telemetry) {
+    if ((telemetry->cell_id[0] == '\0') || (strncmp(telemetry->rat, "NO SERVICE", 10) == 0)) {
+        return false;
+    }
+    switch (lock->rat) {
+        case BSP_MODEM_RAT_LTE:
+            return strncmp(telemetry->rat, "LTE", 3) == 0;
+        case BSP_MODEM_RAT_WCDMA:
+            return strncmp(telemetry->rat, "WCDMA", 5) == 0;
+        case BSP_MODEM_RAT_GSM:
+            return strncmp(telemetry->rat, "GSM", 3) == 0;
+        default:
+            return true;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* A new lock makes the modem reselect and usually drops PPP, wait until the uplink is back on the locked RAT */
+static bool _wait_attached(const bsp_modem_rat_lock_t *lock, bsp_modem_telemetry_t *out) {
+    vTaskDelay(pdMS_TO_TICKS(CONFIG_AIR_GATEWAY_RAT_SETTLE_S * 1000));
+    uint32_t started_ms = _now_ms();
+    while ((_now_ms() - started_ms) < RAT_ATTACH_TIMEOUT_MS) {
+        app_connection_stats_t uplink;
+        app_connection_get_stats(&uplink);
+        if (uplink.is_up && (_read_telemetry(out) == ESP_OK) && _is_serving(lock, out)) {
+            return true;
+        }
+        vTaskDelay(pdMS_TO_TICKS(RAT_ATTACH_POLL_MS));
+    }
+    return false;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Downloads the probe URL through the uplink, returns 0 when too little arrived to judge */
+static uint32_t _probe_kbps(void) {
+    const esp_http_client_config_t config = {
+        .url = CONFIG_AIR_GATEWAY_RAT_PROBE_URL,
+        .timeout_ms = CONFIG_AIR_GATEWAY_RAT_PROBE_S * 1000,
+    };
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    char *buffer = malloc(RAT_PROBE_CHUNK);
+    if ((client == NULL) || (buffer == NULL)) {
+        free(buffer);
+        if (client != NULL) {
+            esp_http_client_cleanup(client);
+        }
+        return 0;
+    }
+
+    uint64_t total = 0;
+    int64_t started_us = esp_timer_get_time();
+    int64_t deadline_us = started_us + (int64_t)CONFIG_AIR_GATEWAY_RAT_PROBE_S * 1000000;
+    esp_err_t err = esp_http_client_open(client, 0);
+    if ((err == ESP_OK) && (esp_http_client_fetch_headers(client) >= 0)) {
+        while ((total < CONFIG_AIR_GATEWAY_RAT_PROBE_KB * 1024ULL) && (esp_timer_get_time() < deadline_us)) {
+            int len = esp_http_client_read(client, buffer, RAT_PROBE_CHUNK);
+            if (len <= 0) {
+                break;
+            }
+            total += len;
+        }
+    }
+    int64_t elapsed_us = esp_timer_get_time() - started_us;
+    esp_http_client_cleanup(client);
+    free(buffer);
+
+    if ((err != ESP_OK) || (total < RAT_PROBE_MIN_BYTES) || (elapsed_us <= 0)) {
+        ESP_LOGW(TAG, "Probe got %" PRIu64 " bytes (%s)", total, esp_err_to_name(err));
+        return 0;
+    }
+    return (uint32_t)((total * 8 * 1000) / (uint64_t)elapsed_us);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _nvs_key(uint32_t hash, char *out, size_t size) {
+    snprintf(out, size, "rat%08" PRIx32, hash);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool _load(uint32_t hash, _stored_t *stored) {
+    char key[RAT_NVS_KEY_MAX] = { 0 };
+    _nvs_key(hash, key, sizeof(key));
+    nvs_handle_t nvs;
+    if (nvs_open(RAT_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return false;
+    }
+    size_t len = sizeof(*stored);
+    esp_err_t err = nvs_get_blob(nvs, key, stored, &len);
+    nvs_close(nvs);
+    return (err == ESP_OK) && (len == sizeof(*stored)) && (stored->version == RAT_STORE_VERSION);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Keeps the cell list in the same commit as the lock, the least recently measured cell makes room for a new one */
+static esp_err_t _index_cell(nvs_handle_t nvs, uint32_t hash) {
+    uint32_t cells[RAT_CELLS_MAX] = { 0 };
+    size_t len = sizeof(cells);
+    if (nvs_get_blob(nvs, RAT_NVS_CELLS_KEY, cells, &len) != ESP_OK) {
+        len = 0;
+    }
+    size_t count = len / sizeof(cells[0]);
+
+    size_t position = count;
+    for (size_t i = 0; i < count; i++) {
+        if (cells[i] == hash) {
+            position = i;
+            break;
+        }
+    }
+    if (position == count) {
+        if (count == RAT_CELLS_MAX) {
+            char key[RAT_NVS_KEY_MAX] = { 0 };
+            _nvs_key(cells[RAT_CELLS_MAX - 1], key, sizeof(key));
+            nvs_erase_key(nvs, key);
+            count--;
+        }
+        position = count++;
+    }
+    memmove(&cells[1], &cells[0], position * sizeof(cells[0]));
+    cells[0] = hash;
+    return nvs_set_blob(nvs, RAT_NVS_CELLS_KEY, cells, count * sizeof(cells[0]));
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _store(uint32_t hash, size_t index, uint32_t kbps) {
+    const _stored_t stored = {
+        .version = RAT_STORE_VERSION,
+        .rat = (uint8_t)_candidates[index].lock.rat,
+        .lte_bands = _candidates[index].lock.lte_bands,
+        .kbps = kbps,
+    };
+    char key[RAT_NVS_KEY_MAX] = { 0 };
+    _nvs_key(hash, key, sizeof(key));
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(RAT_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        err = _index_cell(nvs, hash);
+        if (err == ESP_OK) {
+            err = nvs_set_blob(nvs, key, &stored, sizeof(stored));
+        }
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to store the lock of cell %08" PRIx32 " with %s", hash, esp_err_to_name(err));
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* "auto" and "lte" restore the band mask the modem came with. It is read once, before the first lock this gateway
+ * applies, and kept in NVS since the modem itself keeps any lock across power cycles. */
+static void _load_default_bands(void) {
+    nvs_handle_t nvs;
+    if (nvs_open(RAT_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+    uint64_t lte_bands = 0;
+    if (nvs_get_u64(nvs, RAT_NVS_BANDS_KEY, &lte_bands) != ESP_OK) {
+        // No default known yet, so get_rat_lock() reports the raw mask
+        bsp_modem_rat_lock_t lock;
+        if (bsp_modem_get_rat_lock(&lock) != ESP_OK) {
+            nvs_close(nvs);
+            return;
+        }
+        // A single band is a lock left by an older firmware rather than a default, the built-in mask stays in use
+        lte_bands = ((lock.lte_bands & (lock.lte_bands - 1)) != 0) ? lock.lte_bands : 0;
+        if ((lte_bands != 0) &&
+            ((nvs_set_u64(nvs, RAT_NVS_BANDS_KEY, lte_bands) != ESP_OK) || (nvs_commit(nvs) != ESP_OK))) {
+            ESP_LOGW(TAG, "Failed to store the default LTE bands");
+        }
+    }
+    nvs_close(nvs);
+
+    if (lte_bands != 0) {
+        ESP_LOGI(TAG, "Default LTE bands 0x%016" PRIX64, lte_bands);
+        bsp_modem_set_default_lte_bands(lte_bands);
+    }
+    _has_default_bands = true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Identifies the site by the cell served at the first look, a stored lock for it is applied right away */
+static void _anchor(void) {
+    if (_has_default_bands == false) {
+        _load_default_bands();
+    }
+
+    bsp_modem_rat_lock_t lock;
+    bsp_modem_telemetry_t telemetry;
+    if ((bsp_modem_get_rat_lock(&lock) != ESP_OK) || (_read_telemetry(&telemetry) != ESP_OK) ||
+        (telemetry.cell_id[0] == '\0')) {
+        return;
+    }
+
+    _current = _find(&lock);
+    if ((_current == _candidate_count) && (_apply(0) != ESP_OK)) {
+        // Locked to something the candidates do not cover, retry on the next poll
+        return;
+    }
+    _set_stats_lock(_current, 0);
+    _has_anchor = true;
+    _anchor_hash = app_rat_plan_cell_hash(telemetry.operator_code, telemetry.cell_id);
+    _cell_hash = _anchor_hash;
+
+    _stored_t stored;
+    bsp_modem_rat_lock_t stored_lock = { 0 };
+    if (_load(_anchor_hash, &stored)) {
+        stored_lock.rat = (bsp_modem_rat_e)stored.rat;
+        stored_lock.lte_bands = stored.lte_bands;
+    }
+    size_t index = _find(&stored_lock);
+    if (index == _candidate_count) {
+        ESP_LOGI(TAG, "No lock stored for cell %s of %s, trials follow", telemetry.cell_id, telemetry.operator_code);
+        _next_round_ms = _now_ms();
+        return;
+    }
+
+    ESP_LOGI(TAG,
+             "Cell %s of %s: stored lock %s measured %" PRIu32 " kbps",
+             telemetry.cell_id,
+             telemetry.operator_code,
+             _candidates[index].name,
+             stored.kbps);
+    if ((index != _current) && (_apply(index) != ESP_OK)) {
+        _has_anchor = false;
+        return;
+    }
+    _set_stats_lock(index, stored.kbps);
+    _settled_ms = _now_ms();
+    _next_round_ms = _now_ms() + CONFIG_AIR_GATEWAY_RAT_INTERVAL_H * 3600U * 1000U;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _set_trialing(bool is_trialing) {
+    portENTER_CRITICAL(&_stats_lock);
+    _stats.is_trialing = is_trialing;
+    if (is_trialing) {
+        _stats.rounds++;
+    }
+    portEXIT_CRITICAL(&_stats_lock);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Every candidate is measured in turn, stations returning to the gateway end the round on the incumbent */
+static void _run_round(void) {
+    size_t incumbent = _current;
+    app_rat_plan_sample_t samples[RAT_CANDIDATES_MAX] = { 0 };
+    _set_trialing(true);
+
+    for (size_t i = 0; i < _candidate_count; i++) {
+        if (app_supervisor_idle_ms() < CONFIG_AIR_GATEWAY_RAT_IDLE_MS) {
+            ESP_LOGI(TAG, "Traffic resumed, trials end on %s", _candidates[incumbent].name);
+            if (_current != incumbent) {
+                _apply(incumbent);
+            }
+            portENTER_CRITICAL(&_stats_lock);
+            _stats.aborted++;
+            portEXIT_CRITICAL(&_stats_lock);
+            _set_trialing(false);
+            _settled_ms = _now_ms();
+            _next_round_ms = _now_ms() + RAT_RETRY_MS;
+            return;
+        }
+
+        if ((i != _current) && (_apply(i) != ESP_OK)) {
+            continue;
+        }
+        bsp_modem_telemetry_t telemetry;
+        if (_wait_attached(&_candidates[i].lock, &telemetry) == false) {
+            ESP_LOGW(TAG, "Trial %s: no service", _candidates[i].name);
+            continue;
+        }
+
+        samples[i].rssi = telemetry.rssi;
+        samples[i].rsrp_dbm_x10 = telemetry.rsrp_dbm_x10;
+        samples[i].kbps = _probe_kbps();
+        samples[i].is_measured = (samples[i].kbps != 0);
+        portENTER_CRITICAL(&_stats_lock);
+        _stats.trials++;
+        portEXIT_CRITICAL(&_stats_lock);
+        ESP_LOGI(TAG,
+                 "Trial %s: %s %s cell %s, CSQ %d, RSRP %d.%d dBm, %" PRIu32 " kbps",
+                 _candidates[i].name,
+                 telemetry.rat,
+                 telemetry.band,
+                 telemetry.cell_id,
+                 telemetry.rssi,
+                 telemetry.rsrp_dbm_x10 / 10,
+                 abs(telemetry.rsrp_dbm_x10 % 10),
+                 samples[i].kbps);
+    }
+
+    size_t best = app_rat_plan_pick(samples, _candidate_count, incumbent, CONFIG_AIR_GATEWAY_RAT_HYSTERESIS_PERCENT);
+    bsp_modem_telemetry_t telemetry;
+    if (((best != _current) && (_apply(best) != ESP_OK)) ||
+        (_wait_attached(&_candidates[best].lock, &telemetry) == false)) {
+        // The next round starts from whatever the modem ends up on
+        _has_anchor = false;
+        _set_trialing(false);
+        _next_round_ms = _now_ms() + RAT_RETRY_MS;
+        return;
+    }
+
+    _set_stats_lock(best, samples[best].kbps);
+    if (best != incumbent) {
+        portENTER_CRITICAL(&_stats_lock);
+        _stats.switches++;
+        portEXIT_CRITICAL(&_stats_lock);
+        ESP_LOGW(TAG,
+                 "Lock %s -> %s, %" PRIu32 " -> %" PRIu32 " kbps",
+                 _candidates[incumbent].name,
+                 _candidates[best].name,
+                 samples[incumbent].kbps,
+                 samples[best].kbps);
+    }
+
+    // The locked RAT serves another cell, the result is kept under both so either one finds it after a reboot
+    _store(_anchor_hash, best, samples[best].kbps);
+    _cell_hash = app_rat_plan_cell_hash(telemetry.operator_code, telemetry.cell_id);
+    if (_cell_hash != _anchor_hash) {
+        _store(_cell_hash, best, samples[best].kbps);
+    }
+    _set_trialing(false);
+    _settled_ms = _now_ms();
+    _next_round_ms = _now_ms() + CONFIG_AIR_GATEWAY_RAT_INTERVAL_H * 3600U * 1000U;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* A cell the gateway did not settle on means it was moved, the site is identified again */
+static void _check_cell(void) {
+    app_telemetry_t telemetry;
+    app_telemetry_get(&telemetry);
+    // Snapshots from before the last lock change show a trial's cell
+    if ((telemetry.is_valid == false) || ((int32_t)(telemetry.updated_ms - _settled_ms) < 0) ||
+        (telemetry.modem.cell_id[0] == '\0')) {
+        return;
+    }
+    uint32_t hash = app_rat_plan_cell_hash(telemetry.modem.operator_code, telemetry.modem.cell_id);
+    if ((hash != _anchor_hash) && (hash != _cell_hash)) {
+        ESP_LOGI(TAG, "Serving cell changed to %s", telemetry.modem.cell_id);
+        _has_anchor = false;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _rat_task(void *arg) {
+    (void)arg;
+
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(RAT_POLL_MS));
+
+        app_connection_stats_t uplink;
+        app_connection_get_stats(&uplink);
+        if ((uplink.is_up == false) || bsp_modem_is_sleeping()) {
+            continue;
+        }
+
+        if (_has_anchor == false) {
+            _anchor();
+            continue;
+        }
+        _check_cell();
+        if ((_has_anchor == false) || ((int32_t)(_now_ms() - _next_round_ms) < 0)) {
+            continue;
+        }
+        if (app_supervisor_idle_ms() >= CONFIG_AIR_GATEWAY_RAT_IDLE_MS) {
+            _run_round();
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_rat_start(void) {
+    _build_candidates();
+    strlcpy(_stats.lock, _candidates[0].name, sizeof(_stats.lock));
+    ESP_LOGI(TAG, "%u RAT/band locks to trial", (unsigned)_candidate_count);
+    xTaskCreatePinnedToCore(_rat_task,
+                            "rat",
+                            RAT_TASK_STACK_SIZE,
+                            NULL,
+                            RAT_TASK_PRIORITY,
+                            NULL,
+                            app_affinity_core(APP_AFFINITY_ROLE_BACKGROUND));
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_rat_get_stats(app_rat_stats_t *out) {
+    portENTER_CRITICAL(&_stats_lock);
+    *out = _stats;
+    portEXIT_CRITICAL(&_stats_lock);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_rat_log(void) {
+    app_rat_stats_t stats;
+    app_rat_get_stats(&stats);
+    ESP_LOGI(TAG,
+             "Lock %s at %" PRIu32 " kbps%s: %" PRIu32 " rounds, %" PRIu32 " aborted, %" PRIu32 " trials, %" PRIu32
+             " switches",
+             stats.lock,
+             stats.kbps,
+             stats.is_trialing ? " (trialing)" : "",
+             stats.rounds,
+             stats.aborted,
+             stats.trials,
+             stats.switches);
+}
+
+/* -------------------------------------------------------------------------- */
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define APP_RAT_NAME_MAX (12)
+
+typedef struct {
+    char lock[APP_RAT_NAME_MAX];
+    bool is_trialing;
+    uint32_t rounds;
+    uint32_t aborted;
+    uint32_t trials;
+    uint32_t switches;
+    // Probe result of the lock in use, 0 until it was measured
+    uint32_t kbps;
+} app_rat_stats_t;
+
+void app_rat_start(void);
+void app_rat_get_stats(app_rat_stats_t *out);
+void app_rat_log(void);
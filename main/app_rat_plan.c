@@ -0,0 +1,74 @@
+#include "app_rat_plan.h"
+
+/* -------------------------------------------------------------------------- */
+
+// Probe results per RAT/band lock in, the lock to keep out. Talking to the modem stays in app_rat.c.
+
+#define PLAN_CSQ_UNKNOWN (99)
+#define PLAN_SIGNAL_NONE (-1500)
+#define PLAN_FNV_OFFSET  (2166136261UL)
+#define PLAN_FNV_PRIME   (16777619UL)
+
+/* -------------------------------------------------------------------------- */
+
+/* Received power in dBm x10, RSRP when the modem reports it, the CSQ scale otherwise */
+static int _signal(const app_rat_plan_sample_t *sample) {
+    if (sample->rsrp_dbm_x10 != 0) {
+        return sample->rsrp_dbm_x10;
+    }
+    if ((sample->rssi < 0) || (sample->rssi == PLAN_CSQ_UNKNOWN)) {
+        return PLAN_SIGNAL_NONE;
+    }
+    return (-113 + 2 * sample->rssi) * 10;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Throughput decides, the stronger signal breaks ties since it usually holds up better under load */
+static bool _is_better(const app_rat_plan_sample_t *candidate, const app_rat_plan_sample_t *best) {
+    if (candidate->kbps != best->kbps) {
+        return candidate->kbps > best->kbps;
+    }
+    return _signal(candidate) > _signal(best);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* The incumbent is kept unless another lock measured at least hysteresis_percent more throughput */
+size_t app_rat_plan_pick(const app_rat_plan_sample_t *samples,
+                         size_t count,
+                         size_t incumbent,
+                         uint32_t hysteresis_percent) {
+    size_t best = count;
+    for (size_t i = 0; i < count; i++) {
+        if (samples[i].is_measured && ((best == count) || _is_better(&samples[i], &samples[best]))) {
+            best = i;
+        }
+    }
+
+    if (best == count) {
+        return incumbent;
+    }
+    if ((incumbent >= count) || (samples[incumbent].is_measured == false) || (best == incumbent)) {
+        return best;
+    }
+    uint64_t needed_kbps = (uint64_t)samples[incumbent].kbps * (100 + hysteresis_percent);
+    return ((uint64_t)samples[best].kbps * 100 >= needed_kbps) ? best : incumbent;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* FNV-1a over the operator and the cell id, short enough for an NVS key */
+uint32_t app_rat_plan_cell_hash(const char *operator_code, const char *cell_id) {
+    uint32_t hash = PLAN_FNV_OFFSET;
+    for (const char *p = operator_code; *p != '\0'; p++) {
+        hash = (hash ^ (uint8_t)*p) * PLAN_FNV_PRIME;
+    }
+    hash = (hash ^ '/') * PLAN_FNV_PRIME;
+    for (const char *p = cell_id; *p != '\0'; p++) {
+        hash = (hash ^ (uint8_t)*p) * PLAN_FNV_PRIME;
+    }
+    return hash;
+}
+
+/* -------------------------------------------------------------------------- */
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    bool is_measured;
+    uint32_t kbps;
+    // AT+CSQ, 99 when unknown
+    int rssi;
+    // LTE serving cell only, 0 otherwise
+    int rsrp_dbm_x10;
+} app_rat_plan_sample_t;
+
+size_t app_rat_plan_pick(const app_rat_plan_sample_t *samples,
+                         size_t count,
+                         size_t incumbent,
+                         uint32_t hysteresis_percent);
+uint32_t app_rat_plan_cell_hash(const char *operator_code, const char *cell_id);
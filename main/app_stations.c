@@ -0,0 +1,377 @@
+#include "app_stations.h"
+
+#include "app_config.h"
+#include "app_napt.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include "esp_event.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "lwip/lwip_napt.h"
+#include "lwip/pbuf.h"
+#include "lwip/prot/ip.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/tcp.h"
+#include "sdkconfig.h"
+
+/* -------------------------------------------------------------------------- */
+
+static const char *TAG = "app_stations.c";
+
+// Departed stations stay visible until their slot is needed for a new one
+#define STATIONS_MAX   (APP_CONFIG_STATIONS_MAX + 4)
+#define STATION_NONE   (0xFF)
+#define FLOW_TABLE_LEN (IP_NAPT_MAX)
+#if CONFIG_AIR_GATEWAY_NAPT
+#define NAPT_CAPACITY (CONFIG_AIR_GATEWAY_NAPT_ENTRIES)
+#else
+#define NAPT_CAPACITY (IP_NAPT_MAX)
+#endif
+
+typedef enum {
+    FLOW_EMPTY = 0,
+    FLOW_TCP,
+    FLOW_TCP_CLOSING,
+    FLOW_UDP,
+    FLOW_ICMP,
+} _flow_state_e;
+
+typedef struct {
+    atomic_uint_fast32_t up_packets;
+    atomic_uint_fast32_t up_bytes;
+    atomic_uint_fast32_t down_packets;
+    atomic_uint_fast32_t down_bytes;
+} _station_counters_t;
+
+typedef struct {
+    atomic_bool in_use;
+    atomic_bool is_connected;
+    uint8_t mac[6];
+    atomic_uint_fast32_t ip;
+    uint32_t first_seen_ms;
+    atomic_uint_fast32_t last_seen_ms;
+    // One writer per core, summed on snapshot
+    _station_counters_t counters[portNUM_PROCESSORS];
+} _station_t;
+
+// Mirrors the NAPT table closely enough to attribute entries, esp-lwip does not expose its own
+typedef struct {
+    uint32_t key;
+    uint16_t last_seen_s;
+    uint8_t station;
+    uint8_t state;
+} _flow_t;
+
+static _station_t _stations[STATIONS_MAX];
+#if !CONFIG_AIR_GATEWAY_NAPT
+static _flow_t _flows[FLOW_TABLE_LEN];
+#endif
+static portMUX_TYPE _stations_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* -------------------------------------------------------------------------- */
+
+static uint32_t _now_ms(void) {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint8_t _find_by_ip(uint32_t ip) {
+    for (uint8_t i = 0; i < STATIONS_MAX; i++) {
+        if ((atomic_load_explicit(&_stations[i].ip, memory_order_relaxed) == ip) &&
+            (atomic_load_explicit(&_stations[i].in_use, memory_order_acquire) == true)) {
+            return i;
+        }
+    }
+    return STATION_NONE;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint8_t _find_by_mac(const uint8_t mac[6]) {
+    for (uint8_t i = 0; i < STATIONS_MAX; i++) {
+        if ((atomic_load_explicit(&_stations[i].in_use, memory_order_acquire) == true) &&
+            (memcmp(_stations[i].mac, mac, 6) == 0)) {
+            return i;
+        }
+    }
+    return STATION_NONE;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _count(_station_t *station, bool is_up, uint32_t bytes) {
+    _station_counters_t *counters = &station->counters[xPortGetCoreID()];
+    if (is_up == true) {
+        atomic_fetch_add_explicit(&counters->up_packets, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&counters->up_bytes, bytes, memory_order_relaxed);
+    } else {
+        atomic_fetch_add_explicit(&counters->down_packets, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&counters->down_bytes, bytes, memory_order_relaxed);
+    }
+    atomic_store_explicit(&station->last_seen_ms, _now_ms(), memory_order_relaxed);
+}
+
+/* -------------------------------------------------------------------------- */
+
+#if !CONFIG_AIR_GATEWAY_NAPT
+/* Only called from the tcpip thread, the flow table has a single writer */
+static void _track_flow(const struct pbuf *p, uint8_t station) {
+    const struct ip_hdr *iphdr = (const struct ip_hdr *)p->payload;
+    uint16_t hlen = IPH_HL_BYTES(iphdr);
+    uint8_t proto = IPH_PROTO(iphdr);
+    uint32_t key = iphdr->src.addr ^ (iphdr->dest.addr * 2654435761u) ^ proto;
+    uint8_t state = FLOW_ICMP;
+
+    if (((proto == IP_PROTO_TCP) || (proto == IP_PROTO_UDP)) && (p->len >= hlen + 4)) {
+        const uint8_t *l4 = (const uint8_t *)p->payload + hlen;
+        key ^= ((uint32_t)l4[0] << 24) | ((uint32_t)l4[1] << 16) | ((uint32_t)l4[2] << 8) | l4[3];
+        state = FLOW_UDP;
+        if (proto == IP_PROTO_TCP) {
+            state = FLOW_TCP;
+            if ((p->len >= hlen + TCP_HLEN) && ((l4[13] & (TCP_FIN | TCP_RST)) != 0)) {
+                state = FLOW_TCP_CLOSING;
+            }
+        }
+    } else if (proto != IP_PROTO_ICMP) {
+        return;
+    }
+
+    _flow_t *flow = &_flows[(key ^ (key >> 16)) % FLOW_TABLE_LEN];
+    flow->key = key;
+    flow->station = station;
+    flow->state = state;
+    flow->last_seen_s = (uint16_t)(_now_ms() / 1000);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool _is_flow_active(const _flow_t *flow, uint16_t now_s) {
+    uint32_t idle_ms = (uint32_t)(uint16_t)(now_s - flow->last_seen_s) * 1000;
+    switch (flow->state) {
+        case FLOW_TCP:
+            return idle_ms < IP_NAPT_TIMEOUT_MS_TCP;
+        case FLOW_TCP_CLOSING:
+            return idle_ms < IP_NAPT_TIMEOUT_MS_TCP_DISCON;
+        case FLOW_UDP:
+            return idle_ms < IP_NAPT_TIMEOUT_MS_UDP;
+        case FLOW_ICMP:
+            return idle_ms < IP_NAPT_TIMEOUT_MS_ICMP;
+        default:
+            return false;
+    }
+}
+#endif
+
+/* -------------------------------------------------------------------------- */
+
+static void _on_ip_assigned(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data) {
+    ip_event_ap_staipassigned_t *event = (ip_event_ap_staipassigned_t *)event_data;
+
+    portENTER_CRITICAL(&_stations_lock);
+    // A lease handed to a new station retires the previous holder of the address
+    for (uint8_t i = 0; i < STATIONS_MAX; i++) {
+        if (atomic_load_explicit(&_stations[i].ip, memory_order_relaxed) == event->ip.addr) {
+            atomic_store_explicit(&_stations[i].ip, 0, memory_order_relaxed);
+        }
+    }
+    uint8_t index = _find_by_mac(event->mac);
+    if (index != STATION_NONE) {
+        atomic_store_explicit(&_stations[index].ip, event->ip.addr, memory_order_relaxed);
+    }
+    portEXIT_CRITICAL(&_stations_lock);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_stations_init(void) {
+    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_AP_STAIPASSIGNED, &_on_ip_assigned, NULL));
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_stations_join(const uint8_t mac[6]) {
+    uint32_t now_ms = _now_ms();
+
+    portENTER_CRITICAL(&_stations_lock);
+    uint8_t index = _find_by_mac(mac);
+    if (index == STATION_NONE) {
+        // Free slot first, otherwise recycle the station that left longest ago
+        uint32_t oldest_ms = UINT32_MAX;
+        for (uint8_t i = 0; i < STATIONS_MAX; i++) {
+            if (atomic_load_explicit(&_stations[i].in_use, memory_order_relaxed) == false) {
+                index = i;
+                break;
+            }
+            uint32_t last_seen_ms = atomic_load_explicit(&_stations[i].last_seen_ms, memory_order_relaxed);
+            if ((atomic_load_explicit(&_stations[i].is_connected, memory_order_relaxed) == false) &&
+                (last_seen_ms < oldest_ms)) {
+                oldest_ms = last_seen_ms;
+                index = i;
+            }
+        }
+    }
+
+    if (index != STATION_NONE) {
+        _station_t *station = &_stations[index];
+        if (memcmp(station->mac, mac, 6) != 0) {
+            atomic_store_explicit(&station->in_use, false, memory_order_release);
+            memset(station->counters, 0, sizeof(station->counters));
+            memcpy(station->mac, mac, 6);
+            atomic_store_explicit(&station->ip, 0, memory_order_relaxed);
+            station->first_seen_ms = now_ms;
+        }
+        atomic_store_explicit(&station->last_seen_ms, now_ms, memory_order_relaxed);
+        atomic_store_explicit(&station->is_connected, true, memory_order_relaxed);
+        atomic_store_explicit(&station->in_use, true, memory_order_release);
+    }
+    portEXIT_CRITICAL(&_stations_lock);
+
+    if (index == STATION_NONE) {
+        ESP_LOGW(TAG, "No accounting slot for station " MACSTR, MAC2STR(mac));
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_stations_leave(const uint8_t mac[6]) {
+    portENTER_CRITICAL(&_stations_lock);
+    uint8_t index = _find_by_mac(mac);
+    if (index != STATION_NONE) {
+        atomic_store_explicit(&_stations[index].is_connected, false, memory_order_relaxed);
+        atomic_store_explicit(&_stations[index].ip, 0, memory_order_relaxed);
+    }
+    portEXIT_CRITICAL(&_stations_lock);
+}
+
+/* -------------------------------------------------------------------------- */
+
+size_t app_stations_connected(void) {
+    size_t count = 0;
+    for (uint8_t i = 0; i < STATIONS_MAX; i++) {
+        if ((atomic_load_explicit(&_stations[i].in_use, memory_order_acquire) == true) &&
+            (atomic_load_explicit(&_stations[i].is_connected, memory_order_relaxed) == true)) {
+            count++;
+        }
+    }
+    return count;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* AP ingress, p->payload is the IPv4 header */
+void app_stations_count_up(const struct pbuf *p) {
+    if (p->len < IP_HLEN) {
+        return;
+    }
+    const struct ip_hdr *iphdr = (const struct ip_hdr *)p->payload;
+    uint8_t index = _find_by_ip(iphdr->src.addr);
+    if (index == STATION_NONE) {
+        return;
+    }
+    _count(&_stations[index], true, p->tot_len);
+#if !CONFIG_AIR_GATEWAY_NAPT
+    _track_flow(p, index);
+#endif
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* AP egress, p->payload is the Ethernet header */
+void app_stations_count_down(const struct pbuf *p) {
+    if (p->len < 6) {
+        return;
+    }
+    uint8_t index = _find_by_mac((const uint8_t *)p->payload);
+    if (index == STATION_NONE) {
+        return;
+    }
+    _count(&_stations[index], false, p->tot_len);
+}
+
+/* -------------------------------------------------------------------------- */
+
+size_t app_stations_snapshot(app_station_t *out, size_t max) {
+    size_t count = 0;
+#if !CONFIG_AIR_GATEWAY_NAPT
+    uint8_t slot_to_out[STATIONS_MAX];
+    memset(slot_to_out, STATION_NONE, sizeof(slot_to_out));
+#endif
+
+    for (uint8_t i = 0; (i < STATIONS_MAX) && (count < max); i++) {
+        _station_t *station = &_stations[i];
+        if (atomic_load_explicit(&station->in_use, memory_order_acquire) == false) {
+            continue;
+        }
+
+        app_station_t *entry = &out[count];
+        memset(entry, 0, sizeof(*entry));
+        memcpy(entry->mac, station->mac, 6);
+        entry->ip = atomic_load_explicit(&station->ip, memory_order_relaxed);
+        entry->is_connected = atomic_load_explicit(&station->is_connected, memory_order_relaxed);
+        entry->first_seen_ms = station->first_seen_ms;
+        entry->last_seen_ms = atomic_load_explicit(&station->last_seen_ms, memory_order_relaxed);
+        for (int core = 0; core < portNUM_PROCESSORS; core++) {
+            _station_counters_t *counters = &station->counters[core];
+            entry->up_packets += atomic_load_explicit(&counters->up_packets, memory_order_relaxed);
+            entry->up_bytes += atomic_load_explicit(&counters->up_bytes, memory_order_relaxed);
+            entry->down_packets += atomic_load_explicit(&counters->down_packets, memory_order_relaxed);
+            entry->down_bytes += atomic_load_explicit(&counters->down_bytes, memory_order_relaxed);
+        }
+#if CONFIG_AIR_GATEWAY_NAPT
+        entry->napt_entries = (entry->ip != 0) ? app_napt_count_for(entry->ip) : 0;
+#else
+        slot_to_out[i] = (uint8_t)count;
+#endif
+        count++;
+    }
+
+#if !CONFIG_AIR_GATEWAY_NAPT
+    // Racy read of the flow table, an estimate is all the caller needs
+    uint16_t now_s = (uint16_t)(_now_ms() / 1000);
+    for (size_t i = 0; i < FLOW_TABLE_LEN; i++) {
+        _flow_t flow = _flows[i];
+        if ((flow.station < STATIONS_MAX) && (slot_to_out[flow.station] != STATION_NONE) &&
+            (_is_flow_active(&flow, now_s) == true)) {
+            out[slot_to_out[flow.station]].napt_entries++;
+        }
+    }
+#endif
+    return count;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_stations_log(void) {
+    app_station_t stations[STATIONS_MAX];
+    size_t count = app_stations_snapshot(stations, STATIONS_MAX);
+    uint32_t now_ms = _now_ms();
+    uint32_t napt_entries = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        const app_station_t *station = &stations[i];
+        esp_ip4_addr_t ip = { .addr = station->ip };
+        ESP_LOGI(TAG,
+                 "Station " MACSTR " " IPSTR " %s: up %" PRIu32 " KB/%" PRIu32 " pkts, down %" PRIu32 " KB/%" PRIu32
+                 " pkts, napt %" PRIu32 ", seen %" PRIu32 " s ago, for %" PRIu32 " s",
+                 MAC2STR(station->mac),
+                 IP2STR(&ip),
+                 station->is_connected ? "on" : "off",
+                 station->up_bytes / 1024,
+                 station->up_packets,
+                 station->down_bytes / 1024,
+                 station->down_packets,
+                 station->napt_entries,
+                 (now_ms - station->last_seen_ms) / 1000,
+                 (station->last_seen_ms - station->first_seen_ms) / 1000);
+        napt_entries += station->napt_entries;
+    }
+    ESP_LOGI(TAG, "NAPT entries: %" PRIu32 " of %d", napt_entries, NAPT_CAPACITY);
+}
+
+/* -------------------------------------------------------------------------- */
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct pbuf;
+
+typedef struct {
+    uint8_t mac[6];
+    uint32_t ip;
+    bool is_connected;
+    uint32_t first_seen_ms;
+    uint32_t last_seen_ms;
+    uint32_t up_packets;
+    uint32_t up_bytes;
+    uint32_t down_packets;
+    uint32_t down_bytes;
+    uint32_t napt_entries;
+} app_station_t;
+
+void app_stations_init(void);
+void app_stations_join(const uint8_t mac[6]);
+void app_stations_leave(const uint8_t mac[6]);
+size_t app_stations_connected(void);
+void app_stations_count_up(const struct pbuf *p);
+void app_stations_count_down(const struct pbuf *p);
+size_t app_stations_snapshot(app_station_t *out, size_t max);
+void app_stations_log(void);
@@ -0,0 +1,152 @@
+#include "app_stats.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+/* -------------------------------------------------------------------------- */
+
+static const char *TAG = "app_stats.c";
+
+typedef struct {
+    atomic_uint_fast32_t rx_packets;
+    atomic_uint_fast32_t rx_bytes;
+    atomic_uint_fast32_t tx_packets;
+    atomic_uint_fast32_t tx_bytes;
+} _if_counters_t;
+
+static _if_counters_t _counters[APP_STATS_IF_MAX];
+
+static atomic_uint_fast32_t _milestones_ms[APP_STATS_MILESTONE_MAX];
+static bool _milestones_logged;
+
+static app_stats_if_t _last_log_snapshot[APP_STATS_IF_MAX];
+static int64_t _last_log_ts_us;
+
+/* -------------------------------------------------------------------------- */
+
+static uint32_t _rate_kbps(uint32_t bytes_delta, int64_t elapsed_us) {
+    if (elapsed_us <= 0) {
+        return 0;
+    }
+    return (uint32_t)(((uint64_t)bytes_delta * 8ULL * 1000ULL) / (uint64_t)elapsed_us);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_stats_count_rx(app_stats_if_e iface, size_t bytes) {
+    if (iface >= APP_STATS_IF_MAX) {
+        return;
+    }
+    atomic_fetch_add_explicit(&_counters[iface].rx_packets, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&_counters[iface].rx_bytes, (uint32_t)bytes, memory_order_relaxed);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_stats_count_tx(app_stats_if_e iface, size_t bytes) {
+    if (iface >= APP_STATS_IF_MAX) {
+        return;
+    }
+    atomic_fetch_add_explicit(&_counters[iface].tx_packets, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&_counters[iface].tx_bytes, (uint32_t)bytes, memory_order_relaxed);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_stats_get_if(app_stats_if_e iface, app_stats_if_t *out) {
+    if ((iface >= APP_STATS_IF_MAX) || (out == NULL)) {
+        return;
+    }
+    out->rx_packets = atomic_load_explicit(&_counters[iface].rx_packets, memory_order_relaxed);
+    out->rx_bytes = atomic_load_explicit(&_counters[iface].rx_bytes, memory_order_relaxed);
+    out->tx_packets = atomic_load_explicit(&_counters[iface].tx_packets, memory_order_relaxed);
+    out->tx_bytes = atomic_load_explicit(&_counters[iface].tx_bytes, memory_order_relaxed);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_stats_get_heap(app_stats_heap_t *out) {
+    out->heap_free_internal = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    out->heap_min_free_internal = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+    out->heap_largest_block_internal = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL);
+    out->heap_free_psram = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    out->heap_min_free_psram = heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM);
+    out->heap_largest_block_psram = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Milestones are measured from boot and recorded once, the first caller wins */
+void app_stats_mark_milestone(app_stats_milestone_e milestone) {
+    if (milestone >= APP_STATS_MILESTONE_MAX) {
+        return;
+    }
+    if (atomic_load_explicit(&_milestones_ms[milestone], memory_order_relaxed) != 0) {
+        return;
+    }
+    uint_fast32_t expected = 0;
+    uint32_t now_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    atomic_compare_exchange_strong(&_milestones_ms[milestone], &expected, (now_ms > 0) ? now_ms : 1);
+}
+
+/* -------------------------------------------------------------------------- */
+
+uint32_t app_stats_get_milestone_ms(app_stats_milestone_e milestone) {
+    if (milestone >= APP_STATS_MILESTONE_MAX) {
+        return 0;
+    }
+    return atomic_load_explicit(&_milestones_ms[milestone], memory_order_relaxed);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_stats_log(void) {
+    int64_t now_us = esp_timer_get_time();
+    int64_t elapsed_us = now_us - _last_log_ts_us;
+
+    app_stats_if_t ap;
+    app_stats_if_t ppp;
+    app_stats_get_if(APP_STATS_IF_AP, &ap);
+    app_stats_get_if(APP_STATS_IF_PPP, &ppp);
+
+    ESP_LOGI(TAG,
+             "Uplink (AP rx): %" PRIu32 " kbit/s, %" PRIu32 " pkts; Downlink (PPP rx): %" PRIu32 " kbit/s, %" PRIu32
+             " pkts",
+             _rate_kbps(ap.rx_bytes - _last_log_snapshot[APP_STATS_IF_AP].rx_bytes, elapsed_us),
+             ap.rx_packets - _last_log_snapshot[APP_STATS_IF_AP].rx_packets,
+             _rate_kbps(ppp.rx_bytes - _last_log_snapshot[APP_STATS_IF_PPP].rx_bytes, elapsed_us),
+             ppp.rx_packets - _last_log_snapshot[APP_STATS_IF_PPP].rx_packets);
+
+    app_stats_heap_t heap;
+    app_stats_get_heap(&heap);
+    ESP_LOGI(TAG,
+             "Heap internal: free %" PRIu32 ", min %" PRIu32 ", largest %" PRIu32 "; PSRAM: free %" PRIu32
+             ", min %" PRIu32 ", largest %" PRIu32,
+             heap.heap_free_internal,
+             heap.heap_min_free_internal,
+             heap.heap_largest_block_internal,
+             heap.heap_free_psram,
+             heap.heap_min_free_psram,
+             heap.heap_largest_block_psram);
+
+    uint32_t first_forward_ms = app_stats_get_milestone_ms(APP_STATS_MILESTONE_FIRST_FORWARD);
+    if ((_milestones_logged == false) && (first_forward_ms != 0)) {
+        ESP_LOGI(TAG,
+                 "Boot: modem powered %" PRIu32 " ms, PPP up %" PRIu32 " ms, first packet to a station %" PRIu32 " ms",
+                 app_stats_get_milestone_ms(APP_STATS_MILESTONE_MODEM_POWERED),
+                 app_stats_get_milestone_ms(APP_STATS_MILESTONE_PPP_UP),
+                 first_forward_ms);
+        _milestones_logged = true;
+    }
+
+    _last_log_snapshot[APP_STATS_IF_AP] = ap;
+    _last_log_snapshot[APP_STATS_IF_PPP] = ppp;
+    _last_log_ts_us = now_us;
+}
+
+/* -------------------------------------------------------------------------- */
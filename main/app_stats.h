@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    APP_STATS_IF_AP = 0,
+    APP_STATS_IF_PPP,
+    APP_STATS_IF_MAX,
+} app_stats_if_e;
+
+typedef enum {
+    APP_STATS_MILESTONE_MODEM_POWERED = 0,
+    APP_STATS_MILESTONE_PPP_UP,
+    APP_STATS_MILESTONE_FIRST_FORWARD,
+    APP_STATS_MILESTONE_MAX,
+} app_stats_milestone_e;
+
+typedef struct {
+    uint32_t rx_packets;
+    uint32_t rx_bytes;
+    uint32_t tx_packets;
+    uint32_t tx_bytes;
+} app_stats_if_t;
+
+typedef struct {
+    uint32_t heap_free_internal;
+    uint32_t heap_min_free_internal;
+    uint32_t heap_largest_block_internal;
+    uint32_t heap_free_psram;
+    uint32_t heap_min_free_psram;
+    uint32_t heap_largest_block_psram;
+} app_stats_heap_t;
+
+void app_stats_count_rx(app_stats_if_e iface, size_t bytes);
+void app_stats_count_tx(app_stats_if_e iface, size_t bytes);
+void app_stats_get_if(app_stats_if_e iface, app_stats_if_t *out);
+void app_stats_get_heap(app_stats_heap_t *out);
+void app_stats_mark_milestone(app_stats_milestone_e milestone);
+uint32_t app_stats_get_milestone_ms(app_stats_milestone_e milestone);
+void app_stats_log(void);
@@ -0,0 +1,214 @@
+#include "app_supervisor.h"
+
+#include "app_affinity.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#if CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#endif
+
+/* -------------------------------------------------------------------------- */
+
+static const char *TAG = "app_supervisor.c";
+
+#define SUPERVISOR_TASK_STACK_SIZE (4096)
+#define SUPERVISOR_TASK_PRIORITY   (4)
+#define SUPERVISOR_QUEUE_LENGTH    (16)
+#define SUPERVISOR_POST_TIMEOUT_MS (100)
+
+typedef struct {
+    atomic_uint_fast32_t wakeups;
+    atomic_uint_fast32_t events[APP_SUPERVISOR_EVENT_MAX];
+    atomic_uint_fast32_t queue_full;
+    atomic_uint_fast32_t activity_bursts;
+    atomic_uint_fast32_t activity_ms;
+} _supervisor_stats_t;
+
+static QueueHandle_t _p_queue;
+static app_supervisor_handler_t _p_handler;
+static esp_timer_handle_t _p_status_timer;
+static esp_timer_handle_t _p_activity_timer;
+#if CONFIG_PM_ENABLE
+static esp_pm_lock_handle_t _p_activity_lock;
+#endif
+
+static atomic_bool _is_active;
+static atomic_uint_fast32_t _last_traffic_ms;
+static atomic_uint_fast32_t _active_since_ms;
+
+static _supervisor_stats_t _stats;
+
+/* -------------------------------------------------------------------------- */
+
+static uint32_t _now_ms(void) {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _on_status_timer(void *arg) {
+    (void)arg;
+    const app_supervisor_event_t event = { .type = APP_SUPERVISOR_EVENT_STATUS_LOG };
+    app_supervisor_post(&event);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* esp_timer task, the lock is dropped once no packet was forwarded for the hold time */
+static void _on_activity_timer(void *arg) {
+    (void)arg;
+    uint32_t now_ms = _now_ms();
+    uint32_t idle_ms = now_ms - atomic_load_explicit(&_last_traffic_ms, memory_order_relaxed);
+    if (idle_ms < CONFIG_AIR_GATEWAY_ACTIVITY_HOLD_MS) {
+        esp_timer_start_once(_p_activity_timer, (uint64_t)(CONFIG_AIR_GATEWAY_ACTIVITY_HOLD_MS - idle_ms) * 1000);
+        return;
+    }
+
+    // Cleared before the release, a packet racing in takes a second reference instead of losing one
+    atomic_store(&_is_active, false);
+    uint32_t active_ms = now_ms - atomic_load_explicit(&_active_since_ms, memory_order_relaxed);
+    atomic_fetch_add_explicit(&_stats.activity_ms, active_ms, memory_order_relaxed);
+#if CONFIG_PM_ENABLE
+    if (_p_activity_lock != NULL) {
+        esp_pm_lock_release(_p_activity_lock);
+    }
+#endif
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _supervisor_task(void *arg) {
+    (void)arg;
+
+    app_supervisor_event_t event;
+    while (1) {
+        // Blocks without timeout, the tick-less idle can stretch until the next event or timer
+        if (xQueueReceive(_p_queue, &event, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        atomic_fetch_add_explicit(&_stats.wakeups, 1, memory_order_relaxed);
+        if (event.type < APP_SUPERVISOR_EVENT_MAX) {
+            atomic_fetch_add_explicit(&_stats.events[event.type], 1, memory_order_relaxed);
+        }
+        _p_handler(&event);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_supervisor_start(app_supervisor_handler_t handler) {
+    _p_handler = handler;
+    _p_queue = xQueueCreate(SUPERVISOR_QUEUE_LENGTH, sizeof(app_supervisor_event_t));
+    assert(_p_queue);
+
+#if CONFIG_PM_ENABLE
+    if (esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "forwarding", &_p_activity_lock) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create the forwarding PM lock");
+    }
+#endif
+
+    const esp_timer_create_args_t activity_timer_args = {
+        .callback = _on_activity_timer,
+        .name = "activity",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&activity_timer_args, &_p_activity_timer));
+
+    xTaskCreatePinnedToCore(_supervisor_task,
+                            "supervisor",
+                            SUPERVISOR_TASK_STACK_SIZE,
+                            NULL,
+                            SUPERVISOR_TASK_PRIORITY,
+                            NULL,
+                            app_affinity_core(APP_AFFINITY_ROLE_BACKGROUND));
+
+    const esp_timer_create_args_t status_timer_args = {
+        .callback = _on_status_timer,
+        .name = "status",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&status_timer_args, &_p_status_timer));
+    ESP_ERROR_CHECK(
+        esp_timer_start_periodic(_p_status_timer, (uint64_t)CONFIG_AIR_GATEWAY_STATUS_LOG_INTERVAL_S * 1000000));
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Waits a bounded time for room, a station join or leave that is lost leaves its slot in the wrong state until the
+ * station comes back. Posters are the event loop, esp_timer, HTTP and connection tasks, never the supervisor itself. */
+bool app_supervisor_post(const app_supervisor_event_t *event) {
+    if ((_p_queue == NULL) || (xQueueSend(_p_queue, event, pdMS_TO_TICKS(SUPERVISOR_POST_TIMEOUT_MS)) != pdTRUE)) {
+        atomic_fetch_add_explicit(&_stats.queue_full, 1, memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Tcpip thread, every packet from or to a station. Only the first one of a burst touches the PM lock. */
+void app_supervisor_note_traffic(void) {
+    uint32_t now_ms = _now_ms();
+    atomic_store_explicit(&_last_traffic_ms, now_ms, memory_order_relaxed);
+    if ((_p_activity_timer == NULL) || (atomic_exchange(&_is_active, true) == true)) {
+        return;
+    }
+
+#if CONFIG_PM_ENABLE
+    if (_p_activity_lock != NULL) {
+        esp_pm_lock_acquire(_p_activity_lock);
+    }
+#endif
+    atomic_store_explicit(&_active_since_ms, now_ms, memory_order_relaxed);
+    atomic_fetch_add_explicit(&_stats.activity_bursts, 1, memory_order_relaxed);
+    esp_timer_start_once(_p_activity_timer, (uint64_t)CONFIG_AIR_GATEWAY_ACTIVITY_HOLD_MS * 1000);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Time since the last forwarded packet */
+uint32_t app_supervisor_idle_ms(void) {
+    return _now_ms() - atomic_load_explicit(&_last_traffic_ms, memory_order_relaxed);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_supervisor_get_stats(app_supervisor_stats_t *out) {
+    out->wakeups = atomic_load_explicit(&_stats.wakeups, memory_order_relaxed);
+    for (int i = 0; i < APP_SUPERVISOR_EVENT_MAX; i++) {
+        out->events[i] = atomic_load_explicit(&_stats.events[i], memory_order_relaxed);
+    }
+    out->queue_full = atomic_load_explicit(&_stats.queue_full, memory_order_relaxed);
+    out->activity_bursts = atomic_load_explicit(&_stats.activity_bursts, memory_order_relaxed);
+    out->activity_ms = atomic_load_explicit(&_stats.activity_ms, memory_order_relaxed);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_supervisor_log(void) {
+    app_supervisor_stats_t stats;
+    app_supervisor_get_stats(&stats);
+    uint32_t uptime_ms = _now_ms();
+    ESP_LOGI(TAG,
+             "Supervisor: %" PRIu32 " wakeups (%" PRIu32 " status, %" PRIu32 " station, %" PRIu32
+             " uplink), %" PRIu32 " dropped, forwarding held awake %" PRIu32 " times for %" PRIu32 " ms (%" PRIu32
+             "%% of uptime)",
+             stats.wakeups,
+             stats.events[APP_SUPERVISOR_EVENT_STATUS_LOG],
+             stats.events[APP_SUPERVISOR_EVENT_STATION_JOIN] + stats.events[APP_SUPERVISOR_EVENT_STATION_LEAVE],
+             stats.events[APP_SUPERVISOR_EVENT_UPLINK_UP],
+             stats.queue_full,
+             stats.activity_bursts,
+             stats.activity_ms,
+             (uptime_ms != 0) ? (uint32_t)(((uint64_t)stats.activity_ms * 100) / uptime_ms) : 0);
+}
+
+/* -------------------------------------------------------------------------- */
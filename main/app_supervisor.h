@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_netif.h"
+
+typedef enum {
+    APP_SUPERVISOR_EVENT_STATUS_LOG = 0,
+    APP_SUPERVISOR_EVENT_STATION_JOIN,
+    APP_SUPERVISOR_EVENT_STATION_LEAVE,
+    APP_SUPERVISOR_EVENT_UPLINK_UP,
+    APP_SUPERVISOR_EVENT_CONFIG_CHANGED,
+    APP_SUPERVISOR_EVENT_CHANNEL_CHECK,
+    APP_SUPERVISOR_EVENT_CHANNEL_SCAN_DONE,
+    APP_SUPERVISOR_EVENT_BEACON_INTERVAL,
+    APP_SUPERVISOR_EVENT_MAX,
+} app_supervisor_event_e;
+
+typedef struct {
+    app_supervisor_event_e type;
+    union {
+        uint8_t mac[6];
+        esp_netif_t *netif;
+        uint32_t changes;
+        uint16_t beacon_interval_tu;
+    };
+} app_supervisor_event_t;
+
+typedef struct {
+    uint32_t wakeups;
+    uint32_t events[APP_SUPERVISOR_EVENT_MAX];
+    uint32_t queue_full;
+    uint32_t activity_bursts;
+    uint32_t activity_ms;
+} app_supervisor_stats_t;
+
+typedef void (*app_supervisor_handler_t)(const app_supervisor_event_t *event);
+
+void app_supervisor_start(app_supervisor_handler_t handler);
+bool app_supervisor_post(const app_supervisor_event_t *event);
+void app_supervisor_note_traffic(void);
+uint32_t app_supervisor_idle_ms(void);
+void app_supervisor_get_stats(app_supervisor_stats_t *out);
+void app_supervisor_log(void);
@@ -0,0 +1,138 @@
+#include "app_telemetry.h"
+
+#include "app_affinity.h"
+#include "app_connection.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#include "bsp_ppp_rx.h"
+
+/* -------------------------------------------------------------------------- */
+
+static const char *TAG = "app_telemetry.c";
+
+#define TELEMETRY_TASK_STACK_SIZE (3072)
+#define TELEMETRY_TASK_PRIORITY   (3)
+
+static app_telemetry_t _telemetry;
+static portMUX_TYPE _telemetry_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* -------------------------------------------------------------------------- */
+
+static void _telemetry_task(void *arg) {
+    (void)arg;
+
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_AIR_GATEWAY_TELEMETRY_INTERVAL_MS));
+
+        app_connection_stats_t uplink;
+        app_connection_get_stats(&uplink);
+        if ((uplink.is_up == false) || bsp_modem_is_sleeping()) {
+            continue;
+        }
+
+        // Runs on the CMUX command channel, PPP keeps flowing on the data channel
+        bsp_modem_telemetry_t modem = { 0 };
+        esp_err_t err = bsp_modem_read_telemetry(&modem);
+
+        portENTER_CRITICAL(&_telemetry_lock);
+        _telemetry.polls++;
+        if (err == ESP_OK) {
+            _telemetry.modem = modem;
+            _telemetry.updated_ms = (uint32_t)(esp_timer_get_time() / 1000);
+            _telemetry.is_valid = true;
+        } else {
+            _telemetry.poll_failures++;
+        }
+        portEXIT_CRITICAL(&_telemetry_lock);
+
+        if ((err != ESP_OK) && (err != ESP_ERR_TIMEOUT)) {
+            ESP_LOGD(TAG, "Telemetry poll failed with %s", esp_err_to_name(err));
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_telemetry_start(void) {
+#if CONFIG_GATEWAY_MODEM_USE_CMUX
+    xTaskCreatePinnedToCore(_telemetry_task,
+                            "telemetry",
+                            TELEMETRY_TASK_STACK_SIZE,
+                            NULL,
+                            TELEMETRY_TASK_PRIORITY,
+                            NULL,
+                            app_affinity_core(APP_AFFINITY_ROLE_MODEM));
+#else
+    ESP_LOGW(TAG, "CMUX is disabled, modem telemetry is only read at connect time");
+#endif
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_telemetry_get(app_telemetry_t *out) {
+    portENTER_CRITICAL(&_telemetry_lock);
+    *out = _telemetry;
+    portEXIT_CRITICAL(&_telemetry_lock);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_telemetry_log(void) {
+    bsp_modem_link_stats_t link;
+    bsp_modem_get_link_stats(&link);
+    ESP_LOGI(TAG,
+             "Modem UART: %" PRIu32 " baud, flow control %d, overflows %" PRIu32 ", errors %" PRIu32
+             ", baud fallbacks %" PRIu32,
+             link.baud,
+             (int)link.flow_control,
+             link.buffer_overflows,
+             link.terminal_errors,
+             link.baud_fallbacks);
+
+#if CONFIG_GATEWAY_MODEM_PPP_RX_DIRECT
+    bsp_ppp_rx_stats_t ppp_rx;
+    bsp_ppp_rx_get_stats(&ppp_rx);
+    ESP_LOGI(TAG,
+             "PPP RX: %" PRIu32 " frames, %" PRIu32 " bytes, fcs errors %" PRIu32 ", drops %" PRIu32 "/%" PRIu32
+             "/%" PRIu32 " (pool/oversize/queue), %" PRIu32 " slots free",
+             ppp_rx.frames,
+             ppp_rx.bytes,
+             ppp_rx.fcs_errors,
+             ppp_rx.pool_empty_drops,
+             ppp_rx.oversize_drops,
+             ppp_rx.queue_full_drops,
+             ppp_rx.pool_free);
+#endif
+
+    app_telemetry_t telemetry;
+    app_telemetry_get(&telemetry);
+    if (telemetry.is_valid == false) {
+        return;
+    }
+
+    uint32_t age_ms = (uint32_t)(esp_timer_get_time() / 1000) - telemetry.updated_ms;
+    ESP_LOGI(TAG,
+             "Modem: %s %s cell %s %s, rssi %d, ber %d, rsrp %d.%d dBm, rsrq %d.%d dB, %d C, age %" PRIu32 " ms",
+             telemetry.modem.rat,
+             telemetry.modem.operator_code,
+             telemetry.modem.cell_id,
+             telemetry.modem.band,
+             telemetry.modem.rssi,
+             telemetry.modem.ber,
+             telemetry.modem.rsrp_dbm_x10 / 10,
+             abs(telemetry.modem.rsrp_dbm_x10 % 10),
+             telemetry.modem.rsrq_db_x10 / 10,
+             abs(telemetry.modem.rsrq_db_x10 % 10),
+             telemetry.modem.temperature_c,
+             age_ms);
+}
+
+/* -------------------------------------------------------------------------- */
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_modem_api.h"
+#include "esp_netif.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+
+#include "bsp_modem.h"
+
+typedef struct {
+    bool is_valid;
+    uint32_t updated_ms;
+    uint32_t polls;
+    uint32_t poll_failures;
+    bsp_modem_telemetry_t modem;
+} app_telemetry_t;
+
+void app_telemetry_start(void);
+void app_telemetry_get(app_telemetry_t *out);
+void app_telemetry_log(void);
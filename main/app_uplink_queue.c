@@ -0,0 +1,620 @@
+#include "app_uplink_queue.h"
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_modem_api.h"
+#include "esp_netif.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "lwip/prot/ip.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/tcp.h"
+#include "lwip/tcpip.h"
+#include "lwip/timeouts.h"
+#include "sdkconfig.h"
+
+#include "bsp_modem.h"
+#include "bsp_trace.h"
+
+/* -------------------------------------------------------------------------- */
+
+static const char *TAG = "app_uplink_queue.c";
+
+#define FQ_FLOWS            (CONFIG_AIR_GATEWAY_UPLINK_FQ_FLOWS)
+#define FQ_QUANTUM          (1500)
+#define FQ_BURST_BYTES      (4 * FQ_QUANTUM)
+#define FQ_PUMP_INTERVAL_MS (2)
+#define FQ_FLOW_NONE        (0xFF)
+#define CODEL_TARGET_US     (CONFIG_AIR_GATEWAY_UPLINK_CODEL_TARGET_MS * 1000)
+#define CODEL_INTERVAL_US   (CONFIG_AIR_GATEWAY_UPLINK_CODEL_INTERVAL_MS * 1000)
+#define TCP_OPT_END         (0)
+#define TCP_OPT_NOP         (1)
+#define TCP_OPT_SACK        (5)
+#define IP_ECN_CE           (0x03)
+
+typedef struct _fq_packet {
+    struct _fq_packet *next;
+    struct pbuf *p;
+    ip4_addr_t next_hop;
+    uint32_t enqueue_us;
+} _fq_packet_t;
+
+typedef struct {
+    _fq_packet_t *head;
+    _fq_packet_t *tail;
+    uint32_t bytes;
+    int32_t deficit;
+    uint8_t next_active;
+    bool is_active;
+    // CoDel state, RFC 8289
+    bool is_dropping;
+    uint32_t first_above_us;
+    uint32_t drop_next_us;
+    uint32_t count;
+    uint32_t last_count;
+} _fq_flow_t;
+
+// Addresses and ports of a pure ACK as they sit in the headers
+typedef struct {
+    uint8_t tuple[12];
+    uint32_t ack;
+    bool has_sack;
+} _fq_ack_t;
+
+typedef struct {
+    atomic_uint_fast32_t backlog_packets;
+    atomic_uint_fast32_t backlog_bytes;
+    atomic_uint_fast32_t sent_packets;
+    atomic_uint_fast32_t direct_packets;
+    atomic_uint_fast32_t codel_drops;
+    atomic_uint_fast32_t overflow_drops;
+    atomic_uint_fast32_t acks_filtered;
+    atomic_uint_fast32_t max_sojourn_ms;
+} _fq_stats_t;
+
+// Everything below is owned by the tcpip thread
+static struct netif *_p_netif;
+static netif_output_fn _ppp_output;
+static _fq_packet_t _packets[CONFIG_AIR_GATEWAY_UPLINK_FQ_LIMIT_PACKETS];
+static _fq_packet_t *_p_free_packets;
+static _fq_flow_t _flows[FQ_FLOWS];
+static uint8_t _active_head = FQ_FLOW_NONE;
+static uint8_t _active_tail = FQ_FLOW_NONE;
+static uint32_t _backlog_packets;
+static uint32_t _backlog_bytes;
+static int32_t _tokens = FQ_BURST_BYTES;
+static uint32_t _tokens_ts_us;
+static bool _is_pump_scheduled;
+
+static _fq_stats_t _stats;
+
+/* -------------------------------------------------------------------------- */
+
+static uint32_t _now_us(void) {
+    return (uint32_t)esp_timer_get_time();
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool _time_reached(uint32_t now_us, uint32_t deadline_us) {
+    return (int32_t)(now_us - deadline_us) >= 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint8_t _classify(const struct pbuf *p) {
+    const struct ip_hdr *iphdr = (const struct ip_hdr *)p->payload;
+    uint32_t key = iphdr->dest.addr ^ IPH_PROTO(iphdr);
+    uint16_t hlen = IPH_HL_BYTES(iphdr);
+
+    // After NAPT the translated source port is what tells flows of different stations apart
+    if (((IPH_PROTO(iphdr) == IP_PROTO_TCP) || (IPH_PROTO(iphdr) == IP_PROTO_UDP)) && (p->len >= hlen + 4)) {
+        const uint8_t *l4 = (const uint8_t *)p->payload + hlen;
+        key ^= ((uint32_t)l4[0] << 24) | ((uint32_t)l4[1] << 16) | ((uint32_t)l4[2] << 8) | l4[3];
+    }
+    key *= 2654435761u;
+    return (uint8_t)((key >> 16) % FQ_FLOWS);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _activate(uint8_t index) {
+    _fq_flow_t *flow = &_flows[index];
+    flow->is_active = true;
+    flow->next_active = FQ_FLOW_NONE;
+    flow->deficit = FQ_QUANTUM;
+    if (_active_tail == FQ_FLOW_NONE) {
+        _active_head = index;
+    } else {
+        _flows[_active_tail].next_active = index;
+    }
+    _active_tail = index;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint8_t _pop_active(void) {
+    uint8_t index = _active_head;
+    _active_head = _flows[index].next_active;
+    if (_active_head == FQ_FLOW_NONE) {
+        _active_tail = FQ_FLOW_NONE;
+    }
+    _flows[index].is_active = false;
+    return index;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _release(_fq_packet_t *packet) {
+    pbuf_free(packet->p);
+    packet->p = NULL;
+    packet->next = _p_free_packets;
+    _p_free_packets = packet;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static _fq_packet_t *_unlink_head(_fq_flow_t *flow) {
+    _fq_packet_t *packet = flow->head;
+    if (packet == NULL) {
+        return NULL;
+    }
+    flow->head = packet->next;
+    if (flow->head == NULL) {
+        flow->tail = NULL;
+    }
+    flow->bytes -= packet->p->tot_len;
+    _backlog_packets--;
+    _backlog_bytes -= packet->p->tot_len;
+    return packet;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _drop(_fq_packet_t *packet, atomic_uint_fast32_t *counter) {
+    atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+    _release(packet);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static _fq_packet_t *_codel_pop(_fq_flow_t *flow, uint32_t now_us, bool *ok_to_drop) {
+    *ok_to_drop = false;
+    _fq_packet_t *packet = _unlink_head(flow);
+    if (packet == NULL) {
+        flow->first_above_us = 0;
+        return NULL;
+    }
+
+    uint32_t sojourn_us = now_us - packet->enqueue_us;
+    if (sojourn_us / 1000 > atomic_load_explicit(&_stats.max_sojourn_ms, memory_order_relaxed)) {
+        atomic_store_explicit(&_stats.max_sojourn_ms, sojourn_us / 1000, memory_order_relaxed);
+    }
+
+    // A flow holding no more than one MTU cannot be the cause of a standing queue
+    if ((sojourn_us < CODEL_TARGET_US) || (flow->bytes <= FQ_QUANTUM)) {
+        flow->first_above_us = 0;
+    } else if (flow->first_above_us == 0) {
+        flow->first_above_us = now_us + CODEL_INTERVAL_US;
+    } else if (_time_reached(now_us, flow->first_above_us) == true) {
+        *ok_to_drop = true;
+    }
+    return packet;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint32_t _control_law(uint32_t t_us, uint32_t count) {
+    return t_us + (uint32_t)((float)CODEL_INTERVAL_US / sqrtf((float)count));
+}
+
+/* -------------------------------------------------------------------------- */
+
+static _fq_packet_t *_codel_dequeue(_fq_flow_t *flow, uint32_t now_us) {
+    bool ok_to_drop = false;
+    _fq_packet_t *packet = _codel_pop(flow, now_us, &ok_to_drop);
+    if (packet == NULL) {
+        flow->is_dropping = false;
+        return NULL;
+    }
+
+    if (flow->is_dropping == true) {
+        if (ok_to_drop == false) {
+            flow->is_dropping = false;
+        }
+        while ((flow->is_dropping == true) && (_time_reached(now_us, flow->drop_next_us) == true)) {
+            _drop(packet, &_stats.codel_drops);
+            flow->count++;
+            packet = _codel_pop(flow, now_us, &ok_to_drop);
+            if ((packet == NULL) || (ok_to_drop == false)) {
+                flow->is_dropping = false;
+            } else {
+                flow->drop_next_us = _control_law(flow->drop_next_us, flow->count);
+            }
+        }
+    } else if (ok_to_drop == true) {
+        _drop(packet, &_stats.codel_drops);
+        packet = _codel_pop(flow, now_us, &ok_to_drop);
+        flow->is_dropping = true;
+
+        // Resume near the previous drop rate if the last dropping episode ended recently
+        uint32_t delta = flow->count - flow->last_count;
+        if ((delta > 1) && (_time_reached(now_us, flow->drop_next_us + 16 * CODEL_INTERVAL_US) == false)) {
+            flow->count = delta;
+        } else {
+            flow->count = 1;
+        }
+        flow->drop_next_us = _control_law(now_us, flow->count);
+        flow->last_count = flow->count;
+    }
+    return packet;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Deficit round robin over the active flows, one quantum per visit */
+static _fq_packet_t *_dequeue(uint32_t now_us) {
+    while (_active_head != FQ_FLOW_NONE) {
+        _fq_flow_t *flow = &_flows[_active_head];
+        if (flow->deficit <= 0) {
+            int32_t deficit = flow->deficit + FQ_QUANTUM;
+            uint8_t index = _pop_active();
+            _activate(index);
+            _flows[index].deficit = deficit;
+            continue;
+        }
+
+        _fq_packet_t *packet = _codel_dequeue(flow, now_us);
+        if (packet == NULL) {
+            _pop_active();
+            continue;
+        }
+        flow->deficit -= packet->p->tot_len;
+        if (flow->head == NULL) {
+            _pop_active();
+        }
+        return packet;
+    }
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _refill_tokens(uint32_t now_us) {
+    if (CONFIG_AIR_GATEWAY_UPLINK_RATE_KBPS == 0) {
+        return;
+    }
+    uint32_t elapsed_us = now_us - _tokens_ts_us;
+    uint32_t earned = (uint32_t)(((uint64_t)elapsed_us * CONFIG_AIR_GATEWAY_UPLINK_RATE_KBPS) / 8000ULL);
+    if (earned == 0) {
+        return;
+    }
+    _tokens_ts_us = now_us;
+    _tokens = (_tokens + (int32_t)earned > FQ_BURST_BYTES) ? FQ_BURST_BYTES : _tokens + (int32_t)earned;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* The modem only gets more data once the UART TX ring has drained below the limit, so the standing queue
+ * stays here where CoDel and DRR can act on it */
+static bool _can_send(void) {
+    if ((CONFIG_AIR_GATEWAY_UPLINK_RATE_KBPS != 0) && (_tokens <= 0)) {
+        return false;
+    }
+    return bsp_modem_get_tx_pending() < CONFIG_AIR_GATEWAY_UPLINK_TX_LIMIT_BYTES;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _send(struct pbuf *p, const ip4_addr_t *next_hop) {
+    if (CONFIG_AIR_GATEWAY_UPLINK_RATE_KBPS != 0) {
+        _tokens -= p->tot_len;
+    }
+    atomic_fetch_add_explicit(&_stats.sent_packets, 1, memory_order_relaxed);
+#if CONFIG_GATEWAY_PACKET_TRACE
+    // PPP encoding and the copy into the UART TX ring both happen inside the output call
+    uint32_t trace_key = bsp_trace_key(p->payload, p->len);
+    bsp_trace_record(BSP_TRACE_UPLINK_SENT, trace_key);
+#endif
+    _ppp_output(_p_netif, p, next_hop);
+#if CONFIG_GATEWAY_PACKET_TRACE
+    bsp_trace_record(BSP_TRACE_UART_WRITTEN, trace_key);
+#endif
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _publish_backlog(void) {
+    atomic_store_explicit(&_stats.backlog_packets, _backlog_packets, memory_order_relaxed);
+    atomic_store_explicit(&_stats.backlog_bytes, _backlog_bytes, memory_order_relaxed);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _on_pump_timer(void *arg);
+
+static void _pump(void) {
+    uint32_t now_us = _now_us();
+    _refill_tokens(now_us);
+
+    while ((_backlog_packets > 0) && (_can_send() == true)) {
+        _fq_packet_t *packet = _dequeue(now_us);
+        if (packet == NULL) {
+            break;
+        }
+        _send(packet->p, &packet->next_hop);
+        _release(packet);
+    }
+    _publish_backlog();
+
+    if ((_backlog_packets > 0) && (_is_pump_scheduled == false)) {
+        _is_pump_scheduled = true;
+        sys_timeout(FQ_PUMP_INTERVAL_MS, _on_pump_timer, NULL);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _on_pump_timer(void *arg) {
+    (void)arg;
+    _is_pump_scheduled = false;
+    if (_p_netif != NULL) {
+        _pump();
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _drop_from_fattest_flow(void) {
+    uint8_t fattest = 0;
+    for (uint8_t i = 1; i < FQ_FLOWS; i++) {
+        if (_flows[i].bytes > _flows[fattest].bytes) {
+            fattest = i;
+        }
+    }
+    _fq_packet_t *packet = _unlink_head(&_flows[fattest]);
+    if (packet != NULL) {
+        _drop(packet, &_stats.overflow_drops);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+#if CONFIG_AIR_GATEWAY_UPLINK_ACK_FILTER
+/* A pure ACK carries nothing but the ACK flag, no payload and no CE mark, p->payload is the IPv4 header */
+static bool _parse_pure_ack(const struct pbuf *p, _fq_ack_t *ack) {
+    const uint8_t *ip = (const uint8_t *)p->payload;
+    const struct ip_hdr *iphdr = (const struct ip_hdr *)ip;
+    uint16_t hlen = IPH_HL_BYTES(iphdr);
+    if ((IPH_PROTO(iphdr) != IP_PROTO_TCP) || ((IPH_TOS(iphdr) & IP_ECN_CE) == IP_ECN_CE) ||
+        ((IPH_OFFSET(iphdr) & PP_HTONS(IP_OFFMASK | IP_MF)) != 0) || (p->len < hlen + TCP_HLEN)) {
+        return false;
+    }
+
+    const uint8_t *tcp = &ip[hlen];
+    uint16_t tcp_hlen = (tcp[12] >> 4) * 4;
+    // ECE and CWR sit in the same byte and rule the segment out as well
+    if ((tcp[13] != TCP_ACK) || (tcp_hlen < TCP_HLEN) || (lwip_ntohs(IPH_LEN(iphdr)) != hlen + tcp_hlen) ||
+        (p->len < hlen + tcp_hlen)) {
+        return false;
+    }
+
+    ack->has_sack = false;
+    for (uint16_t offset = TCP_HLEN; offset < tcp_hlen;) {
+        if (tcp[offset] == TCP_OPT_END) {
+            break;
+        }
+        if (tcp[offset] == TCP_OPT_NOP) {
+            offset++;
+            continue;
+        }
+        if ((offset + 1 >= tcp_hlen) || (tcp[offset + 1] < 2)) {
+            return false;
+        }
+        if (tcp[offset] == TCP_OPT_SACK) {
+            ack->has_sack = true;
+        }
+        offset += tcp[offset + 1];
+    }
+
+    memcpy(&ack->tuple[0], &ip[12], 8);
+    memcpy(&ack->tuple[8], &tcp[0], 4);
+    ack->ack = ((uint32_t)tcp[8] << 24) | ((uint32_t)tcp[9] << 16) | ((uint32_t)tcp[10] << 8) | tcp[11];
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Drops queued pure ACKs of the same connection that a newer cumulative ACK makes redundant. Duplicate ACKs
+ * (same number) drive fast retransmit and SACK blocks cannot be merged, both are always kept. */
+static void _filter_acks(_fq_flow_t *flow, const struct pbuf *p) {
+    _fq_ack_t newer;
+    if (_parse_pure_ack(p, &newer) == false) {
+        return;
+    }
+
+    _fq_packet_t *prev = NULL;
+    _fq_packet_t *packet = flow->head;
+    while (packet != NULL) {
+        _fq_packet_t *next = packet->next;
+        _fq_ack_t older;
+        if ((_parse_pure_ack(packet->p, &older) == true) && (older.has_sack == false) &&
+            (memcmp(older.tuple, newer.tuple, sizeof(older.tuple)) == 0) && ((int32_t)(newer.ack - older.ack) > 0)) {
+            if (prev == NULL) {
+                flow->head = next;
+            } else {
+                prev->next = next;
+            }
+            if (flow->tail == packet) {
+                flow->tail = prev;
+            }
+            flow->bytes -= packet->p->tot_len;
+            _backlog_packets--;
+            _backlog_bytes -= packet->p->tot_len;
+            _drop(packet, &_stats.acks_filtered);
+        } else {
+            prev = packet;
+        }
+        packet = next;
+    }
+}
+#endif
+
+/* -------------------------------------------------------------------------- */
+
+static err_t _queued_output(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr) {
+    if (_p_netif == NULL) {
+        return _ppp_output(netif, p, ipaddr);
+    }
+    BSP_TRACE(BSP_TRACE_UPLINK_QUEUED, p->payload, p->len);
+
+    uint32_t now_us = _now_us();
+    _refill_tokens(now_us);
+
+    // Nothing is waiting, skip the queue so an idle link adds no latency
+    if ((_backlog_packets == 0) && (_can_send() == true)) {
+        atomic_fetch_add_explicit(&_stats.direct_packets, 1, memory_order_relaxed);
+        _send(p, ipaddr);
+        return ERR_OK;
+    }
+
+    uint8_t index = _classify(p);
+    _fq_flow_t *flow = &_flows[index];
+#if CONFIG_AIR_GATEWAY_UPLINK_ACK_FILTER
+    // ACKs this one makes redundant go first, they free room before the overflow drops hit packets of other flows
+    _filter_acks(flow, p);
+#endif
+
+    while (((_p_free_packets == NULL) || (_backlog_bytes + p->tot_len > CONFIG_AIR_GATEWAY_UPLINK_FQ_LIMIT_BYTES)) &&
+           (_backlog_packets > 0)) {
+        _drop_from_fattest_flow();
+    }
+
+    _fq_packet_t *packet = _p_free_packets;
+    _p_free_packets = packet->next;
+
+    // The caller frees its reference on return, the queue keeps its own
+    pbuf_ref(p);
+    packet->p = p;
+    packet->next = NULL;
+    packet->enqueue_us = now_us;
+    ip4_addr_copy(packet->next_hop, *ipaddr);
+
+    if (flow->tail == NULL) {
+        flow->head = packet;
+    } else {
+        flow->tail->next = packet;
+    }
+    flow->tail = packet;
+    flow->bytes += p->tot_len;
+    _backlog_packets++;
+    _backlog_bytes += p->tot_len;
+
+    if (flow->is_active == false) {
+        _activate(index);
+    }
+
+    _pump();
+    return ERR_OK;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _flush(void) {
+    for (uint8_t i = 0; i < FQ_FLOWS; i++) {
+        _fq_packet_t *packet = NULL;
+        while ((packet = _unlink_head(&_flows[i])) != NULL) {
+            _release(packet);
+        }
+    }
+    memset(_flows, 0, sizeof(_flows));
+    _active_head = FQ_FLOW_NONE;
+    _active_tail = FQ_FLOW_NONE;
+    _publish_backlog();
+
+    if (_is_pump_scheduled == true) {
+        sys_untimeout(_on_pump_timer, NULL);
+        _is_pump_scheduled = false;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _attach_in_tcpip(void *ctx) {
+    struct netif *netif = ctx;
+
+    _flush();
+    if (_p_free_packets == NULL) {
+        for (int i = 0; i < CONFIG_AIR_GATEWAY_UPLINK_FQ_LIMIT_PACKETS; i++) {
+            _packets[i].next = _p_free_packets;
+            _p_free_packets = &_packets[i];
+        }
+    }
+
+    // The PPP netif survives redials, wrap its output only once
+    if ((netif != NULL) && (netif->output != _queued_output)) {
+        _ppp_output = netif->output;
+        netif->output = _queued_output;
+    }
+    _tokens = FQ_BURST_BYTES;
+    _tokens_ts_us = _now_us();
+    _p_netif = netif;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_uplink_queue_attach(struct netif *ppp_netif) {
+    if (tcpip_callback(_attach_in_tcpip, ppp_netif) != ERR_OK) {
+        ESP_LOGE(TAG, "Failed to attach the uplink queue");
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Only meaningful in the tcpip thread, where the output pointer is swapped */
+bool app_uplink_queue_is_wrapping(const struct netif *netif) {
+    return netif->output == _queued_output;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_uplink_queue_get_stats(app_uplink_queue_stats_t *out) {
+    out->backlog_packets = atomic_load_explicit(&_stats.backlog_packets, memory_order_relaxed);
+    out->backlog_bytes = atomic_load_explicit(&_stats.backlog_bytes, memory_order_relaxed);
+    out->sent_packets = atomic_load_explicit(&_stats.sent_packets, memory_order_relaxed);
+    out->direct_packets = atomic_load_explicit(&_stats.direct_packets, memory_order_relaxed);
+    out->codel_drops = atomic_load_explicit(&_stats.codel_drops, memory_order_relaxed);
+    out->overflow_drops = atomic_load_explicit(&_stats.overflow_drops, memory_order_relaxed);
+    out->acks_filtered = atomic_load_explicit(&_stats.acks_filtered, memory_order_relaxed);
+    out->max_sojourn_ms = atomic_load_explicit(&_stats.max_sojourn_ms, memory_order_relaxed);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_uplink_queue_log(void) {
+    app_uplink_queue_stats_t stats;
+    app_uplink_queue_get_stats(&stats);
+    ESP_LOGI(TAG,
+             "Uplink queue: backlog %" PRIu32 " pkts/%" PRIu32 " B, sent %" PRIu32 " (%" PRIu32
+             " direct), drops %" PRIu32 " codel/%" PRIu32 " overflow, acks filtered %" PRIu32 ", max sojourn %" PRIu32
+             " ms",
+             stats.backlog_packets,
+             stats.backlog_bytes,
+             stats.sent_packets,
+             stats.direct_packets,
+             stats.codel_drops,
+             stats.overflow_drops,
+             stats.acks_filtered,
+             stats.max_sojourn_ms);
+    atomic_store_explicit(&_stats.max_sojourn_ms, 0, memory_order_relaxed);
+}
+
+/* -------------------------------------------------------------------------- */
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct netif;
+
+typedef struct {
+    uint32_t backlog_packets;
+    uint32_t backlog_bytes;
+    uint32_t sent_packets;
+    uint32_t direct_packets;
+    uint32_t codel_drops;
+    uint32_t overflow_drops;
+    uint32_t acks_filtered;
+    uint32_t max_sojourn_ms;
+} app_uplink_queue_stats_t;
+
+void app_uplink_queue_attach(struct netif *ppp_netif);
+bool app_uplink_queue_is_wrapping(const struct netif *netif);
+void app_uplink_queue_get_stats(app_uplink_queue_stats_t *out);
+void app_uplink_queue_log(void);
@@ -0,0 +1,174 @@
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "app_uplink_queue.h"
+#include "host_stubs.h"
+#include "host_test.h"
+#include "lwip/prot/ip.h"
+#include "lwip/prot/tcp.h"
+#include "sdkconfig.h"
+#include "sim_uplink.h"
+
+/* A station downloads over a fast downlink while another one uploads in bulk over a slow uplink. The download is
+ * clocked by its ACKs, which wait in the uplink queue next to the upload. Built once with the ACK filter and once
+ * without, see CMakeLists.txt. */
+
+/* -------------------------------------------------------------------------- */
+
+#define BENCH_UPLINK_KBPS      (256)
+#define BENCH_DOWNLINK_KBPS    (30000)
+#define BENCH_RTT_US           (60 * 1000)
+#define BENCH_RWND             (512 * 1024)
+#define BENCH_CWND_MAX         (64 * 1024)
+#define BENCH_SEGMENTS_PER_ACK (2)
+#define BENCH_WARMUP_US        (5 * 1000000ULL)
+#define BENCH_DURATION_US      (35 * 1000000ULL)
+#define BENCH_FLOW_UPLOAD      (0)
+#define BENCH_FLOW_ACKS        (1)
+
+typedef struct {
+    // Server side
+    uint32_t next_seq;
+    uint32_t acked_seq;
+    uint64_t credit_bits;
+    // Station side
+    uint32_t received_seq;
+    uint32_t unacked_segments;
+    uint32_t acks_sent;
+    uint32_t acks_delivered;
+} _download_t;
+
+static struct netif _ppp;
+static sim_tcp_t _upload;
+static _download_t _download;
+static ip4_addr_t _station;
+static ip4_addr_t _server;
+
+/* -------------------------------------------------------------------------- */
+
+static void _on_ack_at_server(void *ctx, uint32_t ack) {
+    if ((int32_t)(ack - _download.acked_seq) > 0) {
+        _download.acked_seq = ack;
+    }
+    _download.acks_delivered++;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _on_departed(const sim_packet_t *packet) {
+    if (packet->flow == BENCH_FLOW_UPLOAD) {
+        sim_tcp_on_departed(&_upload, packet);
+    } else {
+        sim_after(BENCH_RTT_US / 2, _on_ack_at_server, NULL, packet->ack);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _on_dropped(const sim_packet_t *packet) {
+    // A dropped ACK is covered by the next cumulative one, nothing to tell the server
+    if (packet->flow == BENCH_FLOW_UPLOAD) {
+        sim_tcp_on_dropped(&_upload, packet);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _send_ack(void) {
+    struct pbuf *p = sim_ipv4(BENCH_FLOW_ACKS, IP_PROTO_TCP, &_station, 50001, &_server, 443, 0);
+    sim_tcp_header(p, 1, _download.received_seq, TCP_ACK, 0xFFFF);
+    _download.acks_sent++;
+    sim_output(&_ppp, p);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _on_segment_at_station(void *ctx, uint32_t end_seq) {
+    _download.received_seq = end_seq;
+    if (++_download.unacked_segments >= BENCH_SEGMENTS_PER_ACK) {
+        _download.unacked_segments = 0;
+        _send_ack();
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* The server sends what the receive window allows, at the rate of the downlink */
+static void _serve(void) {
+    _download.credit_bits += (uint64_t)BENCH_DOWNLINK_KBPS * SIM_STEP_US / 1000;
+    while ((_download.next_seq - _download.acked_seq + SIM_MSS <= BENCH_RWND) &&
+           (_download.credit_bits >= (uint64_t)SIM_MSS * 8)) {
+        _download.credit_bits -= (uint64_t)SIM_MSS * 8;
+        _download.next_seq += SIM_MSS;
+        sim_after(BENCH_RTT_US / 2, _on_segment_at_station, NULL, _download.next_seq);
+    }
+    if (_download.credit_bits > (uint64_t)SIM_MSS * 8) {
+        // An idle sender does not save up airtime
+        _download.credit_bits = (uint64_t)SIM_MSS * 8;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+int main(void) {
+    const sim_link_config_t config = {
+        .rate_kbps = BENCH_UPLINK_KBPS,
+        .buffer_bytes = CONFIG_GATEWAY_MODEM_UART_TX_BUFFER_SIZE,
+        .on_departed = _on_departed,
+        .on_dropped = _on_dropped,
+    };
+    sim_link_init(&_ppp, &config);
+    app_uplink_queue_attach(&_ppp);
+
+    IP4_ADDR(&_station, 10, 64, 0, 2);
+    IP4_ADDR(&_server, 198, 51, 100, 10);
+    sim_tcp_init(&_upload, BENCH_FLOW_UPLOAD, BENCH_RTT_US, BENCH_CWND_MAX);
+    IP4_ADDR(&_upload.src, 10, 64, 0, 3);
+    IP4_ADDR(&_upload.dest, 198, 51, 100, 20);
+    _upload.src_port = 50000;
+    _upload.dest_port = 443;
+
+    uint32_t acked_at_warmup = 0;
+    uint64_t uploaded_at_warmup = 0;
+    while (host_time_us() < BENCH_DURATION_US) {
+        if (host_time_us() == BENCH_WARMUP_US) {
+            acked_at_warmup = _download.acked_seq;
+            uploaded_at_warmup = _upload.acked_bytes;
+        }
+        _serve();
+        sim_tcp_send(&_upload, &_ppp);
+        sim_step();
+    }
+
+    uint64_t measured_us = BENCH_DURATION_US - BENCH_WARMUP_US;
+    uint32_t download_kbps = (uint32_t)(((uint64_t)(_download.acked_seq - acked_at_warmup) * 8 * 1000) / measured_us);
+    uint32_t upload_kbps = (uint32_t)(((_upload.acked_bytes - uploaded_at_warmup) * 8 * 1000) / measured_us);
+
+    app_uplink_queue_stats_t stats;
+    app_uplink_queue_get_stats(&stats);
+    app_uplink_queue_attach(NULL);
+
+    printf("Uplink %d kbps, downlink %d kbps, %d ms RTT, one ACK per %d segments, ACK filter %s\n",
+           BENCH_UPLINK_KBPS,
+           BENCH_DOWNLINK_KBPS,
+           BENCH_RTT_US / 1000,
+           BENCH_SEGMENTS_PER_ACK,
+           CONFIG_AIR_GATEWAY_UPLINK_ACK_FILTER ? "on" : "off");
+    printf("download %5" PRIu32 " kbps | upload %4" PRIu32 " kbps | ACKs %" PRIu32 " sent, %" PRIu32
+           " delivered, %" PRIu32 " filtered, %" PRIu32 " codel drops\n",
+           download_kbps,
+           upload_kbps,
+           _download.acks_sent,
+           _download.acks_delivered,
+           stats.acks_filtered,
+           stats.codel_drops);
+
+#if CONFIG_AIR_GATEWAY_UPLINK_ACK_FILTER
+    /* Without the filter both fall short, about 14 Mbps down and half the uplink up: the ACKs take their fair share
+     * and CoDel has to drop them instead */
+    TEST_ASSERT(download_kbps * 100 >= BENCH_DOWNLINK_KBPS * 55);
+    TEST_ASSERT(upload_kbps * 100 >= BENCH_UPLINK_KBPS * 80);
+#endif
+    TEST_ASSERT_EQUAL(0, host_pbufs_alive());
+    return 0;
+}
@@ -0,0 +1,465 @@
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "app_forward.h"
+#include "app_lwip_hooks.h"
+#include "app_stations.h"
+#include "app_stats.h"
+#include "app_supervisor.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "esp_timer.h"
+#include "host_stubs.h"
+#include "host_test.h"
+#include "lwip/def.h"
+#include "lwip/netif.h"
+#include "lwip/prot/ethernet.h"
+#include "lwip/prot/ip.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/tcp.h"
+#include "sdkconfig.h"
+
+/* The forwarding path of the tcpip thread for fixed traffic profiles: the IPv4 input hook with station accounting,
+ * PMTU and NAPT, lwIP's routing decision, then the uplink queue and counters towards PPP or the AP link output
+ * towards a station. Wi-Fi, the modem and lwIP itself stay out, what is left is everything the gateway adds per
+ * packet. Compares against a stored baseline:
+ *
+ *   bench_forward --baseline test/host/bench_forward.baseline [--max-regression 10]
+ *   bench_forward --write test/host/bench_forward.baseline
+ */
+
+/* -------------------------------------------------------------------------- */
+
+#define BENCH_STATIONS        (4)
+#define BENCH_FLOWS_MAX       (800)
+#define BENCH_PACKETS         (400000)
+#define BENCH_STEP_US         (10)
+#define BENCH_PROFILE_NAME    (16)
+#define BENCH_PROFILES_MAX    (8)
+
+typedef struct {
+    const char *name;
+    uint8_t proto;
+    uint16_t flows;
+    // Per round and flow: packets from the station and their size, then packets towards it
+    uint8_t up_count;
+    uint16_t up_payload;
+    uint8_t down_count;
+    uint16_t down_payload;
+} _profile_t;
+
+typedef struct {
+    uint8_t station;
+    uint16_t private_port;
+    uint16_t public_port;
+    uint16_t up_len;
+    uint16_t down_len;
+    uint8_t up[1500];
+    uint8_t down[1500];
+} _flow_t;
+
+typedef struct {
+    char name[BENCH_PROFILE_NAME];
+    uint32_t mbps;
+    uint32_t kpps;
+    uint32_t up_p50_ns;
+    uint32_t up_p99_ns;
+    uint32_t down_p50_ns;
+    uint32_t down_p99_ns;
+    uint32_t heap_peak;
+} _result_t;
+
+static const _profile_t _profiles[] = {
+    // Bulk TCP towards the stations, one ACK per two segments
+    { "download", IP_PROTO_TCP, 16, 1, 0, 2, 1460 },
+    { "upload", IP_PROTO_TCP, 16, 2, 1460, 1, 0 },
+    // RTP sized datagrams both ways
+    { "voice", IP_PROTO_UDP, 8, 1, 172, 1, 172 },
+    // Small requests and replies over many connections, most of the NAPT table in use
+    { "many_flows", IP_PROTO_TCP, BENCH_FLOWS_MAX, 1, 100, 1, 536 },
+};
+
+static struct netif _ap;
+static struct netif _ppp;
+static esp_netif_t _ap_esp = { .lwip_netif = &_ap };
+static esp_netif_t _ppp_esp = { .lwip_netif = &_ppp };
+static const ip4_addr_t _remote = { PP_HTONL(0x5DB8D822UL) };
+static _flow_t _flows[BENCH_FLOWS_MAX];
+static uint32_t _up_ns[BENCH_PACKETS];
+static uint32_t _down_ns[BENCH_PACKETS];
+static uint64_t _forwarded_bytes;
+static uint32_t _forwarded_packets;
+static atomic_uint_fast32_t _last_traffic_ms;
+
+/* -------------------------------------------------------------------------- */
+
+/* Stand-in for the supervisor, which needs Wi-Fi and the modem. Its per-packet part is this store. */
+void app_supervisor_note_traffic(void) {
+    atomic_store_explicit(&_last_traffic_ms, (uint32_t)(esp_timer_get_time() / 1000), memory_order_relaxed);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint64_t _now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _station_mac(uint8_t station, uint8_t mac[6]) {
+    const uint8_t base[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x10 };
+    memcpy(mac, base, 6);
+    mac[5] += station;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint32_t _station_ip(uint8_t station) {
+    return PP_HTONL(0xC0A80402UL + station);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint16_t _packet(uint8_t *ip,
+                        uint8_t proto,
+                        uint32_t src,
+                        uint16_t src_port,
+                        uint32_t dest,
+                        uint16_t dest_port,
+                        uint16_t payload) {
+    uint16_t l4_len = (proto == IP_PROTO_TCP) ? TCP_HLEN : 8;
+    uint16_t len = IP_HLEN + l4_len + payload;
+    memset(ip, 0, IP_HLEN + l4_len);
+    ip[0] = 0x45;
+    ip[2] = (uint8_t)(len >> 8);
+    ip[3] = (uint8_t)len;
+    ip[6] = IP_DF >> 8;
+    ip[8] = 64;
+    ip[9] = proto;
+    memcpy(&ip[12], &src, 4);
+    memcpy(&ip[16], &dest, 4);
+    uint8_t *l4 = &ip[IP_HLEN];
+    l4[0] = (uint8_t)(src_port >> 8);
+    l4[1] = (uint8_t)src_port;
+    l4[2] = (uint8_t)(dest_port >> 8);
+    l4[3] = (uint8_t)dest_port;
+    if (proto == IP_PROTO_TCP) {
+        l4[12] = (TCP_HLEN / 4) << 4;
+        l4[13] = TCP_ACK;
+        l4[16] = 0x5A;
+    } else {
+        l4[4] = (uint8_t)((8 + payload) >> 8);
+        l4[5] = (uint8_t)(8 + payload);
+        l4[6] = 0x5A;
+    }
+    return len;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* The modem, takes everything right away so the queue always sends directly */
+static err_t _ppp_output(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr) {
+    _flow_t *flow = p->host_ctx;
+    const uint8_t *l4 = (const uint8_t *)p->payload + IP_HLEN;
+    if ((flow != NULL) && (flow->public_port == 0)) {
+        flow->public_port = (uint16_t)((l4[0] << 8) | l4[1]);
+    }
+    _forwarded_bytes += p->tot_len;
+    _forwarded_packets++;
+    return ERR_OK;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* The Wi-Fi driver, p->payload is the Ethernet header */
+static err_t _ap_linkoutput(struct netif *netif, struct pbuf *p) {
+    _forwarded_bytes += p->tot_len - SIZEOF_ETH_HDR;
+    _forwarded_packets++;
+    return ERR_OK;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* What etharp_output does for a station on the AP, the pbuf was allocated with room for the header */
+static void _ap_output(struct pbuf *p, const _flow_t *flow) {
+    p->payload = (uint8_t *)p->payload - SIZEOF_ETH_HDR;
+    p->len += SIZEOF_ETH_HDR;
+    p->tot_len += SIZEOF_ETH_HDR;
+    uint8_t *frame = p->payload;
+    _station_mac(flow->station, frame);
+    memcpy(&frame[6], "\x02\x00\x00\x00\x00\x01", 6);
+    frame[12] = ETHTYPE_IP >> 8;
+    frame[13] = ETHTYPE_IP & 0xFF;
+    _ap.linkoutput(&_ap, p);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Station to uplink: the input hook, then lwIP routes to the PPP netif */
+static uint32_t _forward_up(_flow_t *flow) {
+    struct pbuf *p = host_pbuf_new(flow->up, flow->up_len);
+    p->host_ctx = flow;
+
+    uint64_t start_ns = _now_ns();
+    if (app_forward_ip4_input(p, &_ap) == 0) {
+        _ppp.output(&_ppp, p, &_ppp.gw);
+        pbuf_free(p);
+    }
+    return (uint32_t)(_now_ns() - start_ns);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Uplink to station: the input hook, then lwIP routes to the AP netif */
+static uint32_t _forward_down(_flow_t *flow) {
+    struct pbuf *p = host_pbuf_new(NULL, SIZEOF_ETH_HDR + flow->down_len);
+    p->payload = (uint8_t *)p->payload + SIZEOF_ETH_HDR;
+    p->len = flow->down_len;
+    p->tot_len = flow->down_len;
+    memcpy(p->payload, flow->down, flow->down_len);
+
+    uint64_t start_ns = _now_ns();
+    if (app_forward_ip4_input(p, &_ppp) == 0) {
+        _ap_output(p, flow);
+        pbuf_free(p);
+    }
+    return (uint32_t)(_now_ns() - start_ns);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _setup(void) {
+    IP4_ADDR(&_ap.ip_addr, 192, 168, 4, 1);
+    IP4_ADDR(&_ap.netmask, 255, 255, 255, 0);
+    _ap.linkoutput = _ap_linkoutput;
+    _ap.mtu = 1500;
+    IP4_ADDR(&_ppp.ip_addr, 10, 64, 0, 2);
+    IP4_ADDR(&_ppp.netmask, 255, 255, 255, 255);
+    _ppp.output = _ppp_output;
+    _ppp.mtu = 1500;
+
+    app_stations_init();
+    app_forward_init(&_ap_esp);
+    app_forward_set_uplink(&_ppp_esp);
+    // A redial attaches the same netif again, its output must not end up wrapped twice
+    app_forward_set_uplink(NULL);
+    app_forward_set_uplink(&_ppp_esp);
+
+    for (uint8_t i = 0; i < BENCH_STATIONS; i++) {
+        ip_event_ap_staipassigned_t event = { .ip = { _station_ip(i) } };
+        _station_mac(i, event.mac);
+        app_stations_join(event.mac);
+        host_post_event(IP_EVENT, IP_EVENT_AP_STAIPASSIGNED, &event);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static _result_t _run(const _profile_t *profile) {
+    _result_t result = { 0 };
+    snprintf(result.name, sizeof(result.name), "%s", profile->name);
+
+    static uint16_t next_port = 20000;
+    for (uint16_t i = 0; i < profile->flows; i++) {
+        _flow_t *flow = &_flows[i];
+        memset(flow, 0, sizeof(*flow));
+        flow->station = i % BENCH_STATIONS;
+        flow->private_port = next_port++;
+        flow->up_len = _packet(flow->up,
+                               profile->proto,
+                               _station_ip(flow->station),
+                               flow->private_port,
+                               _remote.addr,
+                               443,
+                               profile->up_payload);
+    }
+
+    host_heap_reset_peak();
+    size_t up_count = 0;
+    size_t down_count = 0;
+    uint64_t busy_ns = 0;
+    _forwarded_bytes = 0;
+    _forwarded_packets = 0;
+
+    while ((up_count + profile->up_count <= BENCH_PACKETS) && (down_count + profile->down_count <= BENCH_PACKETS)) {
+        for (uint16_t i = 0; i < profile->flows; i++) {
+            _flow_t *flow = &_flows[i];
+            for (uint8_t n = 0; (n < profile->up_count) && (up_count < BENCH_PACKETS); n++) {
+                _up_ns[up_count] = _forward_up(flow);
+                busy_ns += _up_ns[up_count++];
+            }
+            if (flow->down_len == 0) {
+                // The reply goes to whatever port NAPT picked for the first packet
+                flow->down_len = _packet(flow->down,
+                                         profile->proto,
+                                         _remote.addr,
+                                         443,
+                                         _ppp.ip_addr.addr,
+                                         flow->public_port,
+                                         profile->down_payload);
+            }
+            for (uint8_t n = 0; (n < profile->down_count) && (down_count < BENCH_PACKETS); n++) {
+                _down_ns[down_count] = _forward_down(flow);
+                busy_ns += _down_ns[down_count++];
+            }
+            host_advance_us(BENCH_STEP_US);
+        }
+    }
+
+    result.mbps = (uint32_t)((_forwarded_bytes * 8 * 1000) / busy_ns);
+    result.kpps = (uint32_t)(((uint64_t)_forwarded_packets * 1000000) / busy_ns);
+    result.up_p50_ns = host_percentile(_up_ns, up_count, 50);
+    result.up_p99_ns = host_percentile(_up_ns, up_count, 99);
+    result.down_p50_ns = host_percentile(_down_ns, down_count, 50);
+    result.down_p99_ns = host_percentile(_down_ns, down_count, 99);
+
+    app_stats_heap_t heap;
+    app_stats_get_heap(&heap);
+    result.heap_peak = (HOST_HEAP_INTERNAL_BYTES - heap.heap_min_free_internal) +
+                       (HOST_HEAP_PSRAM_BYTES - heap.heap_min_free_psram);
+
+    // Every packet made it through, none of them was answered or dropped on the way
+    TEST_ASSERT_EQUAL(up_count + down_count, _forwarded_packets);
+    TEST_ASSERT_EQUAL(0, host_pbufs_alive());
+    return result;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static size_t _load_baseline(const char *path, _result_t *out, size_t max) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "No baseline at %s\n", path);
+        exit(1);
+    }
+    size_t count = 0;
+    char line[160];
+    while ((count < max) && (fgets(line, sizeof(line), file) != NULL)) {
+        _result_t *result = &out[count];
+        if (sscanf(line,
+                   "%15s %" SCNu32 " %" SCNu32 " %" SCNu32 " %" SCNu32 " %" SCNu32 " %" SCNu32 " %" SCNu32,
+                   result->name,
+                   &result->mbps,
+                   &result->kpps,
+                   &result->up_p50_ns,
+                   &result->up_p99_ns,
+                   &result->down_p50_ns,
+                   &result->down_p99_ns,
+                   &result->heap_peak) == 8) {
+            count++;
+        }
+    }
+    fclose(file);
+    return count;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _write_baseline(const char *path, const _result_t *results, size_t count) {
+    FILE *file = fopen(path, "w");
+    TEST_ASSERT(file != NULL);
+    fprintf(file, "# profile mbps kpps up_p50_ns up_p99_ns down_p50_ns down_p99_ns heap_peak_bytes\n");
+    for (size_t i = 0; i < count; i++) {
+        const _result_t *result = &results[i];
+        fprintf(file,
+                "%s %" PRIu32 " %" PRIu32 " %" PRIu32 " %" PRIu32 " %" PRIu32 " %" PRIu32 " %" PRIu32 "\n",
+                result->name,
+                result->mbps,
+                result->kpps,
+                result->up_p50_ns,
+                result->up_p99_ns,
+                result->down_p50_ns,
+                result->down_p99_ns,
+                result->heap_peak);
+    }
+    fclose(file);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Percent change of a rate, positive is faster */
+static int32_t _change(uint32_t value, uint32_t baseline) {
+    return (baseline == 0) ? 0 : (int32_t)(((int64_t)value - baseline) * 100 / baseline);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Heap is exact and has to stay within the baseline, timing only fails past max_regression percent */
+static bool _compare(const _result_t *result, const _result_t *baseline, int32_t max_regression) {
+    int32_t mbps = _change(result->mbps, baseline->mbps);
+    // Latency is better when lower, turned around to read like the rate
+    int32_t up_p99 = -_change(result->up_p99_ns, baseline->up_p99_ns);
+    int32_t down_p99 = -_change(result->down_p99_ns, baseline->down_p99_ns);
+    printf("%-10s vs baseline: throughput %+" PRId32 "%%, up p99 %+" PRId32 "%%, down p99 %+" PRId32
+           "%%, heap %+" PRId32 " B\n",
+           result->name,
+           mbps,
+           up_p99,
+           down_p99,
+           (int32_t)result->heap_peak - (int32_t)baseline->heap_peak);
+
+    bool is_ok = (result->heap_peak <= baseline->heap_peak);
+    if (max_regression >= 0) {
+        is_ok = is_ok && (mbps >= -max_regression) && (up_p99 >= -max_regression) && (down_p99 >= -max_regression);
+    }
+    return is_ok;
+}
+
+/* -------------------------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    const char *baseline_path = NULL;
+    const char *write_path = NULL;
+    int32_t max_regression = -1;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--baseline") == 0) {
+            baseline_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--write") == 0) {
+            write_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--max-regression") == 0) {
+            max_regression = atoi(argv[i + 1]);
+        }
+    }
+
+    _setup();
+
+    const size_t count = sizeof(_profiles) / sizeof(_profiles[0]);
+    _result_t results[BENCH_PROFILES_MAX];
+    for (size_t i = 0; i < count; i++) {
+        results[i] = _run(&_profiles[i]);
+        const _result_t *result = &results[i];
+        printf("%-10s %5" PRIu32 " Mbps %5" PRIu32 " kpps | up p50 %4" PRIu32 " ns p99 %5" PRIu32
+               " ns | down p50 %4" PRIu32 " ns p99 %5" PRIu32 " ns | heap peak %" PRIu32 " B\n",
+               result->name,
+               result->mbps,
+               result->kpps,
+               result->up_p50_ns,
+               result->up_p99_ns,
+               result->down_p50_ns,
+               result->down_p99_ns,
+               result->heap_peak);
+    }
+
+    if (write_path != NULL) {
+        _write_baseline(write_path, results, count);
+    }
+
+    bool is_ok = true;
+    if (baseline_path != NULL) {
+        _result_t baseline[BENCH_PROFILES_MAX];
+        size_t baseline_count = _load_baseline(baseline_path, baseline, BENCH_PROFILES_MAX);
+        for (size_t i = 0; i < count; i++) {
+            for (size_t j = 0; j < baseline_count; j++) {
+                if (strcmp(results[i].name, baseline[j].name) == 0) {
+                    is_ok = _compare(&results[i], &baseline[j], max_regression) && is_ok;
+                }
+            }
+        }
+    }
+    return is_ok ? 0 : 1;
+}
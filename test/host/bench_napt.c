@@ -0,0 +1,134 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "app_napt.h"
+#include "esp_random.h"
+#include "host_stubs.h"
+#include "host_test.h"
+#include "lwip/def.h"
+#include "lwip/netif.h"
+#include "lwip/prot/ip.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/tcp.h"
+#include "sdkconfig.h"
+
+/* Translations per second with 1k and 10k connections open. Every round translates one packet of a random
+ * connection out and its reply back in, both take a hash lookup and an incremental checksum update. */
+
+/* -------------------------------------------------------------------------- */
+
+#define BENCH_HEADER_LEN (IP_HLEN + TCP_HLEN)
+#define BENCH_STATIONS   (10)
+#define BENCH_ROUNDS     (2000000)
+
+typedef struct {
+    uint8_t out[BENCH_HEADER_LEN];
+    uint8_t in[BENCH_HEADER_LEN];
+} _connection_t;
+
+static struct netif _ap;
+static struct netif _ppp;
+static _connection_t _connections[10000];
+
+/* -------------------------------------------------------------------------- */
+
+static void _header(uint8_t *ip, uint32_t src, uint16_t src_port, uint32_t dest, uint16_t dest_port) {
+    memset(ip, 0, BENCH_HEADER_LEN);
+    ip[0] = 0x45;
+    ip[3] = BENCH_HEADER_LEN;
+    ip[8] = 64;
+    ip[9] = IP_PROTO_TCP;
+    memcpy(&ip[12], &src, 4);
+    memcpy(&ip[16], &dest, 4);
+    ip[IP_HLEN] = (uint8_t)(src_port >> 8);
+    ip[IP_HLEN + 1] = (uint8_t)src_port;
+    ip[IP_HLEN + 2] = (uint8_t)(dest_port >> 8);
+    ip[IP_HLEN + 3] = (uint8_t)dest_port;
+    ip[IP_HLEN + 12] = (TCP_HLEN / 4) << 4;
+    ip[IP_HLEN + 13] = TCP_ACK;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _open(uint32_t count) {
+    host_reset();
+    app_napt_init(&_ap);
+    app_napt_set_uplink(&_ppp);
+
+    struct pbuf *p = host_pbuf_new(NULL, BENCH_HEADER_LEN);
+    for (uint32_t i = 0; i < count; i++) {
+        ip4_addr_t station;
+        IP4_ADDR(&station, 192, 168, 4, 2 + (i % BENCH_STATIONS));
+        // Unicast addresses of one /8, multicast would stay on the SoftAP side
+        uint32_t remote = lwip_htonl(0x5D000000UL | (esp_random() & 0x00FFFFFFUL));
+        uint16_t remote_port = (i & 1) ? 443 : 80;
+        _header(_connections[i].out, station.addr, (uint16_t)(20000 + i), remote, remote_port);
+
+        memcpy(p->payload, _connections[i].out, BENCH_HEADER_LEN);
+        TEST_ASSERT_EQUAL(0, app_napt_outbound(p));
+        const uint8_t *translated = p->payload;
+        uint16_t public_port = (uint16_t)((translated[IP_HLEN] << 8) | translated[IP_HLEN + 1]);
+        _header(_connections[i].in, remote, remote_port, _ppp.ip_addr.addr, public_port);
+    }
+    pbuf_free(p);
+
+    app_napt_stats_t stats;
+    app_napt_get_stats(&stats);
+    TEST_ASSERT_EQUAL(count, stats.entries);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static double _seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint32_t _lookups_per_second(uint32_t count) {
+    _open(count);
+    struct pbuf *p = host_pbuf_new(NULL, BENCH_HEADER_LEN);
+    uint8_t *ip = p->payload;
+    uint32_t index = 0;
+
+    double start = _seconds();
+    for (uint32_t round = 0; round < BENCH_ROUNDS; round++) {
+        index = (index * 1103515245u + 12345u) % count;
+        memcpy(ip, _connections[index].out, BENCH_HEADER_LEN);
+        app_napt_outbound(p);
+        memcpy(ip, _connections[index].in, BENCH_HEADER_LEN);
+        app_napt_inbound(p);
+    }
+    double elapsed = _seconds() - start;
+
+    // The last reply went back to the station, the lookups hit
+    TEST_ASSERT(memcmp(&ip[16], &_connections[index].out[12], 4) == 0);
+    pbuf_free(p);
+    return (uint32_t)((2.0 * BENCH_ROUNDS) / elapsed);
+}
+
+/* -------------------------------------------------------------------------- */
+
+int main(void) {
+    IP4_ADDR(&_ap.ip_addr, 192, 168, 4, 1);
+    IP4_ADDR(&_ap.netmask, 255, 255, 255, 0);
+    IP4_ADDR(&_ppp.ip_addr, 10, 64, 0, 2);
+    IP4_ADDR(&_ppp.netmask, 255, 255, 255, 255);
+
+    uint32_t small = _lookups_per_second(1000);
+    printf("NAPT table of %d entries,  1000 connections: %" PRIu32 " lookups/s\n",
+           CONFIG_AIR_GATEWAY_NAPT_ENTRIES,
+           small);
+    uint32_t large = _lookups_per_second(10000);
+    printf("NAPT table of %d entries, 10000 connections: %" PRIu32 " lookups/s\n",
+           CONFIG_AIR_GATEWAY_NAPT_ENTRIES,
+           large);
+
+    // Hashed lookups do not slow down with the number of connections, only the cache misses grow
+    TEST_ASSERT(large * 4 >= small);
+    return 0;
+}
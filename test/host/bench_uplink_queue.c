@@ -0,0 +1,165 @@
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "app_uplink_queue.h"
+#include "host_stubs.h"
+#include "host_test.h"
+#include "lwip/prot/ip.h"
+#include "sdkconfig.h"
+#include "sim_uplink.h"
+
+/* A station uploads in bulk while another one sends a small packet every 20 ms, like a voice call. Without the
+ * queue everything waits in one tail-drop FIFO the size of the UART TX buffer plus lwIP's pbuf queue. */
+
+/* -------------------------------------------------------------------------- */
+
+#define BENCH_RATE_KBPS        (1000)
+#define BENCH_RTT_US           (60 * 1000)
+#define BENCH_CWND_MAX         (256 * 1024)
+#define BENCH_FIFO_BYTES       (CONFIG_GATEWAY_MODEM_UART_TX_BUFFER_SIZE + 32 * 1500)
+#define BENCH_VOICE_BYTES      (160)
+#define BENCH_VOICE_PERIOD_US  (20 * 1000)
+#define BENCH_WARMUP_US        (5 * 1000000ULL)
+#define BENCH_DURATION_US      (35 * 1000000ULL)
+#define BENCH_SAMPLES_MAX      (4096)
+#define BENCH_FLOW_BULK        (0)
+#define BENCH_FLOW_VOICE       (1)
+
+typedef struct {
+    uint32_t p50_ms;
+    uint32_t p99_ms;
+    uint32_t max_ms;
+    uint32_t bulk_kbps;
+    uint32_t bulk_losses;
+    uint32_t voice_lost;
+} _result_t;
+
+static struct netif _ppp;
+static sim_tcp_t _bulk;
+static uint32_t _latency_ms[BENCH_SAMPLES_MAX];
+static size_t _samples;
+static uint32_t _voice_lost;
+
+/* -------------------------------------------------------------------------- */
+
+static void _on_departed(const sim_packet_t *packet) {
+    if (packet->flow == BENCH_FLOW_BULK) {
+        sim_tcp_on_departed(&_bulk, packet);
+    } else if ((packet->created_us >= BENCH_WARMUP_US) && (_samples < BENCH_SAMPLES_MAX)) {
+        _latency_ms[_samples++] = (uint32_t)((host_time_us() - packet->created_us) / 1000);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _on_dropped(const sim_packet_t *packet) {
+    if (packet->flow == BENCH_FLOW_BULK) {
+        sim_tcp_on_dropped(&_bulk, packet);
+    } else {
+        _voice_lost++;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static _result_t _run(bool is_queued) {
+    const sim_link_config_t config = {
+        .rate_kbps = BENCH_RATE_KBPS,
+        .buffer_bytes = is_queued ? CONFIG_GATEWAY_MODEM_UART_TX_BUFFER_SIZE : BENCH_FIFO_BYTES,
+        .on_departed = _on_departed,
+        .on_dropped = _on_dropped,
+    };
+    sim_link_init(&_ppp, &config);
+    if (is_queued) {
+        app_uplink_queue_attach(&_ppp);
+    }
+
+    sim_tcp_init(&_bulk, BENCH_FLOW_BULK, BENCH_RTT_US, BENCH_CWND_MAX);
+    IP4_ADDR(&_bulk.src, 10, 64, 0, 2);
+    IP4_ADDR(&_bulk.dest, 198, 51, 100, 10);
+    _bulk.src_port = 50000;
+    _bulk.dest_port = 443;
+    ip4_addr_t voice_src;
+    ip4_addr_t voice_dest;
+    IP4_ADDR(&voice_src, 10, 64, 0, 2);
+    IP4_ADDR(&voice_dest, 198, 51, 100, 20);
+    _samples = 0;
+    _voice_lost = 0;
+
+    uint64_t acked_at_warmup = 0;
+    uint64_t next_voice_us = 0;
+    while (host_time_us() < BENCH_DURATION_US) {
+        if (host_time_us() == BENCH_WARMUP_US) {
+            acked_at_warmup = _bulk.acked_bytes;
+        }
+        sim_tcp_send(&_bulk, &_ppp);
+        if (host_time_us() >= next_voice_us) {
+            struct pbuf *p =
+                sim_ipv4(BENCH_FLOW_VOICE, IP_PROTO_UDP, &voice_src, 40000, &voice_dest, 3478, BENCH_VOICE_BYTES);
+            sim_output(&_ppp, p);
+            next_voice_us += BENCH_VOICE_PERIOD_US;
+        }
+        sim_step();
+    }
+
+    _result_t result = {
+        .max_ms = 0,
+        .bulk_kbps =
+            (uint32_t)(((_bulk.acked_bytes - acked_at_warmup) * 8 * 1000) / (BENCH_DURATION_US - BENCH_WARMUP_US)),
+        .bulk_losses = _bulk.losses,
+        .voice_lost = _voice_lost,
+    };
+    result.p50_ms = host_percentile(_latency_ms, _samples, 50);
+    result.p99_ms = host_percentile(_latency_ms, _samples, 99);
+    result.max_ms = host_percentile(_latency_ms, _samples, 100);
+
+    if (is_queued) {
+        app_uplink_queue_attach(NULL);
+    }
+    return result;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _print(const char *name, const _result_t *result) {
+    printf("%-9s voice p50 %4" PRIu32 " ms, p99 %4" PRIu32 " ms, max %4" PRIu32 " ms, %" PRIu32
+           " lost | bulk %4" PRIu32 " kbps, %" PRIu32 " losses\n",
+           name,
+           result->p50_ms,
+           result->p99_ms,
+           result->max_ms,
+           result->voice_lost,
+           result->bulk_kbps,
+           result->bulk_losses);
+}
+
+/* -------------------------------------------------------------------------- */
+
+int main(void) {
+    printf("Uplink %d kbps, bulk upload with %d ms RTT against %d B voice packets every %d ms\n",
+           BENCH_RATE_KBPS,
+           BENCH_RTT_US / 1000,
+           BENCH_VOICE_BYTES,
+           BENCH_VOICE_PERIOD_US / 1000);
+
+    _result_t fifo = _run(false);
+    _print("fifo", &fifo);
+    _result_t queued = _run(true);
+    _print("fq_codel", &queued);
+
+    app_uplink_queue_stats_t stats;
+    app_uplink_queue_get_stats(&stats);
+    printf("fq_codel  %" PRIu32 " codel drops, %" PRIu32 " overflow drops, %" PRIu32 " sent directly\n",
+           stats.codel_drops,
+           stats.overflow_drops,
+           stats.direct_packets);
+
+    // The voice flow keeps its own queue, it only waits for what the UART TX limit lets into the modem
+    TEST_ASSERT(queued.p99_ms * 4 <= fifo.p99_ms);
+    TEST_ASSERT(queued.p99_ms <= 60);
+    TEST_ASSERT_EQUAL(0, queued.voice_lost);
+    // CoDel keeps the queue short without starving the upload
+    TEST_ASSERT(queued.bulk_kbps * 100 >= BENCH_RATE_KBPS * 85);
+    TEST_ASSERT_EQUAL(0, host_pbufs_alive());
+    return 0;
+}
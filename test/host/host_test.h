@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Assertions for the host tests, a failed one ends the run with a non-zero exit code */
+
+#define TEST_ASSERT(condition)                                                                    \
+    do {                                                                                          \
+        if (!(condition)) {                                                                       \
+            fprintf(stderr, "%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #condition);     \
+            exit(1);                                                                              \
+        }                                                                                         \
+    } while (0)
+
+#define TEST_ASSERT_EQUAL(expected, actual)                                                       \
+    do {                                                                                          \
+        long long _expected = (long long)(expected);                                              \
+        long long _actual = (long long)(actual);                                                  \
+        if (_expected != _actual) {                                                               \
+            fprintf(stderr,                                                                       \
+                    "%s:%d: %s is %lld, expected %lld\n",                                         \
+                    __FILE__,                                                                     \
+                    __LINE__,                                                                     \
+                    #actual,                                                                      \
+                    _actual,                                                                      \
+                    _expected);                                                                   \
+            exit(1);                                                                              \
+        }                                                                                         \
+    } while (0)
+
+#define RUN_TEST(test)                                                                            \
+    do {                                                                                          \
+        test();                                                                                   \
+        printf("PASS %s\n", #test);                                                               \
+    } while (0)
+
+static int _host_test_compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Sorts values in place, nearest rank */
+static inline uint32_t host_percentile(uint32_t *values, size_t count, uint32_t percent) {
+    if (count == 0) {
+        return 0;
+    }
+    qsort(values, count, sizeof(uint32_t), _host_test_compare_u32);
+    size_t rank = (count * percent + 99) / 100;
+    return values[(rank == 0) ? 0 : rank - 1];
+}
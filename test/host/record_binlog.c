@@ -0,0 +1,73 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bsp_binlog.h"
+#include "esp_mac.h"
+#include "host_stubs.h"
+#include "host_test.h"
+
+/* Runs the binary log writer of bsp_binlog.c over three boots and writes the partition to the file given as argument,
+ * test_binlog_decode.py turns it back into text with this program's ELF. Nothing flushes in the background on the
+ * host, so the records of a boot reach flash when the next boot recovers them from RAM. */
+
+/* -------------------------------------------------------------------------- */
+
+static const char *TAG = "record_binlog.c";
+
+#define RECORD_SECTORS     (4)
+#define RECORD_SECTOR_SIZE (4096)
+
+static uint8_t _flash[RECORD_SECTORS * RECORD_SECTOR_SIZE];
+
+/* -------------------------------------------------------------------------- */
+
+static void _boot(esp_reset_reason_t reason) {
+    host_reset();
+    host_set_reset_reason(reason);
+    bsp_binlog_init(0);
+}
+
+/* -------------------------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    TEST_ASSERT(argc == 2);
+
+    // Without the partition the writer refuses and the macros fall back to text
+    host_set_flash(NULL, 0);
+    bsp_binlog_init(0);
+    TEST_ASSERT(bsp_binlog_write(BSP_BINLOG_INFO, 0, TAG, "dropped") == false);
+    BSP_BINLOGW(TAG, "No partition, printed as text");
+
+    // Erased flash, as after flashing a new partition table
+    memset(_flash, 0xFF, sizeof(_flash));
+    host_set_flash(_flash, sizeof(_flash));
+
+    _boot(ESP_RST_POWERON);
+    const uint8_t mac[6] = { 0x02, 0x1A, 0x2B, 0x3C, 0x4D, 0x5E };
+    host_advance_us(1500 * 1000);
+    BSP_BINLOGI(TAG, "station " MACSTR " join, AID=%d", MAC2STR(mac), 1);
+    host_advance_us(250 * 1000);
+    BSP_BINLOGI(TAG, "PPP state changed event %d", -3);
+    BSP_BINLOGE(TAG, "%s: %u of %u, %5u%% 0x%04X", "uplink", 7u, 8u, 87u, 0xBEEFu);
+
+    _boot(ESP_RST_SW);
+    host_advance_us(42 * 1000);
+    BSP_BINLOGW(TAG, "Eight words %d %d %d %d %d %d %d %d", 1, 2, 3, 4, 5, 6, 7, 8);
+    BSP_BINLOGI(TAG, "station " MACSTR " leave, AID=%d", MAC2STR(mac), 1);
+
+    // Recovers the second boot, the third one is still in RAM when the partition is read
+    _boot(ESP_RST_PANIC);
+    BSP_BINLOGI(TAG, "not flushed yet");
+
+    bsp_binlog_stats_t stats;
+    bsp_binlog_get_stats(&stats);
+    TEST_ASSERT_EQUAL(3, stats.boot);
+    TEST_ASSERT_EQUAL(3, stats.recovered);
+
+    FILE *dump = fopen(argv[1], "wb");
+    TEST_ASSERT(dump != NULL);
+    TEST_ASSERT(fwrite(_flash, 1, sizeof(_flash), dump) == sizeof(_flash));
+    fclose(dump);
+    return 0;
+}
@@ -0,0 +1,315 @@
+#include "sim_uplink.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "host_stubs.h"
+#include "lwip/prot/ip.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/tcp.h"
+
+/* -------------------------------------------------------------------------- */
+
+#define SIM_LINK_SLOTS (4096)
+
+typedef struct {
+    uint64_t due_us;
+    uint64_t order;
+    sim_event_fn_t fn;
+    void *ctx;
+    uint32_t arg;
+} _event_t;
+
+static sim_link_config_t _config;
+static sim_packet_t _link[SIM_LINK_SLOTS];
+static uint32_t _link_head;
+static uint32_t _link_count;
+static uint32_t _link_bytes;
+// Bits the link may still send in the current step, carried over while a packet is on the wire
+static uint64_t _credit_bits;
+
+static _event_t _events[SIM_EVENTS_MAX];
+static uint32_t _event_count;
+static uint64_t _event_order;
+
+/* -------------------------------------------------------------------------- */
+
+static bool _is_earlier(const _event_t *a, const _event_t *b) {
+    return (a->due_us != b->due_us) ? (a->due_us < b->due_us) : (a->order < b->order);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _swap(uint32_t a, uint32_t b) {
+    _event_t tmp = _events[a];
+    _events[a] = _events[b];
+    _events[b] = tmp;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _pop_event(void) {
+    _events[0] = _events[--_event_count];
+    uint32_t i = 0;
+    while (1) {
+        uint32_t smallest = i;
+        uint32_t left = 2 * i + 1;
+        uint32_t right = left + 1;
+        if ((left < _event_count) && _is_earlier(&_events[left], &_events[smallest])) {
+            smallest = left;
+        }
+        if ((right < _event_count) && _is_earlier(&_events[right], &_events[smallest])) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            return;
+        }
+        _swap(i, smallest);
+        i = smallest;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+void sim_after(uint32_t delay_us, sim_event_fn_t fn, void *ctx, uint32_t arg) {
+    if (_event_count == SIM_EVENTS_MAX) {
+        abort();
+    }
+    uint32_t i = _event_count++;
+    _events[i] = (_event_t){ host_time_us() + delay_us, _event_order++, fn, ctx, arg };
+    while ((i > 0) && _is_earlier(&_events[i], &_events[(i - 1) / 2])) {
+        _swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _on_pbuf_freed(struct pbuf *p) {
+    sim_packet_t *packet = p->host_ctx;
+    if (packet == NULL) {
+        return;
+    }
+    if ((packet->is_sent == false) && (_config.on_dropped != NULL)) {
+        _config.on_dropped(packet);
+    }
+    free(packet);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* The PPP output, takes a copy as long as the UART TX buffer has room */
+static err_t _link_output(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr) {
+    sim_packet_t *packet = p->host_ctx;
+    if ((_link_bytes + p->tot_len > _config.buffer_bytes) || (_link_count == SIM_LINK_SLOTS)) {
+        return ERR_MEM;
+    }
+    packet->is_sent = true;
+    _link[(_link_head + _link_count) % SIM_LINK_SLOTS] = *packet;
+    _link_count++;
+    _link_bytes += p->tot_len;
+    host_set_tx_pending(_link_bytes);
+    return ERR_OK;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void sim_link_init(struct netif *netif, const sim_link_config_t *config) {
+    host_reset();
+    host_on_pbuf_freed(_on_pbuf_freed);
+    _config = *config;
+    _link_head = 0;
+    _link_count = 0;
+    _link_bytes = 0;
+    _credit_bits = 0;
+    _event_count = 0;
+
+    memset(netif, 0, sizeof(*netif));
+    IP4_ADDR(&netif->ip_addr, 10, 64, 0, 2);
+    IP4_ADDR(&netif->netmask, 255, 255, 255, 255);
+    netif->output = _link_output;
+    netif->mtu = 1500;
+}
+
+/* -------------------------------------------------------------------------- */
+
+uint32_t sim_link_queued_bytes(void) {
+    return _link_bytes;
+}
+
+/* -------------------------------------------------------------------------- */
+
+struct pbuf *sim_ipv4(uint8_t flow,
+                      uint8_t proto,
+                      const ip4_addr_t *src,
+                      uint16_t src_port,
+                      const ip4_addr_t *dest,
+                      uint16_t dest_port,
+                      uint16_t payload_len) {
+    uint16_t l4_len = (proto == IP_PROTO_TCP) ? TCP_HLEN : 8;
+    uint16_t len = IP_HLEN + l4_len + payload_len;
+    struct pbuf *p = host_pbuf_new(NULL, len);
+
+    uint8_t *ip = p->payload;
+    struct ip_hdr *iphdr = (struct ip_hdr *)ip;
+    iphdr->_v_hl = 0x45;
+    IPH_LEN(iphdr) = lwip_htons(len);
+    IPH_TTL(iphdr) = 64;
+    IPH_PROTO(iphdr) = proto;
+    iphdr->src = *src;
+    iphdr->dest = *dest;
+
+    uint8_t *l4 = &ip[IP_HLEN];
+    l4[0] = (uint8_t)(src_port >> 8);
+    l4[1] = (uint8_t)src_port;
+    l4[2] = (uint8_t)(dest_port >> 8);
+    l4[3] = (uint8_t)dest_port;
+    if (proto == IP_PROTO_TCP) {
+        l4[12] = (TCP_HLEN / 4) << 4;
+    } else {
+        l4[4] = (uint8_t)((8 + payload_len) >> 8);
+        l4[5] = (uint8_t)(8 + payload_len);
+    }
+
+    sim_packet_t *packet = calloc(1, sizeof(sim_packet_t));
+    packet->flow = flow;
+    packet->bytes = len;
+    packet->created_us = host_time_us();
+    p->host_ctx = packet;
+    return p;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void sim_tcp_header(struct pbuf *p, uint32_t seq, uint32_t ack, uint8_t flags, uint16_t window) {
+    uint8_t *tcp = (uint8_t *)p->payload + IP_HLEN;
+    for (int i = 0; i < 4; i++) {
+        tcp[4 + i] = (uint8_t)(seq >> (24 - 8 * i));
+        tcp[8 + i] = (uint8_t)(ack >> (24 - 8 * i));
+    }
+    tcp[13] = flags;
+    tcp[14] = (uint8_t)(window >> 8);
+    tcp[15] = (uint8_t)window;
+    sim_packet_t *packet = p->host_ctx;
+    packet->seq = seq;
+    packet->ack = ack;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Routed out of the PPP netif like lwIP's ip4_forward does, the caller's reference is dropped afterwards */
+void sim_output(struct netif *netif, struct pbuf *p) {
+    ip4_addr_t next_hop = netif->gw;
+    netif->output(netif, p, &next_hop);
+    pbuf_free(p);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _drain(void) {
+    if (_link_count == 0) {
+        _credit_bits = 0;
+        return;
+    }
+    _credit_bits += (uint64_t)_config.rate_kbps * SIM_STEP_US / 1000;
+    while ((_link_count > 0) && (_credit_bits >= (uint64_t)_link[_link_head].bytes * 8)) {
+        sim_packet_t packet = _link[_link_head];
+        _credit_bits -= (uint64_t)packet.bytes * 8;
+        _link_head = (_link_head + 1) % SIM_LINK_SLOTS;
+        _link_count--;
+        _link_bytes -= packet.bytes;
+        if (_config.on_departed != NULL) {
+            _config.on_departed(&packet);
+        }
+    }
+    host_set_tx_pending(_link_bytes);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* One step of SIM_STEP_US: the link sends, due events run, then lwIP timeouts like the queue's pump */
+void sim_step(void) {
+    _drain();
+    uint64_t end_us = host_time_us() + SIM_STEP_US;
+    while ((_event_count > 0) && (_events[0].due_us <= end_us)) {
+        _event_t event = _events[0];
+        _pop_event();
+        event.fn(event.ctx, event.arg);
+    }
+    host_advance_us(SIM_STEP_US);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void sim_tcp_init(sim_tcp_t *tcp, uint8_t flow, uint32_t rtt_us, uint32_t cwnd_max) {
+    memset(tcp, 0, sizeof(*tcp));
+    tcp->flow = flow;
+    tcp->rtt_us = rtt_us;
+    tcp->cwnd_max = cwnd_max;
+    tcp->cwnd = 10 * SIM_MSS;
+    tcp->ssthresh = cwnd_max;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void sim_tcp_send(sim_tcp_t *tcp, struct netif *netif) {
+    while (tcp->inflight + SIM_MSS <= tcp->cwnd) {
+        struct pbuf *p =
+            sim_ipv4(tcp->flow, IP_PROTO_TCP, &tcp->src, tcp->src_port, &tcp->dest, tcp->dest_port, SIM_MSS);
+        sim_tcp_header(p, tcp->next_seq, 1, TCP_ACK | TCP_PSH, 0xFFFF);
+        tcp->next_seq += SIM_MSS;
+        tcp->inflight += SIM_MSS;
+        sim_output(netif, p);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _on_tcp_ack(void *ctx, uint32_t bytes) {
+    sim_tcp_on_ack(ctx, bytes);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Congestion avoidance grows the window by one segment per round trip, slow start by one per ACK */
+void sim_tcp_on_ack(sim_tcp_t *tcp, uint32_t bytes) {
+    tcp->inflight -= bytes;
+    tcp->acked_bytes += bytes;
+    if (tcp->cwnd < tcp->ssthresh) {
+        tcp->cwnd += bytes;
+    } else {
+        tcp->cwnd += (uint32_t)(((uint64_t)SIM_MSS * bytes) / tcp->cwnd);
+    }
+    if (tcp->cwnd > tcp->cwnd_max) {
+        tcp->cwnd = tcp->cwnd_max;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _on_tcp_loss(void *ctx, uint32_t bytes) {
+    sim_tcp_t *tcp = ctx;
+    tcp->inflight -= bytes;
+    tcp->losses++;
+    // One reduction per round trip, like fast recovery
+    if (host_time_us() >= tcp->recover_until_us) {
+        tcp->ssthresh = (tcp->cwnd / 2 > 2 * SIM_MSS) ? tcp->cwnd / 2 : 2 * SIM_MSS;
+        tcp->cwnd = tcp->ssthresh;
+        tcp->recover_until_us = host_time_us() + tcp->rtt_us;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+void sim_tcp_on_departed(sim_tcp_t *tcp, const sim_packet_t *packet) {
+    sim_after(tcp->rtt_us, _on_tcp_ack, tcp, packet->bytes - IP_HLEN - TCP_HLEN);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* The sender learns about a drop from the duplicate ACKs of the segments behind it, about a round trip later */
+void sim_tcp_on_dropped(sim_tcp_t *tcp, const sim_packet_t *packet) {
+    sim_after(tcp->rtt_us, _on_tcp_loss, tcp, packet->bytes - IP_HLEN - TCP_HLEN);
+}
+
+/* -------------------------------------------------------------------------- */
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+
+/* Packets handed to the PPP output leave over a link of fixed rate, the remote end answers after a fixed delay.
+ * A Reno-like sender stands in for TCP, it is enough to fill a queue and to back off from drops. */
+
+#define SIM_MSS         (1460)
+#define SIM_STEP_US     (100)
+#define SIM_EVENTS_MAX  (4096)
+
+typedef struct {
+    uint8_t flow;
+    uint16_t bytes;
+    uint32_t seq;
+    uint32_t ack;
+    uint64_t created_us;
+    bool is_sent;
+} sim_packet_t;
+
+typedef void (*sim_packet_cb_t)(const sim_packet_t *packet);
+
+typedef struct {
+    uint32_t rate_kbps;
+    // Tail drop limit of what the PPP output takes, the UART TX buffer
+    uint32_t buffer_bytes;
+    sim_packet_cb_t on_departed;
+    sim_packet_cb_t on_dropped;
+} sim_link_config_t;
+
+typedef struct {
+    uint8_t flow;
+    ip4_addr_t src;
+    ip4_addr_t dest;
+    uint16_t src_port;
+    uint16_t dest_port;
+    uint32_t rtt_us;
+    uint32_t cwnd_max;
+    uint32_t cwnd;
+    uint32_t ssthresh;
+    uint32_t inflight;
+    uint32_t next_seq;
+    uint64_t recover_until_us;
+    uint64_t acked_bytes;
+    uint32_t losses;
+} sim_tcp_t;
+
+void sim_link_init(struct netif *netif, const sim_link_config_t *config);
+uint32_t sim_link_queued_bytes(void);
+struct pbuf *sim_ipv4(uint8_t flow,
+                      uint8_t proto,
+                      const ip4_addr_t *src,
+                      uint16_t src_port,
+                      const ip4_addr_t *dest,
+                      uint16_t dest_port,
+                      uint16_t payload_len);
+void sim_tcp_header(struct pbuf *p, uint32_t seq, uint32_t ack, uint8_t flags, uint16_t window);
+void sim_output(struct netif *netif, struct pbuf *p);
+void sim_step(void);
+typedef void (*sim_event_fn_t)(void *ctx, uint32_t arg);
+
+void sim_after(uint32_t delay_us, sim_event_fn_t fn, void *ctx, uint32_t arg);
+
+void sim_tcp_init(sim_tcp_t *tcp, uint8_t flow, uint32_t rtt_us, uint32_t cwnd_max);
+void sim_tcp_send(sim_tcp_t *tcp, struct netif *netif);
+void sim_tcp_on_departed(sim_tcp_t *tcp, const sim_packet_t *packet);
+void sim_tcp_on_dropped(sim_tcp_t *tcp, const sim_packet_t *packet);
+void sim_tcp_on_ack(sim_tcp_t *tcp, uint32_t bytes);
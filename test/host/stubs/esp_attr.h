@@ -0,0 +1,4 @@
+#pragma once
+
+// Host memory is never cleared behind the program's back, a static stands in for RTC-kept RAM
+#define __NOINIT_ATTR
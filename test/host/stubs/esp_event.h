@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_netif.h"
+
+typedef const char *esp_event_base_t;
+typedef void (*esp_event_handler_t)(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
+
+extern const esp_event_base_t IP_EVENT;
+
+#define IP_EVENT_AP_STAIPASSIGNED (3)
+
+typedef struct {
+    esp_ip4_addr_t ip;
+    uint8_t mac[6];
+} ip_event_ap_staipassigned_t;
+
+/* Handlers run from host_post_event() in the caller */
+esp_err_t esp_event_handler_register(esp_event_base_t event_base,
+                                     int32_t event_id,
+                                     esp_event_handler_t event_handler,
+                                     void *event_handler_arg);
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "esp_err.h"
+#include "esp_netif.h"
+
+typedef struct esp_modem_dce_wrap esp_modem_dce_t;
+
+typedef enum {
+    ESP_MODEM_FLOW_CONTROL_NONE = 0,
+    ESP_MODEM_FLOW_CONTROL_SW,
+    ESP_MODEM_FLOW_CONTROL_HW,
+} esp_modem_flow_ctrl_t;
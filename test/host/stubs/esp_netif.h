@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+struct netif;
+
+/* A host netif is nothing but the lwIP one */
+typedef struct esp_netif_obj {
+    struct netif *lwip_netif;
+} esp_netif_t;
+
+typedef struct {
+    uint32_t addr;
+} esp_ip4_addr_t;
+
+#define IPSTR      "%d.%d.%d.%d"
+#define IP2STR(ip) (int)((ip)->addr & 0xFF), (int)(((ip)->addr >> 8) & 0xFF), (int)(((ip)->addr >> 16) & 0xFF), \
+                   (int)(((ip)->addr >> 24) & 0xFF)
+
+void *esp_netif_get_netif_impl(esp_netif_t *esp_netif);
@@ -0,0 +1,3 @@
+#pragma once
+
+#define ESP_WIFI_MAX_CONN_NUM (15)
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+/* The host runs every module from one thread, critical sections have nothing to exclude */
+
+typedef int portMUX_TYPE;
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+
+#define portNUM_PROCESSORS           (1)
+#define portMUX_INITIALIZER_UNLOCKED (0)
+#define portENTER_CRITICAL(mux)      ((void)(mux))
+#define portEXIT_CRITICAL(mux)       ((void)(mux))
+#define pdTRUE                       (1)
+#define pdFALSE                      (0)
+#define pdMS_TO_TICKS(ms)            ((TickType_t)(ms))
+#define xPortGetCoreID()             (0)
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+/* Nothing runs in the background on the host, created tasks are dropped */
+
+typedef void (*TaskFunction_t)(void *arg);
+typedef void *TaskHandle_t;
+
+#define pdPASS (1)
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task,
+                                   const char *name,
+                                   uint32_t stack_size,
+                                   void *arg,
+                                   uint32_t priority,
+                                   TaskHandle_t *out_handle,
+                                   BaseType_t core);
+void vTaskDelay(TickType_t ticks);
@@ -0,0 +1,475 @@
+#include "host_stubs.h"
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bsp_mem.h"
+#include "esp_cpu.h"
+#include "esp_event.h"
+#include "esp_heap_caps.h"
+#include "esp_netif.h"
+#include "esp_partition.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
+#include "lwip/inet_chksum.h"
+#include "lwip/ip4.h"
+#include "lwip/netif.h"
+#include "lwip/tcpip.h"
+#include "lwip/timeouts.h"
+
+/* -------------------------------------------------------------------------- */
+
+#define HOST_TIMEOUTS_MAX (16)
+#define HOST_HANDLERS_MAX (8)
+
+typedef struct {
+    bool is_used;
+    uint64_t due_us;
+    sys_timeout_handler handler;
+    void *arg;
+} _timeout_t;
+
+typedef enum {
+    HEAP_INTERNAL = 0,
+    HEAP_PSRAM,
+    HEAP_MAX,
+} _heap_e;
+
+typedef struct {
+    esp_event_base_t base;
+    int32_t id;
+    esp_event_handler_t handler;
+    void *arg;
+} _handler_t;
+
+const esp_event_base_t IP_EVENT = "IP_EVENT";
+
+static uint64_t _now_us;
+static _timeout_t _timeouts[HOST_TIMEOUTS_MAX];
+static size_t _tx_pending;
+static uint32_t _random = 0x2545F491;
+static host_pbuf_freed_cb_t _p_freed_cb;
+static size_t _pbufs_alive;
+static size_t _heap_used[HEAP_MAX];
+static size_t _heap_peak[HEAP_MAX];
+static uint32_t _ip4_outputs;
+static _handler_t _handlers[HOST_HANDLERS_MAX];
+static esp_partition_t _partition;
+static uint8_t *_p_flash;
+static esp_reset_reason_t _reset_reason = ESP_RST_POWERON;
+
+/* -------------------------------------------------------------------------- */
+
+void host_log(char level, const char *tag, const char *format, ...) {
+    // Quiet unless asked for, the benchmarks go through error paths on purpose
+    if (getenv("HOST_LOG") == NULL) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "%c (%llu) %s: ", level, (unsigned long long)(_now_us / 1000), tag);
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    va_end(args);
+}
+
+/* -------------------------------------------------------------------------- */
+
+uint64_t host_time_us(void) {
+    return _now_us;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Moves the clock forward, lwIP timeouts fire in order of their due time */
+void host_advance_us(uint64_t us) {
+    uint64_t target_us = _now_us + us;
+    while (1) {
+        _timeout_t *next = NULL;
+        for (int i = 0; i < HOST_TIMEOUTS_MAX; i++) {
+            if (_timeouts[i].is_used && (_timeouts[i].due_us <= target_us) &&
+                ((next == NULL) || (_timeouts[i].due_us < next->due_us))) {
+                next = &_timeouts[i];
+            }
+        }
+        if (next == NULL) {
+            break;
+        }
+        if (next->due_us > _now_us) {
+            _now_us = next->due_us;
+        }
+        next->is_used = false;
+        next->handler(next->arg);
+    }
+    _now_us = target_us;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void host_reset(void) {
+    memset(_timeouts, 0, sizeof(_timeouts));
+    _now_us = 0;
+    _tx_pending = 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void host_set_tx_pending(size_t bytes) {
+    _tx_pending = bytes;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void host_seed_random(uint32_t seed) {
+    _random = (seed != 0) ? seed : 1;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _heap_take(_heap_e heap, size_t bytes) {
+    _heap_used[heap] += bytes;
+    if (_heap_used[heap] > _heap_peak[heap]) {
+        _heap_peak[heap] = _heap_used[heap];
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static _heap_e _heap_for(uint32_t caps) {
+    return ((caps & MALLOC_CAP_SPIRAM) != 0) ? HEAP_PSRAM : HEAP_INTERNAL;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static size_t _heap_size(_heap_e heap) {
+    return (heap == HEAP_PSRAM) ? HOST_HEAP_PSRAM_BYTES : HOST_HEAP_INTERNAL_BYTES;
+}
+
+/* -------------------------------------------------------------------------- */
+
+struct pbuf *host_pbuf_new(const void *data, uint16_t len) {
+    struct pbuf *p = calloc(1, sizeof(struct pbuf) + len);
+    if (p == NULL) {
+        abort();
+    }
+    p->payload = p + 1;
+    p->len = len;
+    p->tot_len = len;
+    p->ref = 1;
+    if (data != NULL) {
+        memcpy(p->payload, data, len);
+    }
+    p->host_size = sizeof(struct pbuf) + len;
+    _heap_take(HEAP_INTERNAL, p->host_size);
+    _pbufs_alive++;
+    return p;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void host_on_pbuf_freed(host_pbuf_freed_cb_t cb) {
+    _p_freed_cb = cb;
+}
+
+/* -------------------------------------------------------------------------- */
+
+size_t host_pbufs_alive(void) {
+    return _pbufs_alive;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Starts a new high-water mark from what is allocated right now */
+void host_heap_reset_peak(void) {
+    memcpy(_heap_peak, _heap_used, sizeof(_heap_peak));
+}
+
+/* -------------------------------------------------------------------------- */
+
+uint32_t host_ip4_output_count(void) {
+    return _ip4_outputs;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void host_post_event(const char *event_base, int32_t event_id, void *event_data) {
+    for (int i = 0; i < HOST_HANDLERS_MAX; i++) {
+        if ((_handlers[i].handler != NULL) && (strcmp(_handlers[i].base, event_base) == 0) &&
+            (_handlers[i].id == event_id)) {
+            _handlers[i].handler(_handlers[i].arg, event_base, event_id, event_data);
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+int64_t esp_timer_get_time(void) {
+    return (int64_t)_now_us;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* xorshift32, repeatable across runs */
+uint32_t esp_random(void) {
+    _random ^= _random << 13;
+    _random ^= _random >> 17;
+    _random ^= _random << 5;
+    return _random;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void pbuf_ref(struct pbuf *p) {
+    p->ref++;
+}
+
+/* -------------------------------------------------------------------------- */
+
+uint8_t pbuf_free(struct pbuf *p) {
+    if (--p->ref != 0) {
+        return 0;
+    }
+    if (_p_freed_cb != NULL) {
+        _p_freed_cb(p);
+    }
+    _pbufs_alive--;
+    _heap_used[HEAP_INTERNAL] -= p->host_size;
+    free(p);
+    return 1;
+}
+
+/* -------------------------------------------------------------------------- */
+
+struct pbuf *pbuf_alloc(pbuf_layer layer, uint16_t length, pbuf_type type) {
+    return host_pbuf_new(NULL, length);
+}
+
+/* -------------------------------------------------------------------------- */
+
+uint8_t ip4_addr_isbroadcast_u32(uint32_t addr, const struct netif *netif) {
+    if ((addr == 0xFFFFFFFFUL) || (addr == 0)) {
+        return 1;
+    }
+    if ((netif == NULL) || (addr == netif->ip_addr.addr)) {
+        return 0;
+    }
+    uint32_t mask = netif->netmask.addr;
+    return ((addr & mask) == (netif->ip_addr.addr & mask)) && ((addr & ~mask) == ~mask);
+}
+
+/* -------------------------------------------------------------------------- */
+
+err_t tcpip_callback(tcpip_callback_fn function, void *ctx) {
+    function(ctx);
+    return ERR_OK;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void sys_timeout(uint32_t msecs, sys_timeout_handler handler, void *arg) {
+    for (int i = 0; i < HOST_TIMEOUTS_MAX; i++) {
+        if (_timeouts[i].is_used == false) {
+            _timeouts[i] = (_timeout_t){ true, _now_us + (uint64_t)msecs * 1000, handler, arg };
+            return;
+        }
+    }
+    abort();
+}
+
+/* -------------------------------------------------------------------------- */
+
+void sys_untimeout(sys_timeout_handler handler, void *arg) {
+    for (int i = 0; i < HOST_TIMEOUTS_MAX; i++) {
+        if (_timeouts[i].is_used && (_timeouts[i].handler == handler) && (_timeouts[i].arg == arg)) {
+            _timeouts[i].is_used = false;
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+size_t bsp_modem_get_tx_pending(void) {
+    return _tx_pending;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Never freed by the modules, like on the target */
+void *bsp_mem_calloc(bsp_mem_owner_e owner, bsp_mem_placement_e placement, size_t count, size_t size) {
+    _heap_take((placement == BSP_MEM_BULK) ? HEAP_PSRAM : HEAP_INTERNAL, count * size);
+    return calloc(count, size);
+}
+
+/* -------------------------------------------------------------------------- */
+
+size_t heap_caps_get_free_size(uint32_t caps) {
+    _heap_e heap = _heap_for(caps);
+    return _heap_size(heap) - _heap_used[heap];
+}
+
+/* -------------------------------------------------------------------------- */
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps) {
+    _heap_e heap = _heap_for(caps);
+    return _heap_size(heap) - _heap_peak[heap];
+}
+
+/* -------------------------------------------------------------------------- */
+
+size_t heap_caps_get_largest_free_block(uint32_t caps) {
+    return heap_caps_get_free_size(caps);
+}
+
+/* -------------------------------------------------------------------------- */
+
+uint16_t inet_chksum(const void *dataptr, uint16_t len) {
+    const uint8_t *data = dataptr;
+    uint32_t sum = 0;
+    for (uint16_t i = 0; i + 1 < len; i += 2) {
+        sum += (uint32_t)((data[i] << 8) | data[i + 1]);
+    }
+    if ((len & 1) != 0) {
+        sum += (uint32_t)(data[len - 1] << 8);
+    }
+    while ((sum >> 16) != 0) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    // In network order, like lwIP returns it
+    return lwip_htons((uint16_t)~sum);
+}
+
+/* -------------------------------------------------------------------------- */
+
+err_t ip4_output_if(struct pbuf *p,
+                    const ip4_addr_t *src,
+                    const ip4_addr_t *dest,
+                    uint8_t ttl,
+                    uint8_t tos,
+                    uint8_t proto,
+                    struct netif *netif) {
+    _ip4_outputs++;
+    return ERR_OK;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void *esp_netif_get_netif_impl(esp_netif_t *esp_netif) {
+    return esp_netif->lwip_netif;
+}
+
+/* -------------------------------------------------------------------------- */
+
+esp_err_t esp_event_handler_register(esp_event_base_t event_base,
+                                     int32_t event_id,
+                                     esp_event_handler_t event_handler,
+                                     void *event_handler_arg) {
+    for (int i = 0; i < HOST_HANDLERS_MAX; i++) {
+        if (_handlers[i].handler == NULL) {
+            _handlers[i] = (_handler_t){ event_base, event_id, event_handler, event_handler_arg };
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* -------------------------------------------------------------------------- */
+
+/* Backs the one data partition with flash, NULL takes it out of the table */
+void host_set_flash(uint8_t *flash, size_t size) {
+    _p_flash = flash;
+    _partition = (esp_partition_t){ .type = ESP_PARTITION_TYPE_DATA, .size = (uint32_t)size };
+}
+
+/* -------------------------------------------------------------------------- */
+
+void host_set_reset_reason(esp_reset_reason_t reason) {
+    _reset_reason = reason;
+}
+
+/* -------------------------------------------------------------------------- */
+
+esp_reset_reason_t esp_reset_reason(void) {
+    return _reset_reason;
+}
+
+/* -------------------------------------------------------------------------- */
+
+int esp_cpu_get_core_id(void) {
+    return 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type,
+                                                esp_partition_subtype_t subtype,
+                                                const char *label) {
+    if ((_p_flash == NULL) || (type != ESP_PARTITION_TYPE_DATA)) {
+        return NULL;
+    }
+    _partition.subtype = subtype;
+    snprintf(_partition.label, sizeof(_partition.label), "%s", label);
+    return &_partition;
+}
+
+/* -------------------------------------------------------------------------- */
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t offset, void *dst, size_t size) {
+    if (offset + size > partition->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(dst, &_p_flash[offset], size);
+    return ESP_OK;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Programming only clears bits, as on NOR flash */
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t offset, const void *src, size_t size) {
+    if (offset + size > partition->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const uint8_t *bytes = src;
+    for (size_t i = 0; i < size; i++) {
+        _p_flash[offset + i] &= bytes[i];
+    }
+    return ESP_OK;
+}
+
+/* -------------------------------------------------------------------------- */
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size) {
+    if ((offset + size > partition->size) || ((offset % 4096) != 0) || ((size % 4096) != 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(&_p_flash[offset], 0xFF, size);
+    return ESP_OK;
+}
+
+/* -------------------------------------------------------------------------- */
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task,
+                                   const char *name,
+                                   uint32_t stack_size,
+                                   void *arg,
+                                   uint32_t priority,
+                                   TaskHandle_t *out_handle,
+                                   BaseType_t core) {
+    if (out_handle != NULL) {
+        *out_handle = NULL;
+    }
+    return pdPASS;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void vTaskDelay(TickType_t ticks) {
+    host_advance_us((uint64_t)ticks * 1000);
+}
+
+/* -------------------------------------------------------------------------- */
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_system.h"
+#include "lwip/pbuf.h"
+
+/* Simulated clock, lwIP timeouts and pbufs behind the IDF and lwIP stubs */
+
+#define HOST_HEAP_INTERNAL_BYTES (256 * 1024)
+#define HOST_HEAP_PSRAM_BYTES    (4 * 1024 * 1024)
+
+typedef void (*host_pbuf_freed_cb_t)(struct pbuf *p);
+
+void host_log(char level, const char *tag, const char *format, ...) __attribute__((format(printf, 3, 4)));
+uint64_t host_time_us(void);
+void host_advance_us(uint64_t us);
+void host_reset(void);
+void host_set_tx_pending(size_t bytes);
+void host_seed_random(uint32_t seed);
+struct pbuf *host_pbuf_new(const void *data, uint16_t len);
+void host_on_pbuf_freed(host_pbuf_freed_cb_t cb);
+size_t host_pbufs_alive(void);
+void host_heap_reset_peak(void);
+uint32_t host_ip4_output_count(void);
+void host_post_event(const char *event_base, int32_t event_id, void *event_data);
+void host_set_flash(uint8_t *flash, size_t size);
+void host_set_reset_reason(esp_reset_reason_t reason);
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "The lwIP stubs assume a little endian host like the ESP32"
+#endif
+
+#define PP_HTONS(x) ((uint16_t)((((x) & 0x00FFU) << 8) | (((x) & 0xFF00U) >> 8)))
+#define PP_NTOHS(x) PP_HTONS(x)
+#define PP_HTONL(x)                                                                                       \
+    ((((x) & 0x000000FFUL) << 24) | (((x) & 0x0000FF00UL) << 8) | (((x) & 0x00FF0000UL) >> 8) |          \
+     (((x) & 0xFF000000UL) >> 24))
+#define PP_NTOHL(x) PP_HTONL(x)
+
+#define lwip_htons(x) PP_HTONS(x)
+#define lwip_ntohs(x) PP_NTOHS(x)
+#define lwip_htonl(x) PP_HTONL(x)
+#define lwip_ntohl(x) PP_NTOHL(x)
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef int8_t err_t;
+
+#define ERR_OK  (0)
+#define ERR_MEM (-1)
+#define ERR_BUF (-2)
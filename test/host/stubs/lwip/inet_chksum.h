@@ -0,0 +1,5 @@
+#pragma once
+
+#include <stdint.h>
+
+uint16_t inet_chksum(const void *dataptr, uint16_t len);
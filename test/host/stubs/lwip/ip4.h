@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "lwip/err.h"
+#include "lwip/ip4_addr.h"
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+
+#define ICMP_TTL (255)
+
+/* Counted and dropped, the host has no IPv4 output path, see host_ip4_output_count() */
+err_t ip4_output_if(struct pbuf *p,
+                    const ip4_addr_t *src,
+                    const ip4_addr_t *dest,
+                    uint8_t ttl,
+                    uint8_t tos,
+                    uint8_t proto,
+                    struct netif *netif);
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "lwip/def.h"
+
+struct netif;
+
+typedef struct ip4_addr {
+    uint32_t addr;
+} ip4_addr_t;
+
+typedef ip4_addr_t ip4_addr_p_t;
+
+#define IP4_ADDR(ipaddr, a, b, c, d)                                                                        \
+    ((ipaddr)->addr = PP_HTONL(((uint32_t)(a) << 24) | ((uint32_t)(b) << 16) | ((uint32_t)(c) << 8) | (d)))
+
+#define ip4_addr_copy(dest, src)        ((dest).addr = (src).addr)
+#define ip4_addr_isany(a)               (((a) == NULL) || ((a)->addr == 0))
+#define ip4_addr_cmp(a, b)              ((a)->addr == (b)->addr)
+#define ip4_addr_netcmp(a, b, mask)     (((a)->addr & (mask)->addr) == ((b)->addr & (mask)->addr))
+#define ip4_addr_ismulticast(a)         (((a)->addr & PP_HTONL(0xF0000000UL)) == PP_HTONL(0xE0000000UL))
+#define ip4_addr_isbroadcast(a, netif)  ip4_addr_isbroadcast_u32((a)->addr, (netif))
+
+uint8_t ip4_addr_isbroadcast_u32(uint32_t addr, const struct netif *netif);
@@ -0,0 +1,3 @@
+#pragma once
+
+#define IP_NAPT_MAX (512)
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "lwip/err.h"
+#include "lwip/ip4_addr.h"
+#include "lwip/pbuf.h"
+
+struct netif;
+
+typedef err_t (*netif_output_fn)(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr);
+typedef err_t (*netif_linkoutput_fn)(struct netif *netif, struct pbuf *p);
+
+struct netif {
+    ip4_addr_t ip_addr;
+    ip4_addr_t netmask;
+    ip4_addr_t gw;
+    netif_output_fn output;
+    netif_linkoutput_fn linkoutput;
+    uint16_t mtu;
+};
+
+#define netif_ip4_addr(netif)    ((const ip4_addr_t *)&((netif)->ip_addr))
+#define netif_ip4_netmask(netif) ((const ip4_addr_t *)&((netif)->netmask))
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "lwip/err.h"
+
+/* Single buffer pbufs, enough for the forwarding hooks which only look at the first one */
+struct pbuf {
+    struct pbuf *next;
+    void *payload;
+    uint16_t tot_len;
+    uint16_t len;
+    uint16_t ref;
+    // Host only, lets a simulation find its own bookkeeping for a packet
+    void *host_ctx;
+    // Host only, what the allocation counts against the heap
+    uint32_t host_size;
+};
+
+typedef enum {
+    PBUF_TRANSPORT,
+    PBUF_IP,
+    PBUF_LINK,
+    PBUF_RAW,
+} pbuf_layer;
+
+typedef enum {
+    PBUF_RAM,
+    PBUF_POOL,
+} pbuf_type;
+
+struct pbuf *pbuf_alloc(pbuf_layer layer, uint16_t length, pbuf_type type);
+void pbuf_ref(struct pbuf *p);
+uint8_t pbuf_free(struct pbuf *p);
@@ -0,0 +1,4 @@
+#pragma once
+
+#define SIZEOF_ETH_HDR (14)
+#define ETHTYPE_IP     (0x0800U)
@@ -0,0 +1,9 @@
+#pragma once
+
+#define ICMP_ER   (0)
+#define ICMP_DUR  (3)
+#define ICMP_ECHO (8)
+#define ICMP_TE   (11)
+#define ICMP_PP   (12)
+
+#define ICMP_DUR_FRAG (4)
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "lwip/ip4_addr.h"
+
+#define IP_HLEN    (20)
+#define IP_RF      (0x8000U)
+#define IP_DF      (0x4000U)
+#define IP_MF      (0x2000U)
+#define IP_OFFMASK (0x1FFFU)
+
+struct ip_hdr {
+    uint8_t _v_hl;
+    uint8_t _tos;
+    uint16_t _len;
+    uint16_t _id;
+    uint16_t _offset;
+    uint8_t _ttl;
+    uint8_t _proto;
+    uint16_t _chksum;
+    ip4_addr_p_t src;
+    ip4_addr_p_t dest;
+} __attribute__((packed));
+
+#define IPH_V(hdr)        ((hdr)->_v_hl >> 4)
+#define IPH_HL(hdr)       ((hdr)->_v_hl & 0x0F)
+#define IPH_HL_BYTES(hdr) ((uint8_t)(IPH_HL(hdr) * 4))
+#define IPH_TOS(hdr)      ((hdr)->_tos)
+#define IPH_LEN(hdr)      ((hdr)->_len)
+#define IPH_ID(hdr)       ((hdr)->_id)
+#define IPH_OFFSET(hdr)   ((hdr)->_offset)
+#define IPH_TTL(hdr)      ((hdr)->_ttl)
+#define IPH_PROTO(hdr)    ((hdr)->_proto)
+#define IPH_CHKSUM(hdr)   ((hdr)->_chksum)
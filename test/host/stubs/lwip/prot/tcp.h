@@ -0,0 +1,12 @@
+#pragma once
+
+#define TCP_HLEN (20)
+
+#define TCP_FIN (0x01U)
+#define TCP_SYN (0x02U)
+#define TCP_RST (0x04U)
+#define TCP_PSH (0x08U)
+#define TCP_ACK (0x10U)
+#define TCP_URG (0x20U)
+#define TCP_ECE (0x40U)
+#define TCP_CWR (0x80U)
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef void (*sys_timeout_handler)(void *arg);
+
+void sys_timeout(uint32_t msecs, sys_timeout_handler handler, void *arg);
+void sys_untimeout(sys_timeout_handler handler, void *arg);
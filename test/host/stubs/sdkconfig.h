@@ -0,0 +1,50 @@
+#pragma once
+
+/* Project defaults from Kconfig.projbuild for the modules built on the host */
+
+#define CONFIG_AIR_GATEWAY_UPLINK_FQ_CODEL            1
+#define CONFIG_AIR_GATEWAY_UPLINK_FQ_FLOWS            32
+#define CONFIG_AIR_GATEWAY_UPLINK_FQ_LIMIT_PACKETS    128
+#define CONFIG_AIR_GATEWAY_UPLINK_FQ_LIMIT_BYTES      65536
+// The ACK filter benchmark is also built without it
+#ifndef CONFIG_AIR_GATEWAY_UPLINK_ACK_FILTER
+#define CONFIG_AIR_GATEWAY_UPLINK_ACK_FILTER          1
+#endif
+#define CONFIG_AIR_GATEWAY_UPLINK_CODEL_TARGET_MS     5
+#define CONFIG_AIR_GATEWAY_UPLINK_CODEL_INTERVAL_MS   100
+#define CONFIG_AIR_GATEWAY_UPLINK_TX_LIMIT_BYTES      4096
+#define CONFIG_AIR_GATEWAY_UPLINK_RATE_KBPS           0
+#define CONFIG_GATEWAY_MODEM_UART_TX_BUFFER_SIZE      16384
+
+#define CONFIG_AIR_GATEWAY_PMTU                       1
+#define CONFIG_AIR_GATEWAY_UPLINK_MTU                 1500
+
+#define CONFIG_AIR_GATEWAY_NAPT                       1
+// The benchmark builds its own table size
+#ifndef CONFIG_AIR_GATEWAY_NAPT_ENTRIES
+#define CONFIG_AIR_GATEWAY_NAPT_ENTRIES               1024
+#endif
+#define CONFIG_AIR_GATEWAY_NAPT_TCP_TIMEOUT_S         7440
+#define CONFIG_AIR_GATEWAY_NAPT_UDP_TIMEOUT_S         300
+
+#define CONFIG_AIR_GATEWAY_GOVERNOR_BALANCED_PERCENT  60
+#define CONFIG_AIR_GATEWAY_GOVERNOR_SAVER_PERCENT     35
+#define CONFIG_AIR_GATEWAY_GOVERNOR_CRITICAL_PERCENT  15
+#define CONFIG_AIR_GATEWAY_GOVERNOR_HYSTERESIS_PERCENT 5
+#define CONFIG_AIR_GATEWAY_GOVERNOR_CRITICAL_MV       3450
+#define CONFIG_AIR_GATEWAY_GOVERNOR_SOLAR_MV          4500
+#define CONFIG_AIR_GATEWAY_GOVERNOR_MIN_DWELL_S       60
+#define CONFIG_AIR_GATEWAY_GOVERNOR_INTERVAL_MS       5000
+
+#define CONFIG_AIR_GATEWAY_CHANNEL_HYSTERESIS_PERCENT 30
+
+#define CONFIG_GATEWAY_BINLOG                         1
+#define CONFIG_GATEWAY_BINLOG_RECORDS                 64
+#define CONFIG_GATEWAY_BINLOG_FLUSH_MS                1000
+
+#define CONFIG_AIR_GATEWAY_ADMISSION                  1
+#define CONFIG_AIR_GATEWAY_ADMISSION_HEAP_RESERVE     32768
+#define CONFIG_AIR_GATEWAY_ADMISSION_NAPT_PERCENT     90
+#define CONFIG_AIR_GATEWAY_ADMISSION_MIN_KBPS         128
+#define CONFIG_AIR_GATEWAY_ADMISSION_HOLDOFF_S        30
+#define CONFIG_AIR_GATEWAY_ADMISSION_IDLE_S           300
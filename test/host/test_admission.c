@@ -0,0 +1,405 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "app_admission.h"
+#include "app_config.h"
+#include "app_connection.h"
+#include "app_napt.h"
+#include "app_stations.h"
+#include "app_stats.h"
+#include "esp_modem_api.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "host_stubs.h"
+#include "host_test.h"
+#include "sdkconfig.h"
+
+#include "bsp_modem.h"
+
+/* Synthetic stations joining one after another, against the budgets of app_admission.c. The station table, the
+ * configuration, the heap, NAPT and link figures and the Wi-Fi driver are stand-ins the tests set directly. */
+
+/* -------------------------------------------------------------------------- */
+
+#define TEST_STATIONS_MAX (APP_CONFIG_STATIONS_MAX + 4)
+#define TEST_HEAP_FREE    (128 * 1024)
+#define TEST_NAPT_ENTRIES (1024)
+// 3 Mbaud on the UART carries 2400 kbit/s of payload, the link budget holds for every station
+#define TEST_BAUD_FAST    (3000000)
+#define TEST_IDLE_US      ((uint64_t)CONFIG_AIR_GATEWAY_ADMISSION_IDLE_S * 1000000ULL)
+#define TEST_HOLDOFF_US   ((uint64_t)CONFIG_AIR_GATEWAY_ADMISSION_HOLDOFF_S * 1000000ULL)
+
+static app_station_t _stations[TEST_STATIONS_MAX];
+static uint8_t _max_stations;
+static uint32_t _heap_free;
+static uint32_t _napt_entries;
+static bool _is_uplink_up;
+static uint32_t _baud;
+static uint32_t _deauths;
+static uint8_t _deauthed[6];
+
+/* -------------------------------------------------------------------------- */
+
+void app_config_get(app_config_t *out) {
+    memset(out, 0, sizeof(*out));
+    out->max_stations = _max_stations;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_stats_get_heap(app_stats_heap_t *out) {
+    memset(out, 0, sizeof(*out));
+    out->heap_free_internal = _heap_free;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_napt_get_stats(app_napt_stats_t *out) {
+    memset(out, 0, sizeof(*out));
+    out->capacity = TEST_NAPT_ENTRIES;
+    out->entries = _napt_entries;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void app_connection_get_stats(app_connection_stats_t *out) {
+    memset(out, 0, sizeof(*out));
+    out->is_up = _is_uplink_up;
+}
+
+/* -------------------------------------------------------------------------- */
+
+void bsp_modem_get_link_stats(bsp_modem_link_stats_t *out) {
+    memset(out, 0, sizeof(*out));
+    out->baud = _baud;
+}
+
+/* -------------------------------------------------------------------------- */
+
+size_t app_stations_snapshot(app_station_t *out, size_t max) {
+    size_t count = (max < TEST_STATIONS_MAX) ? max : TEST_STATIONS_MAX;
+    memcpy(out, _stations, count * sizeof(app_station_t));
+    return count;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* The association ID is the slot in the station table plus one, as long as the station is associated */
+esp_err_t esp_wifi_ap_get_sta_aid(const uint8_t mac[6], uint16_t *aid) {
+    for (size_t i = 0; i < TEST_STATIONS_MAX; i++) {
+        if (_stations[i].is_connected && (memcmp(_stations[i].mac, mac, 6) == 0)) {
+            *aid = (uint16_t)(i + 1);
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* What app_stations_leave() would record once the driver reports the station gone */
+esp_err_t esp_wifi_deauth_sta(uint16_t aid) {
+    if ((aid == 0) || (aid > TEST_STATIONS_MAX) || (_stations[aid - 1].is_connected == false)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    _stations[aid - 1].is_connected = false;
+    memcpy(_deauthed, _stations[aid - 1].mac, sizeof(_deauthed));
+    _deauths++;
+    return ESP_OK;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint32_t _now_ms(void) {
+    return (uint32_t)(host_time_us() / 1000);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Every test uses its own MAC prefix, the hold-off list of app_admission.c outlives a test */
+static void _mac(uint8_t test, uint8_t station, uint8_t out[6]) {
+    const uint8_t mac[6] = { 0x02, 0x00, 0x00, 0x00, test, station };
+    memcpy(out, mac, 6);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _reset(uint8_t max_stations) {
+    memset(_stations, 0, sizeof(_stations));
+    _max_stations = max_stations;
+    _heap_free = TEST_HEAP_FREE;
+    _napt_entries = 0;
+    _is_uplink_up = true;
+    _baud = TEST_BAUD_FAST;
+    _deauths = 0;
+    memset(_deauthed, 0, sizeof(_deauthed));
+}
+
+/* -------------------------------------------------------------------------- */
+
+static size_t _connected(void) {
+    size_t count = 0;
+    for (size_t i = 0; i < TEST_STATIONS_MAX; i++) {
+        count += _stations[i].is_connected ? 1 : 0;
+    }
+    return count;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Like app_stations_join(), a known station keeps its slot, then admission runs as it does on the supervisor */
+static void _join(uint8_t test, uint8_t station) {
+    uint8_t mac[6];
+    _mac(test, station, mac);
+    app_station_t *slot = NULL;
+    for (size_t i = 0; (i < TEST_STATIONS_MAX) && (slot == NULL); i++) {
+        if (memcmp(_stations[i].mac, mac, 6) == 0) {
+            slot = &_stations[i];
+        }
+    }
+    for (size_t i = 0; (i < TEST_STATIONS_MAX) && (slot == NULL); i++) {
+        if (_stations[i].is_connected == false) {
+            slot = &_stations[i];
+        }
+    }
+    TEST_ASSERT(slot != NULL);
+
+    memset(slot, 0, sizeof(*slot));
+    memcpy(slot->mac, mac, 6);
+    slot->is_connected = true;
+    slot->first_seen_ms = _now_ms();
+    slot->last_seen_ms = _now_ms();
+    app_admission_station_joined(mac);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _touch(uint8_t test, uint8_t station) {
+    uint8_t mac[6];
+    _mac(test, station, mac);
+    for (size_t i = 0; i < TEST_STATIONS_MAX; i++) {
+        if (memcmp(_stations[i].mac, mac, 6) == 0) {
+            _stations[i].last_seen_ms = _now_ms();
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool _is_connected(uint8_t test, uint8_t station) {
+    uint8_t mac[6];
+    _mac(test, station, mac);
+    for (size_t i = 0; i < TEST_STATIONS_MAX; i++) {
+        if (_stations[i].is_connected && (memcmp(_stations[i].mac, mac, 6) == 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static bool _was_deauthed(uint8_t test, uint8_t station) {
+    uint8_t mac[6];
+    _mac(test, station, mac);
+    return memcmp(_deauthed, mac, 6) == 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_budgets(void) {
+    app_admission_input_t input = {
+        .stations = 10,
+        .max_stations = 10,
+        .heap_free = TEST_HEAP_FREE,
+        .napt_entries = 0,
+        .napt_capacity = TEST_NAPT_ENTRIES,
+        .link_kbps = 2400,
+    };
+    TEST_ASSERT_EQUAL(APP_ADMISSION_BUDGET_MAX, app_admission_check(&input));
+
+    input.stations = 11;
+    TEST_ASSERT_EQUAL(APP_ADMISSION_BUDGET_STATIONS, app_admission_check(&input));
+    input.stations = 10;
+
+    input.heap_free = CONFIG_AIR_GATEWAY_ADMISSION_HEAP_RESERVE - 1;
+    TEST_ASSERT_EQUAL(APP_ADMISSION_BUDGET_MEMORY, app_admission_check(&input));
+    input.heap_free = CONFIG_AIR_GATEWAY_ADMISSION_HEAP_RESERVE;
+    TEST_ASSERT_EQUAL(APP_ADMISSION_BUDGET_MAX, app_admission_check(&input));
+
+    // 90 % of 1024 is 921.6, the table counts as full from 922 entries
+    input.napt_entries = 921;
+    TEST_ASSERT_EQUAL(APP_ADMISSION_BUDGET_MAX, app_admission_check(&input));
+    input.napt_entries = 922;
+    TEST_ASSERT_EQUAL(APP_ADMISSION_BUDGET_NAPT, app_admission_check(&input));
+    input.napt_entries = 0;
+
+    // 10 shares of 128 kbit/s need 1280
+    input.link_kbps = 1280;
+    TEST_ASSERT_EQUAL(APP_ADMISSION_BUDGET_MAX, app_admission_check(&input));
+    input.link_kbps = 1279;
+    TEST_ASSERT_EQUAL(APP_ADMISSION_BUDGET_LINK, app_admission_check(&input));
+    // The link is down or too slow for one share, neither stops the first station
+    input.link_kbps = 0;
+    TEST_ASSERT_EQUAL(APP_ADMISSION_BUDGET_MAX, app_admission_check(&input));
+    input.stations = 1;
+    input.link_kbps = 64;
+    TEST_ASSERT_EQUAL(APP_ADMISSION_BUDGET_MAX, app_admission_check(&input));
+
+    // The station limit is reported first when several budgets are exceeded
+    input.stations = 11;
+    input.heap_free = 0;
+    TEST_ASSERT_EQUAL(APP_ADMISSION_BUDGET_STATIONS, app_admission_check(&input));
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_ramp_refuses_without_an_idle_station(void) {
+    _reset(10);
+    app_admission_stats_t before;
+    app_admission_get_stats(&before);
+
+    for (uint8_t i = 0; i < 10; i++) {
+        _join(1, i);
+    }
+    TEST_ASSERT_EQUAL(10, _connected());
+    TEST_ASSERT_EQUAL(0, _deauths);
+
+    // Everyone was seen just now, the newcomer is the one turned away
+    host_advance_us(TEST_IDLE_US / 2);
+    for (uint8_t i = 0; i < 10; i++) {
+        _touch(1, i);
+    }
+    _join(1, 10);
+    TEST_ASSERT_EQUAL(10, _connected());
+    TEST_ASSERT_EQUAL(1, _deauths);
+    TEST_ASSERT(_was_deauthed(1, 10));
+
+    app_admission_stats_t after;
+    app_admission_get_stats(&after);
+    TEST_ASSERT_EQUAL(10, after.admitted - before.admitted);
+    TEST_ASSERT_EQUAL(1, after.refused - before.refused);
+    TEST_ASSERT_EQUAL(0, after.evicted - before.evicted);
+    TEST_ASSERT_EQUAL(1,
+                      after.over_budget[APP_ADMISSION_BUDGET_STATIONS] -
+                          before.over_budget[APP_ADMISSION_BUDGET_STATIONS]);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_idle_stations_are_evicted_longest_first(void) {
+    _reset(10);
+    app_admission_stats_t before;
+    app_admission_get_stats(&before);
+
+    for (uint8_t i = 0; i < 10; i++) {
+        _join(2, i);
+    }
+    // Station 7 goes quiet first, station 3 a minute later, the rest stay busy
+    host_advance_us(60 * 1000000ULL);
+    for (uint8_t i = 0; i < 10; i++) {
+        if (i != 7) {
+            _touch(2, i);
+        }
+    }
+    host_advance_us(TEST_IDLE_US);
+    for (uint8_t i = 0; i < 10; i++) {
+        if ((i != 7) && (i != 3)) {
+            _touch(2, i);
+        }
+    }
+
+    _join(2, 10);
+    TEST_ASSERT(_was_deauthed(2, 7));
+    TEST_ASSERT(_is_connected(2, 10));
+
+    _join(2, 11);
+    TEST_ASSERT(_was_deauthed(2, 3));
+    TEST_ASSERT(_is_connected(2, 11));
+
+    // Nobody idle is left, and the newcomers were just seen themselves
+    _join(2, 12);
+    TEST_ASSERT(_was_deauthed(2, 12));
+    TEST_ASSERT_EQUAL(10, _connected());
+
+    app_admission_stats_t after;
+    app_admission_get_stats(&after);
+    TEST_ASSERT_EQUAL(12, after.admitted - before.admitted);
+    TEST_ASSERT_EQUAL(2, after.evicted - before.evicted);
+    TEST_ASSERT_EQUAL(1, after.refused - before.refused);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_refused_station_is_held_off(void) {
+    _reset(4);
+    app_admission_stats_t before;
+    app_admission_get_stats(&before);
+
+    for (uint8_t i = 0; i < 5; i++) {
+        _join(3, i);
+    }
+    TEST_ASSERT(_was_deauthed(3, 4));
+
+    // Room opens up, yet a retry within the hold-off is turned away without a check
+    _stations[0].is_connected = false;
+    host_advance_us(TEST_HOLDOFF_US / 2);
+    _join(3, 4);
+    TEST_ASSERT(_is_connected(3, 4) == false);
+
+    app_admission_stats_t held;
+    app_admission_get_stats(&held);
+    TEST_ASSERT_EQUAL(1, held.held_off - before.held_off);
+    TEST_ASSERT_EQUAL(4, held.admitted - before.admitted);
+
+    host_advance_us(TEST_HOLDOFF_US);
+    _join(3, 4);
+    TEST_ASSERT(_is_connected(3, 4));
+
+    app_admission_stats_t after;
+    app_admission_get_stats(&after);
+    TEST_ASSERT_EQUAL(5, after.admitted - before.admitted);
+    TEST_ASSERT_EQUAL(1, after.refused - before.refused);
+    TEST_ASSERT_EQUAL(1, after.held_off - before.held_off);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_link_budget_ramp(void) {
+    _reset(10);
+    app_admission_stats_t before;
+    app_admission_get_stats(&before);
+
+    // 460800 baud carries 368 kbit/s, two shares of 128 fit and a third does not
+    _baud = 460800;
+    for (uint8_t i = 0; i < 3; i++) {
+        _join(4, i);
+    }
+    TEST_ASSERT_EQUAL(2, _connected());
+    TEST_ASSERT(_was_deauthed(4, 2));
+
+    // Without an uplink there is no link to share
+    _is_uplink_up = false;
+    host_advance_us(TEST_HOLDOFF_US + 1000000ULL);
+    _join(4, 2);
+    TEST_ASSERT_EQUAL(3, _connected());
+
+    app_admission_stats_t after;
+    app_admission_get_stats(&after);
+    TEST_ASSERT_EQUAL(3, after.admitted - before.admitted);
+    TEST_ASSERT_EQUAL(1, after.refused - before.refused);
+    TEST_ASSERT_EQUAL(1, after.over_budget[APP_ADMISSION_BUDGET_LINK] - before.over_budget[APP_ADMISSION_BUDGET_LINK]);
+}
+
+/* -------------------------------------------------------------------------- */
+
+int main(void) {
+    host_reset();
+    RUN_TEST(test_budgets);
+    RUN_TEST(test_ramp_refuses_without_an_idle_station);
+    RUN_TEST(test_idle_stations_are_evicted_longest_first);
+    RUN_TEST(test_refused_station_is_held_off);
+    RUN_TEST(test_link_budget_ramp);
+    return 0;
+}
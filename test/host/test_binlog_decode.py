@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+"""Decodes a partition written by the firmware's binary log writer and checks the text.
+
+    test_binlog_decode.py build-host/record_binlog tools/binlog_decode.py
+
+record_binlog runs bsp_binlog.c on the host over three boots and writes the partition, its own ELF resolves the
+strings the same way the firmware ELF does.
+"""
+
+import os
+import subprocess
+import sys
+import tempfile
+
+EXPECTED = """\
+[1] W (0) c0 bsp_binlog.c: Boot 1, reset reason 1
+[1] I (1500) c0 record_binlog.c: station 02:1a:2b:3c:4d:5e join, AID=1
+[1] I (1750) c0 record_binlog.c: PPP state changed event -3
+[1] E (1750) c0 record_binlog.c: uplink: 7 of 8,    87% 0xBEEF
+[2] W (0) c0 bsp_binlog.c: Boot 2, reset reason 3
+[2] W (42) c0 record_binlog.c: Eight words 1 2 3 4 5 6 7 8
+[2] I (42) c0 record_binlog.c: station 02:1a:2b:3c:4d:5e leave, AID=1
+"""
+
+# Sector header, then 48 byte records, the first boot opens sector 0
+SECOND_RECORD_MS = 16 + 48 + 4
+
+
+def decode(recorder, decoder, dump, *options):
+    result = subprocess.run([sys.executable, decoder, recorder, dump, *options],
+                            capture_output=True, text=True, check=True)
+    return result.stdout, result.stderr
+
+
+def check(name, actual, expected):
+    if actual != expected:
+        sys.exit(f"{name}: got\n{actual}expected\n{expected}")
+    print(f"PASS {name}")
+
+
+def main():
+    recorder, decoder = sys.argv[1:3]
+    with tempfile.TemporaryDirectory() as workdir:
+        dump = os.path.join(workdir, "binlog.bin")
+        subprocess.run([recorder, dump], check=True)
+
+        text, errors = decode(recorder, decoder, dump)
+        check("all boots", text, EXPECTED)
+        check("no corrupt records", errors, "")
+
+        text, _ = decode(recorder, decoder, dump, "--boots", "1")
+        check("last boot", text, "".join(line + "\n" for line in EXPECTED.splitlines() if line.startswith("[2]")))
+
+        # A record torn by a brown-out fails its check and is left out, the rest of the sector still decodes
+        with open(dump, "r+b") as dump_file:
+            dump_file.seek(SECOND_RECORD_MS)
+            dump_file.write(b"\x00")
+        text, errors = decode(recorder, decoder, dump)
+        check("torn record", text, "".join(line + "\n" for line in EXPECTED.splitlines() if "join" not in line))
+        check("torn record count", errors, "1 records failed their check, likely cut short by a brown-out\n")
+
+
+if __name__ == "__main__":
+    main()
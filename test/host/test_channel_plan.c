@@ -0,0 +1,127 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "app_channel_plan.h"
+#include "host_test.h"
+#include "sdkconfig.h"
+
+/* Scans from test/host/scans/ replayed through the plan the way app_channel_scan_done() runs it. A scan holds one AP
+ * per line as app_channel.c logs it at debug level, "AP <primary> <secondary> <rssi>", anything before "AP " is
+ * ignored so device log lines can be pasted as they are. Lines starting with # are comments. */
+
+/* -------------------------------------------------------------------------- */
+
+#define SCAN_RECORDS_MAX (32)
+#define SCAN_LINE_MAX    (160)
+
+static const char *_p_scans_dir;
+
+/* -------------------------------------------------------------------------- */
+
+static size_t _load(const char *name, app_channel_observation_t *out, size_t max) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", _p_scans_dir, name);
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        exit(1);
+    }
+
+    size_t count = 0;
+    char line[SCAN_LINE_MAX];
+    while ((fgets(line, sizeof(line), file) != NULL) && (count < max)) {
+        const char *record = strstr(line, "AP ");
+        if ((line[0] == '#') || (record == NULL)) {
+            continue;
+        }
+        unsigned primary = 0;
+        unsigned secondary = 0;
+        int rssi = 0;
+        TEST_ASSERT(sscanf(record, "AP %u %u %d", &primary, &secondary, &rssi) == 3);
+        out[count].primary = (uint8_t)primary;
+        out[count].secondary = (uint8_t)secondary;
+        out[count].rssi = (int8_t)rssi;
+        count++;
+    }
+    fclose(file);
+    return count;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint8_t _replay(const char *name, uint8_t first, uint8_t last, uint8_t current, app_channel_scores_t *scores) {
+    app_channel_observation_t observations[SCAN_RECORDS_MAX];
+    size_t count = _load(name, observations, SCAN_RECORDS_MAX);
+    app_channel_plan_score(observations, count, scores);
+    return app_channel_plan_pick(scores, first, last, current, CONFIG_AIR_GATEWAY_CHANNEL_HYSTERESIS_PERCENT);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_crowded_channel_is_left_for_the_quietest_one(void) {
+    app_channel_scores_t scores;
+    uint8_t channel = _replay("crowded_6.log", 1, 13, 6, &scores);
+    TEST_ASSERT_EQUAL(5, scores.ap_count[6]);
+    // Between the weak APs on 1 and everything on 6, no AP of its own to share airtime with
+    TEST_ASSERT_EQUAL(2, channel);
+    for (uint8_t other = 1; other <= APP_CHANNEL_PLAN_MAX; other++) {
+        TEST_ASSERT(scores.cost[channel] <= scores.cost[other]);
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_free_channels_tie_towards_non_overlapping_ones(void) {
+    app_channel_scores_t scores;
+    TEST_ASSERT_EQUAL(6, _replay("quiet_1.log", 1, 13, 1, &scores));
+    // Everything from 6 up is free, a station already on one of them stays
+    TEST_ASSERT_EQUAL(11, _replay("quiet_1.log", 1, 13, 11, &scores));
+    TEST_ASSERT_EQUAL(8, _replay("quiet_1.log", 1, 13, 8, &scores));
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_empty_scan_keeps_the_current_channel(void) {
+    app_channel_scores_t scores;
+    TEST_ASSERT_EQUAL(3, _replay("empty.log", 1, 13, 3, &scores));
+    TEST_ASSERT_EQUAL(0, scores.cost[3]);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_small_gains_are_not_worth_a_switch(void) {
+    app_channel_scores_t scores;
+    // 11 costs less than a third more than 13, the best one
+    TEST_ASSERT_EQUAL(11, _replay("near_tie.log", 1, 13, 11, &scores));
+    TEST_ASSERT(scores.cost[13] < scores.cost[11]);
+    // The middle of the band overlaps with twice as many neighbours
+    TEST_ASSERT_EQUAL(13, _replay("near_tie.log", 1, 13, 6, &scores));
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_country_range_limits_the_pick(void) {
+    app_channel_scores_t scores;
+    TEST_ASSERT_EQUAL(13, _replay("strong_13.log", 1, 13, 6, &scores));
+    TEST_ASSERT_EQUAL(2, _replay("strong_13.log", 1, 11, 6, &scores));
+    // 3 costs only a tenth more than 2, not enough to move
+    TEST_ASSERT_EQUAL(3, _replay("strong_13.log", 1, 11, 3, &scores));
+}
+
+/* -------------------------------------------------------------------------- */
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s SCANS_DIR\n", argv[0]);
+        return 2;
+    }
+    _p_scans_dir = argv[1];
+
+    RUN_TEST(test_crowded_channel_is_left_for_the_quietest_one);
+    RUN_TEST(test_free_channels_tie_towards_non_overlapping_ones);
+    RUN_TEST(test_empty_scan_keeps_the_current_channel);
+    RUN_TEST(test_small_gains_are_not_worth_a_switch);
+    RUN_TEST(test_country_range_limits_the_pick);
+    return 0;
+}
@@ -0,0 +1,178 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "app_governor_plan.h"
+#include "host_test.h"
+#include "sdkconfig.h"
+
+/* Battery traces sampled at the governor interval, run through the plan the way the governor task does */
+
+/* -------------------------------------------------------------------------- */
+
+typedef struct {
+    uint32_t transitions;
+    bool has_stepped_up;
+} _trace_t;
+
+typedef struct {
+    app_governor_level_e level;
+    uint32_t since_ms;
+    uint32_t now_ms;
+} _governor_t;
+
+static _trace_t _trace;
+
+/* -------------------------------------------------------------------------- */
+
+static void _start(_governor_t *governor, app_governor_level_e level) {
+    memset(&_trace, 0, sizeof(_trace));
+    governor->level = level;
+    governor->since_ms = 0;
+    governor->now_ms = 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static app_governor_level_e _sample(_governor_t *governor, uint32_t battery_mv, uint32_t percent, uint32_t solar_mv) {
+    governor->now_ms += CONFIG_AIR_GATEWAY_GOVERNOR_INTERVAL_MS;
+    const app_governor_input_t input = { battery_mv, percent, solar_mv };
+    app_governor_level_e level = app_governor_plan_decide(governor->level, &input);
+    if (app_governor_plan_may_switch(governor->level, level, governor->now_ms - governor->since_ms)) {
+        _trace.has_stepped_up = _trace.has_stepped_up || (level < governor->level);
+        _trace.transitions++;
+        governor->level = level;
+        governor->since_ms = governor->now_ms;
+    }
+    return governor->level;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Linear stand-in for the LiPo curve of bsp_battery.c, close enough between 3.5 and 4.15 V */
+static uint32_t _percent_of(uint32_t battery_mv) {
+    if (battery_mv <= 3500) {
+        return 0;
+    }
+    return (battery_mv >= 4150) ? 100 : ((battery_mv - 3500) * 100) / 650;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_discharge_steps_down_once_per_level(void) {
+    _governor_t governor;
+    _start(&governor, APP_GOVERNOR_LEVEL_FULL);
+
+    // 4.15 V to 3.40 V over three hours with 2 mV of ripple on top
+    const uint32_t samples = 3 * 3600 / 5;
+    for (uint32_t i = 0; i < samples; i++) {
+        uint32_t mv = 4150 - (i * 750) / samples + ((i & 1) ? 2 : 0);
+        _sample(&governor, mv, _percent_of(mv), 0);
+    }
+
+    TEST_ASSERT_EQUAL(APP_GOVERNOR_LEVEL_CRITICAL, governor.level);
+    TEST_ASSERT_EQUAL(3, _trace.transitions);
+    TEST_ASSERT(_trace.has_stepped_up == false);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_noise_at_threshold_is_absorbed(void) {
+    _governor_t governor;
+    _start(&governor, APP_GOVERNOR_LEVEL_FULL);
+
+    // Capacity wanders 58 to 63 % around the balanced threshold of 60 % for an hour
+    for (uint32_t i = 0; i < 3600 / 5; i++) {
+        uint32_t percent = CONFIG_AIR_GATEWAY_GOVERNOR_BALANCED_PERCENT - 2 + (i * 7) % 6;
+        _sample(&governor, 3900, percent, 0);
+    }
+
+    TEST_ASSERT_EQUAL(APP_GOVERNOR_LEVEL_BALANCED, governor.level);
+    TEST_ASSERT_EQUAL(1, _trace.transitions);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_sag_goes_critical_at_once(void) {
+    _governor_t governor;
+    _start(&governor, APP_GOVERNOR_LEVEL_BALANCED);
+    _sample(&governor, 3800, 50, 0);
+
+    // A modem TX burst pulls the cell under the floor, well inside the dwell time
+    TEST_ASSERT_EQUAL(APP_GOVERNOR_LEVEL_CRITICAL, _sample(&governor, 3440, 50, 0));
+    // Within the floor hysteresis it stays there, capacity notwithstanding
+    TEST_ASSERT_EQUAL(APP_GOVERNOR_LEVEL_CRITICAL, _sample(&governor, 3490, 50, 0));
+
+    // Above it the capacity decides again, but only once the dwell time is over
+    uint32_t samples = 0;
+    while (_sample(&governor, 3800, 50, 0) == APP_GOVERNOR_LEVEL_CRITICAL) {
+        samples++;
+        TEST_ASSERT(samples < 100);
+    }
+    TEST_ASSERT_EQUAL(APP_GOVERNOR_LEVEL_BALANCED, governor.level);
+    TEST_ASSERT_EQUAL(CONFIG_AIR_GATEWAY_GOVERNOR_MIN_DWELL_S * 1000,
+                      (samples + 2) * CONFIG_AIR_GATEWAY_GOVERNOR_INTERVAL_MS);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_solar_holds_a_higher_level(void) {
+    _governor_t governor;
+    _start(&governor, APP_GOVERNOR_LEVEL_BALANCED);
+
+    for (int i = 0; i < 20; i++) {
+        _sample(&governor, 3850, 55, 0);
+    }
+    TEST_ASSERT_EQUAL(APP_GOVERNOR_LEVEL_BALANCED, governor.level);
+
+    // Charging counts as 10 % more, enough to clear the balanced threshold plus its hysteresis
+    for (int i = 0; i < 20; i++) {
+        _sample(&governor, 3850, 55, 5000);
+    }
+    TEST_ASSERT_EQUAL(APP_GOVERNOR_LEVEL_FULL, governor.level);
+
+    // Clouds: back down after the dwell time
+    for (int i = 0; i < 20; i++) {
+        _sample(&governor, 3850, 54, 1200);
+    }
+    TEST_ASSERT_EQUAL(APP_GOVERNOR_LEVEL_BALANCED, governor.level);
+    TEST_ASSERT_EQUAL(2, _trace.transitions);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_missing_reading_keeps_level(void) {
+    _governor_t governor;
+    _start(&governor, APP_GOVERNOR_LEVEL_SAVER);
+
+    for (int i = 0; i < 50; i++) {
+        _sample(&governor, 0, 0, 0);
+    }
+    TEST_ASSERT_EQUAL(APP_GOVERNOR_LEVEL_SAVER, governor.level);
+    TEST_ASSERT_EQUAL(0, _trace.transitions);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_recovery_skips_levels(void) {
+    _governor_t governor;
+    _start(&governor, APP_GOVERNOR_LEVEL_CRITICAL);
+
+    // A swapped battery: from critical straight to full in one change
+    for (int i = 0; i < 20; i++) {
+        _sample(&governor, 4150, 100, 0);
+    }
+    TEST_ASSERT_EQUAL(APP_GOVERNOR_LEVEL_FULL, governor.level);
+    TEST_ASSERT_EQUAL(1, _trace.transitions);
+}
+
+/* -------------------------------------------------------------------------- */
+
+int main(void) {
+    RUN_TEST(test_discharge_steps_down_once_per_level);
+    RUN_TEST(test_noise_at_threshold_is_absorbed);
+    RUN_TEST(test_sag_goes_critical_at_once);
+    RUN_TEST(test_solar_holds_a_higher_level);
+    RUN_TEST(test_missing_reading_keeps_level);
+    RUN_TEST(test_recovery_skips_levels);
+    return 0;
+}
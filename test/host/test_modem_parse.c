@@ -0,0 +1,118 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "esp_modem_api.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "host_test.h"
+
+#include "bsp_modem.h"
+
+/* Responses of a SIM7600 as esp_modem_at() hands them over, the command echo and OK are already stripped but the
+ * line may still carry the line ending */
+
+/* -------------------------------------------------------------------------- */
+
+static void test_cnmp_modes(void) {
+    bsp_modem_rat_e rat = BSP_MODEM_RAT_AUTO;
+    TEST_ASSERT(bsp_modem_parse_cnmp("+CNMP: 38", &rat));
+    TEST_ASSERT_EQUAL(BSP_MODEM_RAT_LTE, rat);
+    TEST_ASSERT(bsp_modem_parse_cnmp("+CNMP: 2\r\n", &rat));
+    TEST_ASSERT_EQUAL(BSP_MODEM_RAT_AUTO, rat);
+    TEST_ASSERT(bsp_modem_parse_cnmp("+CNMP:14", &rat));
+    TEST_ASSERT_EQUAL(BSP_MODEM_RAT_WCDMA, rat);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_cnmp_rejects_other_lines(void) {
+    bsp_modem_rat_e rat = BSP_MODEM_RAT_GSM;
+    TEST_ASSERT(bsp_modem_parse_cnmp("ERROR", &rat) == false);
+    TEST_ASSERT(bsp_modem_parse_cnmp("+CNMP: ", &rat) == false);
+    TEST_ASSERT(bsp_modem_parse_cnmp("+CNBP: 0x1,0x2", &rat) == false);
+    TEST_ASSERT_EQUAL(BSP_MODEM_RAT_GSM, rat);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_cnbp_masks(void) {
+    uint64_t gw_bands = 0;
+    uint64_t lte_bands = 0;
+    // SIM7600E-H default, the third field is the TDS mask of newer firmware
+    TEST_ASSERT(bsp_modem_parse_cnbp("+CNBP: 0x0002000004400380,0x000007FF3FDF3FFF,0x000000000000003F\r\n",
+                                     &gw_bands,
+                                     &lte_bands));
+    TEST_ASSERT(gw_bands == 0x0002000004400380ULL);
+    TEST_ASSERT(lte_bands == 0x000007FF3FDF3FFFULL);
+
+    // Older firmware, two fields and a band 3 lock
+    TEST_ASSERT(bsp_modem_parse_cnbp("+CNBP: 0x0000000000000380,0x0000000000000004", &gw_bands, &lte_bands));
+    TEST_ASSERT(gw_bands == 0x380ULL);
+    TEST_ASSERT(lte_bands == (1ULL << (3 - 1)));
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_cnbp_rejects_truncated_lines(void) {
+    uint64_t gw_bands = 0;
+    uint64_t lte_bands = 0;
+    TEST_ASSERT(bsp_modem_parse_cnbp("+CNBP: 0x0002000004400380", &gw_bands, &lte_bands) == false);
+    TEST_ASSERT(bsp_modem_parse_cnbp("+CNBP: 0x0002000004400380,", &gw_bands, &lte_bands) == false);
+    TEST_ASSERT(bsp_modem_parse_cnbp("+CME ERROR: 4", &gw_bands, &lte_bands) == false);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_cpsi_lte(void) {
+    bsp_modem_telemetry_t telemetry;
+    memset(&telemetry, 0, sizeof(telemetry));
+    TEST_ASSERT(bsp_modem_parse_cpsi(
+        "+CPSI: LTE,Online,250-01,0x1A2B,12345678,301,EUTRAN-BAND3,1300,5,5,-95,-1100,-780,12", &telemetry));
+    TEST_ASSERT(strcmp(telemetry.rat, "LTE") == 0);
+    TEST_ASSERT(strcmp(telemetry.operator_code, "250-01") == 0);
+    TEST_ASSERT(strcmp(telemetry.cell_id, "12345678") == 0);
+    TEST_ASSERT(strcmp(telemetry.band, "EUTRAN-BAND3") == 0);
+    TEST_ASSERT_EQUAL(-95, telemetry.rsrq_db_x10);
+    TEST_ASSERT_EQUAL(-1100, telemetry.rsrp_dbm_x10);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_cpsi_wcdma_and_no_service(void) {
+    bsp_modem_telemetry_t telemetry;
+    memset(&telemetry, 0, sizeof(telemetry));
+    TEST_ASSERT(bsp_modem_parse_cpsi("+CPSI: WCDMA,Online,250-02,0x0F1E,32109,WCDMA IMT 2000,10737,0,-95,-7,33,-8",
+                                     &telemetry));
+    TEST_ASSERT(strcmp(telemetry.rat, "WCDMA") == 0);
+    TEST_ASSERT(strcmp(telemetry.band, "WCDMA IMT 2000") == 0);
+    // RSRP is LTE only, the CSQ scale stands in for WCDMA
+    TEST_ASSERT_EQUAL(0, telemetry.rsrp_dbm_x10);
+
+    TEST_ASSERT(bsp_modem_parse_cpsi("+CPSI: NO SERVICE,Online", &telemetry) == false);
+    TEST_ASSERT_EQUAL(0, telemetry.cell_id[0]);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_cpmutemp(void) {
+    int celsius = 0;
+    TEST_ASSERT(bsp_modem_parse_cpmutemp("+CPMUTEMP: 35", &celsius));
+    TEST_ASSERT_EQUAL(35, celsius);
+    TEST_ASSERT(bsp_modem_parse_cpmutemp("+CPMUTEMP: -4", &celsius));
+    TEST_ASSERT_EQUAL(-4, celsius);
+    TEST_ASSERT(bsp_modem_parse_cpmutemp("", &celsius) == false);
+}
+
+/* -------------------------------------------------------------------------- */
+
+int main(void) {
+    RUN_TEST(test_cnmp_modes);
+    RUN_TEST(test_cnmp_rejects_other_lines);
+    RUN_TEST(test_cnbp_masks);
+    RUN_TEST(test_cnbp_rejects_truncated_lines);
+    RUN_TEST(test_cpsi_lte);
+    RUN_TEST(test_cpsi_wcdma_and_no_service);
+    RUN_TEST(test_cpmutemp);
+    return 0;
+}
@@ -0,0 +1,413 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "app_napt.h"
+#include "host_stubs.h"
+#include "host_test.h"
+#include "lwip/netif.h"
+#include "lwip/prot/icmp.h"
+#include "lwip/prot/ip.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/tcp.h"
+#include "sdkconfig.h"
+
+/* -------------------------------------------------------------------------- */
+
+#define PACKET_MAX (128)
+
+typedef struct {
+    uint8_t proto;
+    ip4_addr_t src;
+    uint16_t src_port;
+    ip4_addr_t dest;
+    uint16_t dest_port;
+    uint8_t tcp_flags;
+    bool has_udp_checksum;
+} _flow_t;
+
+static struct netif _ap;
+static struct netif _ppp;
+
+/* -------------------------------------------------------------------------- */
+
+static uint32_t _sum(const uint8_t *data, size_t len, uint32_t sum) {
+    for (size_t i = 0; i + 1 < len; i += 2) {
+        sum += (uint32_t)((data[i] << 8) | data[i + 1]);
+    }
+    if ((len & 1) != 0) {
+        sum += (uint32_t)(data[len - 1] << 8);
+    }
+    return sum;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint16_t _fold(uint32_t sum) {
+    while ((sum >> 16) != 0) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Checksum of the transport header and payload including the pseudo header, 0 when it verifies */
+static uint16_t _l4_verify(const uint8_t *ip) {
+    uint16_t len = (uint16_t)((ip[2] << 8) | ip[3]) - IP_HLEN;
+    uint8_t proto = ip[9];
+    uint32_t sum = _sum(&ip[IP_HLEN], len, 0);
+    if (proto != IP_PROTO_ICMP) {
+        sum = _sum(&ip[12], 8, sum);
+        sum += proto + len;
+    }
+    return _fold(sum);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _write_checksum(uint8_t *field, uint16_t value) {
+    field[0] = (uint8_t)(value >> 8);
+    field[1] = (uint8_t)value;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static uint16_t _read16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* A packet of the flow with valid checksums, ICMP uses src_port as echo identifier */
+static struct pbuf *_packet(const _flow_t *flow) {
+    uint16_t l4_len = (flow->proto == IP_PROTO_TCP) ? TCP_HLEN : 8;
+    uint16_t len = IP_HLEN + l4_len + 12;
+    uint8_t data[PACKET_MAX] = { 0 };
+    data[0] = 0x45;
+    data[2] = (uint8_t)(len >> 8);
+    data[3] = (uint8_t)len;
+    data[8] = 64;
+    data[9] = flow->proto;
+    memcpy(&data[12], &flow->src.addr, 4);
+    memcpy(&data[16], &flow->dest.addr, 4);
+    for (int i = IP_HLEN + l4_len; i < len; i++) {
+        data[i] = (uint8_t)(i * 7);
+    }
+
+    uint8_t *l4 = &data[IP_HLEN];
+    if (flow->proto == IP_PROTO_ICMP) {
+        l4[0] = ICMP_ECHO;
+        l4[4] = (uint8_t)(flow->src_port >> 8);
+        l4[5] = (uint8_t)flow->src_port;
+        l4[7] = 1;
+        _write_checksum(&l4[2], _l4_verify(data));
+    } else {
+        l4[0] = (uint8_t)(flow->src_port >> 8);
+        l4[1] = (uint8_t)flow->src_port;
+        l4[2] = (uint8_t)(flow->dest_port >> 8);
+        l4[3] = (uint8_t)flow->dest_port;
+        if (flow->proto == IP_PROTO_TCP) {
+            l4[12] = (TCP_HLEN / 4) << 4;
+            l4[13] = flow->tcp_flags;
+            _write_checksum(&l4[16], _l4_verify(data));
+        } else {
+            l4[5] = (uint8_t)(8 + 12);
+            if (flow->has_udp_checksum) {
+                _write_checksum(&l4[6], _l4_verify(data));
+            }
+        }
+    }
+    _write_checksum(&data[10], _fold(_sum(data, IP_HLEN, 0)));
+    return host_pbuf_new(data, len);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* The reply of the remote end to the translated packet */
+static _flow_t _reply(const _flow_t *flow, const struct pbuf *translated, uint8_t tcp_flags) {
+    const uint8_t *ip = translated->payload;
+    _flow_t reply = *flow;
+    memcpy(&reply.src.addr, &ip[16], 4);
+    memcpy(&reply.dest.addr, &ip[12], 4);
+    reply.tcp_flags = tcp_flags;
+    if (flow->proto == IP_PROTO_ICMP) {
+        reply.src_port = _read16(&ip[IP_HLEN + 4]);
+    } else {
+        reply.src_port = _read16(&ip[IP_HLEN + 2]);
+        reply.dest_port = _read16(&ip[IP_HLEN]);
+    }
+    return reply;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _assert_checksums(const struct pbuf *p) {
+    const uint8_t *ip = p->payload;
+    TEST_ASSERT_EQUAL(0, _fold(_sum(ip, IP_HLEN, 0)));
+    if ((ip[9] != IP_PROTO_UDP) || (_read16(&ip[IP_HLEN + 6]) != 0)) {
+        TEST_ASSERT_EQUAL(0, _l4_verify(ip));
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Outbound translation, returns the translated packet */
+static struct pbuf *_out(const _flow_t *flow) {
+    struct pbuf *p = _packet(flow);
+    TEST_ASSERT_EQUAL(0, app_napt_outbound(p));
+    _assert_checksums(p);
+    return p;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void _setup(void) {
+    host_reset();
+    memset(&_ap, 0, sizeof(_ap));
+    IP4_ADDR(&_ap.ip_addr, 192, 168, 4, 1);
+    IP4_ADDR(&_ap.netmask, 255, 255, 255, 0);
+    memset(&_ppp, 0, sizeof(_ppp));
+    IP4_ADDR(&_ppp.ip_addr, 10, 64, 0, 2);
+    IP4_ADDR(&_ppp.netmask, 255, 255, 255, 255);
+    app_napt_init(&_ap);
+    app_napt_set_uplink(&_ppp);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static _flow_t _tcp(uint8_t station, uint16_t port) {
+    _flow_t flow = { .proto = IP_PROTO_TCP, .src_port = port, .dest_port = 443, .tcp_flags = TCP_SYN };
+    IP4_ADDR(&flow.src, 192, 168, 4, station);
+    IP4_ADDR(&flow.dest, 93, 184, 216, 34);
+    return flow;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static _flow_t _udp(uint8_t station, uint16_t port) {
+    _flow_t flow = { .proto = IP_PROTO_UDP, .src_port = port, .dest_port = 53, .has_udp_checksum = true };
+    IP4_ADDR(&flow.src, 192, 168, 4, station);
+    IP4_ADDR(&flow.dest, 8, 8, 8, 8);
+    return flow;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_tcp_round_trip(void) {
+    _setup();
+    _flow_t flow = _tcp(2, 40000);
+    struct pbuf *out = _out(&flow);
+    const uint8_t *ip = out->payload;
+    TEST_ASSERT(memcmp(&ip[12], &_ppp.ip_addr.addr, 4) == 0);
+    // A free port in the NAPT range is kept as it is
+    TEST_ASSERT_EQUAL(40000, _read16(&ip[IP_HLEN]));
+    TEST_ASSERT_EQUAL(1, app_napt_count_for(flow.src.addr));
+
+    _flow_t reply = _reply(&flow, out, TCP_SYN | TCP_ACK);
+    struct pbuf *in = _packet(&reply);
+    TEST_ASSERT_EQUAL(0, app_napt_inbound(in));
+    _assert_checksums(in);
+    ip = in->payload;
+    TEST_ASSERT(memcmp(&ip[16], &flow.src.addr, 4) == 0);
+    TEST_ASSERT_EQUAL(40000, _read16(&ip[IP_HLEN + 2]));
+    pbuf_free(in);
+    pbuf_free(out);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_other_remote_is_not_translated(void) {
+    _setup();
+    _flow_t flow = _tcp(2, 40001);
+    struct pbuf *out = _out(&flow);
+    _flow_t reply = _reply(&flow, out, TCP_ACK);
+    IP4_ADDR(&reply.src, 93, 184, 216, 35);
+    struct pbuf *in = _packet(&reply);
+    TEST_ASSERT_EQUAL(0, app_napt_inbound(in));
+    TEST_ASSERT(memcmp((uint8_t *)in->payload + 16, &_ppp.ip_addr.addr, 4) == 0);
+    pbuf_free(in);
+    pbuf_free(out);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_port_collision_gets_other_port(void) {
+    _setup();
+    _flow_t first = _tcp(2, 40002);
+    _flow_t second = _tcp(3, 40002);
+    struct pbuf *a = _out(&first);
+    struct pbuf *b = _out(&second);
+    uint16_t port_a = _read16((uint8_t *)a->payload + IP_HLEN);
+    uint16_t port_b = _read16((uint8_t *)b->payload + IP_HLEN);
+    TEST_ASSERT_EQUAL(40002, port_a);
+    TEST_ASSERT(port_b != port_a);
+
+    // Each reply finds its own station
+    _flow_t reply = _reply(&second, b, TCP_ACK);
+    struct pbuf *in = _packet(&reply);
+    app_napt_inbound(in);
+    TEST_ASSERT(memcmp((uint8_t *)in->payload + 16, &second.src.addr, 4) == 0);
+    TEST_ASSERT_EQUAL(40002, _read16((uint8_t *)in->payload + IP_HLEN + 2));
+    pbuf_free(in);
+    pbuf_free(a);
+    pbuf_free(b);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_udp_without_checksum_stays_without(void) {
+    _setup();
+    _flow_t flow = _udp(2, 50000);
+    flow.has_udp_checksum = false;
+    struct pbuf *out = _out(&flow);
+    TEST_ASSERT_EQUAL(0, _read16((uint8_t *)out->payload + IP_HLEN + 6));
+    pbuf_free(out);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_icmp_echo_identifier(void) {
+    _setup();
+    _flow_t flow = { .proto = IP_PROTO_ICMP, .src_port = 20000 };
+    IP4_ADDR(&flow.src, 192, 168, 4, 2);
+    IP4_ADDR(&flow.dest, 1, 1, 1, 1);
+    struct pbuf *out = _out(&flow);
+
+    _flow_t reply_flow = _reply(&flow, out, 0);
+    struct pbuf *in = _packet(&reply_flow);
+    uint8_t *icmp = (uint8_t *)in->payload + IP_HLEN;
+    icmp[0] = ICMP_ER;
+    icmp[2] = 0;
+    icmp[3] = 0;
+    _write_checksum(&icmp[2], _l4_verify(in->payload));
+    TEST_ASSERT_EQUAL(0, app_napt_inbound(in));
+    _assert_checksums(in);
+    TEST_ASSERT(memcmp((uint8_t *)in->payload + 16, &flow.src.addr, 4) == 0);
+    TEST_ASSERT_EQUAL(20000, _read16(&icmp[4]));
+    pbuf_free(in);
+    pbuf_free(out);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_count_per_station(void) {
+    _setup();
+    for (uint16_t i = 0; i < 3; i++) {
+        _flow_t flow = _tcp(2, 41000 + i);
+        pbuf_free(_out(&flow));
+    }
+    for (uint16_t i = 0; i < 2; i++) {
+        _flow_t flow = _udp(3, 41000 + i);
+        pbuf_free(_out(&flow));
+    }
+    ip4_addr_t station;
+    IP4_ADDR(&station, 192, 168, 4, 2);
+    TEST_ASSERT_EQUAL(3, app_napt_count_for(station.addr));
+    IP4_ADDR(&station, 192, 168, 4, 3);
+    TEST_ASSERT_EQUAL(2, app_napt_count_for(station.addr));
+    IP4_ADDR(&station, 192, 168, 4, 4);
+    TEST_ASSERT_EQUAL(0, app_napt_count_for(station.addr));
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_idle_udp_expires(void) {
+    _setup();
+    _flow_t flow = _udp(5, 42000);
+    pbuf_free(_out(&flow));
+    TEST_ASSERT_EQUAL(1, app_napt_count_for(flow.src.addr));
+
+    app_napt_stats_t before;
+    app_napt_get_stats(&before);
+    // The sweep visits the whole table within a few seconds
+    host_advance_us((CONFIG_AIR_GATEWAY_NAPT_UDP_TIMEOUT_S + 5) * 1000000ULL);
+    app_napt_stats_t after;
+    app_napt_get_stats(&after);
+    TEST_ASSERT_EQUAL(0, app_napt_count_for(flow.src.addr));
+    TEST_ASSERT_EQUAL(0, after.entries);
+    TEST_ASSERT_EQUAL(before.expired + 1, after.expired);
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_full_table_evicts_least_recent(void) {
+    _setup();
+    _flow_t oldest = _udp(6, 10000);
+    pbuf_free(_out(&oldest));
+    for (uint16_t i = 1; i < CONFIG_AIR_GATEWAY_NAPT_ENTRIES; i++) {
+        _flow_t flow = _udp(7, 10000 + i);
+        pbuf_free(_out(&flow));
+    }
+    app_napt_stats_t stats;
+    app_napt_get_stats(&stats);
+    TEST_ASSERT_EQUAL(CONFIG_AIR_GATEWAY_NAPT_ENTRIES, stats.entries);
+    uint32_t evicted = stats.evicted;
+
+    _flow_t newest = _udp(7, 20000);
+    pbuf_free(_out(&newest));
+    app_napt_get_stats(&stats);
+    TEST_ASSERT_EQUAL(evicted + 1, stats.evicted);
+    TEST_ASSERT_EQUAL(CONFIG_AIR_GATEWAY_NAPT_ENTRIES, stats.entries);
+    TEST_ASSERT_EQUAL(0, app_napt_count_for(oldest.src.addr));
+}
+
+/* -------------------------------------------------------------------------- */
+
+/* Returns whether a reply to the flow's translated packet makes it back to the station */
+static bool _is_answered(const _flow_t *flow, const struct pbuf *out, const ip4_addr_t *public_ip) {
+    _flow_t reply = _reply(flow, out, TCP_ACK);
+    reply.dest = *public_ip;
+    struct pbuf *in = _packet(&reply);
+    app_napt_inbound(in);
+    bool is_answered = memcmp((uint8_t *)in->payload + 16, &flow->src.addr, 4) == 0;
+    pbuf_free(in);
+    return is_answered;
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_redial_keeps_flows(void) {
+    _setup();
+    _flow_t tcp = _tcp(8, 43000);
+    _flow_t udp = _udp(8, 43001);
+    struct pbuf *tcp_out = _out(&tcp);
+    struct pbuf *udp_out = _out(&udp);
+
+    // Same public address after the redial, nothing changes for the remote ends
+    app_napt_set_uplink(NULL);
+    app_napt_set_uplink(&_ppp);
+    TEST_ASSERT(_is_answered(&tcp, tcp_out, &_ppp.ip_addr));
+    TEST_ASSERT(_is_answered(&udp, udp_out, &_ppp.ip_addr));
+    TEST_ASSERT_EQUAL(2, app_napt_count_for(tcp.src.addr));
+
+    // A new address ends the TCP connections, UDP keeps its port and goes on from the new address
+    app_napt_set_uplink(NULL);
+    IP4_ADDR(&_ppp.ip_addr, 10, 64, 0, 3);
+    app_napt_set_uplink(&_ppp);
+    TEST_ASSERT_EQUAL(1, app_napt_count_for(tcp.src.addr));
+    TEST_ASSERT(_is_answered(&tcp, tcp_out, &_ppp.ip_addr) == false);
+    TEST_ASSERT(_is_answered(&udp, udp_out, &_ppp.ip_addr));
+
+    struct pbuf *again = _out(&udp);
+    TEST_ASSERT(memcmp((uint8_t *)again->payload + 12, &_ppp.ip_addr.addr, 4) == 0);
+    TEST_ASSERT_EQUAL(_read16((uint8_t *)udp_out->payload + IP_HLEN), _read16((uint8_t *)again->payload + IP_HLEN));
+    pbuf_free(again);
+    pbuf_free(tcp_out);
+    pbuf_free(udp_out);
+    IP4_ADDR(&_ppp.ip_addr, 10, 64, 0, 2);
+}
+
+/* -------------------------------------------------------------------------- */
+
+int main(void) {
+    RUN_TEST(test_tcp_round_trip);
+    RUN_TEST(test_other_remote_is_not_translated);
+    RUN_TEST(test_port_collision_gets_other_port);
+    RUN_TEST(test_udp_without_checksum_stays_without);
+    RUN_TEST(test_icmp_echo_identifier);
+    RUN_TEST(test_count_per_station);
+    RUN_TEST(test_idle_udp_expires);
+    RUN_TEST(test_full_table_evicts_least_recent);
+    RUN_TEST(test_redial_keeps_flows);
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "app_rat_plan.h"
+#include "host_test.h"
+
+/* Trial rounds as app_rat.c runs them, one sample per RAT/band lock in candidate order: auto, lte, then single
+ * bands */
+
+/* -------------------------------------------------------------------------- */
+
+#define PLAN_HYSTERESIS_PERCENT (20)
+#define PLAN_AUTO               (0)
+#define PLAN_LTE                (1)
+#define PLAN_B3                 (2)
+#define PLAN_B20                (3)
+
+/* -------------------------------------------------------------------------- */
+
+static void test_faster_lock_wins(void) {
+    const app_rat_plan_sample_t samples[] = {
+        [PLAN_AUTO] = { true, 4200, 18, -1050 },
+        [PLAN_LTE] = { true, 4300, 18, -1050 },
+        [PLAN_B3] = { true, 9800, 20, -980 },
+        [PLAN_B20] = { true, 2100, 25, -870 },
+    };
+    TEST_ASSERT_EQUAL(PLAN_B3, app_rat_plan_pick(samples, 4, PLAN_AUTO, PLAN_HYSTERESIS_PERCENT));
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_small_gain_keeps_the_incumbent(void) {
+    const app_rat_plan_sample_t samples[] = {
+        [PLAN_AUTO] = { true, 5000, 18, -1000 },
+        [PLAN_LTE] = { true, 5900, 18, -1000 },
+        [PLAN_B3] = { true, 4000, 20, -980 },
+        [PLAN_B20] = { false, 0, 99, 0 },
+    };
+    TEST_ASSERT_EQUAL(PLAN_AUTO, app_rat_plan_pick(samples, 4, PLAN_AUTO, PLAN_HYSTERESIS_PERCENT));
+    // The same lock is worth the switch from a slower incumbent
+    TEST_ASSERT_EQUAL(PLAN_LTE, app_rat_plan_pick(samples, 4, PLAN_B3, PLAN_HYSTERESIS_PERCENT));
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_tie_goes_to_the_stronger_signal(void) {
+    const app_rat_plan_sample_t samples[] = {
+        [PLAN_AUTO] = { false, 0, 99, 0 },
+        [PLAN_LTE] = { true, 3000, 10, 0 },
+        [PLAN_B3] = { true, 3000, 15, -1150 },
+        [PLAN_B20] = { true, 3000, 15, -900 },
+    };
+    // CSQ 10 is -93 dBm, below the RSRP of band 20, and no incumbent yet
+    TEST_ASSERT_EQUAL(PLAN_B20, app_rat_plan_pick(samples, 4, 4, PLAN_HYSTERESIS_PERCENT));
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_unmeasured_incumbent_is_replaced(void) {
+    const app_rat_plan_sample_t samples[] = {
+        [PLAN_AUTO] = { false, 0, 99, 0 },
+        [PLAN_LTE] = { true, 800, 10, -1180 },
+        [PLAN_B3] = { false, 0, 99, 0 },
+        [PLAN_B20] = { false, 0, 99, 0 },
+    };
+    TEST_ASSERT_EQUAL(PLAN_LTE, app_rat_plan_pick(samples, 4, PLAN_AUTO, PLAN_HYSTERESIS_PERCENT));
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_nothing_measured_keeps_the_incumbent(void) {
+    const app_rat_plan_sample_t samples[4] = { 0 };
+    TEST_ASSERT_EQUAL(PLAN_B3, app_rat_plan_pick(samples, 4, PLAN_B3, PLAN_HYSTERESIS_PERCENT));
+}
+
+/* -------------------------------------------------------------------------- */
+
+static void test_cell_hash(void) {
+    uint32_t hash = app_rat_plan_cell_hash("250-01", "12345678");
+    TEST_ASSERT_EQUAL(hash, app_rat_plan_cell_hash("250-01", "12345678"));
+    // The separator keeps the operator and cell id from running into each other
+    TEST_ASSERT(hash != app_rat_plan_cell_hash("250-011", "2345678"));
+    TEST_ASSERT(hash != app_rat_plan_cell_hash("250-02", "12345678"));
+    // FNV-1a of the separator alone, the keys stored on devices depend on it staying the same
+    TEST_ASSERT(app_rat_plan_cell_hash("", "") == 0x2A0C975EUL);
+}
+
+/* -------------------------------------------------------------------------- */
+
+int main(void) {
+    RUN_TEST(test_faster_lock_wins);
+    RUN_TEST(test_small_gain_keeps_the_incumbent);
+    RUN_TEST(test_tie_goes_to_the_stronger_signal);
+    RUN_TEST(test_unmeasured_incumbent_is_replaced);
+    RUN_TEST(test_nothing_measured_keeps_the_incumbent);
+    RUN_TEST(test_cell_hash);
+    return 0;
+}
@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+"""Forwarding benchmark to compare the task affinity profiles.
+
+Run from a host joined to the gateway SoftAP, once per profile (menuconfig or the "affinity" NVS string):
+
+    affinity_bench.py run --iperf-server <host on the internet> --ping <host> --results bench.jsonl
+    affinity_bench.py report bench.jsonl
+
+Each run measures iperf3 TCP throughput in both directions while pinging through the gateway, and reads the
+profile name and per-task CPU time from the /metrics endpoint before and after the load.
+"""
+
+import argparse
+import json
+import re
+import subprocess
+import sys
+import threading
+import time
+import urllib.request
+
+METRIC_LINE = re.compile(r'^(\w+)(?:\{(.*)\})? ([0-9.eE+-]+)$')
+LABEL = re.compile(r'(\w+)="([^"]*)"')
+
+
+def scrape(url):
+    with urllib.request.urlopen(url, timeout=10) as response:
+        text = response.read().decode()
+    profile = None
+    tasks = {}
+    for line in text.splitlines():
+        match = METRIC_LINE.match(line)
+        if match is None:
+            continue
+        name, labels, value = match.groups()
+        labels = dict(LABEL.findall(labels or ""))
+        if name == "air_gateway_affinity_profile":
+            profile = labels.get("name")
+        elif name == "air_gateway_task_cpu_seconds_total":
+            tasks[labels.get("task")] = float(value)
+    return profile, tasks
+
+
+def iperf(server, seconds, reverse):
+    command = ["iperf3", "-c", server, "-t", str(seconds), "-J"]
+    if reverse:
+        command.append("-R")
+    result = subprocess.run(command, capture_output=True, text=True, check=True)
+    summary = json.loads(result.stdout)["end"]["sum_received"]
+    return summary["bits_per_second"] / 1e6
+
+
+def ping(target, seconds, interval, out):
+    count = max(1, int(seconds / interval))
+    result = subprocess.run(["ping", "-i", str(interval), "-c", str(count), target], capture_output=True, text=True)
+    out.extend(float(ms) for ms in re.findall(r"time=([0-9.]+)", result.stdout))
+
+
+def percentile(samples, fraction):
+    if not samples:
+        return None
+    ordered = sorted(samples)
+    return ordered[min(len(ordered) - 1, int(len(ordered) * fraction))]
+
+
+def run(args):
+    profile, tasks_before = scrape(args.metrics)
+    started = time.monotonic()
+
+    latencies = []
+    pinger = threading.Thread(target=ping, args=(args.ping, 2 * args.seconds, args.ping_interval, latencies))
+    pinger.start()
+    up_mbps = iperf(args.iperf_server, args.seconds, reverse=False)
+    down_mbps = iperf(args.iperf_server, args.seconds, reverse=True)
+    pinger.join()
+
+    elapsed = time.monotonic() - started
+    _, tasks_after = scrape(args.metrics)
+    cpu = {
+        task: round(100.0 * (seconds - tasks_before.get(task, 0.0)) / elapsed, 1)
+        for task, seconds in tasks_after.items()
+    }
+    busiest = dict(sorted(cpu.items(), key=lambda item: -item[1])[: args.top_tasks])
+
+    result = {
+        "profile": args.label or profile or "unknown",
+        "up_mbps": round(up_mbps, 2),
+        "down_mbps": round(down_mbps, 2),
+        "rtt_p50_ms": percentile(latencies, 0.50),
+        "rtt_p99_ms": percentile(latencies, 0.99),
+        "rtt_samples": len(latencies),
+        "cpu_percent": busiest,
+    }
+    print(json.dumps(result, indent=2))
+    with open(args.results, "a") as results:
+        results.write(json.dumps(result) + "\n")
+
+
+def report(args):
+    runs = {}
+    with open(args.results) as results:
+        for line in results:
+            if line.strip():
+                entry = json.loads(line)
+                runs.setdefault(entry["profile"], []).append(entry)
+
+    def mean(entries, key):
+        values = [entry[key] for entry in entries if entry.get(key) is not None]
+        return sum(values) / len(values) if values else float("nan")
+
+    rows = []
+    for profile, entries in runs.items():
+        rows.append((profile, len(entries), mean(entries, "up_mbps"), mean(entries, "down_mbps"),
+                     mean(entries, "rtt_p50_ms"), mean(entries, "rtt_p99_ms")))
+    # Best total throughput first, tail latency breaks ties
+    rows.sort(key=lambda row: (-(row[2] + row[3]), row[5]))
+
+    print(f"{'profile':<12} {'runs':>4} {'up Mbit/s':>10} {'down Mbit/s':>12} {'p50 ms':>8} {'p99 ms':>8}")
+    for profile, count, up, down, p50, p99 in rows:
+        print(f"{profile:<12} {count:>4} {up:>10.2f} {down:>12.2f} {p50:>8.1f} {p99:>8.1f}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    run_parser = commands.add_parser("run", help="benchmark the profile the gateway currently runs")
+    run_parser.add_argument("--iperf-server", required=True)
+    run_parser.add_argument("--ping", required=True, help="host pinged through the gateway while under load")
+    run_parser.add_argument("--metrics", default="http://192.168.4.1/metrics")
+    run_parser.add_argument("--seconds", type=int, default=30, help="duration of each iperf3 direction")
+    run_parser.add_argument("--ping-interval", type=float, default=0.2)
+    run_parser.add_argument("--label", help="profile name, read from /metrics by default")
+    run_parser.add_argument("--top-tasks", type=int, default=8)
+    run_parser.add_argument("--results", default="affinity_bench.jsonl")
+
+    report_parser = commands.add_parser("report", help="compare the recorded runs per profile")
+    report_parser.add_argument("results")
+
+    args = parser.parse_args()
+    try:
+        if args.command == "run":
+            run(args)
+        else:
+            report(args)
+    except (OSError, subprocess.CalledProcessError) as err:
+        sys.exit(f"Benchmark failed: {err}")
+
+
+if __name__ == "__main__":
+    main()
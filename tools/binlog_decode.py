@@ -0,0 +1,181 @@
+#!/usr/bin/env python3
+"""Turns the gateway's binary event log back into text.
+
+Records only hold the addresses of the tag and the format string plus the raw 32-bit arguments, the strings are
+looked up in the ELF of the firmware that wrote them. Read the partition and decode it:
+
+    parttool.py --port /dev/ttyUSB0 read_partition --partition-name binlog --output binlog.bin
+    binlog_decode.py build/air_gateway.elf binlog.bin
+    binlog_decode.py build/air_gateway.elf binlog.bin --boots 2
+
+Each line is prefixed with the boot number, boots are counted up by the firmware across resets. Records that
+a panic or watchdog reset left in RAM are written on the next boot under the number of the boot that crashed.
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+SECTOR_SIZE = 4096
+SECTOR_MAGIC = 0x474F4C42
+FORMAT_VER = 1
+SECTOR_HEADER = struct.Struct("<IIIHH")
+# check, level, info, ms, tag, format, 8 arguments, as _record_t in bsp_binlog.c
+RECORD = struct.Struct("<HBBIII8I")
+ARGS_MAX = 8
+
+# Same numbering as bsp_binlog_level_e
+LEVELS = {1: "E", 2: "W", 3: "I"}
+
+SHF_ALLOC = 0x2
+SHT_NOBITS = 8
+
+CONVERSION = re.compile(r"%([-+ #0]*)(\d+|\*)?(?:\.(\d+))?(hh|h|ll|l|j|z|t|L)?([diouxXcspfeEgG%])")
+
+
+class Elf:
+    """Just enough of an ELF reader to resolve addresses of constant strings. The firmware is ELF32, the host test of
+    the decoder runs the writer in a non-PIE ELF64 whose strings sit below 4 GiB."""
+
+    def __init__(self, path):
+        with open(path, "rb") as elf:
+            self.data = elf.read()
+        if self.data[:4] != b"\x7fELF" or self.data[4] not in (1, 2):
+            raise ValueError(f"{path} is not an ELF file")
+        if self.data[4] == 1:
+            shoff, = struct.unpack_from("<I", self.data, 0x20)
+            shentsize, shnum = struct.unpack_from("<HH", self.data, 0x2E)
+            section = "<IIIIII"
+        else:
+            shoff, = struct.unpack_from("<Q", self.data, 0x28)
+            shentsize, shnum = struct.unpack_from("<HH", self.data, 0x3A)
+            section = "<IIQQQQ"
+        self.sections = []
+        for i in range(shnum):
+            _, kind, flags, addr, offset, size = struct.unpack_from(section, self.data, shoff + i * shentsize)
+            if flags & SHF_ALLOC and kind != SHT_NOBITS and size:
+                self.sections.append((addr, offset, size))
+
+    def string(self, address):
+        for addr, offset, size in self.sections:
+            if addr <= address < addr + size:
+                start = offset + address - addr
+                end = self.data.find(b"\0", start, offset + size)
+                if end < 0:
+                    return None
+                return self.data[start:end].decode("utf-8", "replace")
+        return None
+
+
+def fletcher16(data):
+    a = b = 0
+    for byte in data:
+        a = (a + byte) % 255
+        b = (b + a) % 255
+    return (b << 8) | a
+
+
+def render(elf, format_string, args):
+    """printf for 32-bit integer arguments, %s arguments are resolved through the ELF."""
+    pending = list(args)
+
+    def convert(match):
+        flags, width, precision, _, conversion = match.groups()
+        if conversion == "%":
+            return "%"
+        if width == "*":
+            width = str(pending.pop(0)) if pending else ""
+        if not pending:
+            return "<missing>"
+        value = pending.pop(0)
+        spec = "%" + flags + (width or "") + ("." + precision if precision else "")
+        if conversion in "di":
+            return (spec + "d") % (value - (1 << 32) if value & 0x80000000 else value)
+        if conversion in "uoxX":
+            return (spec + ("d" if conversion == "u" else conversion)) % value
+        if conversion == "c":
+            return (spec + "c") % (value & 0xFF)
+        if conversion == "p":
+            return f"0x{value:08x}"
+        if conversion == "s":
+            text = elf.string(value)
+            return (spec + "s") % (text if text is not None else f"<0x{value:08x}>")
+        return f"<float 0x{value:08x}>"
+
+    return CONVERSION.sub(convert, format_string)
+
+
+def sectors(dump):
+    found = []
+    for offset in range(0, len(dump) - SECTOR_SIZE + 1, SECTOR_SIZE):
+        magic, sequence, boot, version, record_size = SECTOR_HEADER.unpack_from(dump, offset)
+        if magic != SECTOR_MAGIC:
+            continue
+        if version != FORMAT_VER or record_size != RECORD.size:
+            print(f"Skipping sector at 0x{offset:x}, format {version} with {record_size} byte records",
+                  file=sys.stderr)
+            continue
+        found.append((sequence, boot, offset))
+    # Oldest first, the firmware writes the sectors strictly in turn
+    return sorted(found)
+
+
+def records(dump, offset, stats):
+    position = offset + SECTOR_HEADER.size
+    while position + RECORD.size <= offset + SECTOR_SIZE:
+        raw = dump[position:position + RECORD.size]
+        position += RECORD.size
+        if raw == b"\xff" * RECORD.size:
+            # Erased, the sector ends here
+            return
+        fields = RECORD.unpack(raw)
+        if fields[0] != fletcher16(raw[2:]):
+            stats["corrupt"] += 1
+            continue
+        yield fields
+
+
+def decode(args):
+    elf = Elf(args.elf)
+    with open(args.dump, "rb") as dump_file:
+        dump = dump_file.read()
+
+    stats = {"corrupt": 0}
+    boots = {}
+    for _, boot, offset in sectors(dump):
+        boots.setdefault(boot, []).extend(records(dump, offset, stats))
+
+    selected = sorted(boots)[-args.boots:] if args.boots else sorted(boots)
+    for boot in selected:
+        # The two per-core rings are flushed one after the other, time restores the order
+        for _, level, info, ms, tag, format_address, *words in sorted(boots[boot], key=lambda record: record[3]):
+            count = min(info & 0x0F, ARGS_MAX)
+            format_string = elf.string(format_address)
+            if format_string is None:
+                text = f"<format 0x{format_address:08x}> " + " ".join(f"0x{word:08x}" for word in words[:count])
+            else:
+                text = render(elf, format_string, words[:count])
+            tag_string = elf.string(tag) or f"0x{tag:08x}"
+            core = info >> 4
+            print(f"[{boot}] {LEVELS.get(level, '?')} ({ms}) c{core} {tag_string}: {text}")
+
+    if stats["corrupt"]:
+        print(f"{stats['corrupt']} records failed their check, likely cut short by a brown-out", file=sys.stderr)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("elf", help="ELF of the firmware that wrote the log")
+    parser.add_argument("dump", help="binlog partition read with parttool.py")
+    parser.add_argument("--boots", type=int, default=0, help="only the last N boots")
+
+    args = parser.parse_args()
+    try:
+        decode(args)
+    except (OSError, ValueError, struct.error) as err:
+        sys.exit(f"Decoding failed: {err}")
+
+
+if __name__ == "__main__":
+    main()
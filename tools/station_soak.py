@@ -0,0 +1,204 @@
+#!/usr/bin/env python3
+"""Soak test that ramps emulated stations against the gateway to find its supported ceiling.
+
+Needs root on Linux, iw, wpa_supplicant, curl and a Wi-Fi adapter that allows several managed interfaces at once
+("iw list", valid interface combinations). Every emulated station is a virtual interface with its own MAC and a
+static address at the top of the SoftAP subnet, outside the DHCP pool:
+
+    station_soak.py --phy-dev wlan0 --ssid air-gateway --password air1234567890 --max-stations 15
+    station_soak.py --phy-dev wlan0 --ssid air-gateway --open --results soak.jsonl
+
+After each station joins, all stations ping the gateway and fetch --url over the uplink for --step-seconds, and
+/metrics is scraped for heap, NAPT and admission counters. The ramp stops at the first step where a station is
+refused or evicted, loses more than --max-loss of its pings or fails its fetches, and the last good step is
+reported as the ceiling.
+"""
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+import urllib.request
+
+METRIC_LINE = re.compile(r'^(\w+)(?:\{(.*)\})? ([0-9.eE+-]+)$')
+LABEL = re.compile(r'(\w+)="([^"]*)"')
+LOSS = re.compile(r"([0-9.]+)% packet loss")
+
+
+def sh(*command, check=True):
+    return subprocess.run(command, capture_output=True, text=True, check=check)
+
+
+def scrape(url):
+    with urllib.request.urlopen(url, timeout=10) as response:
+        text = response.read().decode()
+    metrics = {}
+    for line in text.splitlines():
+        match = METRIC_LINE.match(line)
+        if match is None:
+            continue
+        name, labels, value = match.groups()
+        labels = dict(LABEL.findall(labels or ""))
+        key = name + "".join(f",{k}={v}" for k, v in sorted(labels.items()))
+        metrics[key] = float(value)
+    return metrics
+
+
+def summary(metrics):
+    return {
+        "stations": metrics.get("air_gateway_stations"),
+        "heap_free_internal": metrics.get("air_gateway_heap_free_bytes,region=internal"),
+        "heap_min_free_internal": metrics.get("air_gateway_heap_min_free_bytes,region=internal"),
+        "admitted": metrics.get("air_gateway_admission_total,result=admitted"),
+        "evicted": metrics.get("air_gateway_admission_total,result=evicted_idle"),
+        "refused": metrics.get("air_gateway_admission_total,result=refused"),
+    }
+
+
+class Station:
+    def __init__(self, args, index, workdir):
+        self.args = args
+        self.name = f"soak{index}"
+        self.mac = f"02:5a:{index >> 8:02x}:{index & 0xFF:02x}:00:01"
+        self.address = f"{args.subnet}.{args.first_host + index}"
+        self.config = os.path.join(workdir, f"{self.name}.conf")
+        self.pidfile = os.path.join(workdir, f"{self.name}.pid")
+
+    def join(self):
+        sh("iw", "dev", self.args.phy_dev, "interface", "add", self.name, "type", "managed")
+        sh("ip", "link", "set", self.name, "address", self.mac)
+        sh("ip", "link", "set", self.name, "up")
+        with open(self.config, "w") as config:
+            config.write("network={\n")
+            config.write(f'    ssid="{self.args.ssid}"\n')
+            if self.args.open:
+                config.write("    key_mgmt=NONE\n")
+            else:
+                config.write(f'    psk="{self.args.password}"\n')
+            config.write("}\n")
+        sh("wpa_supplicant", "-B", "-i", self.name, "-c", self.config, "-P", self.pidfile)
+
+        deadline = time.monotonic() + self.args.join_timeout
+        while time.monotonic() < deadline:
+            if "Connected to" in sh("iw", "dev", self.name, "link", check=False).stdout:
+                sh("ip", "addr", "add", f"{self.address}/24", "dev", self.name)
+                return True
+            time.sleep(0.5)
+        return False
+
+    def is_associated(self):
+        return "Connected to" in sh("iw", "dev", self.name, "link", check=False).stdout
+
+    def load(self, seconds, out):
+        count = max(1, int(seconds / self.args.ping_interval))
+        ping = subprocess.Popen(["ping", "-I", self.name, "-i", str(self.args.ping_interval), "-c", str(count),
+                                 self.args.gateway], stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, text=True)
+        fetches = failures = 0
+        deadline = time.monotonic() + seconds
+        while time.monotonic() < deadline:
+            result = subprocess.run(["curl", "-s", "-o", "/dev/null", "--max-time", "10", "--interface", self.name,
+                                     self.args.url], check=False)
+            fetches += 1
+            failures += result.returncode != 0
+            time.sleep(self.args.fetch_interval)
+        match = LOSS.search(ping.communicate()[0])
+        out[self.name] = {
+            "loss_percent": float(match.group(1)) if match else 100.0,
+            "fetches": fetches,
+            "fetch_failures": failures,
+        }
+
+    def leave(self):
+        if os.path.exists(self.pidfile):
+            with open(self.pidfile) as pidfile:
+                sh("kill", pidfile.read().strip(), check=False)
+        sh("iw", "dev", self.name, "del", check=False)
+
+
+def step(args, stations):
+    results = {}
+    threads = [threading.Thread(target=station.load, args=(args.step_seconds, results)) for station in stations]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    return results
+
+
+def run(args):
+    stations = []
+    ceiling = 0
+    workdir = tempfile.mkdtemp(prefix="station_soak_")
+    # Every station shares the subnet, so each must only answer ARP and accept replies for its own address
+    sh("sysctl", "-qw", "net.ipv4.conf.all.arp_ignore=1", "net.ipv4.conf.all.arp_announce=2",
+       "net.ipv4.conf.all.rp_filter=0", "net.ipv4.conf.default.rp_filter=0")
+    try:
+        for index in range(1, args.max_stations + 1):
+            station = Station(args, index, workdir)
+            stations.append(station)
+            joined = station.join()
+            # Admission deauthenticates right after the association, give it a moment
+            time.sleep(args.settle_seconds)
+            dropped = [s.name for s in stations if not s.is_associated()]
+
+            loads = step(args, [s for s in stations if s.name not in dropped]) if joined else {}
+            record = {
+                "stations": index,
+                "joined": joined,
+                "dropped": dropped,
+                "loads": loads,
+                "gateway": summary(scrape(args.metrics)),
+            }
+            print(json.dumps(record))
+            with open(args.results, "a") as results:
+                results.write(json.dumps(record) + "\n")
+
+            healthy = joined and not dropped and all(
+                load["loss_percent"] <= args.max_loss and load["fetch_failures"] == 0 for load in loads.values())
+            if not healthy:
+                break
+            ceiling = index
+    finally:
+        for station in stations:
+            station.leave()
+
+    print(f"Supported ceiling: {ceiling} stations")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--phy-dev", required=True, help="existing interface of the adapter, e.g. wlan0")
+    parser.add_argument("--ssid", required=True)
+    security = parser.add_mutually_exclusive_group(required=True)
+    security.add_argument("--password")
+    security.add_argument("--open", action="store_true")
+    parser.add_argument("--max-stations", type=int, default=15)
+    parser.add_argument("--gateway", default="192.168.4.1")
+    parser.add_argument("--subnet", default="192.168.4", help="first three octets of the SoftAP subnet")
+    parser.add_argument("--first-host", type=int, default=200, help="host part of station 1 minus one")
+    parser.add_argument("--metrics", default="http://192.168.4.1/metrics")
+    parser.add_argument("--url", default="http://example.com/", help="fetched over the uplink by every station")
+    parser.add_argument("--step-seconds", type=int, default=60)
+    parser.add_argument("--settle-seconds", type=float, default=3.0)
+    parser.add_argument("--join-timeout", type=float, default=20.0)
+    parser.add_argument("--ping-interval", type=float, default=0.5)
+    parser.add_argument("--fetch-interval", type=float, default=2.0)
+    parser.add_argument("--max-loss", type=float, default=5.0, help="ping loss in percent a station may see")
+    parser.add_argument("--results", default="station_soak.jsonl")
+
+    args = parser.parse_args()
+    if os.geteuid() != 0:
+        sys.exit("Creating interfaces needs root")
+    try:
+        run(args)
+    except (OSError, subprocess.CalledProcessError) as err:
+        sys.exit(f"Soak test failed: {err}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+"""Per-stage latency histograms from the packet trace printed with CONFIG_GATEWAY_PACKET_TRACE.
+
+Usage: trace_latency.py [serial.log ...]   (reads stdin without arguments)
+
+Records of one packet are matched by their key (IPv4 ID and total length). Every stage is paired with the latest
+record of the previous stage on the same path that carries the same key and is at most --window-us older.
+"""
+
+import argparse
+import collections
+import sys
+
+# Same numbering as bsp_trace_stage_e
+STAGES = {
+    1: "ap_rx",
+    2: "ap_routed",
+    3: "uplink_queued",
+    4: "uplink_sent",
+    5: "uart_written",
+    6: "ppp_rx",
+    7: "ppp_input",
+    8: "ppp_routed",
+    9: "ap_tx",
+}
+
+PATHS = {
+    "up": [1, 2, 3, 4, 5],
+    "down": [6, 7, 8, 9],
+}
+
+CYCLE_WRAP = 1 << 32
+
+
+class Trace:
+    def __init__(self):
+        self.mhz = None
+        self.clocks = {}
+        self.offsets = {}
+        self.lost = collections.Counter()
+        self.records = []
+
+    def parse(self, lines):
+        for line in lines:
+            # Console lines may carry a log prefix or trailing noise, only the trace part is used
+            for marker in ("#trace,", "#clock,", "#lost,", "T,"):
+                at = line.find(marker)
+                if at >= 0:
+                    self._parse_fields(line[at:].strip().split(","))
+                    break
+
+    def _parse_fields(self, fields):
+        try:
+            if fields[0] == "#trace":
+                self.mhz = int(fields[2])
+                self.clocks = {}
+            elif fields[0] == "#clock":
+                self.clocks[int(fields[1])] = (int(fields[2]), int(fields[3]))
+                self._align_cores()
+            elif fields[0] == "#lost":
+                self.lost[int(fields[1])] = int(fields[2])
+            elif fields[0] == "T" and self.offsets:
+                core = int(fields[1])
+                # Counters of all cores run off the same clock, only their start differs
+                cycles = (int(fields[4]) - self.offsets.get(core, 0)) % CYCLE_WRAP
+                self.records.append((cycles, int(fields[2]), int(fields[3], 16)))
+        except (IndexError, ValueError):
+            pass
+
+    def _align_cores(self):
+        if self.mhz is None or 0 not in self.clocks:
+            return
+        base_cycles, base_us = self.clocks[0]
+        for core, (cycles, us) in self.clocks.items():
+            expected = base_cycles + (us - base_us) * self.mhz
+            self.offsets[core] = (cycles - expected) % CYCLE_WRAP
+
+
+def _bucket(us):
+    limit = 1
+    while us >= limit:
+        limit *= 2
+    return limit
+
+
+def _print_histogram(name, samples):
+    samples.sort()
+    count = len(samples)
+    p50 = samples[count // 2]
+    p99 = samples[min(count - 1, (count * 99) // 100)]
+    print(f"{name}: {count} packets, p50 {p50:.1f} us, p99 {p99:.1f} us, max {samples[-1]:.1f} us")
+    buckets = collections.Counter(_bucket(us) for us in samples)
+    widest = max(buckets.values())
+    for limit in sorted(buckets):
+        bar = "#" * max(1, (buckets[limit] * 50) // widest)
+        print(f"  < {limit:>8} us {buckets[limit]:>8} {bar}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("logs", nargs="*", help="captured console output")
+    parser.add_argument("--window-us", type=float, default=1000000.0, help="maximum age of the previous stage")
+    args = parser.parse_args()
+
+    trace = Trace()
+    if args.logs:
+        for path in args.logs:
+            with open(path, errors="replace") as log:
+                trace.parse(log)
+    else:
+        trace.parse(sys.stdin)
+
+    if trace.mhz is None or not trace.records:
+        sys.exit("No trace records found, is CONFIG_GATEWAY_PACKET_TRACE enabled?")
+
+    # Records are near each other in time, so the modular difference to the first one gives a wrap-free order
+    first = trace.records[0][0]
+    trace.records.sort(key=lambda record: (record[0] - first + CYCLE_WRAP // 2) % CYCLE_WRAP)
+
+    previous_stage = {}
+    for stages in PATHS.values():
+        for before, after in zip(stages, stages[1:]):
+            previous_stage[after] = before
+
+    last_seen = {}
+    latencies = collections.defaultdict(list)
+    for cycles, stage, key in trace.records:
+        if key == 0:
+            continue
+        last_seen[(stage, key)] = cycles
+        before = previous_stage.get(stage)
+        if before is None or (before, key) not in last_seen:
+            continue
+        us = ((cycles - last_seen[(before, key)]) % CYCLE_WRAP) / trace.mhz
+        if us <= args.window_us:
+            latencies[(before, stage)].append(us)
+
+    print(f"{len(trace.records)} records at {trace.mhz} MHz, lost per core: {dict(trace.lost)}")
+    for path, stages in PATHS.items():
+        print(f"\n== {path} ==")
+        for before, after in zip(stages, stages[1:]):
+            samples = latencies.get((before, after))
+            if samples:
+                _print_histogram(f"{STAGES[before]} -> {STAGES[after]}", samples)
+
+
+if __name__ == "__main__":
+    main()